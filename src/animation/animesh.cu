@@ -1,6 +1,8 @@
 #include "animesh.hpp"
+#include "animesh_cpu.hpp"
 
 #include "animesh_kers.hpp"
+#include "cuda_ctrl.hpp"
 #include "macros.hpp"
 #include "vec3_cu.hpp"
 #include "distance_field.hpp"
@@ -17,18 +19,21 @@
 
 using namespace Cuda_utils;
 
-AnimeshBase *AnimeshBase::create(const Mesh *mesh, std::shared_ptr<const Skeleton> skel)
+AnimeshBase *AnimeshBase::create(const Mesh *mesh, std::shared_ptr<const Skeleton> skel, const Animesh_precomputed *pre)
 {
-    return new Animesh(mesh, skel);
+    if( Cuda_ctrl::_debug._host_evaluation )
+        return new Animesh_cpu(mesh, skel, pre);
+    return new Animesh(mesh, skel, pre);
 }
 
-Animesh::Animesh(const Mesh *m_, std::shared_ptr<const Skeleton> s_) :
+Animesh::Animesh(const Mesh *m_, std::shared_ptr<const Skeleton> s_, const Animesh_precomputed *pre) :
     _mesh(m_), _skel(s_),
     mesh_smoothing(EAnimesh::LAPLACIAN),
     do_smooth_mesh(false),
     do_local_smoothing(true),
     nb_transform_steps(250),
     final_fitting(true),
+    nearest_clusters(false),
     smoothing_iter(7),
     diffuse_smooth_weights_iter(6),
     smooth_force_a(0.5f),
@@ -51,6 +56,9 @@ Animesh::Animesh(const Mesh *m_, std::shared_ptr<const Skeleton> s_) :
     d_piv(_mesh->get_nb_faces()),
     d_unpacked_normals(_mesh->get_nb_vertices() * _mesh->_max_faces_per_vertex),
     d_unpacked_tangents(_mesh->get_nb_vertices() * _mesh->_max_faces_per_vertex),
+    d_fit_stats(1),
+    warm_start(false),
+    warm_start_valid(false),
     h_vert_buffer(_mesh->get_nb_vertices()),
     d_vert_buffer(_mesh->get_nb_vertices()),
     d_vert_buffer_2(_mesh->get_nb_vertices()),
@@ -80,7 +88,10 @@ Animesh::Animesh(const Mesh *m_, std::shared_ptr<const Skeleton> s_) :
     init_smooth_factors(d_input_smooth_factors);
     init_vert_to_fit();
 
-    compute_mvc();
+    compute_mvc(pre);
+
+    if( !Animesh_kers::load_precomputed_nearest_bones(*_mesh, *_skel, pre, h_nearest_bones) )
+        Animesh_kers::nearest_bones_cpu(*_mesh, *_skel, h_nearest_bones);
 }
 
 // -----------------------------------------------------------------------------
@@ -128,16 +139,72 @@ void Animesh::get_vertices(std::vector<Point_cu>& anim_vert) const
     anim_vert.insert(anim_vert.end(), &h_out_verts[0], &h_out_verts[0] + nb_vert);
 }
 
-void Animesh::set_vertices(const std::vector<Vec3_cu> &vertices)
+void Animesh::get_vertices(Vertex_staging &staging, const Transfo &tr) const
 {
-    assert(vertices.size() == d_input_vertices.size());
-    const int nb_vert = vertices.size();
-    Host::Array<Point_cu > input_vertices(nb_vert);
+    const int nb_vert    = d_output_vertices.size();
+    const int block_size = 256;
+    const int grid_size  = (nb_vert + block_size - 1) / block_size;
 
-    for(int i = 0; i < nb_vert; i++)
-        input_vertices[i] = vertices[i].to_point();
+    staging.resize(nb_vert);
+    if(d_staged_vertices.size() != nb_vert)
+        d_staged_vertices.malloc(nb_vert);
+    if(nb_vert == 0) return;
 
-    d_input_vertices.copy_from(input_vertices);
+    Animesh_kers::store_staged_vertices<<<grid_size, block_size>>>
+        (d_output_vertices.ptr(), tr, nb_vert, d_staged_vertices.ptr());
+    CUDA_CHECK_ERRORS();
+    mem_cpy_dth((float4*)staging.ptr(), d_staged_vertices.ptr(), nb_vert);
+}
+
+void Animesh::set_vertices(const Vertex_staging &staging, const Transfo &tr)
+{
+    assert(staging.size() == d_input_vertices.size());
+    const int nb_vert    = staging.size();
+    const int block_size = 256;
+    const int grid_size  = (nb_vert + block_size - 1) / block_size;
+
+    if(d_staged_vertices.size() != nb_vert)
+        d_staged_vertices.malloc(nb_vert);
+    if(nb_vert == 0) return;
+
+    mem_cpy_htd(d_staged_vertices.ptr(), (const float4*)staging.ptr(), nb_vert);
+    Animesh_kers::load_staged_vertices<<<grid_size, block_size>>>
+        (d_staged_vertices.ptr(), tr, nb_vert, d_input_vertices.ptr());
+    CUDA_CHECK_ERRORS();
+}
+
+// -----------------------------------------------------------------------------
+
+Vertex_staging::~Vertex_staging()
+{
+    release();
+}
+
+void Vertex_staging::release()
+{
+    float4* data = (float4*)_data;
+    if(_page_locked) Cuda_utils::free_h<float4, true >(data);
+    else             Cuda_utils::free_h<float4, false>(data);
+    _data = 0;
+    _capacity = 0;
+}
+
+void Vertex_staging::resize(int nb_verts)
+{
+    // Only the GPU Animesh benefits from page-locked memory, which is a
+    // scarce resource.
+    const bool page_lock = !Cuda_ctrl::_debug._host_evaluation;
+    if(nb_verts > _capacity || page_lock != _page_locked)
+    {
+        release();
+        float4* data = 0;
+        if(page_lock) Cuda_utils::malloc_h<float4, true >(data, nb_verts);
+        else          Cuda_utils::malloc_h<float4, false>(data, nb_verts);
+        _data = (float (*)[4])data;
+        _capacity = nb_verts;
+        _page_locked = page_lock;
+    }
+    _size = nb_verts;
 }
 
 void Animesh::copy_mesh_data(const Mesh& a_mesh)
@@ -179,86 +246,29 @@ void Animesh::copy_mesh_data(const Mesh& a_mesh)
 
 
 
-void Animesh::compute_mvc()
+void Animesh::compute_mvc(const Animesh_precomputed *pre)
 {
-    //Device::Array<Vec3_cu> d_grad( d_input_vertices.size() );
     Host::Array<float> edge_lengths(_mesh->get_nb_edges());
     Host::Array<float> edge_mvc    (_mesh->get_nb_edges());
-    for(int i = 0; i < _mesh->get_nb_vertices(); i++)
-    {
-        Point_cu pos = _mesh->get_vertex(i).to_point();
-        Vec3_cu  nor = _mesh->get_mean_normal(i).to_point(); // FIXME : should be the gradient
-
-        Mat3_cu frame = Mat3_cu::coordinate_system( nor ).transpose();
-        float sum = 0.f;
-        bool  out = false;
-        // Look up neighborhood
-        int dep      = _mesh->get_edge_offset(i*2    );
-        int nb_neigh = _mesh->get_edge_offset(i*2 + 1);
-        int end      = (dep+nb_neigh);
-
-        if( nor.norm() < 0.00001f || _mesh->is_vert_on_side(i) ) {
-            for(int n = dep; n < end; n++) edge_mvc[n] = 0.f;
-        }
-        else
-        {
-            for(int n = dep; n < end; n++)
-            {
-                int id_curr = _mesh->get_edge( n );
-                int id_next = _mesh->get_edge( (n+1) >= end  ? dep   : n+1 );
-                int id_prev = _mesh->get_edge( (n-1) <  dep  ? end-1 : n-1 );
-
-                // compute edge length
-                Point_cu  curr = _mesh->get_vertex(id_curr).to_point();
-                Vec3_cu e_curr = (curr - pos);
-                edge_lengths[n] = e_curr.norm();
-
-                // compute mean value coordinates
-                // coordinates are computed by projecting the neighborhood to the
-                // tangent plane
-                {
-                    // Project on tangent plane
-                    Vec3_cu e_next = _mesh->get_vertex(id_next).to_point() - pos;
-                    Vec3_cu e_prev = _mesh->get_vertex(id_prev).to_point() - pos;
-
-                    e_curr = frame * e_curr;
-                    e_next = frame * e_next;
-                    e_prev = frame * e_prev;
-
-                    e_curr.x = 0.f;
-                    e_next.x = 0.f;
-                    e_prev.x = 0.f;
-
-                    float norm_curr_2D = e_curr.norm();
-
-                    e_curr.normalize();
-                    e_next.normalize();
-                    e_prev.normalize();
-
-                    // Computing mvc
-                    float anext = std::atan2( -e_prev.z * e_curr.y + e_prev.y * e_curr.z, e_prev.dot(e_curr) );
-                    float aprev = std::atan2( -e_curr.z * e_next.y + e_curr.y * e_next.z, e_curr.dot(e_next) );
-
-                    float mvc = 0.f;
-                    if(norm_curr_2D > 0.0001f)
-                        mvc = (std::tan(anext*0.5f) + std::tan(aprev*0.5f)) / norm_curr_2D;
-
-                    sum += mvc;
-                    edge_mvc[n] = mvc;
-                    out = out || mvc < 0.f;
-                }
-            }
-            // we ignore points outside the convex hull
-            if( sum  <= 0.f || out || isnan(sum) ) {
-                for(int n = dep; n < end; n++) edge_mvc[n] = 0.f;
-            }
-        }
-
-    }
+    if( !Animesh_kers::load_precomputed_mvc(*_mesh, pre, edge_lengths.ptr(), edge_mvc.ptr()) )
+        Animesh_kers::compute_mvc_cpu(*_mesh, edge_lengths.ptr(), edge_mvc.ptr());
     d_edge_lengths.copy_from( edge_lengths );
     d_edge_mvc.    copy_from( edge_mvc     );
 }
 
+// -----------------------------------------------------------------------------
+
+void Animesh::get_precomputed(Animesh_precomputed &out) const
+{
+    Host::Array<float> edge_lengths(d_edge_lengths.size());
+    Host::Array<float> edge_mvc    (d_edge_mvc.size());
+    edge_lengths.copy_from( d_edge_lengths );
+    edge_mvc.    copy_from( d_edge_mvc     );
+    out.edge_lengths.assign(edge_lengths.ptr(), edge_lengths.ptr() + edge_lengths.size());
+    out.edge_mvc.    assign(edge_mvc.ptr(),     edge_mvc.ptr()     + edge_mvc.size()    );
+    Animesh_kers::store_precomputed_nearest_bones(*_skel, h_nearest_bones, out);
+}
+
 void Animesh::init_smooth_factors(Cuda_utils::DA_float& d_smooth_factors)
 {
     const int nb_vert = _mesh->get_nb_vertices();
@@ -15,7 +15,7 @@
 struct Animesh: public AnimeshBase {
 public:
     // The Mesh must exist for the lifetime of this object.
-    Animesh(const Mesh *m_, std::shared_ptr<const Skeleton> s_);
+    Animesh(const Mesh *m_, std::shared_ptr<const Skeleton> s_, const Animesh_precomputed *pre = NULL);
     ~Animesh();
 
     // Get the loaded skeleton.
@@ -30,6 +30,8 @@ public:
     /// with set_base_potential().
     void calculate_base_potential(std::vector<float> &out) const;
 
+    void get_precomputed(Animesh_precomputed &out) const;
+
     // Read and write the base potential (and gradient).
     void get_base_potential(std::vector<float> &pot) const;
     void set_base_potential(const std::vector<float> &pot);
@@ -39,6 +41,8 @@ public:
     /// @param type specify the technic used to compute vertices deformations
     void transform_vertices();
 
+    EAnimesh::Fit_stats get_fit_stats() const { return d_fit_stats.fetch(0); }
+
     // -------------------------------------------------------------------------
     /// @name Getter & Setters
     // -------------------------------------------------------------------------
@@ -50,13 +54,17 @@ public:
     // Read the vertices.
     void get_vertices(std::vector<Point_cu>& anim_vert) const;
 
-    // Copy the given vertices into the mesh.
-    void set_vertices(const std::vector<Vec3_cu> &vertices);
+    void get_vertices(Vertex_staging &staging, const Transfo &tr) const;
+
+    void set_vertices(const Vertex_staging &staging, const Transfo &tr);
 
     inline void set_smooth_factor(int i, float val) { d_input_smooth_factors.set(i, val); }
 
     void set_nb_transform_steps(int nb_iter) { nb_transform_steps = nb_iter; }
     void set_final_fitting(bool value) { final_fitting = value; }
+    void set_nearest_clusters(bool value) { nearest_clusters = value; }
+    void set_warm_start(bool value) { warm_start_valid &= (value == warm_start); warm_start = value; }
+    void reset_warm_start() { warm_start_valid = false; }
     void set_smoothing_weights_diffusion_iter(int nb_iter) { diffuse_smooth_weights_iter = nb_iter; }
     void set_smoothing_iter (int nb_iter ) { smoothing_iter = nb_iter;   }
     void set_smooth_mesh    (bool state  ) { do_smooth_mesh = state;     }
@@ -100,11 +108,24 @@ private:
     /// Compute normals in 'normals' and the vertices position in 'vertices'
     void compute_normals(const Vec3_cu* vertices, Vec3_cu* normals);
 
+    /// Initialize 'd_output_vertices' with the last fitted positions moved
+    /// along with the bones. Nothing is done and false is returned when there
+    /// is no valid previous solution or when the bones moved too much since.
+    bool apply_warm_start();
+
+    /// Remember the fitted 'd_output_vertices' for the next apply_warm_start()
+    void store_warm_start();
+
+    /// Move the vertices of 'd_vert_to_fit' toward their base potential
+    /// @param full_eval : evaluate the whole skeleton, otherwise only the two
+    /// nearest clusters of each vertex are evaluated if 'nearest_clusters'
+    /// is set.
     void fit_mesh(int nb_vert_to_fit,
                   int* d_vert_to_fit,
                   bool smooth_fac_from_iso,
                   Vec3_cu *d_vertices,
-                  int nb_steps, float smooth_strength);
+                  int nb_steps, float smooth_strength,
+                  bool full_eval);
 
     /// diffuse values over the mesh on GPU
     void diffuse_attr(int nb_iter, float strength, float* attr);
@@ -134,7 +155,9 @@ private:
     /// - one of the mvc coordinate is negative.
     /// (meaning the vertices is outside the polygon the mvc is expressed from)
     /// - Normal of the vertices has norm == zero
-    void compute_mvc();
+    /// @param pre : coordinates are loaded from 'pre' instead if it matches
+    /// the mesh
+    void compute_mvc(const Animesh_precomputed *pre);
 
     /// Allocate and initialize 'd_vert_to_fit' and 'd_vert_to_fit_base'.
     /// For instance lonely vertices are not fitted with the implicit skinning.
@@ -159,6 +182,7 @@ private:
     bool do_local_smoothing;
     int nb_transform_steps;
     bool final_fitting;
+    bool nearest_clusters;
 
     /// Smoothing strength after animation
 
@@ -198,6 +222,10 @@ private:
     /// Animated vertices in their final position.
     Cuda_utils::Device::Array<Point_cu>  d_output_vertices;
 
+    /// Device copy of a Vertex_staging buffer, before it is transformed into
+    /// 'd_input_vertices' or after 'd_output_vertices' has been transformed
+    mutable Cuda_utils::Device::Array<float4> d_staged_vertices;
+
     /// Gradient of the implicit surface at each vertices when animated
     Cuda_utils::Device::Array<Vec3_cu> d_gradient;
 
@@ -227,6 +255,38 @@ private:
     /// ?
     Cuda_utils::Device::Array<Mesh::PrimIdxVertices> d_piv;
 
+    /// Two nearest bones of each vertex (Bone::Id) computed at construction
+    /// @see Animesh_kers::nearest_bones_cpu()
+    std::vector<int2> h_nearest_bones;
+    /// 'h_nearest_bones' converted to Skeleton_env::DBone_id
+    Cuda_utils::Device::Array<int2> d_nearest_bones;
+    /// Device indices of the skeleton's bones used to fill 'd_nearest_bones'
+    std::vector<int> nearest_bones_didx;
+
+    /// Counters of match_base_potential, reset by transform_vertices()
+    Cuda_utils::Device::Array<EAnimesh::Fit_stats> d_fit_stats;
+
+    // -------------------------------------------------------------------------
+    /// @name Warm start
+    /// @see apply_warm_start() store_warm_start()
+    // -------------------------------------------------------------------------
+
+    /// Start the fitting from the last fitted positions instead of the SSD
+    /// positions
+    bool warm_start;
+    /// Does 'd_warm_disp' hold the result of the last transform_vertices()
+    bool warm_start_valid;
+    /// Bones and their transformation at the last transform_vertices()
+    std::vector<Bone::Id> warm_bone_ids;
+    std::vector<Transfo>  warm_bone_tr;
+    /// Index in 'warm_bone_ids' of the nearest bone of each vertex
+    Cuda_utils::Device::Array<int> d_warm_vert_bone;
+    /// Bone transformations (or their inverse) uploaded for the kernels
+    Cuda_utils::Device::Array<Transfo> d_warm_bone_tr;
+    /// Displacement from SSD to fitted position of each vertex in the frame of
+    /// its nearest bone
+    Cuda_utils::Device::Array<Vec3_cu> d_warm_disp;
+
     // -------------------------------------------------------------------------
     /// @name CLUSTER
     // -------------------------------------------------------------------------
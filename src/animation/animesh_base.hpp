@@ -4,10 +4,57 @@
 #include "animesh_enum.hpp"
 #include "skeleton.hpp"
 #include "mesh.hpp"
+#include "transfo.hpp"
 
 #include <vector>
+#include <stdint.h>
+
+// Host buffer used to exchange vertex positions with Maya.  Positions are stored as (x, y, z, w)
+// floats, the layout of MPointArray::get(float[][4]) and MPointArray(const float[][4], count),
+// so Maya fills and reads it with a single bulk copy.  The memory is page-locked when the GPU
+// Animesh is used, so uploads and downloads are a single DMA transfer.  It's kept between
+// frames and only reallocated when the vertex count grows.
+class Vertex_staging {
+public:
+    Vertex_staging(): _data(0), _size(0), _capacity(0), _page_locked(false) { }
+    ~Vertex_staging();
+
+    // Set the number of vertices.  Contents are undefined after a reallocation.
+    void resize(int nb_verts);
+
+    int size() const { return _size; }
+    float (*ptr())[4] { return _data; }
+    const float (*ptr() const)[4] { return _data; }
+
+private:
+    Vertex_staging(const Vertex_staging &);
+    Vertex_staging &operator=(const Vertex_staging &);
+
+    void release();
+
+    float (*_data)[4];
+    int _size;
+    int _capacity;
+    bool _page_locked;
+};
 
 
+// Setup data of an animesh which can be saved, so it isn't computed again when the same mesh
+// and skeleton are loaded.  See AnimeshBase::get_precomputed() and AnimeshBase::create().
+struct Animesh_precomputed {
+    Animesh_precomputed(): skeleton_key(0) { }
+
+    // Length and mean value coordinates of each edge, in the order of Mesh::get_edge().  These
+    // depend on the rest positions of the mesh.
+    std::vector<float> edge_lengths;
+    std::vector<float> edge_mvc;
+
+    // The two nearest bones (Bone::Id) of each vertex, two ints per vertex.  They're only valid
+    // for the skeleton they were computed with, see Animesh_kers::skeleton_key().
+    std::vector<int> nearest_bones;
+    uint64_t skeleton_key;
+};
+
 // This class contains the public interface to Animesh.  This is separated from Animesh
 // to allow creating and accessing Animesh without pulling in CUDA includes, to work around
 // namespace collisions between Maya and CUDA.  This file can be included in NO_CUDA files,
@@ -15,7 +62,9 @@
 struct Animesh;
 class AnimeshBase {
 public:
-    static AnimeshBase *create(const Mesh *mesh, std::shared_ptr<const Skeleton> skel);
+    // pre is setup data returned by get_precomputed() for the same mesh, or NULL.  Data that
+    // doesn't match the mesh or the skeleton is ignored and computed again.
+    static AnimeshBase *create(const Mesh *mesh, std::shared_ptr<const Skeleton> skel, const Animesh_precomputed *pre = NULL);
     virtual ~AnimeshBase() { }
 
     // Get the loaded skeleton.
@@ -30,6 +79,9 @@ public:
     /// with set_base_potential().
     virtual void calculate_base_potential(std::vector<float> &out) const = 0;
 
+    // Read the setup data computed at creation, to give it to create() later.
+    virtual void get_precomputed(Animesh_precomputed &out) const = 0;
+
     // Read and write the base potential (and gradient).
     virtual void get_base_potential(std::vector<float> &pot) const = 0;
     virtual void set_base_potential(const std::vector<float> &pot) = 0;
@@ -39,6 +91,9 @@ public:
     /// @param type specify the technic used to compute vertices deformations
     virtual void transform_vertices() = 0;
 
+    /// Counters of the vertex fitting done by the last transform_vertices()
+    virtual EAnimesh::Fit_stats get_fit_stats() const = 0;
+
     // Return the number of vertices in the mesh.  Calls to copy_vertices must have the
     // same number of vertices.
     virtual int get_nb_vertices() const = 0;
@@ -46,13 +101,28 @@ public:
     // Read the vertices.
     virtual void get_vertices(std::vector<Point_cu>& anim_vert) const = 0;
 
-    // Copy the given vertices into the mesh.
-    virtual void set_vertices(const std::vector<Vec3_cu> &vertices) = 0;
+    // Read the vertices into the staging buffer, transformed by tr (usually from world space
+    // to object space).  The buffer is resized to get_nb_vertices().
+    virtual void get_vertices(Vertex_staging &staging, const Transfo &tr) const = 0;
+
+    // Copy the vertices of the staging buffer into the mesh, transformed by tr (usually from
+    // object space to world space).  The buffer must hold get_nb_vertices() vertices.
+    virtual void set_vertices(const Vertex_staging &staging, const Transfo &tr) = 0;
 
     virtual inline void set_smooth_factor(int i, float val) = 0;
 
     virtual void set_nb_transform_steps(int nb_iter) = 0;
     virtual void set_final_fitting(bool value) = 0;
+    /// If true the fitting passes preceding the final fitting only evaluate
+    /// the two clusters nearest to each vertex instead of the whole skeleton.
+    virtual void set_nearest_clusters(bool value) = 0;
+    /// If true transform_vertices() starts the fitting from the previous
+    /// solution (moved along with the bones) instead of the SSD positions.
+    /// It falls back to the SSD positions when the bones moved too much.
+    virtual void set_warm_start(bool value) = 0;
+    /// Discard the previous solution: the next transform_vertices() starts
+    /// from the SSD positions. Call it on time jumps.
+    virtual void reset_warm_start() = 0;
     virtual void set_smoothing_weights_diffusion_iter(int nb_iter) = 0;
     virtual void set_smoothing_iter (int nb_iter ) = 0;
     virtual void set_smooth_mesh    (bool state  ) = 0;
@@ -0,0 +1,417 @@
+#include "animesh_cpu.hpp"
+
+/**
+ * @file animesh_cpu.cu
+ * @brief implementation of the CPU backend of the implicit skinning
+ *
+ * Compiled with nvcc only because Skeleton_env's host evaluation shares its
+ * headers with the texture based device evaluation.
+ */
+
+#include "animesh_kers.hpp"
+#include "skeleton_env_evaluator.hpp"
+#include "cuda_ctrl.hpp"
+#include "timer.hpp"
+
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+
+// -----------------------------------------------------------------------------
+
+Animesh_cpu::Animesh_cpu(const Mesh *m_, std::shared_ptr<const Skeleton> s_, const Animesh_precomputed *pre) :
+    _mesh(m_), _skel(s_),
+    mesh_smoothing(EAnimesh::LAPLACIAN),
+    do_smooth_mesh(false),
+    do_local_smoothing(true),
+    nb_transform_steps(250),
+    final_fitting(true),
+    nearest_clusters(false),
+    smoothing_iter(7),
+    diffuse_smooth_weights_iter(6),
+    smooth_force_a(0.5f),
+    smooth_force_b(0.5f),
+    h_input_smooth_factors(_mesh->get_nb_vertices(), 0.f),
+    h_smooth_factors_conservative(_mesh->get_nb_vertices(), 0.f),
+    h_smooth_factors_laplacian(_mesh->get_nb_vertices()),
+    h_input_vertices(_mesh->get_nb_vertices()),
+    h_output_vertices(_mesh->get_nb_vertices()),
+    h_gradient(_mesh->get_nb_vertices()),
+    h_base_potential(_mesh->get_nb_vertices()),
+    h_vertices_state(_mesh->get_nb_vertices(), EAnimesh::NOT_DISPLACED),
+    h_edge_lengths(_mesh->get_nb_edges()),
+    h_edge_mvc(_mesh->get_nb_edges()),
+    h_edge_list(_mesh->get_nb_edges()),
+    h_edge_list_offsets(2 * _mesh->get_nb_vertices()),
+    h_piv(_mesh->get_nb_faces()),
+    h_unpacked_normals(_mesh->get_nb_vertices() * _mesh->_max_faces_per_vertex),
+    warm_start(false),
+    warm_start_valid(false),
+    h_vert_buffer(_mesh->get_nb_vertices()),
+    h_vert_buffer_2(_mesh->get_nb_vertices()),
+    h_vert_buffer_3(_mesh->get_nb_vertices()),
+    h_vals_buffer(_mesh->get_nb_vertices())
+{
+    copy_mesh_data(*_mesh);
+    init_vert_to_fit();
+
+    if( !Animesh_kers::load_precomputed_mvc(*_mesh, pre, h_edge_lengths.data(), h_edge_mvc.data()) )
+        Animesh_kers::compute_mvc_cpu(*_mesh, h_edge_lengths.data(), h_edge_mvc.data());
+
+    if( !Animesh_kers::load_precomputed_nearest_bones(*_mesh, *_skel, pre, h_nearest_bones) )
+        Animesh_kers::nearest_bones_cpu(*_mesh, *_skel, h_nearest_bones);
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::get_precomputed(Animesh_precomputed &out) const
+{
+    out.edge_lengths = h_edge_lengths;
+    out.edge_mvc     = h_edge_mvc;
+    Animesh_kers::store_precomputed_nearest_bones(*_skel, h_nearest_bones, out);
+}
+
+// -----------------------------------------------------------------------------
+
+Animesh_cpu::~Animesh_cpu()
+{
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::init_vert_to_fit()
+{
+    const int nb_vert = _mesh->get_nb_vertices();
+    h_vert_to_fit_base.clear();
+    h_vert_to_fit_base.reserve(nb_vert);
+    for (int i = 0; i < nb_vert; ++i)
+    {
+        if( !_mesh->is_disconnect(i) )
+            h_vert_to_fit_base.push_back( i );
+    }
+    h_vert_to_fit = h_vert_to_fit_base;
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::copy_mesh_data(const Mesh& a_mesh)
+{
+    const int nb_vert = a_mesh.get_nb_vertices();
+    for(int i = 0; i < nb_vert; i++)
+        h_input_vertices[i] = a_mesh.get_vertex(i).to_point();
+
+    for(int i = 0; i < a_mesh.get_nb_faces(); i++)
+        h_piv[i] = a_mesh.get_piv(i);
+
+    for(int i = 0; i < a_mesh.get_nb_edges(); i++)
+        h_edge_list[i] = a_mesh.get_edge(i);
+
+    for(int i = 0; i < nb_vert; i++){
+        h_edge_list_offsets[2*i  ] = a_mesh.get_edge_offset(2*i  );
+        h_edge_list_offsets[2*i+1] = a_mesh.get_edge_offset(2*i+1);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::calculate_base_potential(std::vector<float> &out) const
+{
+    Timer time;
+    time.start();
+    const int nb_verts = get_nb_vertices();
+    out.resize( nb_verts );
+    // Send pending bones and controllers changes before evaluating
+    _skel->update_bones_data();
+    Skeleton_env::compute_potential_cpu(_skel->get_skel_id(), h_input_vertices.data(), nb_verts, out.data(), 0);
+    std::cout << "Update base potential (CPU) in " << time.stop() << " sec" << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::set_base_potential(const std::vector<float> &pot)
+{
+    assert((int)pot.size() == get_nb_vertices());
+    h_base_potential = pot;
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::get_vertices(std::vector<Point_cu>& anim_vert) const
+{
+    anim_vert.insert(anim_vert.end(), h_output_vertices.begin(), h_output_vertices.end());
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::get_vertices(Vertex_staging &staging, const Transfo &tr) const
+{
+    const int nb_vert = (int)h_output_vertices.size();
+    staging.resize(nb_vert);
+    Animesh_kers::store_staged_vertices_cpu(h_output_vertices.data(), tr, nb_vert, (float4*)staging.ptr());
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::set_vertices(const Vertex_staging &staging, const Transfo &tr)
+{
+    assert(staging.size() == get_nb_vertices());
+    Animesh_kers::load_staged_vertices_cpu((const float4*)staging.ptr(), tr, staging.size(), h_input_vertices.data());
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::diffuse_attr(int nb_iter, float strength, float *attr)
+{
+    Animesh_kers::diffuse_values_cpu(attr,
+                                     h_vals_buffer.data(),
+                                     h_edge_list.data(),
+                                     h_edge_list_offsets.data(),
+                                     get_nb_vertices(),
+                                     strength,
+                                     nb_iter);
+}
+
+// -----------------------------------------------------------------------------
+
+int Animesh_cpu::pack_vert_to_fit(std::vector<int>& vert_to_fit, int nb_vert_to_fit)
+{
+    std::vector<int>::iterator end = vert_to_fit.begin() + nb_vert_to_fit;
+    return (int)(std::remove(vert_to_fit.begin(), end, -1) - vert_to_fit.begin());
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::smooth_mesh(Vec3_cu* output_vertices,
+                              const float* factors,
+                              int nb_iter,
+                              bool local_smoothing)
+{
+    if(nb_iter == 0) return;
+
+    const int nb_vert = get_nb_vertices();
+    switch(mesh_smoothing)
+    {
+    case EAnimesh::NONE:
+        break;
+    case EAnimesh::LAPLACIAN:
+        Animesh_kers::laplacian_smooth_cpu(output_vertices, h_vert_buffer.data(),
+                                           h_edge_list.data(), h_edge_list_offsets.data(),
+                                           nb_vert, factors, local_smoothing,
+                                           smooth_force_a, nb_iter, 3);
+        break;
+    case EAnimesh::CONSERVATIVE:
+        Animesh_kers::conservative_smooth_cpu(output_vertices,
+                                              h_vert_buffer.data(),
+                                              h_gradient.data(),
+                                              h_edge_list.data(),
+                                              h_edge_list_offsets.data(),
+                                              h_edge_mvc.data(),
+                                              h_vert_to_fit_base.data(),
+                                              (int)h_vert_to_fit_base.size(),
+                                              nb_vert,
+                                              smooth_force_a,
+                                              nb_iter,
+                                              factors,
+                                              local_smoothing);
+        break;
+    case EAnimesh::TANGENTIAL:
+        Animesh_kers::tangential_smooth_cpu(output_vertices,
+                                            h_vert_buffer.data(),
+                                            h_vert_buffer_2.data(),
+                                            _mesh->get_tri_index(),
+                                            h_piv.data(),
+                                            _mesh->get_nb_tri(),
+                                            h_unpacked_normals.data(),
+                                            _mesh->_max_faces_per_vertex,
+                                            h_edge_list.data(),
+                                            h_edge_list_offsets.data(),
+                                            nb_vert,
+                                            factors,
+                                            do_local_smoothing,
+                                            smooth_force_a,
+                                            nb_iter,
+                                            3);
+        break;
+    case EAnimesh::HUMPHREY:
+        std::copy(output_vertices, output_vertices + nb_vert, h_vert_buffer.begin());
+        Animesh_kers::hc_laplacian_smooth_cpu(h_vert_buffer.data(),
+                                              output_vertices,
+                                              h_vert_buffer_2.data(),
+                                              h_vert_buffer_3.data(),
+                                              h_edge_list.data(),
+                                              h_edge_list_offsets.data(),
+                                              nb_vert,
+                                              factors,
+                                              local_smoothing,
+                                              smooth_force_a,
+                                              smooth_force_b,
+                                              nb_iter,
+                                              3);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::conservative_smooth(Vec3_cu* output_vertices,
+                                      const int* vert_to_fit,
+                                      int nb_vert_to_fit,
+                                      int nb_iter)
+{
+    Animesh_kers::conservative_smooth_cpu(output_vertices,
+                                          h_vert_buffer.data(),
+                                          h_gradient.data(),
+                                          h_edge_list.data(),
+                                          h_edge_list_offsets.data(),
+                                          h_edge_mvc.data(),
+                                          vert_to_fit,
+                                          nb_vert_to_fit,
+                                          get_nb_vertices(),
+                                          smooth_force_a,
+                                          nb_iter,
+                                          h_smooth_factors_conservative.data(),
+                                          true);
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::fit_mesh(int nb_vert_to_fit,
+                           int* vert_to_fit,
+                           bool smooth_fac_from_iso,
+                           Vec3_cu* vertices,
+                           int nb_steps,
+                           float smooth_strength,
+                           bool full_eval)
+{
+    if(nb_vert_to_fit == 0) return;
+
+    const bool nearest = nearest_clusters && !full_eval && !h_nearest_bones_didx.empty();
+
+    Animesh_kers::match_base_potential_cpu
+        (_skel->get_skel_id(),
+         smooth_fac_from_iso,
+         vertices,
+         h_base_potential.data(),
+         h_gradient.data(),
+         h_smooth_factors_conservative.data(),
+         h_smooth_factors_laplacian.data(),
+         vert_to_fit,
+         nb_vert_to_fit,
+         (unsigned short)nb_steps,
+         Cuda_ctrl::_debug._collision_threshold,
+         Cuda_ctrl::_debug._step_length,
+         Cuda_ctrl::_debug._potential_pit,
+         h_vertices_state.data(),
+         smooth_strength,
+         Cuda_ctrl::_debug._slope_smooth_weight,
+         Cuda_ctrl::_debug._raphson,
+         nearest ? h_nearest_bones_didx.data() : 0,
+         h_fit_stats);
+}
+
+// -----------------------------------------------------------------------------
+
+bool Animesh_cpu::apply_warm_start()
+{
+    if( !warm_start_valid ) return false;
+
+    std::vector<Bone::Id> bone_ids;
+    std::vector<Transfo>  bone_tr;
+    Animesh_kers::bone_transfos(*_skel, bone_ids, bone_tr);
+    if( bone_ids != warm_bone_ids ||
+        Animesh_kers::is_large_pose_delta(*_skel, bone_ids, warm_bone_tr, bone_tr) )
+    {
+        warm_start_valid = false;
+        return false;
+    }
+
+    Animesh_kers::apply_warm_start_cpu(h_input_vertices.data(), h_warm_disp.data(),
+                                       h_warm_vert_bone.data(), bone_tr.data(),
+                                       (int)h_input_vertices.size(),
+                                       h_output_vertices.data());
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::store_warm_start()
+{
+    std::vector<Bone::Id> bone_ids;
+    Animesh_kers::bone_transfos(*_skel, bone_ids, warm_bone_tr);
+    if( bone_ids != warm_bone_ids || h_warm_vert_bone.empty() )
+    {
+        Animesh_kers::nearest_bone_slots(h_nearest_bones, bone_ids, h_warm_vert_bone);
+        warm_bone_ids.swap( bone_ids );
+    }
+
+    std::vector<Transfo> bone_tr_inv( warm_bone_tr.size() );
+    for(unsigned i = 0; i < warm_bone_tr.size(); i++)
+        bone_tr_inv[i] = warm_bone_tr[i].fast_invert();
+
+    h_warm_disp.resize( h_input_vertices.size() );
+    Animesh_kers::store_warm_start_cpu(h_input_vertices.data(), h_output_vertices.data(),
+                                       h_warm_vert_bone.data(), bone_tr_inv.data(),
+                                       (int)h_input_vertices.size(),
+                                       h_warm_disp.data());
+    warm_start_valid = true;
+}
+
+// -----------------------------------------------------------------------------
+
+void Animesh_cpu::transform_vertices()
+{
+    // If the bone data needs to be updated, do it now.
+    this->_skel->update_bones_data();
+
+    // Start from the SSD positions unless the last solution is close enough
+    if( !(warm_start && apply_warm_start()) )
+        h_output_vertices = h_input_vertices;
+    // Point_cu and Vec3_cu share the same layout (see Animesh::transform_vertices())
+    Vec3_cu* out_verts = (Vec3_cu*)h_output_vertices.data();
+
+    h_smooth_factors_laplacian = h_input_smooth_factors;
+    h_vert_to_fit = h_vert_to_fit_base;
+    h_fit_stats = EAnimesh::Fit_stats();
+    if(nearest_clusters)
+        Animesh_kers::nearest_bones_to_didx(*_skel, h_nearest_bones, nearest_bones_didx, h_nearest_bones_didx);
+    int nb_vert_to_fit = (int)h_vert_to_fit.size();
+    const int nb_steps = nb_transform_steps;
+
+    if(do_smooth_mesh)
+    {
+        // Interleaved fitting
+        for( int i = 0; i < nb_steps && nb_vert_to_fit != 0; i++)
+        {
+            fit_mesh(nb_vert_to_fit, h_vert_to_fit.data(), true/*smooth from iso*/, out_verts, 2, smooth_force_a, false/*full eval*/);
+
+            conservative_smooth(out_verts, h_vert_to_fit.data(), nb_vert_to_fit, smoothing_iter);
+
+            // Remove the vertices fitted during this pass
+            nb_vert_to_fit = pack_vert_to_fit(h_vert_to_fit, nb_vert_to_fit);
+        }
+    }
+    else
+    {
+        // First fitting
+        if(nb_vert_to_fit > 0)
+            fit_mesh(nb_vert_to_fit, h_vert_to_fit.data(), false/*smooth from iso*/, out_verts, nb_steps, Cuda_ctrl::_debug._smooth1_force, false/*full eval*/);
+    }
+
+    // Smooth the initial guess
+    this->diffuse_attr(diffuse_smooth_weights_iter, 1.f, h_smooth_factors_laplacian.data());
+    smooth_mesh(out_verts, h_smooth_factors_laplacian.data(), Cuda_ctrl::_debug._smooth1_iter);
+
+    // Final fitting (global evaluation of the skeleton)
+    if(final_fitting)
+    {
+        h_vert_to_fit = h_vert_to_fit_base;
+        fit_mesh((int)h_vert_to_fit.size(), h_vert_to_fit.data(), false/*smooth from iso*/, out_verts, nb_steps, Cuda_ctrl::_debug._smooth2_force, true/*full eval*/);
+    }
+
+    // Final smoothing
+    this->diffuse_attr(diffuse_smooth_weights_iter, 1.f, h_smooth_factors_laplacian.data());
+    smooth_mesh(out_verts, h_smooth_factors_laplacian.data(), 2);
+
+    if(warm_start)
+        store_warm_start();
+}
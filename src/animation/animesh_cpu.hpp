@@ -0,0 +1,187 @@
+#ifndef ANIMESH_CPU_HPP__
+#define ANIMESH_CPU_HPP__
+
+#include "animesh_enum.hpp"
+#include "animesh_base.hpp"
+#include "mesh.hpp"
+#include "skeleton.hpp"
+
+#include <vector>
+
+/** @brief Implicit skinning deformer running entirely on the CPU
+
+    Same algorithm as Animesh (fit -> smooth -> repack loop of
+    transform_vertices()) but every array lives in host memory. The skeleton
+    is evaluated with the host path of Skeleton_env::compute_potential() and
+    the smoothing uses the CPU versions of Animesh_kers.
+
+    Vertices are split in chunks of Animesh_kers::CPU_CHUNK_SIZE scheduled with
+    work stealing (Thread_utils::parallel_for()): march lengths in
+    match_base_potential vary a lot from one vertex to another.
+
+    AnimeshBase::create() returns an Animesh_cpu when
+    Cuda_ctrl::_debug._host_evaluation is set.
+*/
+struct Animesh_cpu: public AnimeshBase {
+public:
+    // The Mesh must exist for the lifetime of this object.
+    Animesh_cpu(const Mesh *m_, std::shared_ptr<const Skeleton> s_, const Animesh_precomputed *pre = NULL);
+    ~Animesh_cpu();
+
+    const Skeleton *get_skel() const { return _skel.get(); }
+
+    const Mesh*     get_mesh() const { return _mesh; }
+
+    void calculate_base_potential(std::vector<float> &out) const;
+
+    void get_precomputed(Animesh_precomputed &out) const;
+
+    void get_base_potential(std::vector<float> &pot) const { pot = h_base_potential; }
+    void set_base_potential(const std::vector<float> &pot);
+
+    void transform_vertices();
+
+    EAnimesh::Fit_stats get_fit_stats() const { return h_fit_stats; }
+
+    // -------------------------------------------------------------------------
+    /// @name Getter & Setters
+    // -------------------------------------------------------------------------
+
+    int get_nb_vertices() const { return (int)h_input_vertices.size(); }
+
+    void get_vertices(std::vector<Point_cu>& anim_vert) const;
+
+    void get_vertices(Vertex_staging &staging, const Transfo &tr) const;
+
+    void set_vertices(const Vertex_staging &staging, const Transfo &tr);
+
+    inline void set_smooth_factor(int i, float val) { h_input_smooth_factors[i] = val; }
+
+    void set_nb_transform_steps(int nb_iter) { nb_transform_steps = nb_iter; }
+    void set_final_fitting(bool value) { final_fitting = value; }
+    void set_nearest_clusters(bool value) { nearest_clusters = value; }
+    void set_warm_start(bool value) { warm_start_valid &= (value == warm_start); warm_start = value; }
+    void reset_warm_start() { warm_start_valid = false; }
+    void set_smoothing_weights_diffusion_iter(int nb_iter) { diffuse_smooth_weights_iter = nb_iter; }
+    void set_smoothing_iter (int nb_iter ) { smoothing_iter = nb_iter;   }
+    void set_smooth_mesh    (bool state  ) { do_smooth_mesh = state;     }
+    void set_local_smoothing(bool state  ) { do_local_smoothing = state; }
+    void set_smooth_force_a (float alpha ) { smooth_force_a = alpha;     }
+    void set_smooth_force_b (float beta  ) { smooth_force_b = beta;      }
+    void set_smoothing_type (EAnimesh::Smooth_type type ) { mesh_smoothing = type; }
+
+private:
+    // -------------------------------------------------------------------------
+    /// @name Tools
+    // -------------------------------------------------------------------------
+
+    /// @see Animesh::smooth_mesh()
+    void smooth_mesh(Vec3_cu* output_vertices,
+                     const float* factors,
+                     int nb_iter,
+                     bool local_smoothing = true);
+
+    /// @see Animesh::conservative_smooth()
+    void conservative_smooth(Vec3_cu* output_vertices,
+                             const int* vert_to_fit,
+                             int nb_vert_to_fit,
+                             int nb_iter);
+
+    /// @see Animesh::apply_warm_start()
+    bool apply_warm_start();
+
+    /// @see Animesh::store_warm_start()
+    void store_warm_start();
+
+    /// @see Animesh::fit_mesh()
+    void fit_mesh(int nb_vert_to_fit,
+                  int* vert_to_fit,
+                  bool smooth_fac_from_iso,
+                  Vec3_cu *vertices,
+                  int nb_steps, float smooth_strength,
+                  bool full_eval);
+
+    /// diffuse values over the mesh
+    void diffuse_attr(int nb_iter, float strength, float* attr);
+
+    /// Remove in place the negative indices of the nb_vert_to_fit first
+    /// elements of 'vert_to_fit'.
+    /// @return the number of remaining indices
+    static int pack_vert_to_fit(std::vector<int>& vert_to_fit, int nb_vert_to_fit);
+
+    /// Copy the attributes of 'a_mesh' into the attributes of the animated mesh
+    void copy_mesh_data(const Mesh& a_mesh);
+
+    /// Initialize 'h_vert_to_fit_base'. Lonely vertices are not fitted.
+    void init_vert_to_fit();
+
+    // -------------------------------------------------------------------------
+    /// @name Attributes
+    // -------------------------------------------------------------------------
+
+    const Mesh *_mesh;
+    std::shared_ptr<const Skeleton> _skel;
+
+    EAnimesh::Smooth_type mesh_smoothing;
+
+    bool do_smooth_mesh;
+    bool do_local_smoothing;
+    int nb_transform_steps;
+    bool final_fitting;
+    bool nearest_clusters;
+
+    int smoothing_iter;
+    int diffuse_smooth_weights_iter;
+    float smooth_force_a; ///< must be between [0 1]
+    float smooth_force_b; ///< must be between [0 1] only for humphrey smoothing
+
+    /// @name Mesh and per vertex attributes (@see Animesh for details)
+    /// @{
+    std::vector<float> h_input_smooth_factors;
+    std::vector<float> h_smooth_factors_conservative;
+    std::vector<float> h_smooth_factors_laplacian;
+    std::vector<Point_cu> h_input_vertices;
+    std::vector<Point_cu> h_output_vertices;
+    std::vector<Vec3_cu> h_gradient;
+    std::vector<float> h_base_potential;
+    std::vector<EAnimesh::Vert_state> h_vertices_state;
+
+    std::vector<float> h_edge_lengths;
+    std::vector<float> h_edge_mvc;
+    std::vector<int> h_edge_list;
+    std::vector<int> h_edge_list_offsets;
+    std::vector<Mesh::PrimIdxVertices> h_piv;
+    std::vector<Vec3_cu> h_unpacked_normals;
+    /// @}
+
+    /// @see Animesh::h_nearest_bones Animesh::d_nearest_bones
+    std::vector<int2> h_nearest_bones;
+    std::vector<int2> h_nearest_bones_didx;
+    std::vector<int>  nearest_bones_didx;
+
+    /// Counters of match_base_potential_cpu(), reset by transform_vertices()
+    EAnimesh::Fit_stats h_fit_stats;
+
+    /// @name Warm start (@see Animesh for details)
+    /// @{
+    bool warm_start;
+    bool warm_start_valid;
+    std::vector<Bone::Id> warm_bone_ids;
+    std::vector<Transfo>  warm_bone_tr;
+    std::vector<int>      h_warm_vert_bone;
+    std::vector<Vec3_cu>  h_warm_disp;
+    /// @}
+
+    /// @name Pre allocated arrays to store intermediate results of the mesh
+    /// @{
+    std::vector<Vec3_cu> h_vert_buffer;
+    std::vector<Vec3_cu> h_vert_buffer_2;
+    std::vector<Vec3_cu> h_vert_buffer_3;
+    std::vector<float>   h_vals_buffer;
+
+    std::vector<int> h_vert_to_fit;
+    std::vector<int> h_vert_to_fit_base;
+    /// @}
+};
+
+#endif // ANIMESH_CPU_HPP__
@@ -49,6 +49,15 @@ enum Smooth_type {
     HUMPHREY       ///< Laplacian corrected with original points position
 };
 
+// -----------------------------------------------------------------------------
+
+/// Counters of the gradient march during the last transform_vertices()
+struct Fit_stats {
+    Fit_stats() : nb_evals(0), nb_lookups(0) { }
+    int nb_evals;   ///< skeleton potential evaluations
+    int nb_lookups; ///< evaluations which had to walk down the skeleton grid
+};
+
 }
 // END EAnimesh NAMESPACE ======================================================
 
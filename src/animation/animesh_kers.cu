@@ -7,11 +7,19 @@
 #include "cuda_utils.hpp"
 #include "ray_cu.hpp"
 #include "bone.hpp"
+#include "thread_utils.hpp"
 
 #include <math_constants.h>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <map>
+#include <mutex>
 
 // Max number of binary search steps
 #define BINARY_SEARCH_STEPS (20)
+// Max length of a Newton step in match_base_potential (in step_length)
+#define RAPHSON_MAX_STEP (10.f)
 #define EPSILON 0.0001f
 #define ENABLE_COLOR
 
@@ -46,7 +54,7 @@ void clean_unpacked_normals(Device::Array<Vec3_cu> unpacked_normals)
 // -----------------------------------------------------------------------------
 
 /// Compute the normal of triangle pi
-__device__ Vec3_cu
+IF_CUDA_DEVICE_HOST static inline Vec3_cu
 compute_normal_tri(const Mesh::PrimIdx& pi, const Vec3_cu* prim_vertices) {
     const Point_cu va = prim_vertices[pi.a].to_point();
     const Point_cu vb = prim_vertices[pi.b].to_point();
@@ -188,8 +196,11 @@ compute_tangent_tri(const Mesh::PrimIdx& pi,
 
 // -----------------------------------------------------------------------------
 
-__global__
-void conservative_smooth_kernel(const Vec3_cu* in_vertices,
+/// Conservative smoothing of the vertex 'vert_to_fit[thread_idx]'
+/// @see conservative_smooth_kernel
+IF_CUDA_DEVICE_HOST static inline
+void conservative_smooth_vertex(int thread_idx,
+                                const Vec3_cu* in_vertices,
                                 Vec3_cu* out_verts,
                                 const Vec3_cu* normals,
                                 const int* edge_list,
@@ -197,53 +208,70 @@ void conservative_smooth_kernel(const Vec3_cu* in_vertices,
                                 const float* edge_mvc,
                                 const int* vert_to_fit,
                                 float force,
-                                int nb_verts,
                                 const float* smooth_fac,
                                 bool use_smooth_fac)
 {
-    int thread_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if(thread_idx < nb_verts)
-    {
-        const int p = vert_to_fit[thread_idx];
-        if(p == -1)
-            return;
+    const int p = vert_to_fit[thread_idx];
+    if(p == -1)
+        return;
 
-        const Vec3_cu n       = normals[p].normalized();
-        const Vec3_cu in_vert = in_vertices[p];
+    const Vec3_cu n       = normals[p].normalized();
+    const Vec3_cu in_vert = in_vertices[p];
 
-        if(n.norm() < 0.00001f){
-            out_verts[p] = in_vert;
-            return;
-        }
+    if(n.norm() < 0.00001f){
+        out_verts[p] = in_vert;
+        return;
+    }
 
-        Vec3_cu cog(0.f, 0.f, 0.f);
+    Vec3_cu cog(0.f, 0.f, 0.f);
 
-        const int offset = edge_list_offsets[2*p  ];
-        const int nb_ngb = edge_list_offsets[2*p+1];
+    const int offset = edge_list_offsets[2*p  ];
+    const int nb_ngb = edge_list_offsets[2*p+1];
 
-        float sum = 0.f;
-        for(int i = offset; i < offset + nb_ngb; i++){
-            const int j = edge_list[i];
-            const float mvc = edge_mvc[i];
-            sum += mvc;
-            cog =  cog + in_vertices[j] * mvc;
-        }
+    float sum = 0.f;
+    for(int i = offset; i < offset + nb_ngb; i++){
+        const int j = edge_list[i];
+        const float mvc = edge_mvc[i];
+        sum += mvc;
+        cog =  cog + in_vertices[j] * mvc;
+    }
 
-        if( fabs(sum) < 0.00001f ){
-            out_verts[p] = in_vert;
-            return;
-        }
+    if( fabs(sum) < 0.00001f ){
+        out_verts[p] = in_vert;
+        return;
+    }
 
-        cog = cog * (1.f/sum);
+    cog = cog * (1.f/sum);
 
-        // this force the smoothing to be only tangential :
-        const Vec3_cu cog_proj = n.proj_on_plane(in_vert.to_point(), cog.to_point());
-        // this is more like a conservative laplacian smoothing
-        //const Vec3_cu cog_proj = cog;
+    // this force the smoothing to be only tangential :
+    const Vec3_cu cog_proj = n.proj_on_plane(in_vert.to_point(), cog.to_point());
+    // this is more like a conservative laplacian smoothing
+    //const Vec3_cu cog_proj = cog;
 
-        const float u = use_smooth_fac ? smooth_fac[p] : force;
-        out_verts[p]  = cog_proj * u + in_vert * (1.f - u);
-    }
+    const float u = use_smooth_fac ? smooth_fac[p] : force;
+    out_verts[p]  = cog_proj * u + in_vert * (1.f - u);
+}
+
+// -----------------------------------------------------------------------------
+
+__global__
+void conservative_smooth_kernel(const Vec3_cu* in_vertices,
+                                Vec3_cu* out_verts,
+                                const Vec3_cu* normals,
+                                const int* edge_list,
+                                const int* edge_list_offsets,
+                                const float* edge_mvc,
+                                const int* vert_to_fit,
+                                float force,
+                                int nb_verts,
+                                const float* smooth_fac,
+                                bool use_smooth_fac)
+{
+    int thread_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if(thread_idx < nb_verts)
+        conservative_smooth_vertex(thread_idx, in_vertices, out_verts, normals,
+                                   edge_list, edge_list_offsets, edge_mvc,
+                                   vert_to_fit, force, smooth_fac, use_smooth_fac);
 }
 
 // -----------------------------------------------------------------------------
@@ -327,44 +355,59 @@ void conservative_smooth(Vec3_cu* d_verts,
 
 // -----------------------------------------------------------------------------
 
-__global__
-void laplacian_smooth_kernel(const Vec3_cu* in_vertices,
+IF_CUDA_DEVICE_HOST static inline
+void laplacian_smooth_vertex(int p,
+                             const Vec3_cu* in_vertices,
                              Vec3_cu* output_vertices,
                              const int* edge_list,
                              const int* edge_list_offsets,
                              const float* factors,
                              bool use_smooth_factors,
                              float strength,
-                             int nb_min_neighbours,
-                             int n)
+                             int nb_min_neighbours)
 {
-        int p = blockIdx.x * blockDim.x + threadIdx.x;
-        if(p < n)
-        {
-            Vec3_cu in_vertex = in_vertices[p];
-            Vec3_cu centroid  = Vec3_cu(0.f, 0.f, 0.f);
-            float   factor    = factors[p];
+    Vec3_cu in_vertex = in_vertices[p];
+    Vec3_cu centroid  = Vec3_cu(0.f, 0.f, 0.f);
+    float   factor    = factors[p];
 
-            int offset = edge_list_offsets[2*p  ];
-            int nb_ngb = edge_list_offsets[2*p+1];
-            if(nb_ngb > nb_min_neighbours)
-            {
-                for(int i = offset; i < offset + nb_ngb; i++){
-                    int j = edge_list[i];
-                    centroid += in_vertices[j];
-                }
+    int offset = edge_list_offsets[2*p  ];
+    int nb_ngb = edge_list_offsets[2*p+1];
+    if(nb_ngb > nb_min_neighbours)
+    {
+        for(int i = offset; i < offset + nb_ngb; i++){
+            int j = edge_list[i];
+            centroid += in_vertices[j];
+        }
 
-                centroid = centroid * (1.f/nb_ngb);
+        centroid = centroid * (1.f/nb_ngb);
 
-                if(use_smooth_factors)
-                    output_vertices[p] = centroid * factor + in_vertex * (1.f-factor);
-                else
-                    output_vertices[p] = centroid * strength + in_vertex * (1.f-strength);
-            }
-            else
-                output_vertices[p] = in_vertex;
-        }
+        if(use_smooth_factors)
+            output_vertices[p] = centroid * factor + in_vertex * (1.f-factor);
+        else
+            output_vertices[p] = centroid * strength + in_vertex * (1.f-strength);
+    }
+    else
+        output_vertices[p] = in_vertex;
+}
+
+// -----------------------------------------------------------------------------
 
+__global__
+void laplacian_smooth_kernel(const Vec3_cu* in_vertices,
+                             Vec3_cu* output_vertices,
+                             const int* edge_list,
+                             const int* edge_list_offsets,
+                             const float* factors,
+                             bool use_smooth_factors,
+                             float strength,
+                             int nb_min_neighbours,
+                             int n)
+{
+    int p = blockIdx.x * blockDim.x + threadIdx.x;
+    if(p < n)
+        laplacian_smooth_vertex(p, in_vertices, output_vertices, edge_list,
+                                edge_list_offsets, factors, use_smooth_factors,
+                                strength, nb_min_neighbours);
 }
 
 // -----------------------------------------------------------------------------
@@ -409,22 +452,18 @@ void laplacian_smooth(Vec3_cu* d_vertices,
 
 // -----------------------------------------------------------------------------
 
-__global__
-void tangential_smooth_kernel_first_pass(const Vec3_cu* in_vertices,
-                                         const Vec3_cu* in_normals,
-                                         Vec3_cu* out_vector,
-                                         const int* edge_list,
-                                         const int* edge_list_offsets,
-                                         const float* factors,
-                                         bool use_smooth_factors,
-                                         float strength,
-                                         int nb_min_neighbours,
-                                         int n)
+IF_CUDA_DEVICE_HOST static inline
+void tangential_smooth_vertex(int p,
+                              const Vec3_cu* in_vertices,
+                              const Vec3_cu* in_normals,
+                              Vec3_cu* out_vector,
+                              const int* edge_list,
+                              const int* edge_list_offsets,
+                              const float* factors,
+                              bool use_smooth_factors,
+                              float strength,
+                              int nb_min_neighbours)
 {
-    int p = blockIdx.x * blockDim.x + threadIdx.x;
-    if(p >= n)
-        return;
-
     Vec3_cu in_vertex = in_vertices[p];
     Vec3_cu in_normal = in_normals[p];
     Vec3_cu centroid  = Vec3_cu(0.f, 0.f, 0.f);
@@ -459,6 +498,27 @@ void tangential_smooth_kernel_first_pass(const Vec3_cu* in_vertices,
 
 // -----------------------------------------------------------------------------
 
+__global__
+void tangential_smooth_kernel_first_pass(const Vec3_cu* in_vertices,
+                                         const Vec3_cu* in_normals,
+                                         Vec3_cu* out_vector,
+                                         const int* edge_list,
+                                         const int* edge_list_offsets,
+                                         const float* factors,
+                                         bool use_smooth_factors,
+                                         float strength,
+                                         int nb_min_neighbours,
+                                         int n)
+{
+    int p = blockIdx.x * blockDim.x + threadIdx.x;
+    if(p < n)
+        tangential_smooth_vertex(p, in_vertices, in_normals, out_vector,
+                                 edge_list, edge_list_offsets, factors,
+                                 use_smooth_factors, strength, nb_min_neighbours);
+}
+
+// -----------------------------------------------------------------------------
+
 __global__
 void tangential_smooth_kernel_final_pass(const Vec3_cu* in_vertices,
                                          const Vec3_cu* in_vector,
@@ -472,6 +532,44 @@ void tangential_smooth_kernel_final_pass(const Vec3_cu* in_vertices,
 
 // -----------------------------------------------------------------------------
 
+IF_CUDA_DEVICE_HOST static inline
+void hc_smooth_vertex_first_pass(int p,
+                                 const Vec3_cu* original_vertices,
+                                 const Vec3_cu* in_vertices,
+                                 Vec3_cu* out_vector,
+                                 const int* edge_list,
+                                 const int* edge_list_offsets,
+                                 const float* factors,
+                                 bool use_smooth_factors,
+                                 float alpha,
+                                 int nb_min_neighbours)
+{
+    Vec3_cu in_vertex = in_vertices[p];
+    Vec3_cu centroid  = Vec3_cu(0.f, 0.f, 0.f);
+    float     factor  = factors[p];
+
+    int offset = edge_list_offsets[2*p  ];
+    int nb_ngb = edge_list_offsets[2*p+1];
+    if(nb_ngb > nb_min_neighbours)
+    {
+        for(int i = offset; i < offset + nb_ngb; i++){
+            int j = edge_list[i];
+            centroid += in_vertices[j];
+        }
+
+        centroid = centroid * (1.f/nb_ngb);
+
+        if(use_smooth_factors)
+            centroid = centroid * factor + in_vertex * (1.f-factor);
+
+        out_vector[p] = centroid - (original_vertices[p]*alpha + in_vertex*(1.f-alpha));
+    }
+    else
+        out_vector[p] = centroid;
+}
+
+// -----------------------------------------------------------------------------
+
 __global__
 void hc_smooth_kernel_first_pass(const Vec3_cu* original_vertices,
                                  const Vec3_cu* in_vertices,
@@ -486,31 +584,47 @@ void hc_smooth_kernel_first_pass(const Vec3_cu* original_vertices,
 {
     int p = blockIdx.x * blockDim.x + threadIdx.x;
     if(p < n)
-    {
-        Vec3_cu in_vertex = in_vertices[p];
-        Vec3_cu centroid  = Vec3_cu(0.f, 0.f, 0.f);
-        float     factor  = factors[p];
+        hc_smooth_vertex_first_pass(p, original_vertices, in_vertices, out_vector,
+                                    edge_list, edge_list_offsets, factors,
+                                    use_smooth_factors, alpha, nb_min_neighbours);
+}
 
-        int offset = edge_list_offsets[2*p  ];
-        int nb_ngb = edge_list_offsets[2*p+1];
-        if(nb_ngb > nb_min_neighbours)
-        {
-            for(int i = offset; i < offset + nb_ngb; i++){
-                int j = edge_list[i];
-                centroid += in_vertices[j];
-            }
+// -----------------------------------------------------------------------------
 
-            centroid = centroid * (1.f/nb_ngb);
+IF_CUDA_DEVICE_HOST static inline
+void hc_smooth_vertex_final_pass(int p,
+                                 const Vec3_cu* in_vectors,
+                                 const Vec3_cu* in_vertices,
+                                 Vec3_cu* out_vertices,
+                                 float beta,
+                                 const int* edge_list,
+                                 const int* edge_list_offsets,
+                                 int nb_min_neighbours)
+{
+    Vec3_cu centroid = Vec3_cu(0.f, 0.f, 0.f);
+    Vec3_cu mean_vec = Vec3_cu(0.f, 0.f, 0.f);
+    Vec3_cu in_vec   = in_vectors[p];
 
-            if(use_smooth_factors)
-                centroid = centroid * factor + in_vertex * (1.f-factor);
+    int offset = edge_list_offsets[2*p  ];
+    int nb_ngb = edge_list_offsets[2*p+1];
 
-            out_vector[p] = centroid - (original_vertices[p]*alpha + in_vertex*(1.f-alpha));
+    if(nb_ngb > nb_min_neighbours)
+    {
+        for(int i = offset; i < offset + nb_ngb; i++){
+            int j = edge_list[i];
+            centroid += in_vertices[j];
+            mean_vec += in_vectors [j];
         }
-        else
-            out_vector[p] = centroid;
-    }
 
+        float div = 1.f/nb_ngb;
+        centroid = centroid * div;
+        mean_vec = mean_vec * div;
+
+        Vec3_cu vec = in_vec*beta + mean_vec*(1.f-beta);
+        out_vertices[p] = centroid - vec;
+    }
+    else
+        out_vertices[p] = in_vertices[p];
 }
 
 // -----------------------------------------------------------------------------
@@ -527,33 +641,8 @@ void hc_smooth_kernel_final_pass(const Vec3_cu* in_vectors,
 {
     int p = blockIdx.x * blockDim.x + threadIdx.x;
     if(p < n)
-    {
-        Vec3_cu centroid = Vec3_cu(0.f, 0.f, 0.f);
-        Vec3_cu mean_vec = Vec3_cu(0.f, 0.f, 0.f);
-        Vec3_cu in_vec   = in_vectors[p];
-
-        int offset = edge_list_offsets[2*p  ];
-        int nb_ngb = edge_list_offsets[2*p+1];
-
-        if(nb_ngb > nb_min_neighbours)
-        {
-            for(int i = offset; i < offset + nb_ngb; i++){
-                int j = edge_list[i];
-                centroid += in_vertices[j];
-                mean_vec += in_vectors [j];
-            }
-
-            float div = 1.f/nb_ngb;
-            centroid = centroid * div;
-            mean_vec = mean_vec * div;
-
-            Vec3_cu vec = in_vec*beta + mean_vec*(1.f-beta);
-            out_vertices[p] = centroid - vec;
-        }
-        else
-            out_vertices[p] = in_vertices[p];
-    }
-
+        hc_smooth_vertex_final_pass(p, in_vectors, in_vertices, out_vertices, beta,
+                                    edge_list, edge_list_offsets, nb_min_neighbours);
 }
 
 // -----------------------------------------------------------------------------
@@ -618,6 +707,33 @@ void hc_laplacian_smooth(const DA_Vec3_cu& d_original_vertices,
 
 // -----------------------------------------------------------------------------
 
+IF_CUDA_DEVICE_HOST static inline
+void diffuse_vertex(int p,
+                    const float* in_values,
+                    float* out_values,
+                    const int* edge_list,
+                    const int* edge_list_offsets,
+                    float strength)
+{
+    const float in_val   = in_values[p];
+    float centroid = 0.f;
+
+    const int offset = edge_list_offsets[2*p  ];
+    const int nb_ngb = edge_list_offsets[2*p+1];
+
+    for(int i = offset; i < (offset + nb_ngb); i++)
+    {
+        const int j = edge_list[i];
+        centroid += in_values[j];
+    }
+
+    centroid = centroid * (1.f/nb_ngb);
+
+    out_values[p] = centroid * strength + in_val * (1.f-strength);
+}
+
+// -----------------------------------------------------------------------------
+
 __global__
 void diffusion_kernel(const float* in_values,
                       float* out_values,
@@ -628,23 +744,7 @@ void diffusion_kernel(const float* in_values,
 {
     int p = blockIdx.x * blockDim.x + threadIdx.x;
     if(p < nb_vert)
-    {
-        const float in_val   = in_values[p];
-        float centroid = 0.f;
-
-        const int offset = edge_list_offsets[2*p  ];
-        const int nb_ngb = edge_list_offsets[2*p+1];
-
-        for(int i = offset; i < (offset + nb_ngb); i++)
-        {
-            const int j = edge_list[i];
-            centroid += in_values[j];
-        }
-
-        centroid = centroid * (1.f/nb_ngb);
-
-        out_values[p] = centroid * strength + in_val * (1.f-strength);
-    }
+        diffuse_vertex(p, in_values, out_values, edge_list, edge_list_offsets, strength);
 }
 
 // -----------------------------------------------------------------------------
@@ -689,12 +789,36 @@ void fill_index(DA_int array)
 }
 
 /// Evaluate skeleton potential
-__device__
+IF_CUDA_DEVICE_HOST static inline
 float eval_potential(Skeleton_env::Skel_id skel_id, const Point_cu& p, Vec3_cu& grad)
 {
     return Skeleton_env::compute_potential(skel_id, p, grad);
 }
 
+/// What a vertex keeps from one evaluation of the skeleton to the next while
+/// marching toward its iso-surface
+struct Vert_eval {
+    IF_CUDA_DEVICE_HOST
+    Vert_eval() : nb_evals(0) { }
+
+    Skeleton_env::Grid_cell cell;  ///< grid cell of the last evaluation
+    Skeleton_env::DBone_id  bone0; ///< nearest bones of the vertex, only their
+    Skeleton_env::DBone_id  bone1; ///< cluster pairs are evaluated if valid
+    int nb_evals;                  ///< number of evaluations so far
+};
+
+/// Evaluate skeleton potential, the grid lookup is skipped while 'p' stays in
+/// the cell found by the previous evaluation
+IF_CUDA_DEVICE_HOST static inline
+float eval_potential(Skeleton_env::Skel_id skel_id,
+                     const Point_cu& p,
+                     Vec3_cu& grad,
+                     Vert_eval& ve)
+{
+    ve.nb_evals++;
+    return Skeleton_env::compute_potential(skel_id, p, grad, ve.cell, ve.bone0, ve.bone1);
+}
+
 // -----------------------------------------------------------------------------
 
 /// Computes the potential at each vertex of the mesh. When the mesh is
@@ -717,16 +841,17 @@ void compute_base_potential(Skeleton_env::Skel_id skel_id,
 
 // -----------------------------------------------------------------------------
 
-__device__
+IF_CUDA_DEVICE_HOST static
 float binary_search(Skeleton_env::Skel_id skel_id,
                         const Ray_cu&r,
                         float t0, float t1,
                         Vec3_cu& grad,
-                        float iso)
+                        float iso,
+                        Vert_eval& ve)
 {
     float t = t0;
-    float f0 = eval_potential(skel_id, r(t0), grad);
-    float f1 = eval_potential(skel_id, r(t1), grad);
+    float f0 = eval_potential(skel_id, r(t0), grad, ve);
+    float f1 = eval_potential(skel_id, r(t1), grad, ve);
 
     if(f0 > f1){
         t0 = t1;
@@ -738,7 +863,7 @@ float binary_search(Skeleton_env::Skel_id skel_id,
     {
         t = (t0 + t1) * 0.5f;
         p = r(t);
-        f0 = eval_potential(skel_id, p, grad);
+        f0 = eval_potential(skel_id, p, grad, ve);
 
         if(f0 > iso){
             t1 = t;
@@ -753,6 +878,46 @@ float binary_search(Skeleton_env::Skel_id skel_id,
 
 // -----------------------------------------------------------------------------
 
+/// Find the point of potential 'iso' along 'r' between t0 and t1 with the
+/// Illinois variant of the regula falsi. Converges in a few steps where
+/// binary_search() needs a lot more on the smooth potential of the skeleton.
+/// @param f0, f1 : potential minus 'iso' at t0 and t1, of opposite signs
+/// @param grad : gradient at the returned position
+IF_CUDA_DEVICE_HOST static
+float secant_search(Skeleton_env::Skel_id skel_id,
+                    const Ray_cu&r,
+                    float t0, float t1,
+                    float f0, float f1,
+                    Vec3_cu& grad,
+                    float iso,
+                    Vert_eval& ve)
+{
+    float t = t1;
+    int side = 0;
+    for(unsigned short i = 0; i < BINARY_SEARCH_STEPS; ++i)
+    {
+        t = (t0 * f1 - t1 * f0) / (f1 - f0);
+        float f = eval_potential(skel_id, r(t), grad, ve) - iso;
+
+        if( fabsf(f) < EPSILON ) break;
+
+        // Halve the weight of an end point kept twice in a row so that
+        // it gets replaced (Illinois)
+        if( f * f1 > 0.f ){
+            t1 = t; f1 = f;
+            if(side == -1) f0 *= 0.5f;
+            side = -1;
+        } else {
+            t0 = t; f0 = f;
+            if(side == +1) f1 *= 0.5f;
+            side = +1;
+        }
+    }
+    return t;
+}
+
+// -----------------------------------------------------------------------------
+
 /// Search for the gradient divergence section
 __device__
 float binary_search_div(Skeleton_env::Skel_id skel_id,
@@ -797,7 +962,7 @@ float binary_search_div(Skeleton_env::Skel_id skel_id,
 // -----------------------------------------------------------------------------
 
 /// transform iso to sfactor
-__device__
+IF_CUDA_DEVICE_HOST
 inline static float iso_to_sfactor(float x, int s)
 {
      #if 0
@@ -839,32 +1004,40 @@ inline static float iso_to_sfactor(float x, int s)
 /// the gradient of the implicit primitive. this parameter specify when the vertex
 /// stops the march i.e when gradient_threshold < to the scalar product of the
 /// gradient between two steps
-/// @param full_eval tells is we evaluate the skeleton entirely or if we just
-/// use the potential of the two nearest clusters, in full eval we don't update
-/// d_vert_to_fit has it is suppossed to be the last pass
-__global__
-void match_base_potential(Skeleton_env::Skel_id skel_id, 
-                          const bool smooth_fac_from_iso,
-                          Vec3_cu* out_verts,
-                          const float* base_potential,
-                          Vec3_cu* out_gradient,
-                          float* smooth_factors_iso,
-                          float* smooth_factors,
-                          int* vert_to_fit,
-                          const int nb_vert_to_fit,
-                          const unsigned short nb_iter,
-                          const float gradient_threshold,
-                          const float step_length,
-                          const bool potential_pit, // TODO: this condition should not be necessary
-                          EAnimesh::Vert_state *d_vert_state,
-                          const float smooth_strength,
-                          const int slope,
-                          const bool raphson)
+/// @param raphson if true vertices take Newton steps toward their base
+/// potential (clamped to RAPHSON_MAX_STEP * step_length) and the final
+/// position is refined with secant_search(). Otherwise they march with steps
+/// of 'step_length' and the final position is found with binary_search().
+/// @param nearest_bones tells if we evaluate the skeleton entirely (NULL) or
+/// if we just use the potential of the two nearest clusters. Otherwise holds
+/// for each vertex its two nearest bones (device indices), only their cluster
+/// pairs are evaluated.
+/// @param nb_evals incremented by the number of potential evaluations
+/// @param nb_lookups incremented by the number of evaluations which walked
+/// the skeleton grid. A vertex remembers its grid cell along its march and
+/// only looks it up again when it crosses the cell boundary.
+IF_CUDA_DEVICE_HOST static
+void match_base_potential_vertex(const int thread_idx,
+                                 Skeleton_env::Skel_id skel_id,
+                                 const bool smooth_fac_from_iso,
+                                 Vec3_cu* out_verts,
+                                 const float* base_potential,
+                                 Vec3_cu* out_gradient,
+                                 float* smooth_factors_iso,
+                                 float* smooth_factors,
+                                 int* vert_to_fit,
+                                 const unsigned short nb_iter,
+                                 const float gradient_threshold,
+                                 const float step_length,
+                                 const bool potential_pit, // TODO: this condition should not be necessary
+                                 EAnimesh::Vert_state *d_vert_state,
+                                 const float smooth_strength,
+                                 const int slope,
+                                 const bool raphson,
+                                 const int2* nearest_bones,
+                                 int& nb_evals,
+                                 int& nb_lookups)
 {
-    const int thread_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if(thread_idx >= nb_vert_to_fit)
-        return;
-
     const int p = vert_to_fit[thread_idx];
 
     // STOP CASE : Vertex already fitted
@@ -872,10 +1045,16 @@ void match_base_potential(Skeleton_env::Skel_id skel_id,
 
     const float ptl = base_potential[p];
 
+    Vert_eval ve;
+    if( nearest_bones != 0 ){
+        ve.bone0 = Skeleton_env::DBone_id( nearest_bones[p].x );
+        ve.bone1 = Skeleton_env::DBone_id( nearest_bones[p].y );
+    }
+
     Point_cu v0 = out_verts[p].to_point();
     Vec3_cu gf0;
     float f0;
-    f0 = eval_potential(skel_id, v0, gf0) - ptl;
+    f0 = eval_potential(skel_id, v0, gf0, ve) - ptl;
 
     if(smooth_fac_from_iso)
         smooth_factors_iso[p] = iso_to_sfactor(f0, slope) * smooth_strength;
@@ -885,6 +1064,8 @@ void match_base_potential(Skeleton_env::Skel_id skel_id,
     // STOP CASE : Point already near enough the isosurface
     if( fabsf(f0) < EPSILON ){
         vert_to_fit[thread_idx] = -1;
+        nb_evals   += ve.nb_evals;
+        nb_lookups += ve.cell.nb_lookups;
         return;
     }
 
@@ -906,17 +1087,37 @@ void match_base_potential(Skeleton_env::Skel_id skel_id,
         r.set_pos(v0);
         r.set_dir(gf0.normalized());
 
-        // Move v0 along the vector gf0 by dl.
-        Point_cu vi = r(dl);
+        // Newton step: along the ray the potential varies like f0 + t*|gf0|.
+        // f0 keeps its sign until we overshoot so the step has the same
+        // direction as dl.
+        float step = dl;
+        if( raphson ){
+            const float max_step = RAPHSON_MAX_STEP * step_length;
+            step = fmaxf(-max_step, fminf(max_step, -f0 / gf0.norm()));
+        }
+
+        // Move v0 along the vector gf0 by step.
+        Point_cu vi = r(step);
 
         // Get the new position's gradient (gfi) and difference in potential (fi).
         Vec3_cu gfi;
-        float fi = eval_potential(skel_id, vi, gfi) - ptl;
+        float fi = eval_potential(skel_id, vi, gfi, ve) - ptl;
+
+        // STOP CASE : Newton step landed on the isosurface
+        if( raphson && fabsf(fi) < EPSILON )
+        {
+            v0  = vi;
+            gf0 = gfi;
+            vert_to_fit[thread_idx] = -1;
+            break;
+        }
 
-        // If the sign of the potential is different, we've overshot.  Switch to binary search.
+        // If the sign of the potential is different, we've overshot.  Refine between the two last
+        // positions.
         if( fi * f0 <= 0.f)
         {
-            float t = binary_search(skel_id, r, 0.f, dl, gfi, ptl);
+            float t = raphson ? secant_search(skel_id, r, 0.f, step, f0, fi, gfi, ptl, ve) :
+                                binary_search(skel_id, r, 0.f, dl, gfi, ptl, ve);
             v0 = r(t);
 
             vert_to_fit[thread_idx] = -1;
@@ -941,7 +1142,7 @@ void match_base_potential(Skeleton_env::Skel_id skel_id,
         }
 
         // STOP CASE 3 : Stop if the last step made the potential value worse.
-        if( ((fi - f0)*dl < 0.f) && potential_pit )
+        if( ((fi - f0)*step < 0.f) && potential_pit )
         {
             vert_to_fit[thread_idx] = -1;
             smooth_factors[p] = smooth_strength;
@@ -956,8 +1157,778 @@ void match_base_potential(Skeleton_env::Skel_id skel_id,
 
     out_gradient[p] = gf0;
     out_verts[p] = v0;
+    nb_evals   += ve.nb_evals;
+    nb_lookups += ve.cell.nb_lookups;
+}
+
+// -----------------------------------------------------------------------------
+
+__global__
+void match_base_potential(Skeleton_env::Skel_id skel_id,
+                          const bool smooth_fac_from_iso,
+                          Vec3_cu* out_verts,
+                          const float* base_potential,
+                          Vec3_cu* out_gradient,
+                          float* smooth_factors_iso,
+                          float* smooth_factors,
+                          int* vert_to_fit,
+                          const int nb_vert_to_fit,
+                          const unsigned short nb_iter,
+                          const float gradient_threshold,
+                          const float step_length,
+                          const bool potential_pit,
+                          EAnimesh::Vert_state *d_vert_state,
+                          const float smooth_strength,
+                          const int slope,
+                          const bool raphson,
+                          const int2* nearest_bones,
+                          EAnimesh::Fit_stats* fit_stats)
+{
+    const int thread_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if(thread_idx < nb_vert_to_fit)
+    {
+        int nb_evals = 0, nb_lookups = 0;
+        match_base_potential_vertex(thread_idx, skel_id, smooth_fac_from_iso, out_verts,
+                                    base_potential, out_gradient, smooth_factors_iso,
+                                    smooth_factors, vert_to_fit, nb_iter,
+                                    gradient_threshold, step_length, potential_pit,
+                                    d_vert_state, smooth_strength, slope, raphson,
+                                    nearest_bones, nb_evals, nb_lookups);
+        if(nb_evals > 0){
+            atomicAdd(&fit_stats->nb_evals  , nb_evals  );
+            atomicAdd(&fit_stats->nb_lookups, nb_lookups);
+        }
+    }
 }
 
+// -----------------------------------------------------------------------------
+
+/// Starting position of vertex 'p' for a warm started fitting
+IF_CUDA_DEVICE_HOST static inline
+Point_cu warm_start_vertex(int p,
+                           const Point_cu* in_verts,
+                           const Vec3_cu* local_disp,
+                           const int* vert_bone,
+                           const Transfo* bone_tr)
+{
+    const int b = vert_bone[p];
+    const Vec3_cu disp = b < 0 ? local_disp[p] : bone_tr[b] * local_disp[p];
+    return in_verts[p] + disp;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Displacement of vertex 'p' from its SSD position to its fitted position,
+/// in the frame of its nearest bone
+IF_CUDA_DEVICE_HOST static inline
+Vec3_cu warm_start_displacement(int p,
+                                const Point_cu* in_verts,
+                                const Point_cu* out_verts,
+                                const int* vert_bone,
+                                const Transfo* bone_tr_inv)
+{
+    const int b = vert_bone[p];
+    const Vec3_cu disp = out_verts[p] - in_verts[p];
+    return b < 0 ? disp : bone_tr_inv[b] * disp;
+}
+
+// -----------------------------------------------------------------------------
+
+__global__
+void apply_warm_start(const Point_cu* in_verts,
+                      const Vec3_cu* local_disp,
+                      const int* vert_bone,
+                      const Transfo* bone_tr,
+                      int nb_verts,
+                      Point_cu* out_verts)
+{
+    const int p = blockIdx.x * blockDim.x + threadIdx.x;
+    if(p < nb_verts)
+        out_verts[p] = warm_start_vertex(p, in_verts, local_disp, vert_bone, bone_tr);
+}
+
+// -----------------------------------------------------------------------------
+
+__global__
+void store_warm_start(const Point_cu* in_verts,
+                      const Point_cu* out_verts,
+                      const int* vert_bone,
+                      const Transfo* bone_tr_inv,
+                      int nb_verts,
+                      Vec3_cu* local_disp)
+{
+    const int p = blockIdx.x * blockDim.x + threadIdx.x;
+    if(p < nb_verts)
+        local_disp[p] = warm_start_displacement(p, in_verts, out_verts, vert_bone, bone_tr_inv);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Vertex 'p' of a Vertex_staging buffer transformed by 'tr'
+IF_CUDA_DEVICE_HOST static inline
+Point_cu load_staged_vertex(int p, const float4* staged, const Transfo& tr)
+{
+    const float4 v = staged[p];
+    return tr * Point_cu(v.x, v.y, v.z);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Vertex 'p' of 'verts' transformed by 'tr' in the layout of a Vertex_staging
+IF_CUDA_DEVICE_HOST static inline
+float4 store_staged_vertex(int p, const Point_cu* verts, const Transfo& tr)
+{
+    const Point_cu v = tr * verts[p];
+    return make_float4(v.x, v.y, v.z, 1.f);
+}
+
+// -----------------------------------------------------------------------------
+
+__global__
+void load_staged_vertices(const float4* staged,
+                          Transfo tr,
+                          int nb_verts,
+                          Point_cu* out_verts)
+{
+    const int p = blockIdx.x * blockDim.x + threadIdx.x;
+    if(p < nb_verts)
+        out_verts[p] = load_staged_vertex(p, staged, tr);
+}
+
+// -----------------------------------------------------------------------------
+
+__global__
+void store_staged_vertices(const Point_cu* verts,
+                           Transfo tr,
+                           int nb_verts,
+                           float4* staged)
+{
+    const int p = blockIdx.x * blockDim.x + threadIdx.x;
+    if(p < nb_verts)
+        staged[p] = store_staged_vertex(p, verts, tr);
+}
+
+// =============================================================================
+// CPU versions: same computations as the kernels above, arrays are in host
+// memory and vertices are dispatched over threads by chunks of CPU_CHUNK_SIZE
+// =============================================================================
+
+void compute_mvc_cpu(const Mesh& mesh, float* edge_lengths, float* edge_mvc)
+{
+    // Each vertex only writes its own edges
+    Thread_utils::parallel_for(0, mesh.get_nb_vertices(), 256, [&](int begin, int end_vert)
+    {
+        for(int i = begin; i < end_vert; i++)
+        {
+            Point_cu pos = mesh.get_vertex(i).to_point();
+            Vec3_cu  nor = mesh.get_mean_normal(i).to_point(); // FIXME : should be the gradient
+
+            Mat3_cu frame = Mat3_cu::coordinate_system( nor ).transpose();
+            float sum = 0.f;
+            bool  out = false;
+            // Look up neighborhood
+            int dep      = mesh.get_edge_offset(i*2    );
+            int nb_neigh = mesh.get_edge_offset(i*2 + 1);
+            int end      = (dep+nb_neigh);
+
+            if( nor.norm() < 0.00001f || mesh.is_vert_on_side(i) ) {
+                for(int n = dep; n < end; n++) edge_mvc[n] = 0.f;
+            }
+            else
+            {
+                for(int n = dep; n < end; n++)
+                {
+                    int id_curr = mesh.get_edge( n );
+                    int id_next = mesh.get_edge( (n+1) >= end  ? dep   : n+1 );
+                    int id_prev = mesh.get_edge( (n-1) <  dep  ? end-1 : n-1 );
+
+                    // compute edge length
+                    Point_cu  curr = mesh.get_vertex(id_curr).to_point();
+                    Vec3_cu e_curr = (curr - pos);
+                    edge_lengths[n] = e_curr.norm();
+
+                    // compute mean value coordinates
+                    // coordinates are computed by projecting the neighborhood to the
+                    // tangent plane
+                    {
+                        // Project on tangent plane
+                        Vec3_cu e_next = mesh.get_vertex(id_next).to_point() - pos;
+                        Vec3_cu e_prev = mesh.get_vertex(id_prev).to_point() - pos;
+
+                        e_curr = frame * e_curr;
+                        e_next = frame * e_next;
+                        e_prev = frame * e_prev;
+
+                        e_curr.x = 0.f;
+                        e_next.x = 0.f;
+                        e_prev.x = 0.f;
+
+                        float norm_curr_2D = e_curr.norm();
+
+                        e_curr.normalize();
+                        e_next.normalize();
+                        e_prev.normalize();
+
+                        // Computing mvc
+                        float anext = std::atan2( -e_prev.z * e_curr.y + e_prev.y * e_curr.z, e_prev.dot(e_curr) );
+                        float aprev = std::atan2( -e_curr.z * e_next.y + e_curr.y * e_next.z, e_curr.dot(e_next) );
+
+                        float mvc = 0.f;
+                        if(norm_curr_2D > 0.0001f)
+                            mvc = (std::tan(anext*0.5f) + std::tan(aprev*0.5f)) / norm_curr_2D;
+
+                        sum += mvc;
+                        edge_mvc[n] = mvc;
+                        out = out || mvc < 0.f;
+                    }
+                }
+                // we ignore points outside the convex hull
+                if( sum  <= 0.f || out || std::isnan(sum) ) {
+                    for(int n = dep; n < end; n++) edge_mvc[n] = 0.f;
+                }
+            }
+        }
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void nearest_bones_cpu(const Mesh& mesh, const Skeleton& skel, std::vector<int2>& nearest_bones)
+{
+    std::vector< std::shared_ptr<const Bone> > bones;
+    for(Bone::Id bone_id: skel.get_bone_ids())
+    {
+        std::shared_ptr<const Bone> bone = skel.get_bone(bone_id);
+        if( bone->get_enabled() )
+            bones.push_back( bone );
+    }
+
+    nearest_bones.resize( mesh.get_nb_vertices() );
+    Thread_utils::parallel_for(0, mesh.get_nb_vertices(), 256, [&](int begin, int end)
+    {
+        for(int i = begin; i < end; i++)
+        {
+            const Point_cu vert = mesh.get_vertex(i).to_point();
+            float d0 = FLT_MAX, d1 = FLT_MAX;
+            int2 nearest = make_int2(-1, -1);
+            for(const std::shared_ptr<const Bone>& bone: bones)
+            {
+                const float dist = bone->dist_to( vert );
+                if( dist < d0 ){
+                    d1 = d0; nearest.y = nearest.x;
+                    d0 = dist; nearest.x = bone->get_bone_id();
+                } else if( dist < d1 ){
+                    d1 = dist; nearest.y = bone->get_bone_id();
+                }
+            }
+            nearest_bones[i] = nearest;
+        }
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t skeleton_key(const Skeleton& skel)
+{
+    // FNV-1a over the enabled state and segment of every bone
+    uint64_t key = 14695981039346656037ULL;
+    const auto hash = [&key](const void* data, int size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for(int i = 0; i < size; i++)
+            key = (key ^ bytes[i]) * 1099511628211ULL;
+    };
+
+    for(Bone::Id bone_id: skel.get_bone_ids())
+    {
+        std::shared_ptr<const Bone> bone = skel.get_bone(bone_id);
+        const int enabled = bone->get_enabled() ? 1 : 0;
+        const Point_cu org = bone->org();
+        const Vec3_cu  dir = bone->dir();
+        const float seg[6] = { org.x, org.y, org.z, dir.x, dir.y, dir.z };
+        hash(&bone_id, sizeof(bone_id));
+        hash(&enabled, sizeof(enabled));
+        hash(seg, sizeof(seg));
+    }
+    return key;
+}
+
+// -----------------------------------------------------------------------------
+
+bool load_precomputed_mvc(const Mesh& mesh,
+                          const Animesh_precomputed* pre,
+                          float* edge_lengths,
+                          float* edge_mvc)
+{
+    const int nb_edges = mesh.get_nb_edges();
+    if( pre == 0 ||
+        (int)pre->edge_lengths.size() != nb_edges ||
+        (int)pre->edge_mvc.size()     != nb_edges )
+    {
+        return false;
+    }
+
+    std::copy(pre->edge_lengths.begin(), pre->edge_lengths.end(), edge_lengths);
+    std::copy(pre->edge_mvc.begin(),     pre->edge_mvc.end(),     edge_mvc    );
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+bool load_precomputed_nearest_bones(const Mesh& mesh,
+                                    const Skeleton& skel,
+                                    const Animesh_precomputed* pre,
+                                    std::vector<int2>& nearest_bones)
+{
+    const int nb_verts = mesh.get_nb_vertices();
+    if( pre == 0 ||
+        (int)pre->nearest_bones.size() != nb_verts * 2 ||
+        pre->skeleton_key != skeleton_key(skel) )
+    {
+        return false;
+    }
+
+    nearest_bones.resize( nb_verts );
+    for(int i = 0; i < nb_verts; i++)
+        nearest_bones[i] = make_int2(pre->nearest_bones[i*2], pre->nearest_bones[i*2 + 1]);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void store_precomputed_nearest_bones(const Skeleton& skel,
+                                     const std::vector<int2>& nearest_bones,
+                                     Animesh_precomputed& out)
+{
+    out.nearest_bones.resize( nearest_bones.size() * 2 );
+    for(unsigned i = 0; i < nearest_bones.size(); i++)
+    {
+        out.nearest_bones[i*2    ] = nearest_bones[i].x;
+        out.nearest_bones[i*2 + 1] = nearest_bones[i].y;
+    }
+    out.skeleton_key = skeleton_key(skel);
+}
+
+// -----------------------------------------------------------------------------
+
+bool nearest_bones_to_didx(const Skeleton& skel,
+                           const std::vector<int2>& nearest_bones,
+                           std::vector<int>& bones_didx,
+                           std::vector<int2>& out)
+{
+    std::map<Bone::Id, int> didx;
+    std::vector<int> new_bones_didx;
+    for(Bone::Id bone_id: skel.get_bone_ids())
+    {
+        const int d = skel.get_bone_didx( bone_id ).id();
+        didx[bone_id] = d;
+        new_bones_didx.push_back( d );
+    }
+
+    if( new_bones_didx == bones_didx )
+        return false;
+
+    bones_didx.swap( new_bones_didx );
+    out.resize( nearest_bones.size() );
+    for(unsigned i = 0; i < nearest_bones.size(); i++)
+    {
+        const int2 n = nearest_bones[i];
+        out[i] = make_int2(n.x < 0 ? -1 : didx[n.x],
+                           n.y < 0 ? -1 : didx[n.y]);
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void bone_transfos(const Skeleton& skel, std::vector<Bone::Id>& bone_ids, std::vector<Transfo>& tr)
+{
+    bone_ids.clear();
+    tr.clear();
+    for(Bone::Id bone_id: skel.get_bone_ids())
+    {
+        bone_ids.push_back( bone_id );
+        tr.push_back( skel.get_bone(bone_id)->get_world_space_matrix() );
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void nearest_bone_slots(const std::vector<int2>& nearest_bones,
+                        const std::vector<Bone::Id>& bone_ids,
+                        std::vector<int>& vert_bone)
+{
+    std::map<Bone::Id, int> slot;
+    for(unsigned i = 0; i < bone_ids.size(); i++)
+        slot[bone_ids[i]] = i;
+
+    vert_bone.resize( nearest_bones.size() );
+    for(unsigned i = 0; i < nearest_bones.size(); i++)
+    {
+        std::map<Bone::Id, int>::const_iterator it = slot.find( nearest_bones[i].x );
+        vert_bone[i] = it == slot.end() ? -1 : it->second;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool is_large_pose_delta(const Skeleton& skel,
+                         const std::vector<Bone::Id>& bone_ids,
+                         const std::vector<Transfo>& prev_tr,
+                         const std::vector<Transfo>& tr)
+{
+    // Max difference of a rotation matrix coefficient (~15 degrees)
+    const float max_rot = 0.25f;
+    // Max translation relatively to the bone length
+    const float max_trans = 0.25f;
+
+    if( prev_tr.size() != tr.size() ) return true;
+
+    for(unsigned i = 0; i < tr.size(); i++)
+    {
+        const Transfo& a = prev_tr[i];
+        const Transfo& b = tr[i];
+        for(int j = 0; j < 3; j++)
+            for(int k = 0; k < 3; k++)
+                if( fabsf(a.m[j*4+k] - b.m[j*4+k]) > max_rot )
+                    return true;
+
+        const float len = skel.get_bone(bone_ids[i])->length();
+        if( (a.get_translation() - b.get_translation()).norm() > max_trans * len )
+            return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+void apply_warm_start_cpu(const Point_cu* in_verts,
+                          const Vec3_cu* local_disp,
+                          const int* vert_bone,
+                          const Transfo* bone_tr,
+                          int nb_verts,
+                          Point_cu* out_verts)
+{
+    Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for(int p = begin; p < end; p++)
+            out_verts[p] = warm_start_vertex(p, in_verts, local_disp, vert_bone, bone_tr);
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void store_warm_start_cpu(const Point_cu* in_verts,
+                          const Point_cu* out_verts,
+                          const int* vert_bone,
+                          const Transfo* bone_tr_inv,
+                          int nb_verts,
+                          Vec3_cu* local_disp)
+{
+    Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for(int p = begin; p < end; p++)
+            local_disp[p] = warm_start_displacement(p, in_verts, out_verts, vert_bone, bone_tr_inv);
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void load_staged_vertices_cpu(const float4* staged,
+                              const Transfo& tr,
+                              int nb_verts,
+                              Point_cu* out_verts)
+{
+    Thread_utils::parallel_for(0, nb_verts, 4096, [&](int begin, int end)
+    {
+        for(int p = begin; p < end; p++)
+            out_verts[p] = load_staged_vertex(p, staged, tr);
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void store_staged_vertices_cpu(const Point_cu* verts,
+                               const Transfo& tr,
+                               int nb_verts,
+                               float4* staged)
+{
+    Thread_utils::parallel_for(0, nb_verts, 4096, [&](int begin, int end)
+    {
+        for(int p = begin; p < end; p++)
+            staged[p] = store_staged_vertex(p, verts, tr);
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void match_base_potential_cpu(Skeleton_env::Skel_id skel_id,
+                              const bool smooth_fac_from_iso,
+                              Vec3_cu* out_verts,
+                              const float* base_potential,
+                              Vec3_cu* out_gradient,
+                              float* smooth_factors_iso,
+                              float* smooth_factors,
+                              int* vert_to_fit,
+                              const int nb_vert_to_fit,
+                              const unsigned short nb_iter,
+                              const float gradient_threshold,
+                              const float step_length,
+                              const bool potential_pit,
+                              EAnimesh::Vert_state *vert_state,
+                              const float smooth_strength,
+                              const int slope,
+                              const bool raphson,
+                              const int2* nearest_bones,
+                              EAnimesh::Fit_stats& fit_stats)
+{
+    std::mutex mutex;
+    // March lengths vary a lot between vertices: small chunks let idle
+    // threads steal the remaining work
+    Thread_utils::parallel_for(0, nb_vert_to_fit, CPU_CHUNK_SIZE, [&](int begin, int end)
+    {
+        int nb_evals = 0, nb_lookups = 0;
+        for(int i = begin; i < end; i++)
+            match_base_potential_vertex(i, skel_id, smooth_fac_from_iso, out_verts,
+                                        base_potential, out_gradient, smooth_factors_iso,
+                                        smooth_factors, vert_to_fit, nb_iter,
+                                        gradient_threshold, step_length, potential_pit,
+                                        vert_state, smooth_strength, slope, raphson,
+                                        nearest_bones, nb_evals, nb_lookups);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        fit_stats.nb_evals   += nb_evals;
+        fit_stats.nb_lookups += nb_lookups;
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void compute_normals_cpu(const int* tri,
+                         const Mesh::PrimIdxVertices* piv,
+                         int nb_tri,
+                         const Vec3_cu* vertices,
+                         Vec3_cu* unpacked_normals,
+                         int unpack_factor,
+                         int nb_verts,
+                         Vec3_cu* out_normals)
+{
+    std::fill(unpacked_normals, unpacked_normals + nb_verts * unpack_factor, Vec3_cu(0.f, 0.f, 0.f));
+
+    // Each face writes to its own slots of 'unpacked_normals'
+    Thread_utils::parallel_for(0, nb_tri, CPU_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for(int p = begin; p < end; p++)
+        {
+            Mesh::PrimIdx pidx;
+            pidx.a = tri[3*p    ];
+            pidx.b = tri[3*p + 1];
+            pidx.c = tri[3*p + 2];
+            const Mesh::PrimIdxVertices pivp = piv[p];
+            const Vec3_cu nm = compute_normal_tri(pidx, vertices);
+            unpacked_normals[pidx.a * unpack_factor + pivp.ia] = nm;
+            unpacked_normals[pidx.b * unpack_factor + pivp.ib] = nm;
+            unpacked_normals[pidx.c * unpack_factor + pivp.ic] = nm;
+        }
+    });
+
+    Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for(int p = begin; p < end; p++)
+        {
+            Vec3_cu nm = Vec3_cu::zero();
+            for(int i = 0; i < unpack_factor; i++)
+                nm = nm + unpacked_normals[p * unpack_factor + i];
+            out_normals[p] = nm.normalized();
+        }
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void conservative_smooth_cpu(Vec3_cu* verts,
+                             Vec3_cu* buff_verts,
+                             const Vec3_cu* normals,
+                             const int* edge_list,
+                             const int* edge_list_offsets,
+                             const float* edge_mvc,
+                             const int* vert_to_fit,
+                             int nb_vert_to_fit,
+                             int nb_verts,
+                             float strength,
+                             int nb_iter,
+                             const float* smooth_fac,
+                             bool use_smooth_fac)
+{
+    if(nb_vert_to_fit == 0) return;
+
+    Vec3_cu* verts_a = verts;
+    Vec3_cu* verts_b = buff_verts;
+
+    // See conservative_smooth(): every vertex must be readable in both buffers
+    if(nb_iter > 1)
+        std::copy(verts, verts + nb_verts, buff_verts);
+
+    for(int i = 0; i < nb_iter; i++)
+    {
+        Thread_utils::parallel_for(0, nb_vert_to_fit, CPU_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for(int t = begin; t < end; t++)
+                conservative_smooth_vertex(t, verts_a, verts_b, normals,
+                                           edge_list, edge_list_offsets, edge_mvc,
+                                           vert_to_fit, strength, smooth_fac, use_smooth_fac);
+        });
+        std::swap(verts_a, verts_b);
+    }
+
+    if(nb_iter % 2 == 1){
+        for(int t = 0; t < nb_vert_to_fit; t++){
+            const int p = vert_to_fit[t];
+            if(p != -1) verts[p] = buff_verts[p];
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void laplacian_smooth_cpu(Vec3_cu* vertices,
+                          Vec3_cu* tmp_vertices,
+                          const int* edge_list,
+                          const int* edge_list_offsets,
+                          int nb_verts,
+                          const float* factors,
+                          bool use_smooth_factors,
+                          float strength,
+                          int nb_iter,
+                          int nb_min_neighbours)
+{
+    Vec3_cu* vertices_a = vertices;
+    Vec3_cu* vertices_b = tmp_vertices;
+    for(int i = 0; i < nb_iter; i++)
+    {
+        Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for(int p = begin; p < end; p++)
+                laplacian_smooth_vertex(p, vertices_a, vertices_b, edge_list,
+                                        edge_list_offsets, factors, use_smooth_factors,
+                                        strength, nb_min_neighbours);
+        });
+        std::swap(vertices_a, vertices_b);
+    }
+
+    if(nb_iter % 2 == 1)
+        std::copy(tmp_vertices, tmp_vertices + nb_verts, vertices);
+}
+
+// -----------------------------------------------------------------------------
+
+void tangential_smooth_cpu(Vec3_cu* vertices,
+                           Vec3_cu* vertices_prealloc,
+                           Vec3_cu* normals,
+                           const int* tri,
+                           const Mesh::PrimIdxVertices* piv,
+                           int nb_tri,
+                           Vec3_cu* unpacked_normals,
+                           int unpack_factor,
+                           const int* edge_list,
+                           const int* edge_list_offsets,
+                           int nb_verts,
+                           const float* factors,
+                           bool use_smooth_factors,
+                           float strength,
+                           int nb_iter,
+                           int nb_min_neighbours)
+{
+    Vec3_cu* vertices_a = vertices;
+    Vec3_cu* vertices_b = vertices_prealloc;
+    for(int i = 0; i < nb_iter; i++)
+    {
+        if(nb_tri > 0)
+            compute_normals_cpu(tri, piv, nb_tri, vertices_a, unpacked_normals,
+                                unpack_factor, nb_verts, normals);
+
+        Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for(int p = begin; p < end; p++){
+                tangential_smooth_vertex(p, vertices_a, normals, vertices_b,
+                                         edge_list, edge_list_offsets, factors,
+                                         use_smooth_factors, strength, nb_min_neighbours);
+                vertices_b[p] = vertices_a[p] + vertices_b[p];
+            }
+        });
+        std::swap(vertices_a, vertices_b);
+    }
+
+    if(nb_iter % 2 == 1)
+        std::copy(vertices_prealloc, vertices_prealloc + nb_verts, vertices);
+}
+
+// -----------------------------------------------------------------------------
+
+void hc_laplacian_smooth_cpu(const Vec3_cu* original_vertices,
+                             Vec3_cu* smoothed_vertices,
+                             Vec3_cu* vector_correction,
+                             Vec3_cu* tmp_vertices,
+                             const int* edge_list,
+                             const int* edge_list_offsets,
+                             int nb_verts,
+                             const float* factors,
+                             bool use_smooth_factors,
+                             float alpha,
+                             float beta,
+                             int nb_iter,
+                             int nb_min_neighbours)
+{
+    Vec3_cu* vertices_a = smoothed_vertices;
+    Vec3_cu* vertices_b = tmp_vertices;
+    for(int i = 0; i < nb_iter; i++)
+    {
+        Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for(int p = begin; p < end; p++)
+                hc_smooth_vertex_first_pass(p, original_vertices, vertices_a, vector_correction,
+                                            edge_list, edge_list_offsets, factors,
+                                            use_smooth_factors, alpha, nb_min_neighbours);
+        });
+
+        Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for(int p = begin; p < end; p++)
+                hc_smooth_vertex_final_pass(p, vector_correction, vertices_a, vertices_b, beta,
+                                            edge_list, edge_list_offsets, nb_min_neighbours);
+        });
+        std::swap(vertices_a, vertices_b);
+    }
+
+    if(nb_iter % 2 == 1)
+        std::copy(tmp_vertices, tmp_vertices + nb_verts, smoothed_vertices);
+}
+
+// -----------------------------------------------------------------------------
+
+void diffuse_values_cpu(float* values,
+                        float* values_buffer,
+                        const int* edge_list,
+                        const int* edge_list_offsets,
+                        int nb_verts,
+                        float strength,
+                        int nb_iter)
+{
+    float* values_a = values;
+    float* values_b = values_buffer;
+    strength = std::max( 0.f, std::min(1.f, strength));
+    for(int i = 0; i < nb_iter; i++)
+    {
+        Thread_utils::parallel_for(0, nb_verts, CPU_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for(int p = begin; p < end; p++)
+                diffuse_vertex(p, values_a, values_b, edge_list, edge_list_offsets, strength);
+        });
+        std::swap(values_a, values_b);
+    }
+
+    if(nb_iter % 2 == 1)
+        std::copy(values_buffer, values_buffer + nb_verts, values);
+}
 }
 // END KERNELS NAMESPACE =======================================================
 
@@ -6,6 +6,7 @@
 #include "mesh.hpp"
 #include "skeleton.hpp"
 #include "animesh_enum.hpp"
+#include "animesh_base.hpp"
 
 /** @namespace Kernels
     @brief The cuda kernels used to animate the mesh
@@ -30,6 +31,10 @@ compute_base_potential(Skeleton_env::Skel_id skel_id,
 
 /// Match the base potential after basic ssd deformation
 /// (i.e : do the implicit skinning step)
+/// @param d_nearest_bones NULL to evaluate the whole skeleton, otherwise the
+/// two nearest bones of each vertex (see nearest_bones_cpu())
+/// @param d_fit_stats counters incremented with the number of potential
+/// evaluations and grid lookups of the kernel (see EAnimesh::Fit_stats)
 __global__
 void match_base_potential(Skeleton_env::Skel_id skel_id,
                           const bool smooth_fac_from_iso,
@@ -47,9 +52,57 @@ void match_base_potential(Skeleton_env::Skel_id skel_id,
                           EAnimesh::Vert_state *d_vert_state,
                           const float smooth_strength,
                           const int slope,
-                          const bool raphson);
+                          const bool raphson,
+                          const int2* d_nearest_bones,
+                          EAnimesh::Fit_stats* d_fit_stats);
 
 
+/// Starting positions of a warm started fitting: the displacement from the
+/// SSD position to the fitted position of the previous evaluation is applied
+/// to 'in_verts' (SSD positions) after being moved along with the vertex's
+/// nearest bone.
+/// @param local_disp : displacements in the frame of the bones, as computed by
+/// store_warm_start()
+/// @param vert_bone : index in 'bone_tr' of the nearest bone of each vertex,
+/// -1 if the displacement is expressed in world space.
+/// @param bone_tr : current transformation of the bones
+__global__
+void apply_warm_start(const Point_cu* in_verts,
+                      const Vec3_cu* local_disp,
+                      const int* vert_bone,
+                      const Transfo* bone_tr,
+                      int nb_verts,
+                      Point_cu* out_verts);
+
+/// Store the displacement from 'in_verts' (SSD positions) to 'out_verts'
+/// (fitted positions) expressed in the frame of the nearest bone of each
+/// vertex.
+/// @param bone_tr_inv : inverse of the current transformation of the bones
+/// @see apply_warm_start()
+__global__
+void store_warm_start(const Point_cu* in_verts,
+                      const Point_cu* out_verts,
+                      const int* vert_bone,
+                      const Transfo* bone_tr_inv,
+                      int nb_verts,
+                      Vec3_cu* local_disp);
+
+/// Read the vertices of a Vertex_staging buffer ((x, y, z, w) floats) and
+/// transform them by 'tr' into 'out_verts'
+__global__
+void load_staged_vertices(const float4* staged,
+                          Transfo tr,
+                          int nb_verts,
+                          Point_cu* out_verts);
+
+/// Transform 'verts' by 'tr' and write them in the layout of a Vertex_staging
+/// buffer ((x, y, z, 1) floats)
+__global__
+void store_staged_vertices(const Point_cu* verts,
+                           Transfo tr,
+                           int nb_verts,
+                           float4* staged);
+
 /*
  *
  * // TODO: to be deleted
@@ -175,6 +228,211 @@ void tangential_smooth_kernel_final_pass(const Vec3_cu* in_vertices,
 
 
 
+// =============================================================================
+/// @name CPU versions
+/// Host counterparts of the kernels above for the CPU backend Animesh_cpu.
+/// Arrays are in host memory, parameters have the same meaning as their CUDA
+/// equivalent. Vertices are processed in parallel with Thread_utils.
+// =============================================================================
+/// @{
+
+/// Number of vertices processed in a row by a thread. Small enough for a chunk
+/// and its neighborhood to stay in cache, and to let work stealing balance
+/// the vertex marches of match_base_potential_cpu()
+const int CPU_CHUNK_SIZE = 64;
+
+/// Compute the mean value coordinates and the length of every edges of the
+/// mesh in rest pose. Arrays are indexed like the mesh's edge list.
+/// @see Animesh::compute_mvc()
+void compute_mvc_cpu(const Mesh& mesh, float* edge_lengths, float* edge_mvc);
+
+/// Find for each vertex of 'mesh' its two nearest enabled bones of 'skel'
+/// (distance to the bone segments). Used to fit vertices against the two
+/// nearest clusters only (see match_base_potential()).
+/// @param nearest_bones : Bone::Id of the nearest (x) and second nearest (y)
+/// bone of each vertex, -1 if there is no such bone.
+void nearest_bones_cpu(const Mesh& mesh, const Skeleton& skel, std::vector<int2>& nearest_bones);
+
+/// Key of the bones positions nearest_bones_cpu() depends on, to tell if
+/// saved nearest bones still match 'skel' (see Animesh_precomputed)
+uint64_t skeleton_key(const Skeleton& skel);
+
+/// Copy the mean value coordinates saved in 'pre' if they match 'mesh'
+/// @return false if 'pre' is NULL or doesn't match: compute_mvc_cpu() must
+/// be called instead
+bool load_precomputed_mvc(const Mesh& mesh,
+                          const Animesh_precomputed* pre,
+                          float* edge_lengths,
+                          float* edge_mvc);
+
+/// Copy the nearest bones saved in 'pre' if they match 'mesh' and 'skel'
+/// @return false if 'pre' is NULL or doesn't match: nearest_bones_cpu() must
+/// be called instead
+bool load_precomputed_nearest_bones(const Mesh& mesh,
+                                    const Skeleton& skel,
+                                    const Animesh_precomputed* pre,
+                                    std::vector<int2>& nearest_bones);
+
+/// Save the output of nearest_bones_cpu() and the key of 'skel' in 'out'
+void store_precomputed_nearest_bones(const Skeleton& skel,
+                                     const std::vector<int2>& nearest_bones,
+                                     Animesh_precomputed& out);
+
+/// Convert the output of nearest_bones_cpu() to the device indices of the
+/// bones (Skeleton_env::DBone_id), as expected by match_base_potential().
+/// Device indices change when Skeleton_env lays out its skeletons again, the
+/// conversion is skipped when they are the same as 'bones_didx'.
+/// @param bones_didx : device index of every bone of 'skel' at the last
+/// conversion (empty before the first one), updated by the call.
+/// @return true if 'out' has been updated
+bool nearest_bones_to_didx(const Skeleton& skel,
+                           const std::vector<int2>& nearest_bones,
+                           std::vector<int>& bones_didx,
+                           std::vector<int2>& out);
+
+/// Transformations of the bones of 'skel' as used by apply_warm_start()
+/// @param bone_ids : bones in the order of 'tr' (i.e. Skeleton::get_bone_ids())
+void bone_transfos(const Skeleton& skel, std::vector<Bone::Id>& bone_ids, std::vector<Transfo>& tr);
+
+/// Index in 'bone_ids' of the nearest bone of each vertex (see
+/// nearest_bones_cpu()), -1 if the bone is not listed.
+void nearest_bone_slots(const std::vector<int2>& nearest_bones,
+                        const std::vector<Bone::Id>& bone_ids,
+                        std::vector<int>& vert_bone);
+
+/// @return true if the bones moved too much between 'prev_tr' and 'tr' for
+/// the last fitted positions to be a good starting point.
+/// Rotations are compared coefficient wise, translations relatively to the
+/// bone's length.
+bool is_large_pose_delta(const Skeleton& skel,
+                         const std::vector<Bone::Id>& bone_ids,
+                         const std::vector<Transfo>& prev_tr,
+                         const std::vector<Transfo>& tr);
+
+/// CPU version of apply_warm_start()
+void apply_warm_start_cpu(const Point_cu* in_verts,
+                          const Vec3_cu* local_disp,
+                          const int* vert_bone,
+                          const Transfo* bone_tr,
+                          int nb_verts,
+                          Point_cu* out_verts);
+
+/// CPU version of store_warm_start()
+void store_warm_start_cpu(const Point_cu* in_verts,
+                          const Point_cu* out_verts,
+                          const int* vert_bone,
+                          const Transfo* bone_tr_inv,
+                          int nb_verts,
+                          Vec3_cu* local_disp);
+
+/// CPU version of load_staged_vertices()
+void load_staged_vertices_cpu(const float4* staged,
+                              const Transfo& tr,
+                              int nb_verts,
+                              Point_cu* out_verts);
+
+/// CPU version of store_staged_vertices()
+void store_staged_vertices_cpu(const Point_cu* verts,
+                               const Transfo& tr,
+                               int nb_verts,
+                               float4* staged);
+
+/// CPU version of match_base_potential()
+void match_base_potential_cpu(Skeleton_env::Skel_id skel_id,
+                              const bool smooth_fac_from_iso,
+                              Vec3_cu* output_vertices,
+                              const float* base_potential,
+                              Vec3_cu* gradient,
+                              float* smooth_factors_iso,
+                              float* smooth_factors,
+                              int* vert_to_fit,
+                              const int nb_vert_to_fit,
+                              const unsigned short nb_iter,
+                              const float gradient_threshold,
+                              const float step_length,
+                              const bool potential_pit,
+                              EAnimesh::Vert_state *vert_state,
+                              const float smooth_strength,
+                              const int slope,
+                              const bool raphson,
+                              const int2* nearest_bones,
+                              EAnimesh::Fit_stats& fit_stats);
+
+void compute_normals_cpu(const int* tri,
+                         const Mesh::PrimIdxVertices* piv,
+                         int nb_tri,
+                         const Vec3_cu* vertices,
+                         Vec3_cu* unpacked_normals,
+                         int unpack_factor,
+                         int nb_verts,
+                         Vec3_cu* out_normals);
+
+void conservative_smooth_cpu(Vec3_cu* vertices,
+                             Vec3_cu* tmp_vertices,
+                             const Vec3_cu* normals,
+                             const int* edge_list,
+                             const int* edge_list_offsets,
+                             const float* edge_mvc,
+                             const int* vert_to_fit,
+                             int nb_vert_to_fit,
+                             int nb_verts,
+                             float strength,
+                             int nb_iter,
+                             const float* smooth_fac,
+                             bool use_smooth_fac);
+
+void laplacian_smooth_cpu(Vec3_cu* vertices,
+                          Vec3_cu* tmp_vertices,
+                          const int* edge_list,
+                          const int* edge_list_offsets,
+                          int nb_verts,
+                          const float* factors,
+                          bool use_smooth_factors,
+                          float strength,
+                          int nb_iter,
+                          int nb_min_neighbours);
+
+/// Normals are recomputed at each iteration with compute_normals_cpu()
+void tangential_smooth_cpu(Vec3_cu* vertices,
+                           Vec3_cu* vertices_prealloc,
+                           Vec3_cu* normals,
+                           const int* tri,
+                           const Mesh::PrimIdxVertices* piv,
+                           int nb_tri,
+                           Vec3_cu* unpacked_normals,
+                           int unpack_factor,
+                           const int* edge_list,
+                           const int* edge_list_offsets,
+                           int nb_verts,
+                           const float* factors,
+                           bool use_smooth_factors,
+                           float strength,
+                           int nb_iter,
+                           int nb_min_neighbours);
+
+void hc_laplacian_smooth_cpu(const Vec3_cu* original_vertices,
+                             Vec3_cu* smoothed_vertices,
+                             Vec3_cu* vector_correction,
+                             Vec3_cu* tmp_vertices,
+                             const int* edge_list,
+                             const int* edge_list_offsets,
+                             int nb_verts,
+                             const float* factors,
+                             bool use_smooth_factors,
+                             float alpha,
+                             float beta,
+                             int nb_iter,
+                             int nb_min_neighbours);
+
+void diffuse_values_cpu(float* values,
+                        float* values_buffer,
+                        const int* edge_list,
+                        const int* edge_list_offsets,
+                        int nb_verts,
+                        float strength,
+                        int nb_iter);
+/// @}
+
 }// END Animesh_kers NAMESPACE =================================================
 
 #endif // ANIMESH_KERS_HPP_
@@ -11,6 +11,7 @@
 #include "timer.hpp"
 #include "cuda_current_device.hpp"
 #include "std_utils.hpp"
+#include "skeleton_env_evaluator.hpp"
 
 void Animesh::calculate_base_potential(std::vector<float> &out) const
 {
@@ -24,6 +25,18 @@ void Animesh::calculate_base_potential(std::vector<float> &out) const
     assert(d_input_vertices.ptr());
     assert(d_base_potential.ptr());
 
+    // Send pending bones and controllers changes before evaluating
+    _skel->update_bones_data();
+
+    if( Cuda_ctrl::_debug._host_evaluation )
+    {
+        std::vector<Point_cu> verts = d_input_vertices.to_host_vector();
+        out.resize( nb_verts );
+        Skeleton_env::compute_potential_cpu(_skel->get_skel_id(), verts.data(), nb_verts, out.data(), 0);
+        std::cout << "Update base potential (CPU) in " << time.stop() << " sec" << std::endl;
+        return;
+    }
+
     Cuda_utils::Device::Array<float> base_potential;
     base_potential.malloc(d_input_vertices.size());
 
@@ -198,7 +211,8 @@ void Animesh::fit_mesh(int nb_vert_to_fit,
                        bool smooth_fac_from_iso,
                        Vec3_cu* d_vertices,
                        int nb_steps,
-                       float smooth_strength)
+                       float smooth_strength,
+                       bool full_eval)
 {
     if(nb_vert_to_fit == 0) return;
 
@@ -207,6 +221,8 @@ void Animesh::fit_mesh(int nb_vert_to_fit,
     assert(d_smooth_factors_laplacian.ptr());
     assert(d_vertices_state.ptr());
 
+    const bool nearest = nearest_clusters && !full_eval && d_nearest_bones.size() > 0;
+
     const int nb_vert    = nb_vert_to_fit;
     const int block_size = 16;
     const int grid_size  = (nb_vert + block_size - 1) / block_size;
@@ -233,11 +249,75 @@ void Animesh::fit_mesh(int nb_vert_to_fit,
          d_vertices_state.ptr(),
          smooth_strength,
          Cuda_ctrl::_debug._slope_smooth_weight,
-         Cuda_ctrl::_debug._raphson);
+         Cuda_ctrl::_debug._raphson,
+         nearest ? d_nearest_bones.ptr() : 0,
+         d_fit_stats.ptr());
+
+    CUDA_CHECK_ERRORS();
+}
+
+bool Animesh::apply_warm_start()
+{
+    if( !warm_start_valid ) return false;
+
+    std::vector<Bone::Id> bone_ids;
+    std::vector<Transfo>  bone_tr;
+    Animesh_kers::bone_transfos(*_skel, bone_ids, bone_tr);
+    if( bone_ids != warm_bone_ids ||
+        Animesh_kers::is_large_pose_delta(*_skel, bone_ids, warm_bone_tr, bone_tr) )
+    {
+        warm_start_valid = false;
+        return false;
+    }
+
+    const int nb_vert    = d_input_vertices.size();
+    const int block_size = 256;
+    const int grid_size  = (nb_vert + block_size - 1) / block_size;
 
+    d_warm_bone_tr.malloc( (int)bone_tr.size() );
+    d_warm_bone_tr.copy_from( bone_tr );
+    Animesh_kers::apply_warm_start<<<grid_size, block_size>>>
+        (d_input_vertices.ptr(), d_warm_disp.ptr(), d_warm_vert_bone.ptr(),
+         d_warm_bone_tr.ptr(), nb_vert, d_output_vertices.ptr());
     CUDA_CHECK_ERRORS();
+    return true;
 }
 
+// -----------------------------------------------------------------------------
+
+void Animesh::store_warm_start()
+{
+    std::vector<Bone::Id> bone_ids;
+    Animesh_kers::bone_transfos(*_skel, bone_ids, warm_bone_tr);
+    if( bone_ids != warm_bone_ids || d_warm_vert_bone.size() == 0 )
+    {
+        std::vector<int> vert_bone;
+        Animesh_kers::nearest_bone_slots(h_nearest_bones, bone_ids, vert_bone);
+        d_warm_vert_bone.malloc( (int)vert_bone.size() );
+        d_warm_vert_bone.copy_from( vert_bone );
+        warm_bone_ids.swap( bone_ids );
+    }
+
+    std::vector<Transfo> bone_tr_inv( warm_bone_tr.size() );
+    for(unsigned i = 0; i < warm_bone_tr.size(); i++)
+        bone_tr_inv[i] = warm_bone_tr[i].fast_invert();
+
+    const int nb_vert    = d_input_vertices.size();
+    const int block_size = 256;
+    const int grid_size  = (nb_vert + block_size - 1) / block_size;
+
+    d_warm_disp.malloc( nb_vert );
+    d_warm_bone_tr.malloc( (int)bone_tr_inv.size() );
+    d_warm_bone_tr.copy_from( bone_tr_inv );
+    Animesh_kers::store_warm_start<<<grid_size, block_size>>>
+        (d_input_vertices.ptr(), d_output_vertices.ptr(), d_warm_vert_bone.ptr(),
+         d_warm_bone_tr.ptr(), nb_vert, d_warm_disp.ptr());
+    CUDA_CHECK_ERRORS();
+    warm_start_valid = true;
+}
+
+// -----------------------------------------------------------------------------
+
 void Animesh::transform_vertices()
 {
     // If the bone data needs to be updated, do it now.
@@ -248,9 +328,21 @@ void Animesh::transform_vertices()
     // XXX: This is actually Point_cu; we should probably adjust the calls below to allow using
     // that type, instead of casting Vec3_cu to Point_cu.
     Vec3_cu* out_verts    = (Vec3_cu*)d_output_vertices.ptr();
-    d_output_vertices.copy_from(d_input_vertices);
+    // Start from the SSD positions unless the last solution is close enough
+    if( !(warm_start && apply_warm_start()) )
+        d_output_vertices.copy_from(d_input_vertices);
 
     d_smooth_factors_laplacian.copy_from( d_input_smooth_factors );
+    d_fit_stats.set(0, EAnimesh::Fit_stats());
+    if(nearest_clusters)
+    {
+        std::vector<int2> nearest_bones;
+        if( Animesh_kers::nearest_bones_to_didx(*_skel, h_nearest_bones, nearest_bones_didx, nearest_bones) )
+        {
+            d_nearest_bones.malloc( (int)nearest_bones.size() );
+            d_nearest_bones.copy_from(nearest_bones);
+        }
+    }
     // d_vert_to_fit_base: a list of vertices that fit_mesh should be applied to;
     // doesn't depend on the results of skinning
     d_vert_to_fit.copy_from(d_vert_to_fit_base);
@@ -272,7 +364,7 @@ void Animesh::transform_vertices()
         {
             // Make a fitting pass over all vertices in curr that aren't -1.  curr will be updated
             // in-place, setting finished vertex indices to -1.
-            fit_mesh(nb_vert_to_fit, curr->ptr(), true/*smooth from iso*/, out_verts, 2, smooth_force_a);
+            fit_mesh(nb_vert_to_fit, curr->ptr(), true/*smooth from iso*/, out_verts, 2, smooth_force_a, false/*full eval*/);
 
             // Querying an event causes CUDA to flush the kernel queue to the GPU.  If we don't do this,
             // fit_mesh won't actually start until we do our readback in pack_vert_to_fit_gpu down below.
@@ -301,7 +393,7 @@ void Animesh::transform_vertices()
         if(nb_vert_to_fit > 0)
         {
             d_vert_to_fit.copy_from(d_vert_to_fit_base);
-            fit_mesh(nb_vert_to_fit, curr->ptr(), false/*smooth from iso*/, out_verts, nb_steps, Cuda_ctrl::_debug._smooth1_force);
+            fit_mesh(nb_vert_to_fit, curr->ptr(), false/*smooth from iso*/, out_verts, nb_steps, Cuda_ctrl::_debug._smooth1_force, false/*full eval*/);
         }
     }
 
@@ -315,13 +407,16 @@ void Animesh::transform_vertices()
     {
         // Reset d_vert_to_fit, so we always re-fit all vertices on this pass.
         curr->copy_from(d_vert_to_fit_base);
-        fit_mesh(curr->size(), curr->ptr(), false/*smooth from iso*/, out_verts, nb_steps, Cuda_ctrl::_debug._smooth2_force);
+        fit_mesh(curr->size(), curr->ptr(), false/*smooth from iso*/, out_verts, nb_steps, Cuda_ctrl::_debug._smooth2_force, true/*full eval*/);
     }
 
     // Final smoothing
     this->diffuse_attr(diffuse_smooth_weights_iter, 1.f, d_smooth_factors_laplacian.ptr());
     smooth_mesh(out_verts, d_smooth_factors_laplacian.ptr(), 2 /*Cuda_ctrl::_debug._smooth2_iter*/);
 #endif
+
+    if(warm_start)
+        store_warm_start();
 }
 
 // -----------------------------------------------------------------------------
@@ -219,6 +219,7 @@ Bone::Bone():
     _primitive.initialize();
     _world_space_transform = Transfo::identity();
     _update_sequence = 1;
+    _shape_sequence = 1;
 }
 
 Bone::~Bone() {
@@ -377,6 +378,7 @@ void Bone::set_enabled(bool value) {
 void Bone::set_hrbf_radius(float rad, const Skeleton *skeleton)
 {
     _hrbf.set_radius(rad);
+    shape_changed();
 
     if(_precomputed) {
         discard_precompute();
@@ -404,6 +406,7 @@ void Bone::precompute(const Skeleton *skeleton)
     _obbox = get_obbox_object_space(false);
 
     _precomputed = true;
+    shape_changed();
     
     // When we go to or from precomputed, update the current (HRBF or precomputed)
     // primitive's transform, since when set_world_space_matrix is called we only update
@@ -415,6 +418,33 @@ void Bone::discard_precompute()
 {
     _precomputed = false;
     _obbox_surface_cached = false;
+    shape_changed();
+}
+
+// Changes of the samples, weights or radius of our HRBF, including the ones made directly
+// through get_hrbf().
+static uint64_t hrbf_shape_sequence(const HermiteRBF& hrbf)
+{
+    const int hrbf_id = hrbf.get_id();
+    return hrbf_id > -1? HRBF_env::get_inst_shape_sequence(hrbf_id): 0;
+}
+
+uint64_t Bone::get_update_sequence() const
+{
+    // Both sequences only increase, so does their sum
+    return _update_sequence + hrbf_shape_sequence(_hrbf);
+}
+
+uint64_t Bone::get_shape_sequence() const
+{
+    return _shape_sequence + hrbf_shape_sequence(_hrbf);
+}
+
+void Bone::shape_changed()
+{
+    // Skeletons holding us need to update too.
+    _shape_sequence++;
+    _update_sequence++;
 }
 
 void Bone::set_world_space_matrix(Transfo tr)
@@ -213,12 +213,21 @@ public:
     // When a change is made to this bone that invalidates the caching performed by a Skeleton containing
     // this bone, this is incremented.  This allows Skeletons holding us to know that they need to update,
     // without us needing to have a reference to all Skeletons that are using us.
-    uint64_t get_update_sequence() const { return _update_sequence; }
+    uint64_t get_update_sequence() const;
+
+    // Like get_update_sequence(), but only incremented when the shape of the bone in object space
+    // changes (enabled state, HRBF radius, samples or weights, precomputation), not when the bone
+    // moves.  This allows caching data computed in object space, like the bounding box.  Changes
+    // made directly to get_hrbf() are included (see HRBF_env::get_inst_shape_sequence()).
+    uint64_t get_shape_sequence() const;
 
 private:
     OBBox_cu get_obbox_object_space(bool surface) const;
     void update_primitive_transform();
 
+    // Mark the object space shape of the bone as changed.
+    void shape_changed();
+
     // A globally unique bone ID.
     const Id _bone_id;
 
@@ -244,6 +253,7 @@ private:
 
     Transfo _world_space_transform;
     uint64_t _update_sequence;
+    uint64_t _shape_sequence;
 };
 
 #endif // BONE_HPP__
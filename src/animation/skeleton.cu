@@ -146,6 +146,9 @@ IBL::Ctrl_setup Skeleton::get_joint_controller(Bone::Id bone_id) const
 
 void Skeleton::update_bones_data() const
 {
+    // Controllers changed since the last evaluation are sent in one go
+    Blending_env::update_controllers_in_device();
+
     // Only update_bones_data() if we're out of date.
     bool any_bones_need_update = false;
     for(auto &it: _joints)
@@ -164,6 +167,12 @@ void Skeleton::update_bones_data() const
     Skeleton_env::update_bones_data(_skel_id);
 }
 
+Skeleton_env::Grid_stats Skeleton::get_grid_stats(const std::vector<Point_cu>& points) const
+{
+    update_bones_data();
+    return Skeleton_env::grid_stats(_skel_id, points);
+}
+
 Skeleton_env::DBone_id Skeleton::get_bone_didx(Bone::Id i) const {
     return Skeleton_env::bone_hidx_to_didx(_skel_id, i);
 }
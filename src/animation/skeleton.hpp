@@ -174,6 +174,11 @@ struct Skeleton {
   // but doesn't change the skeleton's real data; it needs to be called by const users.
   void update_bones_data() const;
 
+  /// Count how many bones are evaluated when looking up 'points' in the
+  /// acceleration structure of the skeleton.
+  /// @see Skeleton_env::grid_stats()
+  Skeleton_env::Grid_stats get_grid_stats(const std::vector<Point_cu>& points) const;
+
 private:
 
   /// Create and initilize a skeleton in the environment Skeleton_env
@@ -4,12 +4,14 @@
 #include <cstdio>
 #include <cstdlib>
 #include <deque>
+#include <set>
+#include <algorithm>
 
 #include "constants.hpp"
 #include "blending_env.hpp"
 #include "blending_lib/controller.hpp"
 #include "blending_lib/generator.hpp"
-#include "class_saver.hpp"
+#include "cache_file.hpp"
 #include "timer.hpp"
 #include "std_utils.hpp"
 
@@ -44,6 +46,21 @@ std::deque< IBL::float2* > list_controllers;
 /// Tells is the ith controller instance is used or empty
 /// h_ctrl_active[ith_ctrl_instance] = is_used
 std::deque<bool> h_ctrl_active;
+
+/// Number of controllers h_controllers and d_controllers can store
+int ctrl_capacity = 0;
+
+/// Size of h_controllers in (x, y) direction
+int2 h_controllers_size = {0, 0};
+
+/// Controllers modified in h_controllers and not yet sent to d_controllers
+std::set<Ctrl_id> h_ctrl_dirty;
+
+/// d_controllers must be reallocated and entirely uploaded
+bool d_ctrl_realloc = false;
+
+/// Uploads since the last reset_ctrl_upload_stats()
+Ctrl_upload_stats ctrl_stats;
 /// @}
 
 int nb_instances = 0;
@@ -78,27 +95,39 @@ float2* h_bulge_normals_profile = 0;
 //@{
 cudaArray* d_bulge_4D_profiles = 0;
 cudaArray* d_bulge_4D_profiles_normals = 0;
+HA_float   h_bulge_4D_profiles;
+HA_float2  h_bulge_4D_profiles_normals;
 //@}
 
 /// precomputed profile function for the 4D ricci
 //@{
 cudaArray* d_ricci_4D_profiles = 0;
 cudaArray* d_ricci_4D_profiles_normals = 0;
+HA_float   h_ricci_4D_profiles;
+HA_float2  h_ricci_4D_profiles_normals;
 //@}
 
 /// 3D Bulge in contact with parameterizable strength
 //@{
 Cuda_utils::Device::CuArray<float>   d_block_3D_bulge;
 Cuda_utils::Device::CuArray<float2>  d_block_3D_bulge_gradient;
+HA_float  h_block_3D_bulge;
+HA_float2 h_block_3D_bulge_gradient;
+int3      h_block_3D_bulge_size = {0, 0, 0};
 //@}
 
 /// 3D ricci with parameterizable N
 //@{
 Cuda_utils::Device::CuArray<float>   d_block_3D_ricci;
 Cuda_utils::Device::CuArray<float2>  d_block_3D_ricci_gradient;
+HA_float  h_block_3D_ricci;
+HA_float2 h_block_3D_ricci_gradient;
+int3      h_block_3D_ricci_size = {0, 0, 0};
 //@}
 
 cudaArray* d_global_controller = 0;
+/// Host copy of d_global_controller
+Host::Array<float2> h_global_controller;
 IBL::Ctrl_setup globale_ctrl_shape;
 const int nb_samples = NB_SAMPLES;
 
@@ -149,8 +178,9 @@ std::string get_cache_dir() {
     GetTempPath(sizeof(tmp), tmp);
     dir = tmp;
 #else
-    // This is untested.
-    dir = getenv("HOME") + "/.implicit/";
+    const char* home = getenv("HOME");
+    dir = std::string(home != 0 ? home : "/tmp") + "/.implicit/";
+    mkdir(dir.c_str(), 0755);
 #endif
 
     dir += "implicit/";
@@ -158,6 +188,36 @@ std::string get_cache_dir() {
     return dir;
 }
 
+// -----------------------------------------------------------------------------
+
+/// Every sampled array of the environment (profiles, openings, operators) is
+/// cached in a single file. The configuration lists the sampling constants:
+/// when one of them changes the whole cache is rebuilt.
+Cache_file& get_cache()
+{
+    static Cache_file* cache = 0;
+    if(cache == 0)
+    {
+        const int config[] = { NB_SAMPLES, NB_SAMPLES_OCU, NB_SAMPLES_ALPHA,
+                               NB_SAMPLES_4D_BULGE, NB_SAMPLES_MAG_4D_BULGE,
+                               MAX_TEX_LENGTH, (int)sizeof(float2) };
+        const int nb_config = sizeof(config) / sizeof(int);
+        cache = new Cache_file(get_cache_dir()+"operators.opc",
+                               std::vector<int>(config, config + nb_config));
+    }
+    return *cache;
+}
+
+// -----------------------------------------------------------------------------
+
+/// @return the key of the parameter 'param' of a cached array.
+/// @param h : key of the previous parameters
+template<class T>
+uint64_t cache_key(const T& param, uint64_t h = Cache_file::hash_seed)
+{
+    return Cache_file::hash(&param, sizeof(T), h);
+}
+
 /// @param src_vals host array to be copied. 3D values are stored linearly
 /// src_vals[x + y*width + z*width*height] = [x][y][z];
 /// @param d_dst_values device array to stores and allocate the values from host
@@ -286,17 +346,23 @@ void bind()
             CUDA_SAFE_CALL(cudaBindTexture(0, n_3D_ricci_tex, d_n_3D_ricci, sizeof(float)));
         }
 
-        profiles_ricci_4D_tex.normalized = false;
-        profiles_ricci_4D_tex.addressMode[0] = cudaAddressModeClamp;
-        profiles_ricci_4D_tex.addressMode[1] = cudaAddressModeClamp;
-        profiles_ricci_4D_tex.filterMode = cudaFilterModeLinear;
-        CUDA_SAFE_CALL(cudaBindTextureToArray(profiles_ricci_4D_tex, d_ricci_4D_profiles));
+        if(d_ricci_4D_profiles)
+        {
+            profiles_ricci_4D_tex.normalized = false;
+            profiles_ricci_4D_tex.addressMode[0] = cudaAddressModeClamp;
+            profiles_ricci_4D_tex.addressMode[1] = cudaAddressModeClamp;
+            profiles_ricci_4D_tex.filterMode = cudaFilterModeLinear;
+            CUDA_SAFE_CALL(cudaBindTextureToArray(profiles_ricci_4D_tex, d_ricci_4D_profiles));
+        }
 
-        profiles_ricci_4D_normals_tex.normalized = false;
-        profiles_ricci_4D_normals_tex.addressMode[0] = cudaAddressModeClamp;
-        profiles_ricci_4D_normals_tex.addressMode[1] = cudaAddressModeClamp;
-        profiles_ricci_4D_normals_tex.filterMode = cudaFilterModeLinear;
-        CUDA_SAFE_CALL(cudaBindTextureToArray(profiles_ricci_4D_normals_tex, d_ricci_4D_profiles_normals));
+        if(d_ricci_4D_profiles_normals)
+        {
+            profiles_ricci_4D_normals_tex.normalized = false;
+            profiles_ricci_4D_normals_tex.addressMode[0] = cudaAddressModeClamp;
+            profiles_ricci_4D_normals_tex.addressMode[1] = cudaAddressModeClamp;
+            profiles_ricci_4D_normals_tex.filterMode = cudaFilterModeLinear;
+            CUDA_SAFE_CALL(cudaBindTextureToArray(profiles_ricci_4D_normals_tex, d_ricci_4D_profiles_normals));
+        }
 
         openable_ricci_4D_tex.normalized = false;
         openable_ricci_4D_tex.addressMode[0] = cudaAddressModeClamp;
@@ -331,8 +397,8 @@ void bind()
 
 
         // Binary 3D operators -------
-        d_operators_idx_offsets.bind_tex(tex_pred_operators_idx_offsets);
-        d_operators_id.bind_tex(tex_pred_operators_id);
+        hd_operators_idx_offsets.device_array().bind_tex(tex_pred_operators_idx_offsets);
+        hd_operators_id.device_array().bind_tex(tex_pred_operators_id);
 
         tex_operators_values.normalized = false;
         tex_operators_values.addressMode[0] = cudaAddressModeClamp;
@@ -388,7 +454,8 @@ void unbind()
 
 // -----------------------------------------------------------------------------
 
-void init_3D_operator(const IBL::Profile_polar::Base& profile,
+void init_3D_operator(Op_t op_t,
+                      const IBL::Profile_polar::Base& profile,
                       const IBL::Opening::Base& opening,
                       float range,
                       const std::string filename,
@@ -398,7 +465,8 @@ void init_3D_operator(const IBL::Profile_polar::Base& profile,
 
 void init_3D_barths_circle_arc(bool use_cache)
 {
-    init_3D_operator(IBL::Profile_polar::Circle(),
+    init_3D_operator(C_L,
+                     IBL::Profile_polar::Circle(),
                      IBL::Opening::Line(),
                      1.f,
                      "barths_circle",
@@ -409,7 +477,8 @@ void init_3D_barths_circle_arc(bool use_cache)
 
 void init_3D_barths_circle_diamond(bool use_cache)
 {
-    init_3D_operator(IBL::Profile_polar::Circle(),
+    init_3D_operator(C_D,
+                     IBL::Profile_polar::Circle(),
                      IBL::Opening::Diamond(),
                      2.f,
                      "barths_circle_diamond",
@@ -428,7 +497,8 @@ void init_3D_clean_union(bool use_cache)
     typedef IBL::Opening::Discreet_hyperbola Dh;
     IBL::Opening::Discreet_hyperbola opening(Dh::OPEN_TANH);
 
-    init_3D_operator(hyperbola_curve,
+    init_3D_operator(U_OH,
+                     hyperbola_curve,
                      opening,
                      1.f,
                      "3D_clean_union",
@@ -446,7 +516,8 @@ void init_3D_bulge_in_contact(bool use_cache)
     typedef IBL::Opening::Discreet_hyperbola Dh;
     IBL::Opening::Discreet_hyperbola opening(Dh::OPEN_TANH);
 
-    init_3D_operator(bulge_curve,
+    init_3D_operator(B_OH,
+                     bulge_curve,
                      opening,
                      1.f,
                      "3D_bulge_in_contact",
@@ -460,7 +531,8 @@ void init_circle_hyperbola_open(bool use_cache)
     typedef IBL::Opening::Discreet_hyperbola Dh;
     IBL::Opening::Discreet_hyperbola opening(Dh::OPEN_TANH);
 
-    init_3D_operator(IBL::Profile_polar::Circle(),
+    init_3D_operator(C_OH,
+                     IBL::Profile_polar::Circle(),
                      opening,
                      2.f,
                      "circle_hyperbola_open",
@@ -473,7 +545,8 @@ void init_circle_hyperbola_closed_h(bool use_cache)
 {
     typedef IBL::Opening::Discreet_hyperbola Dh;
 
-    init_3D_operator(IBL::Profile_polar::Circle(),
+    init_3D_operator(C_HCH,
+                     IBL::Profile_polar::Circle(),
                      Dh(Dh::CLOSED_HERMITE),
                      2.f,
                      "circle_hyperbola_closed_h",
@@ -486,7 +559,8 @@ void init_circle_hyperbola_closed_t(bool use_cache)
 {
     typedef IBL::Opening::Discreet_hyperbola Dh;
 
-    init_3D_operator(IBL::Profile_polar::Circle(),
+    init_3D_operator(C_TCH,
+                     IBL::Profile_polar::Circle(),
                      Dh(Dh::CLOSED_TANH),
                      2.f,
                      "circle_hyperbola_closed_t",
@@ -499,7 +573,8 @@ void init_ultimate_hyperbola_closed_h(bool use_cache)
 {
     typedef IBL::Opening::Discreet_hyperbola Dh;
 
-    init_3D_operator(IBL::Profile_polar::Discreet(h_hyperbola_profile,
+    init_3D_operator(U_HCH,
+                     IBL::Profile_polar::Discreet(h_hyperbola_profile,
                                                   (IBL::float2*)h_hyperbola_normals_profile,
                                                   NB_SAMPLES),
                      Dh(Dh::CLOSED_HERMITE),
@@ -514,7 +589,8 @@ void init_ultimate_hyperbola_closed_t(bool use_cache)
 {
     typedef IBL::Opening::Discreet_hyperbola Dh;
 
-    init_3D_operator(IBL::Profile_polar::Discreet(h_hyperbola_profile,
+    init_3D_operator(U_TCH,
+                     IBL::Profile_polar::Discreet(h_hyperbola_profile,
                                                   (IBL::float2*)h_hyperbola_normals_profile,
                                                   NB_SAMPLES),
                      Dh(Dh::CLOSED_TANH),
@@ -529,7 +605,8 @@ void init_bulge_hyperbola_closed_h(bool use_cache)
 {
     typedef IBL::Opening::Discreet_hyperbola Dh;
 
-    init_3D_operator(IBL::Profile_polar::Discreet(h_bulge_profile,
+    init_3D_operator(B_HCH,
+                     IBL::Profile_polar::Discreet(h_bulge_profile,
                                                   (IBL::float2*)h_bulge_normals_profile,
                                                   NB_SAMPLES),
                      Dh(Dh::CLOSED_HERMITE),
@@ -544,7 +621,8 @@ void init_bulge_hyperbola_closed_t(bool use_cache)
 {
     typedef IBL::Opening::Discreet_hyperbola Dh;
 
-    init_3D_operator(IBL::Profile_polar::Discreet(h_bulge_profile,
+    init_3D_operator(B_TCH,
+                     IBL::Profile_polar::Discreet(h_bulge_profile,
                                                   (IBL::float2*)h_bulge_normals_profile,
                                                   NB_SAMPLES),
                      Dh(Dh::CLOSED_TANH),
@@ -559,7 +637,8 @@ void init_bulge_skinning_closed_t(bool use_cache)
 {
     typedef IBL::Opening::Diamond Dia;
 
-    init_3D_operator(IBL::Profile_polar::Discreet(h_bulge_profile,
+    init_3D_operator(B_D,
+                     IBL::Profile_polar::Discreet(h_bulge_profile,
                                                   (IBL::float2*)h_bulge_normals_profile,
                                                   NB_SAMPLES),
                      Dia(0.55f),
@@ -701,12 +780,13 @@ void init_4D_ricci(bool use_cache)
     HA_float  h_block_vals (block_len, 0.f                   );
     HA_float2 h_block_grads(block_len, make_float2(0.f, 0.f) );
 
+    const uint64_t key = cache_key(nb_grids, cache_key(block_size));
     bool s = use_cache;
 
     if(use_cache)
     {
-        s = s && read_array(h_block_vals.ptr() , block_len, get_cache_dir()+"/4D_ricci_vals.opc"  );
-        s = s && read_array(h_block_grads.ptr(), block_len, get_cache_dir()+"/4D_ricci_grads.opc" );
+        s = s && get_cache().read("4D_ricci_vals" , key, h_block_vals.ptr() , block_len);
+        s = s && get_cache().read("4D_ricci_grads", key, h_block_grads.ptr(), block_len);
     }
 
     HA_float  h_ricci_profiles      ((NB_SAMPLES+2)*nb_grids, 0.f);
@@ -767,8 +847,8 @@ void init_4D_ricci(bool use_cache)
 
     if(!s)
     {
-        write_array(h_block_vals.ptr() , block_len, get_cache_dir()+"/4D_ricci_vals.opc"  );
-        write_array(h_block_grads.ptr(), block_len, get_cache_dir()+"/4D_ricci_grads.opc" );
+        get_cache().set("4D_ricci_vals" , key, h_block_vals.ptr() , block_len);
+        get_cache().set("4D_ricci_grads", key, h_block_grads.ptr(), block_len);
     }
 
     d_block_3D_ricci.malloc(block_size.x, block_size.y, block_size.z);
@@ -779,6 +859,13 @@ void init_4D_ricci(bool use_cache)
 
     allocate_and_copy_1D_array((NB_SAMPLES+2)*nb_grids, h_ricci_profiles.ptr()      , d_ricci_4D_profiles        );
     allocate_and_copy_1D_array((NB_SAMPLES+2)*nb_grids, h_ricci_profiles_grads.ptr(), d_ricci_4D_profiles_normals);
+
+    // Keep the host copies for openable_ricci_4D_fetch() and co.
+    h_block_3D_ricci.swap( h_block_vals );
+    h_block_3D_ricci_gradient.swap( h_block_grads );
+    h_block_3D_ricci_size = block_size;
+    h_ricci_4D_profiles.swap( h_ricci_profiles );
+    h_ricci_4D_profiles_normals.swap( h_ricci_profiles_grads );
 }
 #endif
 
@@ -820,12 +907,13 @@ void init_4D_bulge_in_contact(bool use_cache)
     HA_float  h_block_vals (block_len, 0.f                   );
     HA_float2 h_block_grads(block_len, make_float2(0.f, 0.f) );
 
+    const uint64_t key = cache_key(nb_grids, cache_key(block_size));
     bool s = use_cache;
 
     if(use_cache)
     {
-        s = s && read_array(h_block_vals.ptr() , block_len, get_cache_dir()+"/4D_bulge_vals.opc"  );
-        s = s && read_array(h_block_grads.ptr(), block_len, get_cache_dir()+"/4D_bulge_grads.opc" );
+        s = s && get_cache().read("4D_bulge_vals" , key, h_block_vals.ptr() , block_len);
+        s = s && get_cache().read("4D_bulge_grads", key, h_block_grads.ptr(), block_len);
     }
 
     HA_float  h_bulge_profiles      ((NB_SAMPLES+2)*nb_grids, 0.f);
@@ -885,8 +973,8 @@ void init_4D_bulge_in_contact(bool use_cache)
 
     if(!s)
     {
-        write_array(h_block_vals.ptr() , block_len, get_cache_dir()+"/4D_bulge_vals.opc"  );
-        write_array(h_block_grads.ptr(), block_len, get_cache_dir()+"/4D_bulge_grads.opc" );
+        get_cache().set("4D_bulge_vals" , key, h_block_vals.ptr() , block_len);
+        get_cache().set("4D_bulge_grads", key, h_block_grads.ptr(), block_len);
     }
 
     d_block_3D_bulge.malloc(block_size.x, block_size.y, block_size.z);
@@ -897,6 +985,13 @@ void init_4D_bulge_in_contact(bool use_cache)
 
     allocate_and_copy_1D_array((NB_SAMPLES+2)*nb_grids, h_bulge_profiles.ptr()      , d_bulge_4D_profiles        );
     allocate_and_copy_1D_array((NB_SAMPLES+2)*nb_grids, h_bulge_profiles_grads.ptr(), d_bulge_4D_profiles_normals);
+
+    // Keep the host copies for openable_bulge_4D_fetch() and co.
+    h_block_3D_bulge.swap( h_block_vals );
+    h_block_3D_bulge_gradient.swap( h_block_grads );
+    h_block_3D_bulge_size = block_size;
+    h_bulge_4D_profiles.swap( h_bulge_profiles );
+    h_bulge_4D_profiles_normals.swap( h_bulge_profiles_grads );
 }
 
 // -----------------------------------------------------------------------------
@@ -912,18 +1007,21 @@ void init_profile_hyperbola(bool use_cache)
     float*       h_vals    = 0;
     IBL::float2* h_grads = 0;
 
+    const uint64_t key = cache_key(len);
     bool s = use_cache;
 
     if(use_cache)
     {
         h_vals  = new float      [len];
         h_grads = new IBL::float2[len];
-        s = s && read_array(h_vals , len, get_cache_dir()+"/profile_hyperbola_vals.opc"  );
-        s = s && read_array(h_grads, len, get_cache_dir()+"/profile_hyperbola_grads.opc" );
+        s = s && get_cache().read("profile_hyperbola_vals" , key, h_vals , len);
+        s = s && get_cache().read("profile_hyperbola_grads", key, h_grads, len);
     }
 
     if(!s)
     {
+        delete[] h_vals;
+        delete[] h_grads;
         IBL::Profile_polar::Discreet hyperbola_curve;
 
         // Profile is not cached we compute it:
@@ -934,8 +1032,8 @@ void init_profile_hyperbola(bool use_cache)
         h_vals  = hyperbola_curve.get_vals();
         h_grads = hyperbola_curve.get_grads();
         // And save it
-        write_array(h_vals , len, get_cache_dir()+"/profile_hyperbola_vals.opc"  );
-        write_array(h_grads, len, get_cache_dir()+"/profile_hyperbola_grads.opc" );
+        get_cache().set("profile_hyperbola_vals" , key, h_vals , len);
+        get_cache().set("profile_hyperbola_grads", key, h_grads, len);
 
     }
 
@@ -959,18 +1057,21 @@ void init_profile_bulge(bool use_cache)
     float*       h_vals  = 0;
     IBL::float2* h_grads = 0;
 
+    const uint64_t key = cache_key(h_magnitude_3D_bulge, cache_key(len));
     bool s = use_cache;
 
     if(use_cache)
     {
         h_vals  = new float      [len];
         h_grads = new IBL::float2[len];
-        s = s && read_array(h_vals , len, get_cache_dir()+"/profile_bulge_vals.opc"  );
-        s = s && read_array(h_grads, len, get_cache_dir()+"/profile_bulge_grads.opc" );
+        s = s && get_cache().read("profile_bulge_vals" , key, h_vals , len);
+        s = s && get_cache().read("profile_bulge_grads", key, h_grads, len);
     }
 
     if(!s)
     {
+        delete[] h_vals;
+        delete[] h_grads;
         IBL::Profile_polar::Discreet bulge_curve;
         // Profile is not cached we compute it:
         IBL::gen_polar_profile(bulge_curve,
@@ -980,8 +1081,8 @@ void init_profile_bulge(bool use_cache)
         h_vals  = bulge_curve.get_vals();
         h_grads = bulge_curve.get_grads();
         // And save it
-        write_array(h_vals , len, get_cache_dir()+"/profile_bulge_vals.opc"  );
-        write_array(h_grads, len, get_cache_dir()+"/profile_bulge_grads.opc" );
+        get_cache().set("profile_bulge_vals" , key, h_vals , len);
+        get_cache().set("profile_bulge_grads", key, h_grads, len);
 
     }
 
@@ -998,14 +1099,17 @@ void init_opening_hyperbola(bool use_cache)
 {
     assert(!binded);
     int len = IBL::Opening::Pan_hf::_nb_samples;
+    // pan_hyperbola_fetch() samples it as NB_SAMPLES elements
+    assert(len == NB_SAMPLES);
 
     delete[] pan_hyperbola;
 
+    const uint64_t key = cache_key(len);
     bool s = use_cache;
 
     if(use_cache){
         pan_hyperbola = new float[len];
-        s = s && read_array(pan_hyperbola, len, get_cache_dir()+"/opening_hyperbola_vals.opc");
+        s = s && get_cache().read("opening_hyperbola_vals", key, pan_hyperbola, len);
     }
 
 
@@ -1016,13 +1120,13 @@ void init_opening_hyperbola(bool use_cache)
         // opening is not cached we compute it:
 
         IBL::Opening::Pan_hf::init_samples();
-        delete pan_hyperbola;
+        delete[] pan_hyperbola;
         pan_hyperbola = new float[len];
         for(int i = 0; i < len; ++i)
             pan_hyperbola[i] = IBL::Opening::Pan_hf::_vals[i];
 
         // And save it
-        write_array(pan_hyperbola, len, get_cache_dir()+"/opening_hyperbola_vals.opc");
+        get_cache().set("opening_hyperbola_vals", key, pan_hyperbola, len);
     }
 
     allocate_and_copy_1D_array(len, pan_hyperbola, d_pan_hyperbola);
@@ -1037,6 +1141,8 @@ void init_global_controller()
     globale_ctrl_shape = IBL::Shape::elbow();
     IBL::gen_controller(NB_SAMPLES, globale_ctrl_shape, controller);
     allocate_and_copy_1D_array(NB_SAMPLES, (float2*)controller, d_global_controller);
+    h_global_controller.malloc(NB_SAMPLES);
+    mem_cpy_hth(h_global_controller.ptr(), (float2*)controller, NB_SAMPLES);
     delete[] controller;
 }
 
@@ -1063,7 +1169,8 @@ void update_3D_bulge()
 
     std::cout << "update samples \n..." << std::endl;
     init_profile_bulge(false);
-    init_3D_bulge_in_contact(false);
+    if( get_predefined_op_id(B_OH) >= 0 )
+        init_3D_bulge_in_contact(false);
 
     bind();
 }
@@ -1092,15 +1199,14 @@ static void d_controllers_copy_from(const Cuda_utils::Host::Array<float2>& h_a,
 
 // -----------------------------------------------------------------------------
 
-/// @return the size of the block in (x,y) direction given the current number of
+/// @return the size of the block in (x,y) direction to store 'nb_ctrl'
 /// controllers
-static int2 ctrl_max_size_2D()
+static int2 ctrl_size_2D(int nb_ctrl)
 {
-    int nb_ctrl = list_controllers.size() - 1;
-
-    if(nb_ctrl < 0) return make_int2(0, 0);
+    if(nb_ctrl <= 0) return make_int2(0, 0);
 
-    int2 bidx_2D = { nb_ctrl % BLOCK_CTRL_LX, nb_ctrl / BLOCK_CTRL_LX };
+    int last = nb_ctrl - 1;
+    int2 bidx_2D = { last % BLOCK_CTRL_LX, last / BLOCK_CTRL_LX };
     int2 s = { (bidx_2D.y == 0) ? ((bidx_2D.x+1) * GRID_CTRL_LX) : (BLOCK_CTRL_LX*GRID_CTRL_LX),
                (bidx_2D.y+1) * GRID_CTRL_LY};
 
@@ -1119,57 +1225,98 @@ static int2 ctrl_1DIdx_to_2DIdx(int id)
 
 // -----------------------------------------------------------------------------
 
-/// copy the 2D list of controllers 'list' in the flat representation and device
-/// memory.
-void update_ctrl_in_device()
+/// copy the controller 'list_controllers[id]' and its padding in the flat
+/// representation 'h_controllers'
+static void ctrl_copy_to_host(Ctrl_id id)
 {
-    assert(!binded);
-    int2 gsize2D = ctrl_max_size_2D();
+    float2* ctrl = (float2*)list_controllers[id];
+
+    // Nothing to copy we skip
+    if(ctrl == 0) return;
+
+    const int width = h_controllers_size.x;
+    int2 bidx_2D = ctrl_1DIdx_to_2DIdx( id );
+    int2 gidx_2D = {bidx_2D.x * GRID_CTRL_LX, bidx_2D.y * GRID_CTRL_LY };
+
+    for(int i = 0; i < SIZE_CONTROLLER; i++)
+    {
+        // Pad start and end with the extremities
+        float2 val = ctrl[ std::min(std::max(i-1, 0), NB_SAMPLES-1) ];
+        for(int j = 0; j < GRID_CTRL_LY; j++)
+            h_controllers[(gidx_2D.x + i) + (gidx_2D.y + j) * width] = val;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Reallocate 'h_controllers' to store 'capacity' controllers and copy back
+/// every controllers of 'list_controllers'. The width of the 2D array depends
+/// on the capacity so the whole array is uploaded by the next
+/// update_controllers_in_device().
+static void ctrl_resize(int capacity)
+{
+    ctrl_capacity = capacity;
+    int2 gsize2D = ctrl_size_2D(capacity);
     h_controllers.malloc( gsize2D.x * gsize2D.y );
-    d_controllers_malloc( gsize2D               );
+    h_controllers_size = gsize2D;
 
-    // Do the copy of 'list_controllers' into the flatten array 'h_controllers'
-    const int width = gsize2D.x;
     for(unsigned i = 0; i < list_controllers.size(); i++)
-    {
-        float2* ctrl = (float2*)list_controllers[i];
+        ctrl_copy_to_host( i );
 
-        // Nothing to copy we skip
-        if(ctrl == 0) continue;
+    h_ctrl_dirty.clear();
+    d_ctrl_realloc = true;
+}
 
-        int2 bidx_2D = ctrl_1DIdx_to_2DIdx( i );
-        int2 gidx_2D = {bidx_2D.x * GRID_CTRL_LX, bidx_2D.y * GRID_CTRL_LY };
+// -----------------------------------------------------------------------------
 
-        for(int j = 0; j < NB_SAMPLES; j++)
+void update_controllers_in_device()
+{
+    if( d_ctrl_realloc )
+    {
+        // The texture must be bound to the new array
+        Blending_env::unbind();
+        int2 gsize2D = ctrl_size_2D(ctrl_capacity);
+        d_controllers_malloc   ( gsize2D                );
+        d_controllers_copy_from( h_controllers, gsize2D );
+        Blending_env::bind();
+
+        ctrl_stats.nb_bytes += sizeof(float2) * gsize2D.x * gsize2D.y;
+        ctrl_stats.nb_full_uploads++;
+    }
+    else if( !h_ctrl_dirty.empty() )
+    {
+        // Only the grid of each modified controller is sent
+        const int width = ctrl_size_2D(ctrl_capacity).x;
+        const int2 grid_size = { GRID_CTRL_LX, GRID_CTRL_LY };
+        std::set<Ctrl_id>::const_iterator it = h_ctrl_dirty.begin();
+        for(; it != h_ctrl_dirty.end(); ++it)
         {
-            int row0_idx = (gidx_2D.x + j + 1) + (gidx_2D.y  ) * width;
-            int row1_idx = (gidx_2D.x + j + 1) + (gidx_2D.y+1) * width;
-            int row2_idx = (gidx_2D.x + j + 1) + (gidx_2D.y+2) * width;
-
-            float2 val = ctrl[j];
-            h_controllers[row0_idx] = val;
-            h_controllers[row1_idx] = val;
-            h_controllers[row2_idx] = val;
-        }
+            int2 bidx_2D = ctrl_1DIdx_to_2DIdx( *it );
+            int2 gidx_2D = {bidx_2D.x * GRID_CTRL_LX, bidx_2D.y * GRID_CTRL_LY };
+            const float2* grid = h_controllers.ptr() + gidx_2D.x + gidx_2D.y * width;
+            mem_cpy_2D_htd(d_controllers, gidx_2D, grid, width, grid_size);
 
-        // Copy extremities
-        int row0_idx = (gidx_2D.x) + (gidx_2D.y  ) * width;
-        int row1_idx = (gidx_2D.x) + (gidx_2D.y+1) * width;
-        int row2_idx = (gidx_2D.x) + (gidx_2D.y+2) * width;
-        float2 val = ctrl[0];
-        // Pad start
-        h_controllers[row0_idx] = val;
-        h_controllers[row1_idx] = val;
-        h_controllers[row2_idx] = val;
-
-        // Pad end
-        val = ctrl[NB_SAMPLES-1];
-        h_controllers[row0_idx+NB_SAMPLES+1] = val;
-        h_controllers[row1_idx+NB_SAMPLES+1] = val;
-        h_controllers[row2_idx+NB_SAMPLES+1] = val;
+            ctrl_stats.nb_bytes += sizeof(float2) * GRID_CTRL_LX * GRID_CTRL_LY;
+            ctrl_stats.nb_grids++;
+        }
     }
-    // Update the device array
-    d_controllers_copy_from(h_controllers, gsize2D);
+
+    h_ctrl_dirty.clear();
+    d_ctrl_realloc = false;
+}
+
+// -----------------------------------------------------------------------------
+
+Ctrl_upload_stats get_ctrl_upload_stats()
+{
+    return ctrl_stats;
+}
+
+// -----------------------------------------------------------------------------
+
+void reset_ctrl_upload_stats()
+{
+    ctrl_stats = Ctrl_upload_stats();
 }
 
 // -----------------------------------------------------------------------------
@@ -1178,8 +1325,6 @@ Ctrl_id new_ctrl_instance()
 {
     assert(nb_instances >= 0);
 
-    Blending_env::unbind();
-
     // find the first free element
     int idx = 0;
     for(; idx < (int)h_ctrl_active.size(); idx++)
@@ -1191,14 +1336,20 @@ Ctrl_id new_ctrl_instance()
     {
         list_controllers.push_back(0);
         h_ctrl_active.push_back( true );
-        // Increase memory and recopy values from 'list_controllers'
-        update_ctrl_in_device();
+
+        // Grow geometrically so that adding instances one by one doesn't
+        // reallocate and upload every controllers each time
+        if(idx >= ctrl_capacity)
+        {
+            const int max_ctrl = BLOCK_CTRL_LX * BLOCK_CTRL_LY;
+            assert(idx < max_ctrl);
+            ctrl_resize( std::min(std::max(ctrl_capacity * 2, 8), max_ctrl) );
+        }
     }
 
     h_ctrl_active[idx] = true;
     nb_instances++;
 
-    Blending_env::bind();
     return idx;
 }
 
@@ -1220,37 +1371,20 @@ void delete_ctrl_instance(Ctrl_id inst_id)
     assert(nb_instances > 0);
 
     // Deleted controller instances are tagged in order to
-    // re-use the element for a new instance later
+    // re-use the element for a new instance later. Memory space of
+    // h_controllers and d_controllers is kept for later use.
     h_ctrl_active[inst_id] = false;
-
-    if(inst_id != (int)(h_ctrl_active.size()-1))
-    {
-        // The instance is not in the end of the list we keep memory space of
-        // h_controllers and d_controllers for later use.
-        nb_instances--;
-        delete[] list_controllers[inst_id];
-        list_controllers[inst_id] = 0;
-        return;
-    }
-
-    // Instance is at the end we erase what is necessary :
-    Blending_env::unbind();
+    nb_instances--;
+    delete[] list_controllers[inst_id];
+    list_controllers[inst_id] = 0;
+    h_ctrl_dirty.erase(inst_id);
 
     // Scan for every deleted instances at the top of the list
-    int idx = h_ctrl_active.size()-1;
-    while(h_ctrl_active[idx] == false)
+    while(!h_ctrl_active.empty() && !h_ctrl_active.back())
     {
-        delete[] list_controllers[idx];
         list_controllers.pop_back();
         h_ctrl_active.pop_back();
-
-        idx--;
-        if(idx < 0) break;
     }
-
-    update_ctrl_in_device();
-
-    Blending_env::bind();
 }
 
 // -----------------------------------------------------------------------------
@@ -1261,41 +1395,16 @@ void update_controller(Ctrl_id inst_id, const IBL::Ctrl_setup& shape)
     assert(inst_id >= 0);
     assert(h_ctrl_active[inst_id]);
     assert(nb_instances > 0);
-    Blending_env::unbind();
-
-    int2 bidx_2D = {inst_id % BLOCK_CTRL_LX , inst_id / BLOCK_CTRL_LX  };
-    int2 gidx_2D = {bidx_2D.x * GRID_CTRL_LX, bidx_2D.y * GRID_CTRL_LY };
-    int2 gsize2D = ctrl_max_size_2D();
-
-    const int width = gsize2D.x;
 
     IBL::float2* controller = 0;
     IBL::gen_controller(NB_SAMPLES, shape, controller);
 
-    int off = (gidx_2D.x+ 1/*padding*/) + (gidx_2D.y+1/*write values in the midlle*/) * width;
-
-    Cuda_utils::mem_cpy_hth((IBL::float2*)(h_controllers.ptr()+off), controller, NB_SAMPLES);
-
     delete[] list_controllers[inst_id];
     list_controllers[inst_id] = controller;
 
-    // Padd values :
-    h_controllers[off-1           ] = h_controllers[off           ];
-    h_controllers[off+NB_SAMPLES+1] = h_controllers[off+NB_SAMPLES];
-
-    for(int i = 0; i < (NB_SAMPLES+2/*Padding*/); i++)
-    {
-        int row0_idx = (gidx_2D.x + i) + (gidx_2D.y  ) * width;
-        int row1_idx = (gidx_2D.x + i) + (gidx_2D.y+1) * width;
-        int row2_idx = (gidx_2D.x + i) + (gidx_2D.y+2) * width;
-
-        float2 val = h_controllers[row1_idx];
-        h_controllers[row0_idx] = val;
-        h_controllers[row2_idx] = val;
-    }
-
-    d_controllers_copy_from(h_controllers, gsize2D);
-    Blending_env::bind();
+    ctrl_copy_to_host( inst_id );
+    // Sent to the GPU by the next update_controllers_in_device()
+    h_ctrl_dirty.insert( inst_id );
 }
 
 // -----------------------------------------------------------------------------
@@ -1333,13 +1442,13 @@ Grid3_cu<float2>* grid_operators_grads  = 0;
 /// in 'd_operators_xxx' or 'grid_operators_xxx'
 /// @{
 std::vector<Idx3_cu> h_operators_idx_offsets;
-Cuda_utils::Device::Array<int4> d_operators_idx_offsets; // GPU mem
+Cuda_utils::HD_Array<int4> hd_operators_idx_offsets; // indexed by Op_id
 /// @}
 
 /// maps operators types to their identifier.
 // TODO this maps only a sub part of operators type it should map everything
 // and with id=-1 for operators types which doesn't exists.
-Cuda_utils::Device::Array<Op_id> d_operators_id;
+Cuda_utils::HD_Array<Op_id> hd_operators_id;
 
 /// predefined operators grids
 std::vector< Grid3_cu<float>*  > h_operators_values;
@@ -1366,143 +1475,124 @@ void allocate_and_copy_3D_array(Grid3_cu<T>* grid_data,
 
 // -----------------------------------------------------------------------------
 
-void init_3D_operator(const IBL::Profile_polar::Base& profile,
+/// @return the key of the operator built from 'profile' and 'opening'. It's
+/// computed from both functions evaluated on a coarse grid so a change of their
+/// parameters (e.g. the bulge magnitude) invalidates the cached operator.
+uint64_t operator_key(const IBL::Profile_polar::Base& profile,
+                      const IBL::Opening::Base& opening,
+                      float range)
+{
+    const int n = 32;
+    uint64_t key = cache_key(range);
+    for(int i = 0; i < n; i++)
+    {
+        const float tan_alpha = (float)i / (float)(n-1);
+        key = cache_key(profile.f(tan_alpha), key);
+        for(int j = 0; j < n; j++)
+            key = cache_key(opening.f(range * (float)j / (float)(n-1), tan_alpha), key);
+    }
+    return key;
+}
+
+// -----------------------------------------------------------------------------
+
+void init_3D_operator(Op_t op_t,
+                      const IBL::Profile_polar::Base& profile,
                       const IBL::Opening::Base& opening,
                       float range,
                       const std::string filename,
                       bool use_cache)
 {
-    float*       h_vals  = 0;
-    IBL::float2* h_grads = 0;
+    const int len = (NB_SAMPLES_OCU+2)*(NB_SAMPLES_OCU+2)*(NB_SAMPLES_ALPHA+2);
+    const uint64_t key = operator_key(profile, opening, range);
 
-    int len = (NB_SAMPLES_OCU+2)*(NB_SAMPLES_OCU+2)*(NB_SAMPLES_ALPHA+2);
-    bool s = use_cache;
-    Vec3i_cu size(NB_SAMPLES_OCU, NB_SAMPLES_OCU, NB_SAMPLES_ALPHA);
-    Vec3i_cu pad_off(0, 0, 0);
-    if(use_cache)
+    const float*  cached_vals  = 0;
+    const float2* cached_grads = 0;
+    if(use_cache && filename.size() > 0)
     {
-        // Operator must be cached => get it (already padded)
-        h_vals  = new float      [len];
-        h_grads = new IBL::float2[len];
-        s = s && read_array(h_vals , len, get_cache_dir()+"/"+filename+"_vals.opc"  );
-        s = s && read_array(h_grads, len, get_cache_dir()+"/"+filename+"_grads.opc" );
+        cached_vals  = get_cache().get<float >(filename+"_vals" , key, len);
+        cached_grads = get_cache().get<float2>(filename+"_grads", key, len);
     }
 
-    if(!s)
+    Grid3_cu<float >* grid_vals  = 0;
+    Grid3_cu<float2>* grid_grads = 0;
+    if(cached_vals != 0 && cached_grads != 0)
+    {
+        // Operator is cached => fill the grids straight from the mapped file
+        // (already padded)
+        Vec3i_cu size(NB_SAMPLES_OCU+2, NB_SAMPLES_OCU+2, NB_SAMPLES_ALPHA+2);
+        grid_vals  = new Grid3_cu<float >(size, cached_vals , PADDING_OFFSET);
+        grid_grads = new Grid3_cu<float2>(size, cached_grads, PADDING_OFFSET);
+    }
+    else
     {
         // Operator is not cached => compute it
+        float*       h_vals  = 0;
+        IBL::float2* h_grads = 0;
+        Timer t;
+        t.start();
         IBL::gen_custom_operator(profile,
                                  opening,
                                  range,
                                  NB_SAMPLES_OCU, NB_SAMPLES_ALPHA ,
                                  h_vals, h_grads);
-    }
-    else {
-        // as already padded
-        size += Vec3i_cu(2, 2, 2);
-        pad_off = PADDING_OFFSET;
-    }
+        std::cout << "Generated operator " << filename << " in " << t.stop() << " sec" << std::endl;
 
-    // store into new grids
-    Grid3_cu<float >* grid_vals  = new Grid3_cu<float >(size, h_vals          , pad_off);
-    Grid3_cu<float2>* grid_grads = new Grid3_cu<float2>(size, (float2*)h_grads, pad_off);
+        Vec3i_cu size(NB_SAMPLES_OCU, NB_SAMPLES_OCU, NB_SAMPLES_ALPHA);
+        grid_vals  = new Grid3_cu<float >(size, h_vals          );
+        grid_grads = new Grid3_cu<float2>(size, (float2*)h_grads);
+        delete[] h_vals;
+        delete[] h_grads;
 
-    // if not cached : padd it as concatenation won't and save it padded
-    if( !s)
-    {
-        // padd it as concatenation won't
+        // padd it as concatenation won't and save it padded
         grid_vals-> padd( Vec3i_cu(PADDING, PADDING, PADDING) );
         grid_grads->padd( Vec3i_cu(PADDING, PADDING, PADDING) );
         if ( filename.size() > 0 ){
-            write_array(grid_vals->get_vals().data(), len, get_cache_dir()+"/"+filename+"_vals.opc"  );
-            write_array(grid_grads->get_vals().data(), len, get_cache_dir()+"/"+filename+"_grads.opc" );
+            get_cache().set(filename+"_vals" , key, grid_vals ->get_vals().data(), len);
+            get_cache().set(filename+"_grads", key, grid_grads->get_vals().data(), len);
         }
     }
 
-    // record the new operator
-    h_operators_values.push_back( grid_vals  );
-    h_operators_grads. push_back( grid_grads );
-
-    delete[] h_vals;
-    delete[] h_grads;
+    // record the new operator in its slot
+    const int i = op_t - BINARY_3D_OPERATOR_BEGIN - 1;
+    assert( i >= 0 && i < (int)h_operators_values.size() );
+    delete h_operators_values[i];
+    delete h_operators_grads [i];
+    h_operators_values[i] = grid_vals;
+    h_operators_grads [i] = grid_grads;
 }
 
 // -----------------------------------------------------------------------------
 
+typedef void (*Init_operator)(bool use_cache);
+
+/// Functions generating the predefined 3D operators in the order of Op_t
+const Init_operator init_predefined[NB_PRED_OPS] = {
+    init_3D_barths_circle_arc,        // C_L
+    init_3D_barths_circle_diamond,    // C_D
+    init_circle_hyperbola_open,       // C_OH
+    init_circle_hyperbola_closed_h,   // C_HCH
+    init_circle_hyperbola_closed_t,   // C_TCH
+    init_3D_clean_union,              // U_OH
+    init_ultimate_hyperbola_closed_h, // U_HCH
+    init_ultimate_hyperbola_closed_t, // U_TCH
+    init_3D_bulge_in_contact,         // B_OH
+    init_bulge_hyperbola_closed_h,    // B_HCH
+    init_bulge_hyperbola_closed_t,    // B_TCH
+    init_bulge_skinning_closed_t      // B_D
+};
+
+// -----------------------------------------------------------------------------
+
+/// Load the enabled predefined operators, the others are left to NULL until
+/// load_predefined_operator() is called
 void load_3d_predefined(bool use_cache = true)
 {
-    if ( h_operators_enabling[0] ) {
-        init_3D_barths_circle_arc(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[1] ) {
-        init_3D_barths_circle_diamond(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[2] ) {
-        init_circle_hyperbola_open(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[3] ) {
-        init_circle_hyperbola_closed_h(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[4] ) {
-        init_circle_hyperbola_closed_t(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[5] ) {
-        init_3D_clean_union(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[6] ) {
-        init_ultimate_hyperbola_closed_h(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[7] ) {
-        init_ultimate_hyperbola_closed_t(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[8] ) {
-        init_3D_bulge_in_contact(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[9] ) {
-        init_bulge_hyperbola_closed_h(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[10] ) {
-        init_bulge_hyperbola_closed_t(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
-    if ( h_operators_enabling[11] ) {
-        init_bulge_skinning_closed_t(use_cache);
-    } else {
-        h_operators_values.push_back(0);
-        h_operators_grads.push_back(0);
-    }
+    h_operators_values.resize(NB_PRED_OPS, 0);
+    h_operators_grads. resize(NB_PRED_OPS, 0);
+    for(int i = 0; i < NB_PRED_OPS; ++i)
+        if( h_operators_enabling[i] )
+            init_predefined[i](use_cache);
 }
 
 // -----------------------------------------------------------------------------
@@ -1528,21 +1618,20 @@ void init_env()
     init_opening_hyperbola(use_cache);
     std::cout << "Done in " << t.stop() << " sec" << std::endl;
 
+    // Bones of a cluster always blend with BulgeFreeBlending (see
+    // Skeleton_env::Blend_func::Cluster) which samples U_OH
+    enable_predefined_operator(U_OH, true);
+
+    t.start();
     std::cout << "init 3D operators" << std::endl;
     load_3d_predefined(use_cache);
     std::cout << "Done in " << t.stop() << " sec" << std::endl;
 
-    // todo with new env archi
-    std::cout << "init 4D operators" << std::endl;
-    std::cout << "init 4D bulge" << std::endl;
-    t.start();
-    init_4D_bulge_in_contact(use_cache);
-    std::cout << "Done in " << t.stop() << " sec" << std::endl;
-    t.start();
-    std::cout << "init 4D ricci" << std::endl;
-    init_4D_ricci(use_cache);
-    std::cout << "Done in " << t.stop() << " sec" << std::endl;
-    std::cout << "end 4D operators" << std::endl;
+    // 4D operators and the predefined operators not enabled are loaded on
+    // first use with load_predefined_operator()
+
+    // Save the arrays which were not cached
+    get_cache().write();
 
     std::cout <<  "Allocate and init controller\n..." << std::endl;
     init_global_controller();
@@ -1622,8 +1711,10 @@ static void update_map_operators_type_to_id()
         }
     }
 
-    d_operators_id.malloc( pred_id.size() );
-    d_operators_id.copy_from( pred_id );
+    hd_operators_id.malloc( pred_id.size() );
+    for(unsigned i = 0; i < pred_id.size(); ++i)
+        hd_operators_id[i] = pred_id[i];
+    hd_operators_id.update_device_mem();
 }
 
 // -----------------------------------------------------------------------------
@@ -1666,8 +1757,11 @@ void update_operators()
     {
         Cuda_utils::free_d(d_operators_values);
         Cuda_utils::free_d(d_operators_grads);
-        d_operators_idx_offsets.erase();
-        d_operators_id.erase();
+        hd_operators_idx_offsets.erase();
+        hd_operators_idx_offsets.update_device_mem();
+        hd_operators_id.erase();
+        hd_operators_id.update_device_mem();
+        bind();
         return;
     }
 
@@ -1707,8 +1801,10 @@ void update_operators()
 
 
     // upload idx
-    d_operators_idx_offsets.malloc( indices.size() );
-    d_operators_idx_offsets.copy_from( indices );
+    hd_operators_idx_offsets.malloc( indices.size() );
+    for(unsigned i = 0; i < indices.size(); ++i)
+        hd_operators_idx_offsets[i] = indices[i];
+    hd_operators_idx_offsets.update_device_mem();
 
     update_map_operators_type_to_id();
     bind();
@@ -1724,9 +1820,14 @@ void clean_env()
     for(unsigned i = 0; i < list_controllers.size(); i++)
         delete[] list_controllers[i];
     h_controllers.erase();
+    h_global_controller.erase();
     h_ctrl_active.clear();
     list_controllers.clear();
     nb_instances = 0;
+    ctrl_capacity = 0;
+    h_controllers_size = make_int2(0, 0);
+    h_ctrl_dirty.clear();
+    d_ctrl_realloc = false;
 
     // free profiles -----------------
     delete[] h_hyperbola_profile;
@@ -1739,6 +1840,16 @@ void clean_env()
     h_bulge_profile = 0;
     h_bulge_normals_profile = 0;
     pan_hyperbola = 0;
+    h_bulge_4D_profiles.erase();
+    h_bulge_4D_profiles_normals.erase();
+    h_ricci_4D_profiles.erase();
+    h_ricci_4D_profiles_normals.erase();
+    h_block_3D_bulge.erase();
+    h_block_3D_bulge_gradient.erase();
+    h_block_3D_ricci.erase();
+    h_block_3D_ricci_gradient.erase();
+    h_block_3D_bulge_size = make_int3(0, 0, 0);
+    h_block_3D_ricci_size = make_int3(0, 0, 0);
 
     // free binary 3D operators -----------------
     for(unsigned i = 0; i < h_operators_values.size(); ++i) {
@@ -1760,8 +1871,10 @@ void clean_env()
     delete grid_operators_grads;
     grid_operators_values = 0;
     grid_operators_grads = 0;
-    d_operators_idx_offsets.erase();
-    d_operators_id.erase();
+    hd_operators_idx_offsets.erase();
+    hd_operators_idx_offsets.update_device_mem();
+    hd_operators_id.erase();
+    hd_operators_id.update_device_mem();
 
     // free gpu memory -----------------
     if(allocated){
@@ -1829,28 +1942,26 @@ Op_id new_op_instance(const IBL::Profile_polar::Base& profile,
 
 Op_id new_op_instance(const std::string &filename)
 {
-    float*       h_vals  = 0;
-    IBL::float2* h_grads = 0;
-    int len = (NB_SAMPLES_OCU+2)*(NB_SAMPLES_OCU+2)*(NB_SAMPLES_ALPHA+2);
+    const int len = (NB_SAMPLES_OCU+2)*(NB_SAMPLES_OCU+2)*(NB_SAMPLES_ALPHA+2);
+    const uint64_t key = cache_key(len);
 
-    h_vals  = new float      [len];
-    h_grads = new IBL::float2[len];
-    bool s = read_array(h_vals , len, get_cache_dir()+"/"+filename+"_vals.opc"  );
-    s = s && read_array(h_grads, len, get_cache_dir()+"/"+filename+"_grads.opc" );
+    const float*  cached_vals  = get_cache().get<float >("custom_"+filename+"_vals" , key, len);
+    const float2* cached_grads = get_cache().get<float2>("custom_"+filename+"_grads", key, len);
 
-    if (!s)  assert( false );
+    if(cached_vals == 0 || cached_grads == 0){
+        std::cerr << "Operator not cached: " << filename << std::endl;
+        assert( false );
+        return -1;
+    }
 
     // store the operator into new grids
     Vec3i_cu size(NB_SAMPLES_OCU+2, NB_SAMPLES_OCU+2, NB_SAMPLES_ALPHA+2);
-    Grid3_cu<float >* grid_vals  = new Grid3_cu<float >(size, h_vals          , PADDING_OFFSET);
-    Grid3_cu<float2>* grid_grads = new Grid3_cu<float2>(size, (float2*)h_grads, PADDING_OFFSET);
+    Grid3_cu<float >* grid_vals  = new Grid3_cu<float >(size, cached_vals , PADDING_OFFSET);
+    Grid3_cu<float2>* grid_grads = new Grid3_cu<float2>(size, cached_grads, PADDING_OFFSET);
 
     // record new operator grids
     h_custom_op_vals.push_back( grid_vals );
     h_custom_op_grads.push_back( grid_grads );
-    // clean function
-    delete[] h_vals;
-    delete[] h_grads;
     // return new op id
     updated = false;
     return h_custom_op_vals.size()-1 + NB_PRED_OPS;
@@ -1885,16 +1996,51 @@ void make_cache(Op_id op_id, const std::string &filename)
     assert( h_custom_op_grads[op_id - NB_PRED_OPS]->size().product() == len);
     if(filename.size() > 0)
     {
-        write_array(&(h_vals [0]), len, get_cache_dir()+"/"+filename+"_vals.opc"  );
-        write_array(&(h_grads[0]), len, get_cache_dir()+"/"+filename+"_grads.opc" );
+        const uint64_t key = cache_key(len);
+        get_cache().set("custom_"+filename+"_vals" , key, h_vals .data(), len);
+        get_cache().set("custom_"+filename+"_grads", key, h_grads.data(), len);
+        get_cache().write();
     }
 }
 
 // -----------------------------------------------------------------------------
 
 void enable_predefined_operator( Op_t op_t, bool on ){
-    // TODO: assert() if wrong op types
-    h_operators_enabling[ op_t - BINARY_3D_OPERATOR_BEGIN - 1 ] = on;
+    const int i = op_t - BINARY_3D_OPERATOR_BEGIN - 1;
+    assert( i >= 0 && i < NB_PRED_OPS );
+    h_operators_enabling[ i ] = on;
+}
+
+// -----------------------------------------------------------------------------
+
+bool load_predefined_operator( Op_t op_t )
+{
+    assert( allocated );
+    if( op_t == B_OH_4D || op_t == R_OH_4D )
+    {
+        // The 4D operators have their own textures
+        cudaArray* profiles = (op_t == B_OH_4D) ? d_bulge_4D_profiles : d_ricci_4D_profiles;
+        if( profiles != 0 )
+            return false;
+
+        unbind();
+        if( op_t == B_OH_4D ) init_4D_bulge_in_contact(true);
+        else                  init_4D_ricci(true);
+        get_cache().write();
+        bind();
+        return false;
+    }
+
+    const int i = op_t - BINARY_3D_OPERATOR_BEGIN - 1;
+    assert( i >= 0 && i < NB_PRED_OPS );
+    if( h_operators_enabling[i] )
+        return false;
+
+    h_operators_enabling[i] = true;
+    init_predefined[i](true);
+    get_cache().write();
+    updated = false;
+    return true;
 }
 
 // -----------------------------------------------------------------------------
@@ -1920,61 +2066,66 @@ void make_cache_env(const std::string &filename)
     if(filename.size() == 0)
         return;
 
-    std::string base_name = get_cache_dir()+"/"+filename;
+    const std::string base_name = "env_"+filename;
+    Cache_file& cache = get_cache();
 
-    // save concatenation
-    const std::vector<float>&   conc_vals  = grid_operators_values->get_vals();
-    const std::vector<float2>&  conc_grads = grid_operators_grads ->get_vals();
-    int conc_len = grid_operators_values->size().product();
+    // save infos, every other section is keyed with them.
+    // There is no concatenation when no operator is used yet
+    Vec3i_cu conc_size(0, 0, 0);
+    if(grid_operators_values != 0)
+        conc_size = grid_operators_values->size();
+    int idx_len  = h_operators_idx_offsets.size();
+    int enab_len = NB_PRED_OPS;
+    const int infos[5] = {conc_size.x, conc_size.y, conc_size.z, enab_len, idx_len};
+    const uint64_t key = Cache_file::hash(infos, sizeof(infos));
+    cache.set(base_name+"_infos", cache_key(enab_len), infos, 5);
 
-    write_array(&(conc_vals [0]), conc_len, base_name+"_conc_vals.opc"  );
-    write_array(&(conc_grads[0]), conc_len, base_name+"_conc_grads.opc" );
+    // save concatenation
+    int conc_len = conc_size.product();
+    if(conc_len > 0)
+    {
+        cache.set(base_name+"_conc_vals" , key, grid_operators_values->get_vals().data(), conc_len);
+        cache.set(base_name+"_conc_grads", key, grid_operators_grads ->get_vals().data(), conc_len);
+    }
 
     // save predefined => done through enabling
     // => cf load predifined comment in init_env_fom_cache method
     // save idx
-    int idx_len = h_operators_idx_offsets.size();
-    write_array(h_operators_idx_offsets.data(), idx_len, base_name+"_offset_idx.opc" );
+    cache.set(base_name+"_offset_idx", key, h_operators_idx_offsets.data(), idx_len);
     // save enabling
-    int enab_len = NB_PRED_OPS;
-    write_array(h_operators_enabling, enab_len, base_name+"_pred_state.opc" );
-    // save infos
-    std::ofstream file((base_name+"_infos.opc").c_str(), std::ios_base::out|std::ios_base::trunc);
-    if(!file.is_open()){
-        std::cerr << "Error exporting file " << filename << std::endl;
-        return;
-    }
+    cache.set(base_name+"_pred_state", key, h_operators_enabling, enab_len);
 
-    Vec3i_cu s = grid_operators_values->size();
-    file << s.x << " " << s.y << " " << s.z << " " << enab_len << " " << idx_len;
-    file.close();
+    // A failure is reported by the cache itself
+    cache.write();
 }
 
 // -----------------------------------------------------------------------------
 
 bool init_env_from_cache(const std::string &filename)
 {
-    std::string base_name = get_cache_dir()+"/"+filename;
+    const std::string base_name = "env_"+filename;
+    Cache_file& cache = get_cache();
     clean_env();
     assert(!binded);
 
     bool use_cache = true;
+    // Always loaded, see init_env()
+    enable_predefined_operator(U_OH, true);
 
     init_profile_bulge(use_cache);
     init_profile_hyperbola(use_cache);
     init_opening_hyperbola(use_cache);
     // get infos
-    int conc_s_x, conc_s_y, conc_s_z, enab_len, idx_len;
-    std::ifstream file((base_name+"_infos.opc").c_str(), std::ios_base::in);
-    if(!file.is_open()){
+    const int* infos = cache.get<int>(base_name+"_infos", cache_key(NB_PRED_OPS), 5);
+    if(infos == 0){
         std::cerr << "Cache doesn't exists: " << filename << std::endl;
         clean_env();
         return false;
     }
-    file >> conc_s_x  >> conc_s_y  >> conc_s_z  >>
-            enab_len >> idx_len;
-    file.close();
-    Vec3i_cu conc_size(conc_s_x, conc_s_y, conc_s_z);
+    const uint64_t key = Cache_file::hash(infos, 5 * sizeof(int));
+    Vec3i_cu conc_size(infos[0], infos[1], infos[2]);
+    int enab_len = infos[3];
+    int idx_len  = infos[4];
     // restore enabling
     if(enab_len != NB_PRED_OPS){
         clean_env();
@@ -1982,7 +2133,7 @@ bool init_env_from_cache(const std::string &filename)
     }
 
     Cuda_utils::HA_bool enabled( NB_PRED_OPS );
-    if(!read_array(enabled.ptr(), NB_PRED_OPS, base_name+"_pred_state.opc")){
+    if(!cache.read(base_name+"_pred_state", key, enabled.ptr(), NB_PRED_OPS)){
         clean_env();
         return false;
     }
@@ -1996,34 +2147,30 @@ bool init_env_from_cache(const std::string &filename)
 
     // then idx
     h_operators_idx_offsets.resize( idx_len );
-    if (!read_array(h_operators_idx_offsets.data(), idx_len, base_name+"_offset_idx.opc" )){
+    if (!cache.read(base_name+"_offset_idx", key, h_operators_idx_offsets.data(), idx_len)){
         clean_env();
         return false;
     }
-    // then concatenation
+    // then concatenation, straight from the mapped file
     int conc_len = conc_size.product();
-    std::vector<float>  conc_vals ( conc_len );
-    std::vector<float2> conc_grads( conc_len );
-    if (!read_array( &(conc_vals[0]), conc_len, base_name+"_conc_vals.opc" )){
-        clean_env();
-        return false;
-    }
-
-    if (!read_array( &(conc_grads[0]), conc_len, base_name+"_conc_grads.opc" )){
-        clean_env();
-        return false;
+    if(conc_len > 0)
+    {
+        const float*  conc_vals  = cache.get<float >(base_name+"_conc_vals" , key, conc_len);
+        const float2* conc_grads = cache.get<float2>(base_name+"_conc_grads", key, conc_len);
+        if (conc_vals == 0 || conc_grads == 0){
+            clean_env();
+            return false;
+        }
+        delete grid_operators_values;
+        grid_operators_values = new Grid3_cu<float>( conc_size, conc_vals );
+        delete grid_operators_grads;
+        grid_operators_grads = new Grid3_cu<float2>( conc_size, conc_grads );
     }
-    delete grid_operators_values;
-    grid_operators_values = new Grid3_cu<float>( conc_size, &(conc_vals[0]) );
-    delete grid_operators_grads;
-    grid_operators_grads = new Grid3_cu<float2>( conc_size, &(conc_grads[0]) );
     // then predefined
     load_3d_predefined(); // quicker than conc pred when save and retrieve from conc_grids
 
-    // todo with new env archi
-    init_4D_bulge_in_contact(use_cache);
-    init_4D_ricci(use_cache);
     init_global_controller();
+    cache.write();
 
     Cuda_utils::malloc_d(d_magnitude_3D_bulge, 1);
     Cuda_utils::mem_cpy_htd(d_magnitude_3D_bulge, &h_magnitude_3D_bulge, 1);
@@ -2035,14 +2182,16 @@ bool init_env_from_cache(const std::string &filename)
 
     allocated = true;
     // allocate on gpu without concatenate
-    allocate_and_copy_3D_array(grid_operators_values, d_operators_values);
-    allocate_and_copy_3D_array(grid_operators_grads, d_operators_grads);
+    if(conc_len > 0)
+    {
+        allocate_and_copy_3D_array(grid_operators_values, d_operators_values);
+        allocate_and_copy_3D_array(grid_operators_grads, d_operators_grads);
+    }
     // upload idx offsets
-    std::vector< int4 > indices(h_operators_idx_offsets.size());
-    for(unsigned i = 0; i < indices.size(); ++i)
-        indices[i] = h_operators_idx_offsets[i].to_int4();
-    d_operators_idx_offsets.malloc( indices.size() );
-    d_operators_idx_offsets.copy_from( indices );
+    hd_operators_idx_offsets.malloc( h_operators_idx_offsets.size() );
+    for(unsigned i = 0; i < h_operators_idx_offsets.size(); ++i)
+        hd_operators_idx_offsets[i] = h_operators_idx_offsets[i].to_int4();
+    hd_operators_idx_offsets.update_device_mem();
     // upload pred ids
     std::vector<int> pred_id(NB_PRED_OPS, -1);
     int id = 0;
@@ -2052,8 +2201,10 @@ bool init_env_from_cache(const std::string &filename)
             ++id;
         }
     }
-    d_operators_id.malloc( pred_id.size() );
-    d_operators_id.copy_from( pred_id );
+    hd_operators_id.malloc( pred_id.size() );
+    for(unsigned i = 0; i < pred_id.size(); ++i)
+        hd_operators_id[i] = pred_id[i];
+    hd_operators_id.update_device_mem();
 
     bind();
     return true;
@@ -2071,6 +2222,7 @@ void set_global_ctrl_shape(const IBL::Ctrl_setup& shape)
 
     int data_size = NB_SAMPLES * sizeof(float2);
     CUDA_SAFE_CALL(cudaMemcpyToArray(d_global_controller, 0, 0, (float2*)controller, data_size, cudaMemcpyHostToDevice));
+    mem_cpy_hth(h_global_controller.ptr(), (float2*)controller, NB_SAMPLES);
 
     delete[] controller;
 
@@ -18,7 +18,9 @@
 
 #include <cstdio>
 #include "cuda_utils.hpp"
+#include "host_tex.hpp"
 #include "idx3_cu.hpp"
+#include "grid3_cu.hpp"
 
 // forward defs ----------------------------------------------------------------
 #include "blending_env_type.hpp"
@@ -109,26 +111,53 @@ extern Cuda_utils::Device::CuArray<float2>  d_block_3D_bulge_gradient;
 extern Cuda_utils::Device::CuArray<float>  d_block_3D_ricci;
 extern Cuda_utils::Device::CuArray<float2>  d_block_3D_ricci_gradient;
 
+/// Host copies of the 4D operators, empty until they're loaded
+/// (see load_predefined_operator())
+/// @{
+extern Cuda_utils::HA_float  h_bulge_4D_profiles;
+extern Cuda_utils::HA_float2 h_bulge_4D_profiles_normals;
+extern Cuda_utils::HA_float  h_ricci_4D_profiles;
+extern Cuda_utils::HA_float2 h_ricci_4D_profiles_normals;
+
+extern Cuda_utils::HA_float  h_block_3D_bulge;
+extern Cuda_utils::HA_float2 h_block_3D_bulge_gradient;
+extern int3                  h_block_3D_bulge_size;
+
+extern Cuda_utils::HA_float  h_block_3D_ricci;
+extern Cuda_utils::HA_float2 h_block_3D_ricci_gradient;
+extern int3                  h_block_3D_ricci_size;
+/// @}
+
 /// 2D array which actually stores a 1D function -> the controller
 /// @note we use 2D instead of a 1D array because 1D array are limited to 655356
 /// elements.
 extern cudaArray* d_controllers;
 
+/// Host copy of 'd_controllers' (see controller_fetch())
+/// @{
+extern Cuda_utils::Host::Array<float2> h_controllers;
+extern int2 h_controllers_size;
+/// @}
+
 extern cudaArray* d_hyperbola_profile;
 extern cudaArray* d_hyperbola_normals_profile;
 
 extern float*  h_hyperbola_profile;
 extern float2* h_hyperbola_normals_profile;
 
+extern float*  h_bulge_profile;
 extern float2* h_bulge_normals_profile;
 
 extern cudaArray* d_global_controller;
+extern Cuda_utils::Host::Array<float2> h_global_controller;
 extern IBL::Ctrl_setup globale_ctrl_shape;
 extern const int nb_samples;
 
 extern bool allocated;
 
 extern cudaArray* d_pan_hyperbola;
+/// Host copy of 'd_pan_hyperbola' (NB_SAMPLES elements)
+extern float* pan_hyperbola;
 
 // -----------------------------------------------------------------------------
 
@@ -147,8 +176,20 @@ Ctrl_id new_ctrl_instance();
 
 void delete_ctrl_instance(Ctrl_id inst_id);
 
+/// Change the shape of a controller. The GPU copy is updated by the next
+/// update_controllers_in_device(), so several controllers can be modified at
+/// once for the cost of a single flush.
 void update_controller(Ctrl_id inst_id, const IBL::Ctrl_setup& shape);
 
+/// Send the controllers modified since the last call to the GPU. Only the grid
+/// of each modified controller is copied, unless the number of instances
+/// outgrew the device array which is then reallocated and entirely copied.
+/// @note Skeleton::update_bones_data() calls it before evaluating a skeleton
+void update_controllers_in_device();
+
+// Ctrl_upload_stats, get_ctrl_upload_stats() and reset_ctrl_upload_stats()
+// are declared in blending_env_type.hpp so that they can be used without CUDA
+
 IBL::Ctrl_setup get_global_ctrl_shape();
 
 float eval_global_ctrl(float dot);
@@ -193,11 +234,19 @@ void bind();
 
 extern cudaArray* d_operators_values;
 extern cudaArray* d_operators_grads;
-extern Cuda_utils::Device::Array<int4> d_operators_idx_offsets;
-extern Cuda_utils::Device::Array<Op_id> d_operators_id;
+extern Cuda_utils::HD_Array<int4> hd_operators_idx_offsets;
+extern Cuda_utils::HD_Array<Op_id> hd_operators_id;
+
+/// Host copies of 'd_operators_values' and 'd_operators_grads' used to fetch
+/// the operators on host (see operator_fetch())
+/// @{
+extern Grid3_cu<float>*  grid_operators_values;
+extern Grid3_cu<float2>* grid_operators_grads;
+/// @}
 
 /// Generates predefined profiles and openings, global controller,
 /// enabled predefined operators and activates custom operators
+/// @see load_predefined_operator() for the others
 void init_env();
 
 /// upload operators to gpu memory
@@ -245,6 +294,15 @@ void make_cache(Op_id op_id, const std::string &filename);
 /// @warning Acts only when init_env() or reset_env() are called
 void enable_predefined_operator( Op_t op_t, bool on );
 
+/// Enables the specified predefined operator after init_env() and loads it
+/// from the cache (or generates it) if it's not already.
+/// Operators not enabled before init_env() are loaded this way the first time
+/// they are used, so only the operators of the scene take memory.
+/// 4D operators (B_OH_4D, R_OH_4D) are uploaded right away.
+/// @return true if a 3D operator was added: update_operators() must be called
+/// to use it.
+bool load_predefined_operator( Op_t op_t );
+
 /// @return number of predefined operators enabled through
 /// enable_predefined_operator()
 int get_nb_predefined_enabled();
@@ -313,84 +371,89 @@ bool init_env_from_cache(const std::string &filename);
     /// unbind textures to the arrays into the '.cu' this header is included in
     static inline void unbind_local();
 
+    // On host the fetches below sample the host copies of the textures
+    // (see Host_tex) so operators give the same results on host and device.
+
     // boundary functions fetch ------------------------------------------------
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float pan_hyperbola_fetch(float t);
     // -------------------------------------------------------------------------
 
     // profile functions fetch -------------------------------------------------
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float hyperbola_fetch(float tan_t);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 hyperbola_normal_fetch(float tan_t);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float skin_fetch(float tan_t);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 skin_normal_fetch(float tan_t);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float profile_bulge_4D_fetch(float tan_t, float strength);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 profile_bulge_4D_normal_fetch(float tan_t, float strength);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float profile_ricci_4D_fetch(float tan_t, float N);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 profile_ricci_4D_normal_fetch(float tan_t, float N);
     // -------------------------------------------------------------------------
 
     // operator fetch for OH ---------------------------------------------------
     // used for U_OH
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float openable_clean_union_fetch(float f1, float f2, float tan_alpha);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 openable_clean_union_gradient_fetch(float f1, float f2, float tan_alpha);
 
     // used for B_OH
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float openable_clean_skin_fetch(float f1, float f2, float tan_alpha);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 openable_clean_skin_gradient_fetch(float f1, float f2, float tan_alpha);
     // -------------------------------------------------------------------------
 
     // 4D operators stuff ------------------------------------------------------
     // TODO: 4D fetch that fetch both potential and gradient.
     // B_OH_4D
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float magnitude_3D_bulge_fetch();
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float openable_bulge_4D_fetch(float f1, float f2, float tan_alpha, float strength);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 openable_bulge_4D_gradient_fetch(float f1, float f2, float tan_alpha, float strength);
 
     // R_OH_4D
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float n_3D_ricci_fetch();
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float openable_ricci_4D_fetch(float f1, float f2, float tan_alpha, float N);
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 openable_ricci_4D_gradient_fetch(float f1, float f2, float tan_alpha, float N);
     // -------------------------------------------------------------------------
 
     /// @param dot Is the angle between two gradient given by the dot product
     /// i.e cos(teta)
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 global_controller_fetch(float dot);
 
     /// @param dot Is the angle between two gradient given by the dot product
     /// i.e cos(teta)
-    __device__
+    /// @note on host 'h_controllers' is sampled like the texture, changes of
+    /// update_controller() are seen before update_controllers_in_device()
+    IF_CUDA_DEVICE_HOST
     static float2 controller_fetch(int inst_id, float dot);
 
     // =========================================================================
@@ -415,15 +478,15 @@ bool init_env_from_cache(const std::string &filename);
     extern texture<float , 3, cudaReadModeElementType> tex_operators_values;
     extern texture<float2, 3, cudaReadModeElementType> tex_operators_grads;
 
-    __device__
+    IF_CUDA_DEVICE_HOST
     static Idx3_cu operator_idx_offset_fetch(Op_id op_id);
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float operator_fetch(Idx3_cu tex_idx, float f1, float f2 ,float tan_alpha);
-    __device__
+    IF_CUDA_DEVICE_HOST
     static float2 operator_grad_fetch(Idx3_cu tex_idx, float f1, float f2, float tan_alpha);
 
     /// @returns the identifier attached to the op_t predefined operator
-    __device__
+    IF_CUDA_DEVICE_HOST
     static Op_id predefined_op_id_fetch( Op_t op_t );
     // -----------------------------------------------------------------------------
 
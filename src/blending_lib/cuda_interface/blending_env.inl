@@ -7,6 +7,8 @@
 
 
 #define TL1D(tex,x,dimx) (tex1D((tex),((dimx)-1)*(x)+0.5f))
+/// Host version of TL1D() sampling the host copy 'data' of the texture
+#define HTL1D(data,x,dimx) (Host_tex::fetch_1D((data),(dimx),((dimx)-1)*(x)+0.5f))
 #define TL2D(tex,x,y,dimx,dimy) (tex2D((tex),((dimx)-1)*(x)+0.5f, ((dimy)-1)*(y)+0.5f))
 #define TL3D(tex,x,y,z,dimx,dimy,dimz) (tex3D((tex),((dimx)-1)*(x)+0.5f, ((dimy)-1)*(y)+0.5f,((dimz)-1)*(z)+0.5f))
 
@@ -15,68 +17,104 @@ namespace Blending_env {
 // =============================================================================
 
 // boundary functions fetch ------------------------------------------------
-__device__
+IF_CUDA_DEVICE_HOST
 static float pan_hyperbola_fetch(float t){
+    #ifdef __CUDA_ARCH__
     return TL1D(opening_hyperbola_tex,t*0.5f,NB_SAMPLES);
+    #else
+    return HTL1D(pan_hyperbola,t*0.5f,NB_SAMPLES);
+    #endif
 }
 // -----------------------------------------------------------------------------
 
 // profile functions fetch -------------------------------------------------
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 hyperbola_fetch(float tan_t){
+    #ifdef __CUDA_ARCH__
     return TL1D(profile_hyperbola_tex,tan_t,NB_SAMPLES);
+    #else
+    return HTL1D(h_hyperbola_profile,tan_t,NB_SAMPLES);
+    #endif
 }
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 hyperbola_normal_fetch(float tan_t){
+    #ifdef __CUDA_ARCH__
     return TL1D(profile_hyperbola_normals_tex,tan_t,NB_SAMPLES);
+    #else
+    return HTL1D(h_hyperbola_normals_profile,tan_t,NB_SAMPLES);
+    #endif
 }
 
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 skin_fetch(float tan_t){
+    #ifdef __CUDA_ARCH__
     return TL1D(profile_bulge_tex,tan_t,NB_SAMPLES);
+    #else
+    return HTL1D(h_bulge_profile,tan_t,NB_SAMPLES);
+    #endif
 }
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 skin_normal_fetch(float tan_t){
+    #ifdef __CUDA_ARCH__
     return TL1D(profile_bulge_normals_tex,tan_t,NB_SAMPLES);
+    #else
+    return HTL1D(h_bulge_normals_profile,tan_t,NB_SAMPLES);
+    #endif
 }
 
-__device__
+IF_CUDA_DEVICE_HOST
 static float profile_bulge_4D_fetch(float tan_t, float strength)
 {
     int idx = floorf(strength * (NB_SAMPLES_MAG_4D_BULGE-1));
     float x = idx*(NB_SAMPLES+2) + tan_t*(NB_SAMPLES-1);
+    #ifdef __CUDA_ARCH__
     return tex1D(profiles_bulge_4D_tex, x + 0.5f);
+    #else
+    return Host_tex::fetch_1D(h_bulge_4D_profiles.ptr(), h_bulge_4D_profiles.size(), x + 0.5f);
+    #endif
 }
 
-__device__
+IF_CUDA_DEVICE_HOST
 static float2 profile_bulge_4D_normal_fetch(float tan_t, float strength)
 {
     int idx = floorf(strength * (NB_SAMPLES_MAG_4D_BULGE-1));
     float x = idx*(NB_SAMPLES+2) + tan_t*(NB_SAMPLES-1);
+    #ifdef __CUDA_ARCH__
     return tex1D(profiles_bulge_4D_normals_tex, x + 0.5f);
+    #else
+    return Host_tex::fetch_1D(h_bulge_4D_profiles_normals.ptr(), h_bulge_4D_profiles_normals.size(), x + 0.5f);
+    #endif
 }
 
-__device__
+IF_CUDA_DEVICE_HOST
 static float profile_ricci_4D_fetch(float tan_t, float N)
 {
     int idx = floorf( N  * 2);
     float x = idx*(NB_SAMPLES+2) + tan_t*(NB_SAMPLES-1);
+    #ifdef __CUDA_ARCH__
     return tex1D(profiles_ricci_4D_tex, x + 0.5f);
+    #else
+    return Host_tex::fetch_1D(h_ricci_4D_profiles.ptr(), h_ricci_4D_profiles.size(), x + 0.5f);
+    #endif
 }
-__device__
+IF_CUDA_DEVICE_HOST
 static float2 profile_ricci_4D_normal_fetch(float tan_t, float N)
 {
     int idx = floorf( N * 2 );
     float x = idx*(NB_SAMPLES+2) + tan_t*(NB_SAMPLES-1);
+    #ifdef __CUDA_ARCH__
     return tex1D(profiles_ricci_4D_normals_tex, x + 0.5f);
+    #else
+    return Host_tex::fetch_1D(h_ricci_4D_profiles_normals.ptr(), h_ricci_4D_profiles_normals.size(), x + 0.5f);
+    #endif
 }
 // -----------------------------------------------------------------------------
 
 // operator fetch for *_OH -----------------------------------------------------
 // used for U_OH
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 openable_clean_union_fetch(float f1, float f2, float tan_alpha){
     Blending_env::Op_id id = Blending_env::predefined_op_id_fetch( Blending_env::U_OH );
     if (id < 0)
@@ -85,7 +123,7 @@ openable_clean_union_fetch(float f1, float f2, float tan_alpha){
     return operator_fetch(idx, f1*2.f, f2*2.f, tan_alpha);
 }
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 openable_clean_union_gradient_fetch(float f1, float f2, float tan_alpha){
     Blending_env::Op_id id = Blending_env::predefined_op_id_fetch( Blending_env::U_OH );
     if (id < 0)
@@ -94,7 +132,7 @@ openable_clean_union_gradient_fetch(float f1, float f2, float tan_alpha){
     return operator_grad_fetch(idx, f1*2.f, f2*2.f, tan_alpha);
 }
 // used for B_OH
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 openable_clean_skin_fetch(float f1, float f2, float tan_alpha){
     Blending_env::Op_id id = Blending_env::predefined_op_id_fetch( Blending_env::B_OH );
     if (id < 0)
@@ -103,7 +141,7 @@ openable_clean_skin_fetch(float f1, float f2, float tan_alpha){
     return operator_fetch(idx, f1*2.f, f2*2.f, tan_alpha);
 }
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 openable_clean_skin_gradient_fetch(float f1, float f2, float tan_alpha){
     Blending_env::Op_id id = Blending_env::predefined_op_id_fetch( Blending_env::B_OH );
     if (id < 0)
@@ -116,12 +154,16 @@ openable_clean_skin_gradient_fetch(float f1, float f2, float tan_alpha){
 // 4D operators stuff ----------------------------------------------------------
 // TODO: 4D fetch that fetch both potential and gradient.
 // B_OH_4D
-__device__
+IF_CUDA_DEVICE_HOST
 static float magnitude_3D_bulge_fetch(){
+    #ifdef __CUDA_ARCH__
     return tex1Dfetch(magnitude_3D_bulge_tex, 0);
+    #else
+    return h_magnitude_3D_bulge;
+    #endif
 }
 
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 openable_bulge_4D_fetch(float f1, float f2, float tan_alpha, float strength)
 {
     int idx = floorf(strength * (NB_SAMPLES_MAG_4D_BULGE-1));
@@ -140,10 +182,14 @@ openable_bulge_4D_fetch(float f1, float f2, float tan_alpha, float strength)
                       block_idx.z + tan_alpha * (NB_SAMPLES_4D_BULGE-1)
                     };
 
+    #ifdef __CUDA_ARCH__
     return tex3D(openable_bulge_4D_tex, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f) * 0.5f;
+    #else
+    return Host_tex::fetch_3D(h_block_3D_bulge.ptr(), h_block_3D_bulge_size, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f) * 0.5f;
+    #endif
 }
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 openable_bulge_4D_gradient_fetch(float f1, float f2, float tan_alpha, float strength)
 {
     int idx = floorf(strength * (NB_SAMPLES_MAG_4D_BULGE-1));
@@ -162,17 +208,25 @@ openable_bulge_4D_gradient_fetch(float f1, float f2, float tan_alpha, float stre
                       block_idx.z + tan_alpha * (NB_SAMPLES_4D_BULGE-1)
                     };
 
+    #ifdef __CUDA_ARCH__
     return tex3D(openable_bulge_4D_gradient_tex, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f);
+    #else
+    return Host_tex::fetch_3D(h_block_3D_bulge_gradient.ptr(), h_block_3D_bulge_size, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f);
+    #endif
 }
 
 // R_OH_4D
 
-__device__
+IF_CUDA_DEVICE_HOST
 static float n_3D_ricci_fetch(){
+    #ifdef __CUDA_ARCH__
     return tex1Dfetch(n_3D_ricci_tex, 0);
+    #else
+    return h_n_3D_ricci;
+    #endif
 }
 
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 openable_ricci_4D_fetch(float f1, float f2, float tan_alpha, float N)
 {
     int idx = floorf( N * 2 );
@@ -191,9 +245,13 @@ openable_ricci_4D_fetch(float f1, float f2, float tan_alpha, float N)
                       block_idx.z + tan_alpha * (NB_SAMPLES_4D_BULGE-1)
                     };
 
+    #ifdef __CUDA_ARCH__
     return tex3D(openable_ricci_4D_tex, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f) * 0.5f;
+    #else
+    return Host_tex::fetch_3D(h_block_3D_ricci.ptr(), h_block_3D_ricci_size, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f) * 0.5f;
+    #endif
 }
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 openable_ricci_4D_gradient_fetch(float f1, float f2, float tan_alpha, float N)
 {
     int idx = floorf( N * 2);
@@ -212,18 +270,27 @@ openable_ricci_4D_gradient_fetch(float f1, float f2, float tan_alpha, float N)
                       block_idx.z + tan_alpha * (NB_SAMPLES_4D_BULGE-1)
                     };
 
+    #ifdef __CUDA_ARCH__
     return tex3D(openable_ricci_4D_gradient_tex, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f);
+    #else
+    return Host_tex::fetch_3D(h_block_3D_ricci_gradient.ptr(), h_block_3D_ricci_size, coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f);
+    #endif
 }
 // -----------------------------------------------------------------------------
 
 
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 global_controller_fetch(float dot){
+    #ifdef __CUDA_ARCH__
     return tex1D(global_controller_tex, dot * 0.5f + 0.5f);
+    #else
+    // The texture uses normalized coordinates
+    return Host_tex::fetch_1D(h_global_controller.ptr(), NB_SAMPLES, (dot * 0.5f + 0.5f) * NB_SAMPLES);
+    #endif
 }
 
-__device__
+IF_CUDA_DEVICE_HOST
 static float2 controller_fetch(int inst_id, float dot){
 
     int2 bidx_2D = {inst_id  %  BLOCK_CTRL_LX, inst_id   / BLOCK_CTRL_LX  };
@@ -231,9 +298,13 @@ static float2 controller_fetch(int inst_id, float dot){
 
     const float off = 1/*padding*/ + 0.5f/*linear interpolation*/ + (dot * 0.5f + 0.5f) * (NB_SAMPLES-1);
 
-    return tex2D(tex_controllers,
-                 (float)gidx_2D.x + off,
-                 (float)gidx_2D.y + 1.f/*middle column*/ + 0.5f /*linear interpolation*/);
+    const float x = (float)gidx_2D.x + off;
+    const float y = (float)gidx_2D.y + 1.f/*middle column*/ + 0.5f /*linear interpolation*/;
+    #ifdef __CUDA_ARCH__
+    return tex2D(tex_controllers, x, y);
+    #else
+    return Host_tex::fetch_2D(h_controllers.ptr(), h_controllers_size, x, y);
+    #endif
 }
 
 // =============================================================================
@@ -241,36 +312,58 @@ static float2 controller_fetch(int inst_id, float dot){
 // =============================================================================
 // ======================  TEST with new env archi  ============================
 // =============================================================================
-__device__ static Idx3_cu operator_idx_offset_fetch(Op_id op_id){
+IF_CUDA_DEVICE_HOST static Idx3_cu operator_idx_offset_fetch(Op_id op_id){
 
+    #ifdef __CUDA_ARCH__
     const int4 i = tex1Dfetch( tex_pred_operators_idx_offsets, op_id );
+    #else
+    const int4 i = hd_operators_idx_offsets[op_id];
+    #endif
     return Idx3_cu(Vec3i_cu(i.x, i.y, i.z), i.w);
 }
 
-__device__ static float
+IF_CUDA_DEVICE_HOST static float
 operator_fetch(Idx3_cu tex_idx, float f1, float f2 ,float tan_alpha){
     int a, b, c;
     tex_idx.to_3d(a, b, c);
-    return tex3D(tex_operators_values, a+f1*(NB_SAMPLES_OCU-1)+0.5f,
-                                       b+f2*(NB_SAMPLES_OCU-1)+0.5f,
-                                       c+tan_alpha*(NB_SAMPLES_ALPHA-1)+0.5f)*0.5f;
+    const float x = a+f1*(NB_SAMPLES_OCU-1)+0.5f;
+    const float y = b+f2*(NB_SAMPLES_OCU-1)+0.5f;
+    const float z = c+tan_alpha*(NB_SAMPLES_ALPHA-1)+0.5f;
+    #ifdef __CUDA_ARCH__
+    return tex3D(tex_operators_values, x, y, z)*0.5f;
+    #else
+    const Vec3i_cu s = grid_operators_values->size();
+    return Host_tex::fetch_3D(grid_operators_values->get_vals().data(), make_int3(s.x, s.y, s.z), x, y, z)*0.5f;
+    #endif
 }
 
-__device__ static float2
+IF_CUDA_DEVICE_HOST static float2
 operator_grad_fetch(Idx3_cu tex_idx, float f1, float f2, float tan_alpha){
     int a, b, c;
     tex_idx.to_3d(a, b, c);
-    return tex3D(tex_operators_grads, a+f1*(NB_SAMPLES_OCU-1)+0.5f,
-                                      b+f2*(NB_SAMPLES_OCU-1)+0.5f,
-                                      c+tan_alpha*(NB_SAMPLES_ALPHA-1)+0.5f);
+    const float x = a+f1*(NB_SAMPLES_OCU-1)+0.5f;
+    const float y = b+f2*(NB_SAMPLES_OCU-1)+0.5f;
+    const float z = c+tan_alpha*(NB_SAMPLES_ALPHA-1)+0.5f;
+    #ifdef __CUDA_ARCH__
+    return tex3D(tex_operators_grads, x, y, z);
+    #else
+    const Vec3i_cu s = grid_operators_grads->size();
+    return Host_tex::fetch_3D(grid_operators_grads->get_vals().data(), make_int3(s.x, s.y, s.z), x, y, z);
+    #endif
 }
 
-__device__ static Op_id
+IF_CUDA_DEVICE_HOST static Op_id
 predefined_op_id_fetch(Op_t op_t)
 {
     // TODO: assert if wrong type of operators
     int id_opt = op_t - BINARY_3D_OPERATOR_BEGIN - 1;
+    #ifdef __CUDA_ARCH__
     return tex1Dfetch(tex_pred_operators_id, id_opt);
+    #else
+    // No operators loaded yet
+    if(id_opt >= hd_operators_id.size()) return -1;
+    return hd_operators_id[id_opt];
+    #endif
 }
 // -----------------------------------------------------------------------------
 
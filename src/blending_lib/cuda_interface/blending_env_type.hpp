@@ -1,6 +1,7 @@
 #ifndef BLENDING_ENV_TYPE_HPP
 #define BLENDING_ENV_TYPE_HPP
 
+#include <cstddef>
 
 // =============================================================================
 namespace Blending_env {
@@ -60,6 +61,20 @@ enum Op_mode {
     DIFFERENCE_    ///< specifies Difference-defined operators
 };
 
+/// Counters of the uploads of update_controllers_in_device()
+struct Ctrl_upload_stats {
+    Ctrl_upload_stats() : nb_bytes(0), nb_grids(0), nb_full_uploads(0) { }
+    size_t nb_bytes;     ///< bytes copied to the GPU
+    int nb_grids;        ///< controllers copied alone
+    int nb_full_uploads; ///< reallocations copying every controllers
+};
+
+/// @return the uploads since the last reset_ctrl_upload_stats().
+/// Reset it once per frame to get the bytes uploaded per frame.
+Ctrl_upload_stats get_ctrl_upload_stats();
+
+void reset_ctrl_upload_stats();
+
 }// END BLENDING_ENV NAMESPACE =================================================
 
 #endif // BLENDING_ENV_TYPE_HPP
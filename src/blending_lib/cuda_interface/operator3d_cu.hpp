@@ -20,7 +20,7 @@ struct Operator3D_cu {
     /// @param gf1, gf2 : gradients of composed implicit surfaces
     /// @returns the composition value of f1 and f2 by @see _op_idx operator
     /// with global controller
-    __device__ inline
+    IF_CUDA_DEVICE_HOST inline
     float f(float f1, float f2, const Vec3_cu &gf1, const Vec3_cu &gf2) const {
         Idx3_cu id = Blending_env::operator_idx_offset_fetch( _op_idx );
         Vec3_cu gf1n = gf1.normalized();
@@ -33,7 +33,7 @@ struct Operator3D_cu {
     /// @param gf1, gf2 : gradients of composed implicit surfaces
     /// @returns the composition gradient of f1 and f2 by @see _op_idx operator
     /// with global controller
-    __device__ inline
+    IF_CUDA_DEVICE_HOST inline
     Vec3_cu gf(float f1, float f2, const Vec3_cu &gf1, const Vec3_cu &gf2) const {
         Idx3_cu id = Blending_env::operator_idx_offset_fetch( _op_idx );
         Vec3_cu gf1n = gf1.normalized();
@@ -49,7 +49,7 @@ struct Operator3D_cu {
     /// with global controller
     /// @returns the composition value of f1 and f2 by @see _op_idx operator
     /// with global controller
-    __device__ inline
+    IF_CUDA_DEVICE_HOST inline
     float fngf(float f1, float f2, const Vec3_cu &gf1, const Vec3_cu &gf2, Vec3_cu &gf) const {
         Idx3_cu id = Blending_env::operator_idx_offset_fetch( _op_idx );
         Vec3_cu gf1n = gf1.normalized();
@@ -81,7 +81,7 @@ struct Dyn_Operator3D_cu {
     /// @param gf1, gf2 : gradients of composed implicit surfaces
     /// @returns the composition value of f1 and f2 by @see _op_idx operator
     /// with @see _ctrl_idx controller
-    __device__ inline
+    IF_CUDA_DEVICE_HOST inline
     float f(float f1, float f2, const Vec3_cu &gf1, const Vec3_cu &gf2) const {
         Idx3_cu id = Blending_env::operator_idx_offset_fetch( _op_idx );
         Vec3_cu gf1n = gf1.normalized();
@@ -94,7 +94,7 @@ struct Dyn_Operator3D_cu {
     /// @param gf1, gf2 : gradients of composed implicit surfaces
     /// @returns the composition gradient of f1 and f2 by @see _op_idx operator
     /// with @see _ctrl_idx controller
-    __device__ inline
+    IF_CUDA_DEVICE_HOST inline
     Vec3_cu gf(float f1, float f2, const Vec3_cu &gf1, const Vec3_cu &gf2) const {
         Idx3_cu id = Blending_env::operator_idx_offset_fetch( _op_idx );
         Vec3_cu gf1n = gf1.normalized();
@@ -110,7 +110,7 @@ struct Dyn_Operator3D_cu {
     /// with @see _ctrl_idx controller
     /// @returns the composition value of f1 and f2 by @see _op_idx operator
     /// with @see _ctrl_idx controller
-    __device__ inline
+    IF_CUDA_DEVICE_HOST inline
     float fngf(float f1, float f2, const Vec3_cu &gf1, const Vec3_cu &gf2, Vec3_cu &gf) const {
         Idx3_cu id = Blending_env::operator_idx_offset_fetch( _op_idx );
         Vec3_cu gf1n = gf1.normalized();
@@ -4,7 +4,7 @@
 /** @file ultimate.hpp
  *
  * @warning the following operators using cuda textures that must be bound
- * before being used
+ * before being used. On host they sample the host copies of the textures.
  * @see Blending_env
  */
 #if !defined(BLENDING_ENV_HPP__)
@@ -38,15 +38,16 @@ typedef UltimateOperator<E_OCU::BULGE> BulgeInContact;
 
 // =============================================================================
 
+/// @note E_OCU::BLEND samples the operator U_OH, which Blending_env::init_env()
+/// always loads. E_OCU::BULGE samples B_OH, loaded on demand: it evaluates to
+/// zero until then.
 template <E_OCU::Union_t type>
 struct OCU {
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float f(float f1, float f2, float tan_alpha)
     {
-        if(type == E_OCU::BLEND && Blending_env::predefined_op_id_fetch(Blending_env::U_OH) == -1){
-            return 0.f;
-        } else if (type == E_OCU::BULGE && Blending_env::predefined_op_id_fetch(Blending_env::B_OH) == -1){
+        if(type == E_OCU::BULGE && Blending_env::predefined_op_id_fetch(Blending_env::B_OH) == -1){
             return 0.f;
         }
 
@@ -74,12 +75,10 @@ struct OCU {
         return fmaxf(f1, f2);
     }
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float2 gf(float f1, float f2, float tan_alpha)
     {
-        if(type == E_OCU::BLEND && Blending_env::predefined_op_id_fetch(Blending_env::U_OH) == -1){
-            return make_float2(0.f, 0.f);
-        } else if (type == E_OCU::BULGE && Blending_env::predefined_op_id_fetch(Blending_env::B_OH) == -1){
+        if(type == E_OCU::BULGE && Blending_env::predefined_op_id_fetch(Blending_env::B_OH) == -1){
             return make_float2(0.f, 0.f);
         }
 
@@ -112,13 +111,10 @@ struct OCU {
     }
 
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float fngf(float2& gf, float f1, float f2, float tan_alpha)
     {
-        if(type == E_OCU::BLEND && Blending_env::predefined_op_id_fetch(Blending_env::U_OH) == -1){
-            gf = make_float2(0.f, 0.f);
-            return 0.f;
-        } else if (type == E_OCU::BULGE && Blending_env::predefined_op_id_fetch(Blending_env::B_OH) == -1){
+        if(type == E_OCU::BULGE && Blending_env::predefined_op_id_fetch(Blending_env::B_OH) == -1){
             gf = make_float2(0.f, 0.f);
             return 0.f;
         }
@@ -176,7 +172,7 @@ struct OCU {
 template <E_OCU::Union_t type>
 struct UltimateOperator{
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float f(float f1, float f2, const Vec3_cu& gf1, const Vec3_cu& gf2){
         Vec3_cu gf1n = gf1.normalized();
         Vec3_cu gf2n = gf2.normalized();
@@ -187,7 +183,7 @@ struct UltimateOperator{
     }
 
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     Vec3_cu gf(float f1, float f2, const Vec3_cu& gf1, const Vec3_cu& gf2){
         Vec3_cu gf1n = gf1.normalized();
         Vec3_cu gf2n = gf2.normalized();
@@ -197,7 +193,7 @@ struct UltimateOperator{
         return gf1 * gd.x + gf2 * gd.y;
     }
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float fngf(Vec3_cu& gf, float f1, float f2, const Vec3_cu& gf1, const Vec3_cu& gf2){
         Vec3_cu gf1n = gf1.normalized();
         Vec3_cu gf2n = gf2.normalized();
@@ -215,7 +211,7 @@ struct UltimateOperator{
 
 struct Base_4D_bulge{
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float f(float f1, float f2, float tan_alpha, float strength)
     {
         if(f1 <= 0.5f & f2 <= 0.5f)
@@ -239,7 +235,7 @@ struct Base_4D_bulge{
         return fmaxf(f1, f2);
     }
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float2 gf(float f1, float f2, float tan_alpha, float strength)
     {
         if(f1 <= 0.5f & f2 <= 0.5f)
@@ -268,7 +264,7 @@ struct Base_4D_bulge{
     }
 
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float fngf(float2& gf, float f1, float f2, float tan_alpha, float strength)
     {
         if(f1 <= 0.5f & f2 <= 0.5f)
@@ -312,7 +308,7 @@ struct Base_4D_bulge{
 // =============================================================================
 
 struct Static_4D_bulge{
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float f(float f1, float f2, const Vec3_cu& gf1, const Vec3_cu& gf2){
         Vec3_cu gf1n = gf1.normalized();
         Vec3_cu gf2n = gf2.normalized();
@@ -323,7 +319,7 @@ struct Static_4D_bulge{
     }
 
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     Vec3_cu gf(float f1, float f2, const Vec3_cu& gf1, const Vec3_cu& gf2){
         Vec3_cu gf1n = gf1.normalized();
         Vec3_cu gf2n = gf2.normalized();
@@ -333,7 +329,7 @@ struct Static_4D_bulge{
         return gf1 * gd.x + gf2 * gd.y;
     }
 
-    __device__ static inline
+    IF_CUDA_DEVICE_HOST static inline
     float fngf(Vec3_cu& gf, float f1, float f2, const Vec3_cu& gf1, const Vec3_cu& gf2){
         Vec3_cu gf1n = gf1.normalized();
         Vec3_cu gf2n = gf2.normalized();
@@ -3,6 +3,7 @@
 #include "controller_tools.hpp"
 #include "controller.hpp"
 #include "funcs.hpp"
+#include "thread_utils.hpp"
 
 #include <iostream>
 #include <cassert>
@@ -336,211 +337,232 @@ void gen_polar_profile(Profile_polar::Discreet& discreet_curve,
 
 // -----------------------------------------------------------------------------
 
-void gen_custom_operator(const Profile_polar::Base& profile,
-                         const Opening::Base& opening,
-                         double range,
-                         int nb_samples_ocu,
-                         int nb_samples_alpha,
-                         float*& out_values,
-                         IBL::float2*& out_gradients)
+/// Compute the slice of the operator for the opening angle 'alpha'. Slices
+/// don't depend on each other. (see gen_custom_operator())
+/// @param values : the nb_samples_ocu^2 elements of the slice plus one
+/// @param gradient : the nb_samples_ocu^2 elements of the slice
+static void gen_operator_slice(const Profile_polar::Base& profile,
+                               const Opening::Base& opening,
+                               double range,
+                               int nb_samples_ocu,
+                               int nb_samples_alpha,
+                               int alpha,
+                               double* values,
+                               IBL::double2* gradient)
 {
-    const int size = nb_samples_ocu*nb_samples_ocu*nb_samples_alpha;
-    double*       values   = new double      [size];
-    IBL::double2* gradient = new IBL::double2[size];
+    const int slice = nb_samples_ocu*nb_samples_ocu;
 
-    // Init arrays
-    for(int i = 0; i < size; i++){
+    // Init arrays. The gradient on the last row reads one value past the
+    // slice, which used to be the first (not yet computed) value of the next
+    // slice: keep it to -1.
+    for(int i = 0; i < slice; i++){
         values  [i] = -1.;
         gradient[i] = IBL::make_double2(0., 0.);
     }
+    values[slice] = -1.;
 
-    //float step_i = range / (float)(nb_samples_ocu-1);
-    for(int alpha = 0; alpha < nb_samples_alpha; alpha++) // Fill values by opening angles
-    {
-        int offset = alpha * nb_samples_ocu*nb_samples_ocu;
-        values[offset] = 0.;
-        double tan_alpha = alpha / (double)(nb_samples_alpha-1.);
+    values[0] = 0.;
+    double tan_alpha = alpha / (double)(nb_samples_alpha-1.);
 
-        for(int i = 0; i < nb_samples_ocu; i++)
-        {
-            double x = ((double)i * range) / (double)(nb_samples_ocu-1);
-            double x2 = opening.f((float) x, (float) tan_alpha);
+    for(int i = 0; i < nb_samples_ocu; i++)
+    {
+        double x = ((double)i * range) / (double)(nb_samples_ocu-1);
+        double x2 = opening.f((float) x, (float) tan_alpha);
 
-            for(int j = 0; j < ((x2 * (double)(nb_samples_ocu-1)) / range); j++){
-                assert((i + j*nb_samples_ocu + offset) < size);
-                assert((j + i*nb_samples_ocu + offset) < size);
+        for(int j = 0; j < ((x2 * (double)(nb_samples_ocu-1)) / range); j++){
+            assert((i + j*nb_samples_ocu) < slice);
+            assert((j + i*nb_samples_ocu) < slice);
 
-                values[i + j*nb_samples_ocu + offset] = x;
-                values[j + i*nb_samples_ocu + offset] = x;
-            }
-            //printf("i = %d\n",i);fflush(stdout);
-            double c0 = x2;
-            double xtmp = ((double)(i+1) * range) / (double)(nb_samples_ocu-1);
-            double c1 = opening.f((float) xtmp, (float) tan_alpha);
-
-            int k0 = (int)floor( ((x2 * (double)(nb_samples_ocu-1)) / range) ) /* x2 * (nb_samples_ocu-1)*/;
-            int k1 = i;
-            for(int ik = k0; ik <= k1; ik++){
-                double xk = ((double)ik * range) / (double)(nb_samples_ocu-1);
-                for(int jk = k0; jk <= k1; jk++){
-                    double yk = ((double)jk * range) / (double)(nb_samples_ocu-1);
-                    double dx = xk - c0;
-                    double dy = yk - c0;
-                    double tan0 = (dx<dy)?dx/dy:(dy/dx);
-
-                    assert((ik + jk*nb_samples_ocu + offset) < size);
-                    if(values[ik + jk*nb_samples_ocu + offset] == -1.)
-                    {
-                        if(tan0 < 0.){
-                            values[ik + jk*nb_samples_ocu + offset] = (dx<dy)?yk:xk;
-                        } else {
-                            double r0 = sqrt(dx*dx + dy*dy);
-                            r0 /= profile.f((float) tan0);
-                            dx = xk - c1;
-                            dy = yk - c1;
-                            double tan1 = (dx<dy)?dx/dy:(dy/dx);
-                            double r1 = sqrt(dx*dx + dy*dy);
-                            r1 /= profile.f((float) tan1);
-
-                            if( (r0 >= (x - c0)) & (r1 <  (xtmp - c1)))
-                            {
-                                double d0 = r0 - (x - c0);
-                                double d1 = (xtmp - c1) - r1;
-                                double lbd = d1 / (d1 + d0);
-
-                                values[ik + jk*nb_samples_ocu + offset] = lbd * x + (1. - lbd) * xtmp;
-                            }
+            values[i + j*nb_samples_ocu] = x;
+            values[j + i*nb_samples_ocu] = x;
+        }
+        //printf("i = %d\n",i);fflush(stdout);
+        double c0 = x2;
+        double xtmp = ((double)(i+1) * range) / (double)(nb_samples_ocu-1);
+        double c1 = opening.f((float) xtmp, (float) tan_alpha);
+
+        int k0 = (int)floor( ((x2 * (double)(nb_samples_ocu-1)) / range) ) /* x2 * (nb_samples_ocu-1)*/;
+        int k1 = i;
+        for(int ik = k0; ik <= k1; ik++){
+            double xk = ((double)ik * range) / (double)(nb_samples_ocu-1);
+            for(int jk = k0; jk <= k1; jk++){
+                double yk = ((double)jk * range) / (double)(nb_samples_ocu-1);
+                double dx = xk - c0;
+                double dy = yk - c0;
+                double tan0 = (dx<dy)?dx/dy:(dy/dx);
+
+                assert((ik + jk*nb_samples_ocu) < slice);
+                if(values[ik + jk*nb_samples_ocu] == -1.)
+                {
+                    if(tan0 < 0.){
+                        values[ik + jk*nb_samples_ocu] = (dx<dy)?yk:xk;
+                    } else {
+                        double r0 = sqrt(dx*dx + dy*dy);
+                        r0 /= profile.f((float) tan0);
+                        dx = xk - c1;
+                        dy = yk - c1;
+                        double tan1 = (dx<dy)?dx/dy:(dy/dx);
+                        double r1 = sqrt(dx*dx + dy*dy);
+                        r1 /= profile.f((float) tan1);
+
+                        if( (r0 >= (x - c0)) & (r1 <  (xtmp - c1)))
+                        {
+                            double d0 = r0 - (x - c0);
+                            double d1 = (xtmp - c1) - r1;
+                            double lbd = d1 / (d1 + d0);
+
+                            values[ik + jk*nb_samples_ocu] = lbd * x + (1. - lbd) * xtmp;
                         }
                     }
-
                 }
+
             }
         }
+    }
 
-        // Building isos which are not connected to a max
-        double org = opening.f((float) range, (float) tan_alpha);
-        int   p0  = (int)floor( ((org * (double)(nb_samples_ocu-1)) / range) );
-        for(int i = p0; i < nb_samples_ocu; i++){
-            double xi = ((double)i * range) / (double)(nb_samples_ocu-1);
-            double dx = xi - org;
-            for(int j = p0; j < nb_samples_ocu; j++){
-                assert((i + j*nb_samples_ocu + offset) < size);
-                if(values[i + j*nb_samples_ocu + offset]==-1.){
-                    double xj = ((double)j * range) / (double)(nb_samples_ocu-1);
-                    double dy = xj - org;
-                    double r = sqrt(dx*dx + dy*dy);
-                    double tant = (dx<dy) ? (dx/dy) : (dy/dx);
-                    r /= profile.f((float) tant);
-                    values[i + j*nb_samples_ocu + offset] = r + org;
-                }
+    // Building isos which are not connected to a max
+    double org = opening.f((float) range, (float) tan_alpha);
+    int   p0  = (int)floor( ((org * (double)(nb_samples_ocu-1)) / range) );
+    for(int i = p0; i < nb_samples_ocu; i++){
+        double xi = ((double)i * range) / (double)(nb_samples_ocu-1);
+        double dx = xi - org;
+        for(int j = p0; j < nb_samples_ocu; j++){
+            assert((i + j*nb_samples_ocu) < slice);
+            if(values[i + j*nb_samples_ocu]==-1.){
+                double xj = ((double)j * range) / (double)(nb_samples_ocu-1);
+                double dy = xj - org;
+                double r = sqrt(dx*dx + dy*dy);
+                double tant = (dx<dy) ? (dx/dy) : (dy/dx);
+                r /= profile.f((float) tant);
+                values[i + j*nb_samples_ocu] = r + org;
             }
         }
+    }
 
-        // Smoothing values
+    // Smoothing values
 #if 1
-        for(int i = 0; i < nb_samples_ocu; i++){
-            for(int j = 0; j < nb_samples_ocu; j++){
-                assert((i + j * nb_samples_ocu + offset) < size);
-                double v = values[i + j *nb_samples_ocu + offset];
-                if(v == -1.)
-                {
-                    //printf("%d %d %d\n",alpha,i,j);
-                    double acc = 0.;
-                    int nb = 0;
-                    assert(((i-1) + j*nb_samples_ocu + offset) < size);
-                    double v0 = values[i-1 + j *nb_samples_ocu + offset];
-                    if(v0 > -1.){
-                        acc += v0;
-                        nb++;
-                    }
-                    assert(((i+1) + j*nb_samples_ocu + offset) < size);
-                    v0 = values[i+1 + j *nb_samples_ocu + offset];
-                    if(v0 > -1.){
-                        acc += v0;
-                        nb++;
-                    }
-                    assert((i + (j-1)*nb_samples_ocu + offset) < size);
-                    v0 = values[i + (j-1)*nb_samples_ocu + offset];
-                    if(v0 > -1.){
-                        acc += v0;
-                        nb++;
-                    }
-                    assert((i + (j+1)*nb_samples_ocu + offset) < size);
-                    v0 = values[i + (j+1)*nb_samples_ocu + offset];
-                    if(v0 > -1.){
-                        acc += v0;
-                        nb++;
-                    }
-                    values[i + j *nb_samples_ocu + offset] = acc/nb;
+    for(int i = 0; i < nb_samples_ocu; i++){
+        for(int j = 0; j < nb_samples_ocu; j++){
+            assert((i + j * nb_samples_ocu) < slice);
+            double v = values[i + j *nb_samples_ocu];
+            if(v == -1.)
+            {
+                //printf("%d %d %d\n",alpha,i,j);
+                double acc = 0.;
+                int nb = 0;
+                assert(((i-1) + j*nb_samples_ocu) < slice);
+                double v0 = values[i-1 + j *nb_samples_ocu];
+                if(v0 > -1.){
+                    acc += v0;
+                    nb++;
+                }
+                assert(((i+1) + j*nb_samples_ocu) < slice);
+                v0 = values[i+1 + j *nb_samples_ocu];
+                if(v0 > -1.){
+                    acc += v0;
+                    nb++;
+                }
+                assert((i + (j-1)*nb_samples_ocu) < slice);
+                v0 = values[i + (j-1)*nb_samples_ocu];
+                if(v0 > -1.){
+                    acc += v0;
+                    nb++;
+                }
+                assert((i + (j+1)*nb_samples_ocu) < slice);
+                v0 = values[i + (j+1)*nb_samples_ocu];
+                if(v0 > -1.){
+                    acc += v0;
+                    nb++;
                 }
+                values[i + j *nb_samples_ocu] = acc/nb;
             }
         }
+    }
 #endif
 
 
-        //compute gradient with finite differences
-        for(int i = 1; i < nb_samples_ocu-1; i++)
+    //compute gradient with finite differences
+    const double dl = (2. * range) / (double)(nb_samples_ocu-1);
+    for(int i = 1; i < nb_samples_ocu-1; i++)
+    {
+        for(int j = 1; j< nb_samples_ocu-1; j++)
         {
-            for(int j = 1; j< nb_samples_ocu-1; j++)
-            {
-                double dfx = values[i+1 + j*nb_samples_ocu + offset] -
-                            values[i-1 + j*nb_samples_ocu + offset];
-
-                double dfy = values[i + (j+1)*nb_samples_ocu + offset]-
-                            values[i + (j-1)*nb_samples_ocu + offset];
+            double dfx = values[i+1 + j*nb_samples_ocu] -
+                        values[i-1 + j*nb_samples_ocu];
 
-                double dl = (2. * range) / (double)(nb_samples_ocu-1);
+            double dfy = values[i + (j+1)*nb_samples_ocu]-
+                        values[i + (j-1)*nb_samples_ocu];
 
-                IBL::double2 gf = IBL::make_double2(dfx / dl, dfy / dl);
-                gradient[i + j * nb_samples_ocu + offset] = gf;
-            }
+            IBL::double2 gf = IBL::make_double2(dfx / dl, dfy / dl);
+            gradient[i + j * nb_samples_ocu] = gf;
         }
+    }
 
-        for(int i = 1; i < nb_samples_ocu-1; i++)
-        {
-
-            double dy = values[nb_samples_ocu*nb_samples_ocu-1  -i   + offset] -
-                       values[nb_samples_ocu*(nb_samples_ocu-1)-1-i + offset];
+    for(int i = 1; i < nb_samples_ocu-1; i++)
+    {
 
-            double dx = values[nb_samples_ocu*nb_samples_ocu  -i   + offset] -
-                       values[nb_samples_ocu*nb_samples_ocu-2-i + offset];
+        double dy = values[nb_samples_ocu*nb_samples_ocu-1  -i] -
+                   values[nb_samples_ocu*(nb_samples_ocu-1)-1-i];
 
-            IBL::double2 gf = IBL::make_double2(dx * 0.5 * (nb_samples_ocu - 1), dy *(nb_samples_ocu - 1));
-            gradient[nb_samples_ocu*nb_samples_ocu-1-i + offset] = gf;
+        double dx = values[nb_samples_ocu*nb_samples_ocu  -i] -
+                   values[nb_samples_ocu*nb_samples_ocu-2-i];
 
-            dx = values[nb_samples_ocu*nb_samples_ocu-1-i*nb_samples_ocu + offset] -
-                 values[nb_samples_ocu*nb_samples_ocu-2-i*nb_samples_ocu + offset];
+        IBL::double2 gf = IBL::make_double2(dx * 0.5 * (nb_samples_ocu - 1), dy *(nb_samples_ocu - 1));
+        gradient[nb_samples_ocu*nb_samples_ocu-1-i] = gf;
 
-            dy = values[nb_samples_ocu*(nb_samples_ocu+1)-1-i*nb_samples_ocu + offset] -
-                 values[nb_samples_ocu*(nb_samples_ocu-1)-1-i*nb_samples_ocu + offset];
+        dx = values[nb_samples_ocu*nb_samples_ocu-1-i*nb_samples_ocu] -
+             values[nb_samples_ocu*nb_samples_ocu-2-i*nb_samples_ocu];
 
-            gf = IBL::make_double2(dx * (nb_samples_ocu - 1), dy * 0.5 * (nb_samples_ocu - 1));
-            gradient[nb_samples_ocu*nb_samples_ocu-1-i*nb_samples_ocu + offset] = gf;
+        dy = values[nb_samples_ocu*(nb_samples_ocu+1)-1-i*nb_samples_ocu] -
+             values[nb_samples_ocu*(nb_samples_ocu-1)-1-i*nb_samples_ocu];
 
-            gradient[i                + offset] = IBL::make_double2(1.,0.);
-            gradient[i*nb_samples_ocu + offset] = IBL::make_double2(0.,1.);
-        }
+        gf = IBL::make_double2(dx * (nb_samples_ocu - 1), dy * 0.5 * (nb_samples_ocu - 1));
+        gradient[nb_samples_ocu*nb_samples_ocu-1-i*nb_samples_ocu] = gf;
 
-        //gradient values at corners
-        gradient[nb_samples_ocu-1                  + offset] = IBL::make_double2(1.,0.);
-        gradient[(nb_samples_ocu-1)*nb_samples_ocu + offset] = IBL::make_double2(0.,1.);
-        gradient[nb_samples_ocu*nb_samples_ocu-1   + offset] = IBL::make_double2(0.620133, 0.620133);
+        gradient[i] = IBL::make_double2(1.,0.);
+        gradient[i*nb_samples_ocu] = IBL::make_double2(0.,1.);
+    }
 
-        //printf("\r %f per cents done",(alpha+1)*100.f/NB_SAMPLES_ALPHA);fflush(stdout);//-------------
+    //gradient values at corners
+    gradient[nb_samples_ocu-1] = IBL::make_double2(1.,0.);
+    gradient[(nb_samples_ocu-1)*nb_samples_ocu] = IBL::make_double2(0.,1.);
+    gradient[nb_samples_ocu*nb_samples_ocu-1] = IBL::make_double2(0.620133, 0.620133);
+}
 
-    } // END FOR( NB_SAMPLES_ALPHA )
+// -----------------------------------------------------------------------------
 
-    out_values    = new float      [size];
-    out_gradients = new IBL::float2[size];
+void gen_custom_operator(const Profile_polar::Base& profile,
+                         const Opening::Base& opening,
+                         double range,
+                         int nb_samples_ocu,
+                         int nb_samples_alpha,
+                         float*& out_values,
+                         IBL::float2*& out_gradients)
+{
+    const int slice = nb_samples_ocu*nb_samples_ocu;
+    out_values    = new float      [slice*nb_samples_alpha];
+    out_gradients = new IBL::float2[slice*nb_samples_alpha];
 
-    // Init arrays
-    for(int i = 0; i < size; i++){
-        out_values   [i]   = (float)values  [i];
-        out_gradients[i].x = (float)gradient[i].x;
-        out_gradients[i].y = (float)gradient[i].y;
-    }
-    delete [] values;
-    delete [] gradient;
+    // Fill values by opening angles. Each thread computes its slices in double
+    // precision in its own buffers, then converts them to the output.
+    Thread_utils::parallel_for(0, nb_samples_alpha, 1, [&](int begin, int end)
+    {
+        std::vector<double>       values  (slice + 1);
+        std::vector<IBL::double2> gradient(slice);
+        for(int alpha = begin; alpha < end; alpha++)
+        {
+            gen_operator_slice(profile, opening, range,
+                               nb_samples_ocu, nb_samples_alpha, alpha,
+                               values.data(), gradient.data());
+
+            const int offset = alpha * slice;
+            for(int i = 0; i < slice; i++){
+                out_values   [offset + i]   = (float)values  [i];
+                out_gradients[offset + i].x = (float)gradient[i].x;
+                out_gradients[offset + i].y = (float)gradient[i].y;
+            }
+        }
+    });
 }
 
 // -----------------------------------------------------------------------------
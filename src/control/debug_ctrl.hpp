@@ -15,7 +15,8 @@ public:
         _smooth2_iter(1),
         _smooth1_force(1.f),
         _smooth2_force(0.5f),
-        _slope_smooth_weight(2)
+        _slope_smooth_weight(2),
+        _host_evaluation(false)
     {
     }
 
@@ -29,6 +30,10 @@ public:
     float _smooth1_force;
     float _smooth2_force;
     int _slope_smooth_weight;
+
+    /// Evaluate the skeleton's potential with the CPU
+    /// (Skeleton_env::compute_potential_cpu()) instead of CUDA kernels
+    bool _host_evaluation;
 };
 
 #endif // DEBUG_CTRL_HPP__
@@ -4,13 +4,35 @@
 namespace Skeleton_env {
 // =============================================================================
 
+/// Finest resolution of the grid when none is specified
+static const int DEFAULT_RES = 64;
+
+/// Bones are inserted in the cells with their bbox enlarged by this fraction
+/// of its diagonal on each side, so that the cells stay valid while joints
+/// bend a little. @see Grid::update_grid()
+static const float CELL_MARGIN = 0.1f;
+
+// -----------------------------------------------------------------------------
+
+/// @return the depth of an octree with a finest resolution of at least 'res'
+static int res_to_depth(int res)
+{
+    int depth = 0;
+    while( (1 << depth) < res )
+        depth++;
+    return depth;
+}
+
+// -----------------------------------------------------------------------------
+
 Grid::Grid(const Tree* tree, int res) :
-    _tree(tree)
+    _tree(tree),
+    _world_to_grid( Transfo::identity() ),
+    _root(-1)
 {
     if(res == -1)
-        res = 20;
-    _res = res;
-    _grid_cells.resize( _res * _res * _res);
+        res = DEFAULT_RES;
+    _depth = res_to_depth( res );
     build_grid();
 }
 
@@ -19,40 +41,47 @@ Grid::Grid(const Tree* tree, int res) :
 void Grid::set_res(int res)
 {
     assert( res > 0);
-    _grid_cells.clear();
-    _res = res;
-    _grid_cells.resize( res * res * res);
+    _depth = res_to_depth( res );
     build_grid();
 }
 
 // -----------------------------------------------------------------------------
 
-int Grid::res() const { return _res; }
-
-// -----------------------------------------------------------------------------
-
-Vec3i_cu Grid::index_cell( Vec3_cu p ) const
+void Grid::build_grid()
 {
-    return _pos.index_grid_cell(Vec3i_cu(res(), res(), res()), p);
-}
+    _nodes.assign(1, -1);
+    _leaves.clear();
+    _leaf_ids.clear();
+    _bones.clear();
+    _world_to_grid = Transfo::identity();
+    _root = -1;
 
-// -----------------------------------------------------------------------------
-
-Vec3_cu Grid::fsize_grid() const {
-    assert(_pos.is_valid());
-    return _pos.pmax - _pos.pmin;
-}
+    // Same as _tree->bbox() but with the cached object space bboxes
+    // enlarged by the margin
+    _pos = BBox_cu();
+    for(auto bone: _tree->bones())
+    {
+        Bone_frame& f = update_frame(bone);
+        const BBox_cu bb = world_bbox(f);
+        const float m = (bb.pmax - bb.pmin).norm() * CELL_MARGIN;
+        f._cell_bbox = BBox_cu(bb.pmin - Vec3_cu(m, m, m), bb.pmax + Vec3_cu(m, m, m));
+        _pos = _pos.bbox_union( f._cell_bbox );
 
-// -----------------------------------------------------------------------------
+        // The cells follow the root with the smallest id
+        const Bone::Id id = bone->get_bone_id();
+        if( _tree->parent(id) < 0 && (_root < 0 || id < _root) )
+            _root = id;
 
-Vec3_cu Grid::cell_size() const { return fsize_grid() / (float)_res;}
+        const bool in_cells = bone->get_type() != EBone::SSD &&
+                !(bone->get_type() == EBone::HRBF && bone->get_hrbf().empty()) &&
+                bb.is_valid();
 
-// -----------------------------------------------------------------------------
+        if( in_cells )
+            _bones.push_back( std::make_pair(id, f._cell_bbox) );
+        else
+            f._cell_bbox = BBox_cu();
+    }
 
-void Grid::build_grid()
-{
-    reset_grid();
-    _pos = _tree->bbox();
     // Slightly enlarge bbox to avoid being perfectly aligned with bone bbox
     const float e = 0.00001f;
     const Vec3_cu eps(e, e, e);
@@ -63,59 +92,171 @@ void Grid::build_grid()
     if(!_pos.is_valid())
         return;
 
-    for(auto bone: _tree->bones())
-        add_bone(bone);
+    std::vector<int> bones( _bones.size() );
+    for(unsigned i = 0; i < bones.size(); ++i)
+        bones[i] = i;
+
+    subdivide(0, _pos.pmin, _pos.pmax - _pos.pmin, bones, 0);
 }
 
-void Grid::reset_grid()
+// -----------------------------------------------------------------------------
+
+/// @return true if the closed boxes 'bb' and (pmin, pmin+size) intersect
+static bool overlap(const BBox_cu& bb, const Point_cu& pmin, const Vec3_cu& size)
 {
-    int total_bones = _tree->bones().size();
-    for( unsigned i = 0; i < _grid_cells.size(); ++i) {
-        _grid_cells[i].clear();
-        _grid_cells[i].reserve(total_bones);
-    }
-    _filled_cells.assign(_grid_cells.size(), false);
+    const Point_cu pmax = pmin + size;
+    return bb.pmin.x <= pmax.x && bb.pmax.x >= pmin.x &&
+           bb.pmin.y <= pmax.y && bb.pmax.y >= pmin.y &&
+           bb.pmin.z <= pmax.z && bb.pmax.z >= pmin.z;
 }
 
-void Grid::add_bone(const Bone *bone)
+// -----------------------------------------------------------------------------
+
+void Grid::subdivide(int node,
+                     const Point_cu& pmin,
+                     const Vec3_cu& size,
+                     const std::vector<int>& bones,
+                     int depth)
 {
-    if( bone->get_type() == EBone::SSD)
+    if( bones.empty() ){
+        _nodes[node] = -1;
         return;
+    }
+
+    // Look up which bones overlap each child. Children are computed exactly
+    // like Skeleton_env::fetch_grid_blending_list_offset() does to avoid
+    // rounding discrepancies.
+    const Vec3_cu half = size * 0.5f;
+    std::vector<int> child_bones[8];
+    Point_cu child_pmin[8];
+    bool split = false;
+    if( depth < _depth )
+    {
+        for(int c = 0; c < 8; ++c)
+        {
+            child_pmin[c] = pmin;
+            if( c & 1 ) child_pmin[c].x += half.x;
+            if( c & 2 ) child_pmin[c].y += half.y;
+            if( c & 4 ) child_pmin[c].z += half.z;
+
+            for(int b: bones)
+                if( overlap(_bones[b].second, child_pmin[c], half) )
+                    child_bones[c].push_back( b );
 
-    if( bone->get_type() == EBone::HRBF){
-        if( bone->get_hrbf().empty() )
-            return;
+            split = split || child_bones[c].size() < bones.size();
+        }
     }
 
-    // Lookup every cell inside the bbox and add the bone id to these cells.
-    BBox_cu bb = bone->get_bbox();
-    if( !bb.is_valid() ) return;
+    // Splitting wouldn't reduce the number of bones to evaluate
+    if( !split ){
+        _nodes[node] = leaf_to_node( add_leaf(bones) );
+        return;
+    }
+
+    const int first_child = _nodes.size();
+    _nodes.resize(first_child + 8);
+    _nodes[node] = first_child;
+    for(int c = 0; c < 8; ++c)
+        subdivide(first_child + c, child_pmin[c], half, child_bones[c], depth + 1);
+}
+
+// -----------------------------------------------------------------------------
+
+int Grid::add_leaf(const std::vector<int>& bones)
+{
+    std::vector<Bone::Id> ids( bones.size() );
+    for(unsigned i = 0; i < bones.size(); ++i)
+        ids[i] = _bones[ bones[i] ].first;
+
+    auto it = _leaf_ids.find( ids );
+    if( it != _leaf_ids.end() )
+        return it->second;
 
-    Vec3i_cu min_idx = index_cell( bb.pmin ).clamp(0, _res-1);
-    Vec3i_cu max_idx = index_cell( bb.pmax ).clamp(0, _res-1);
+    const int leaf = _leaves.size();
+    _leaves.push_back( ids );
+    _leaf_ids[ids] = leaf;
+    return leaf;
+}
 
-    Vec3i_cu sub_size = max_idx - min_idx + 1;
-    assert(sub_size.product() >= 0);
+// -----------------------------------------------------------------------------
 
+/// @return true if 'inner' lies inside the closed box 'outer'
+static bool contains(const BBox_cu& outer, const BBox_cu& inner)
+{
+    return outer.pmin.x <= inner.pmin.x && inner.pmax.x <= outer.pmax.x &&
+           outer.pmin.y <= inner.pmin.y && inner.pmax.y <= outer.pmax.y &&
+           outer.pmin.z <= inner.pmin.z && inner.pmax.z <= outer.pmax.z;
+}
 
-    Vec3i_cu grid_size(_res, _res, _res);
-    Idx3_cu offset(grid_size, min_idx);
-    for(Idx3_cu idx(sub_size, 0); idx.is_in(); ++idx)
+// -----------------------------------------------------------------------------
+
+bool Grid::update_grid()
+{
+    // The cells follow the root bone: express every bone relatively to it
+    Transfo world_to_grid = Transfo::identity();
+    if( _root >= 0 )
     {
-        int i = (offset + idx.to_vec3i()).to_linear();
-        assert(i < grid_size.product() );
-        assert(i >= 0);
-        _filled_cells[i] = true;
-        _grid_cells[i].push_back( bone->get_bone_id() );
+        auto it = _frames.find( _root );
+        if( it == _frames.end() ){
+            build_grid();
+            return true;
+        }
+        const Bone* root = _tree->bone( _root );
+        world_to_grid = (root->get_world_space_matrix() * it->second._tr.full_invert()).full_invert();
     }
 
-    if( sub_size.product() == 0)
+    for(auto bone: _tree->bones())
     {
-        int i = offset.to_linear();
-        assert( offset.is_in() );
-        _filled_cells[i] = true;
-        _grid_cells[i].push_back(bone->get_bone_id());
+        auto it = _frames.find( bone->get_bone_id() );
+        const bool shape_changed = it == _frames.end() ||
+                it->second._shape_sequence != bone->get_shape_sequence();
+
+        if( shape_changed ){
+            build_grid();
+            return true;
+        }
+
+        const Bone_frame& f = it->second;
+        if( !f._cell_bbox.is_valid() )
+            continue;
+
+        // The cells are still conservative as long as the bone stays in the
+        // enlarged bbox it was inserted with
+        OBBox_cu obbox = f._obbox;
+        obbox._tr = world_to_grid * bone->get_world_space_matrix() * obbox._tr;
+        if( !contains(f._cell_bbox, obbox.to_bbox()) ){
+            build_grid();
+            return true;
+        }
     }
+
+    _world_to_grid = world_to_grid;
+    return false;
 }
 
+// -----------------------------------------------------------------------------
+
+Grid::Bone_frame& Grid::update_frame(const Bone* bone)
+{
+    Bone_frame& f = _frames[bone->get_bone_id()];
+    if( f._shape_sequence != bone->get_shape_sequence() )
+    {
+        f._obbox = bone->get_obbox(false, false);
+        f._shape_sequence = bone->get_shape_sequence();
+    }
+    f._tr = bone->get_world_space_matrix();
+    return f;
+}
+
+// -----------------------------------------------------------------------------
+
+BBox_cu Grid::world_bbox(const Bone_frame& f) const
+{
+    OBBox_cu obbox = f._obbox;
+    obbox._tr = f._tr * obbox._tr;
+    return obbox.to_bbox();
+}
+
+// -----------------------------------------------------------------------------
+
 }// NAMESPACE END Skeleton_env  ================================================
@@ -4,15 +4,37 @@
 #include "idx3_cu.hpp"
 #include "vec3i_cu.hpp"
 #include "tree.hpp"
+#include "transfo.hpp"
 #include <vector>
 #include <deque>
 #include <list>
 #include <set>
+#include <map>
 
 // =============================================================================
 namespace Skeleton_env {
 // =============================================================================
 
+/** @struct Grid
+    @brief Adaptive sparse grid (octree) over the bones of a skeleton.
+
+    A cell is split in eight as long as one of its children overlaps less
+    bones than itself, down to the finest resolution res(). Empty regions and
+    regions covered by the same bones stay coarse while small joints like
+    fingers get fine cells, without paying for a dense res^3 grid over the
+    whole skeleton bbox.
+
+    The octree is flattened in '_nodes' to be uploaded as is to the GPU:
+    @li _nodes[i] >= 0 : inner node, its 8 children are stored at
+    _nodes[_nodes[i] + child] with child = x | (y << 1) | (z << 2)
+    @li _nodes[i] == -1 : empty leaf
+    @li _nodes[i] <= -2 : leaf overlapped by the bones
+    _leaves[ node_to_leaf(_nodes[i]) ]
+
+    _nodes[0] is the root and covers bbox(). Children of a cell of size 's'
+    and lower corner 'p' have size s*0.5 and their lower corner is p plus
+    s*0.5 along the axes where their bit is set.
+*/
 struct Grid {
 
     Grid(const Tree* tree, int res=-1);
@@ -22,49 +44,90 @@ struct Grid {
     /// Call this each time the tree data/position changes
     void build_grid();
 
+    /// Update Grid's datas after bones moved.
+    /// Cells follow the root bone and bones are inserted with an enlarged
+    /// bbox: as long as every bone, relatively to the root, stays in the
+    /// bbox it was inserted with since the last build_grid() cells are kept
+    /// as is and only world_to_grid() changes. This covers rigid motions of
+    /// the whole skeleton and small articulations of the joints. Otherwise
+    /// the grid is rebuilt with build_grid().
+    /// @return true if cells have been rebuilt
+    bool update_grid();
+
     //--------------------------------------------------------------------------
     /// @name Accessors
     //--------------------------------------------------------------------------
 
-    /// Change the resolution x=y=z=res of the grid
+    /// Change the finest resolution x=y=z=res of the grid.
+    /// 'res' is rounded up to the next power of two
     void set_res(int res);
 
-    /// resolution of the grid res^3 = x.y.z
-    int res() const;
+    /// finest resolution of the grid (2^depth())
+    int res() const { return 1 << _depth; }
 
-    /// 3d position to grid integer index
-    Vec3i_cu index_cell( Vec3_cu p ) const;
+    /// Maximal depth of the octree
+    int depth() const { return _depth; }
 
-    /// Total size in the scene of the grid;
-    Vec3_cu fsize_grid() const;
+    BBox_cu bbox() const { return _pos; }
 
-    /// x, y and z cell size of the grid
-    Vec3_cu cell_size() const;
+    /// Transformation from world space to the space the grid cells and bbox()
+    /// are expressed in. Points must be transformed with it before looking
+    /// up the cells
+    const Transfo& world_to_grid() const { return _world_to_grid; }
 
-    BBox_cu bbox() const { return _pos; }
+    /// Encode a leaf index into a node value of '_nodes'
+    static int leaf_to_node(int leaf) { return -leaf - 2; }
+
+    /// Decode a leaf node value of '_nodes' (must be <= -2)
+    static int node_to_leaf(int node) { return -node - 2; }
 
     //--------------------------------------------------------------------------
     /// @name Datas
     //--------------------------------------------------------------------------
 
-    /// 3D grid stored linearly of size _res*_res*_res.
-    /// Each cell contains a list of bones that intersects it
-    std::vector< std::vector<Bone::Id> > _grid_cells;
+    /// Flattened octree. @see Grid
+    std::vector<int> _nodes;
 
-    /// Indices of the cells empty not empty.
-    std::vector<bool> _filled_cells;
+    /// Bones that overlap each leaf, ordered as in the tree.
+    /// Leaves overlapped by the same bones share the same list.
+    std::vector< std::vector<Bone::Id> > _leaves;
 
 private:
 
+    /// Bone's bbox in its local frame and bone's frame when cells were built
+    struct Bone_frame {
+        Bone_frame() : _shape_sequence(0) { }
+        uint64_t _shape_sequence; ///< Bone::get_shape_sequence() of '_obbox'
+        OBBox_cu _obbox;          ///< bbox in bone's object space
+        Transfo  _tr;             ///< bone's world transformation
+        /// Enlarged world bbox the bone was inserted in the cells with
+        /// (invalid if not inserted)
+        BBox_cu  _cell_bbox;
+    };
+
     //--------------------------------------------------------------------------
     /// @name Class tools
     //--------------------------------------------------------------------------
 
-    /// clear _filled_cells and list of bones for each cell in _grid_cells
-    void reset_grid();
+    /// Recompute the object space bbox of 'bone' if its shape changed
+    /// and set its frame to the current bone's world transformation
+    Bone_frame& update_frame(const Bone* bone);
+
+    /// @return axis aligned bbox of the bone in world space when cells were
+    /// built
+    BBox_cu world_bbox(const Bone_frame& f) const;
 
-    /// Add a bone to the cell the bounding box intersects
-    void add_bone(const Bone *bone);
+    /// Fill _nodes[node] for the cell (pmin, size) overlapped by the bones
+    /// _bones[ bones[i] ], and recursively its children if it needs to be
+    /// split.
+    void subdivide(int node,
+                   const Point_cu& pmin,
+                   const Vec3_cu& size,
+                   const std::vector<int>& bones,
+                   int depth);
+
+    /// @return index in '_leaves' of the list of bones _bones[ bones[i] ]
+    int add_leaf(const std::vector<int>& bones);
 
     //--------------------------------------------------------------------------
     /// @name Attributes
@@ -73,11 +136,30 @@ private:
     /// Associated tree to the grid
     const Tree* _tree;
 
-    /// x, y resolutions of the grid
-    int _res;
+    /// maximal depth of the octree
+    int _depth;
 
     ///  position and length of the grid represented with a bbox.
     BBox_cu _pos;
+
+    /// @see world_to_grid()
+    Transfo _world_to_grid;
+
+    /// Root bone the cells follow (-1 if none)
+    Bone::Id _root;
+
+    /// Object space bboxes of the bones. Computing a bone bbox is expensive
+    /// for HRBFs so we only do it when its shape changes.
+    /// _frames[bone_id] = bone_frame
+    std::map<Bone::Id, Bone_frame> _frames;
+
+    /// @name Temporaries of build_grid()
+    /// @{
+    /// Bones to be inserted in the grid and their enlarged world space bbox
+    std::vector<std::pair<Bone::Id, BBox_cu> > _bones;
+    /// Index in '_leaves' of every list of bones
+    std::map<std::vector<Bone::Id>, int> _leaf_ids;
+    /// @}
 };
 
 
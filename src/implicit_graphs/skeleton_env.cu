@@ -5,10 +5,12 @@
 #include "grid.hpp"
 #include "tree_cu.hpp"
 #include "tree.hpp"
+#include "blending_env.hpp"
 #include <list>
 #include <deque>
 #include <map>
 #include <set>
+#include <algorithm>
 
 // =============================================================================
 namespace Skeleton_env {
@@ -32,6 +34,7 @@ texture<int4, 1, cudaReadModeElementType> tex_blending_list;
 texture<int4, 1, cudaReadModeElementType> tex_grid_list;
 texture<int, 1, cudaReadModeElementType> tex_grid;
 texture<float4, 1, cudaReadModeElementType> tex_grid_bbox;
+texture<float4, 1, cudaReadModeElementType> tex_grid_transfo;
 texture<int2, 1, cudaReadModeElementType> tex_offset;
 texture<float, 1, cudaReadModeElementType> tex_bulge_strength;
 texture<int, 1, cudaReadModeElementType> tex_bone_type;
@@ -48,6 +51,19 @@ texture<int   , 1, cudaReadModeElementType> tex_bone_precomputed;
  * @endcode
 */
 
+/// Region reserved for a skeleton inside one of the concatenated arrays.
+/// Reserving a bit more than needed allows to update a skeleton in place
+/// without moving the other skeletons (and rebinding every textures).
+struct Slot {
+    Slot() : offset(0), size(0), capacity(0) { }
+
+    bool fits() const { return size <= capacity; }
+
+    int offset;   ///< index of the first element in the concatenated array
+    int size;     ///< number of elements actually used
+    int capacity; ///< number of elements reserved
+};
+
 class SkeletonEnv
 {
 public:
@@ -62,6 +78,33 @@ public:
     Grid *h_grid;
 
     Tree_cu *h_tree_cu_instance;
+
+    /// Host data changed since the last update_device()
+    bool dirty;
+
+    /// Only the grid frame (Grid::world_to_grid()) changed since the last
+    /// update_device()
+    bool frame_dirty;
+
+    /// @name GPU layout of this skeleton alone
+    /// Bone indices and offsets are relative to the slots below.
+    /// @{
+    std::vector<Cluster_cu>   blending_list;
+    std::vector<Cluster_data> cluster_data;
+    /// Grid::_nodes with leaves pointing to 'grid_list' instead of
+    /// Grid::_leaves
+    std::vector<int>          grid;
+    std::vector<Cluster_cu>   grid_list;
+    std::vector<Cluster_data> grid_data;
+    /// @}
+
+    /// @name Regions reserved in the concatenated arrays
+    /// @{
+    Slot bone_slot;      ///< in hd_bone_arrays
+    Slot list_slot;      ///< in hd_blending_list and hd_cluster_data
+    Slot grid_slot;      ///< in hd_grid
+    Slot grid_list_slot; ///< in hd_grid_blending_list and hd_grid_data
+    /// @}
 };
 
 std::deque<SkeletonEnv *> h_envs;
@@ -70,12 +113,16 @@ Cuda_utils::HD_Array<Cluster_cu> hd_grid_blending_list;
 
 /// Concatenated datas corresponding to clusters listed hd_grid_blending_list
 Cuda_utils::HD_Array<Cluster_data> hd_grid_data;
-/// Table of indirection which maps grid cells to blending list.
-/// hd_grid[ hd_offset[Skel_id].grid_data + cell_idx] == offset in hd_grid_blending_list or -1 if empty cell
+/// Concatenated flattened octrees (see Grid) which map grid cells to blending list.
+/// hd_grid[ hd_offset[Skel_id].grid_data + node] == index of the first child
+/// relative to hd_offset[Skel_id].grid_data, -1 if empty leaf or
+/// Grid::leaf_to_node( offset in hd_grid_blending_list )
 Cuda_utils::HD_Array<int> hd_grid;
 
 Cuda_utils::HD_Array<float4> hd_grid_bbox;
 
+Cuda_utils::HD_Array<float4> hd_grid_transfo;
+
 /// d_offset[Skel_id] == offset in lists or grid
 Cuda_utils::HD_Array<Offset>  hd_offset; // maybe we should cut in half offset and allocate it in advance at each new skeleton instances
 
@@ -95,6 +142,8 @@ SkeletonEnv::SkeletonEnv()
     h_tree = NULL;
     h_tree_cu_instance = NULL;
     h_grid = NULL;
+    dirty = true;
+    frame_dirty = false;
 }
 
 SkeletonEnv::~SkeletonEnv()
@@ -124,6 +173,7 @@ void bind()
     hd_grid              .device_array().bind_tex( tex_grid            );
     hd_grid_blending_list.device_array().bind_tex( tex_grid_list       );
     hd_grid_bbox         .device_array().bind_tex( tex_grid_bbox       );
+    hd_grid_transfo      .device_array().bind_tex( tex_grid_transfo    );
 }
 
 // -----------------------------------------------------------------------------
@@ -141,6 +191,7 @@ void unbind()
     CUDA_SAFE_CALL( cudaUnbindTexture(&tex_grid)             );
     CUDA_SAFE_CALL( cudaUnbindTexture(&tex_grid_list)        );
     CUDA_SAFE_CALL( cudaUnbindTexture(&tex_grid_bbox)        );
+    CUDA_SAFE_CALL( cudaUnbindTexture(&tex_grid_transfo)     );
 }
 
 // -----------------------------------------------------------------------------
@@ -148,19 +199,17 @@ void unbind()
 // =============================================================================
 
 /// @param env : SkeletonEnv
-/// @param cell_id : linear index of the 3d cell we want to extract the blending
-/// list
+/// @param bones_in_cell : bones of the grid leaf we want to extract the
+/// blending list
 /// @param blist : described the sub-skeleton in the
 int cell_to_blending_list(SkeletonEnv *env,
-                           int cell_id,
+                           const std::vector<Bone::Id>& bones_in_cell,
                            std::vector< std::vector<Cluster> * >& blist,
                            std::vector<std::vector<Cluster> > &blists)
 {
     // Note: if in each cell the list of bones is order from root to leaf
     // then blending list will be also ordered root to leaf
-    const Grid*    grid = env->h_grid;
     const Tree_cu* tree = env->h_tree_cu_instance;
-    const std::vector<Bone::Id> &bones_in_cell = grid->_grid_cells[cell_id];
 
     std::vector<bool> cluster_done(tree->_clusters.size(), false);
 
@@ -183,253 +232,424 @@ int cell_to_blending_list(SkeletonEnv *env,
 
 // -----------------------------------------------------------------------------
 
-/// Fill device array : hd_grid_blending_list; hd_offset (only grid_data field);
-/// hd_grid; hd_grid_data
-// XXX: This is fairly expensive, and we're updating every grid and not just the
-// one that was requested.  This is hard to fix right now, since all of the data
-// is put in the same array to allow putting it into a texture.  This doesn't really
-// need to be in a texture, and once that's changed this will be easier to fix.
-
-// This is only a temporary in update_device_grid.  Allocating this is a bit expensive
+// This is only a temporary in build_env_grid.  Allocating this is a bit expensive
 // and this is a hot code path, so keep it around and reuse the allocation.  We aren't
 // reentrant, and we won't be called from multiple threads, so this is safe.
 static std::vector< std::vector< std::vector<Cluster> * > > blist_per_cell;
 
-static void update_device_grid()
-{
-#if 1
-    assert( !binded );
-    hd_grid.fill( -1 );
+/// Skeletons were added, removed or resized: slots of every skeleton must be
+/// recomputed at the next update_device()
+static bool layout_dirty = true;
 
-    // Look up every grids and compute the cells blending list.
-    // update offset to access blending list as well
-    int offset = 0;
-    int grid_offset = 0;
-    int off_bone = 0;
+/// Extra room reserved for the grid and grid blending list of a skeleton
+/// (in percentage of their current size). The size of the octree and cells
+/// blending lists changes with the pose, this avoid moving every skeletons
+/// each time one of them grows a little.
+static const int GRID_LIST_SLACK = 50;
+
+// -----------------------------------------------------------------------------
 
-    for(unsigned grid_id = 0; grid_id < h_envs.size(); ++grid_id)
+/// Convert the tree of 'env' to the GPU layout.
+/// Fill env->blending_list; env->cluster_data and the sizes of the bone and
+/// list slots. Bones indices are relative to the skeleton.
+static void build_env_tree(SkeletonEnv* env)
+{
+    delete env->h_tree_cu_instance;
+    env->h_tree_cu_instance = new Tree_cu( env->h_tree );
+    const Tree_cu* tree_cu = env->h_tree_cu_instance;
+
+    const int size = tree_cu->_blending_list.size();
+    assert(size > 0); // unless we have no elements
+    env->blending_list.resize( size );
+    env->cluster_data. resize( size );
+    for(int i = 0; i < size; ++i)
     {
-        if(h_envs[grid_id] == NULL)
-            continue;
+        const Cluster& c = tree_cu->_blending_list[i];
+        env->blending_list[i] = Cluster_cu( c );
+        env->cluster_data [i]._bulge_strength = c.datas._bulge_strength;
+    }
+    // We store nb_pairs in the first element of the list
+    env->blending_list[0].nb_pairs = size / 2;
 
-        SkeletonEnv *env = h_envs[grid_id];
-        const Grid* grid = env->h_grid;
-        const Tree_cu *tree = env->h_tree_cu_instance;
+    env->bone_slot.size = tree_cu->_bone_aranged.size();
+    env->list_slot.size = size;
+}
 
-        // Cache cluster IDs to blending lists.
-        std::vector<std::vector<Cluster> > blist_cache;
+// -----------------------------------------------------------------------------
 
-        Cluster_id clus_id(0);
-        for(Cluster c: tree->_clusters) {
-            std::vector<Cluster> cluster;
-            tree->add_cluster(clus_id, cluster);
-            blist_cache.push_back(cluster);
-            clus_id += 1;
-        }
+/// Compute the blending list of every cell of the grid of 'env'.
+/// Fill env->grid; env->grid_list; env->grid_data and the sizes of the grid
+/// slots. Bones indices and list offsets are relative to the skeleton.
+/// @warning build_env_tree() must be called first
+static void build_env_grid(SkeletonEnv* env)
+{
+    const Grid* grid = env->h_grid;
+    const Tree_cu *tree = env->h_tree_cu_instance;
+
+    // Cache cluster IDs to blending lists.
+    std::vector<std::vector<Cluster> > blist_cache;
+
+    Cluster_id clus_id(0);
+    for(Cluster c: tree->_clusters) {
+        std::vector<Cluster> cluster;
+        tree->add_cluster(clus_id, cluster);
+        blist_cache.push_back(cluster);
+        clus_id += 1;
+    }
 
-        // Get the blending list for each cell, and the total number of resulting clusters.
-        // Each element of blist_per_cell is a list of blending lists, pointing into blist_cache.
-        // The list is concatenated down below.
-        //
-        // The grid has res^3 cells.  We'll only process cells that actually have surfaces affecting them,
-        // but preallocate the maximum for efficiency.
-        if(blist_per_cell.size() < grid->_filled_cells.size())
-            blist_per_cell.resize(grid->_filled_cells.size());
-
-        int total_size = 0;
-        for(int cell_idx = 0; cell_idx < grid->_filled_cells.size(); ++cell_idx) {
-            std::vector< std::vector<Cluster> * > &blists_list = blist_per_cell[cell_idx];
-            // XXX: It's important that we only clear the list and don't deallocate it, so we don't
-            // reallocate hundreds of these every frame.  This is what clear() does in MSVC.  What about
-            // gnuc++?
-            blists_list.clear();
-
-            if(!grid->_filled_cells[cell_idx])
-                continue;
+    // Get the blending list for each leaf, and the total number of resulting clusters.
+    // Each element of blist_per_cell is a list of blending lists, pointing into blist_cache.
+    // The list is concatenated down below.
+    //
+    // Leaves overlapped by the same bones already share the same entry of grid->_leaves,
+    // so we only build one blending list per distinct set of bones.
+    const int nb_leaves = grid->_leaves.size();
+    if(blist_per_cell.size() < nb_leaves)
+        blist_per_cell.resize(nb_leaves);
 
-            // The number of clusters that the blending list can possibly have is the number of bones.
-            // Preallocate that amount, so we don't have to reallocate.
-            blists_list.reserve(grid->_grid_cells[cell_idx].size());
+    int total_size = 0;
+    for(int leaf = 0; leaf < nb_leaves; ++leaf) {
+        std::vector< std::vector<Cluster> * > &blists_list = blist_per_cell[leaf];
+        // XXX: It's important that we only clear the list and don't deallocate it, so we don't
+        // reallocate hundreds of these every frame.  This is what clear() does in MSVC.  What about
+        // gnuc++?
+        blists_list.clear();
+
+        // The number of clusters that the blending list can possibly have is the number of bones.
+        // Preallocate that amount, so we don't have to reallocate.
+        blists_list.reserve(grid->_leaves[leaf].size());
+
+        total_size += cell_to_blending_list(env, grid->_leaves[leaf], blists_list, blist_cache);
+    }
 
-            total_size += cell_to_blending_list(env, cell_idx, blists_list, blist_cache);
-        }
+    env->grid_list.resize( total_size );
+    env->grid_data.resize( total_size );
 
-        // Allocate space for these clusters.
-        hd_grid_blending_list.realloc(offset + total_size);
-        hd_grid_data.realloc(offset + total_size);
+    // Iterate over the leaves again, copying the results to grid_list and grid_data.
+    std::vector<int> leaf_offsets( nb_leaves );
+    int offset = 0;
+    for(int leaf = 0; leaf < nb_leaves; ++leaf) {
+        const std::vector< std::vector<Cluster> *> &blists_list = blist_per_cell[leaf];
 
-        // Iterate over _filled_cells again, copying the results to hd_grid_blending_list and hd_grid_data.
-        for(int cell_idx = 0; cell_idx < grid->_filled_cells.size(); ++cell_idx) {
-            if(!grid->_filled_cells[cell_idx])
-                continue;
+        leaf_offsets[leaf] = offset;
 
-            const std::vector< std::vector<Cluster> *> &blists_list = blist_per_cell[cell_idx];
-
-            hd_grid[grid_offset + cell_idx] = offset;
-
-            int first_offset = offset;
-            int total_size = 0;
-            for(const std::vector<Cluster> *blists: blists_list) {
-                for(const Cluster &c: *blists) {
-                    // Convert cluster to cluster_cu and offset bones id to match the concateneted representation
-                    hd_grid_blending_list[offset] = c;
-                    hd_grid_blending_list[offset].first_bone += off_bone;
-                    hd_grid_data         [offset]._bulge_strength = c.datas._bulge_strength;
-                    offset++;
-                    total_size++;
-                }
+        int first_offset = offset;
+        for(const std::vector<Cluster> *blists: blists_list) {
+            for(const Cluster &c: *blists) {
+                env->grid_list[offset] = c;
+                env->grid_data[offset]._bulge_strength = c.datas._bulge_strength;
+                offset++;
             }
-
-            // Store the total number of bones (divided by two) in the first item's blend_type.  If first_offset and offset
-            // are the same then there were no clusters at all, so don't do anything.
-            if(first_offset != offset)
-                hd_grid_blending_list[first_offset].blend_type = (EJoint::Joint_t) (total_size/2);
         }
 
-        hd_offset[grid_id].grid_data = grid_offset;
-        const int res = grid->res();
-        grid_offset += res*res*res;
-
-        // Update grid bbox and resolution
-        BBox_cu bb = grid->bbox();
-        hd_grid_bbox[grid_id*2 + 0] = bb.pmin.to_float4();
-        hd_grid_bbox[grid_id*2 + 1] = bb.pmax.to_float4();
-        hd_grid_bbox[grid_id*2 + 0].w = (float)res;
+        // Store the total number of bones (divided by two) in the first item's blend_type.  If first_offset and offset
+        // are the same then there were no clusters at all, so don't do anything.
+        if(first_offset != offset)
+            env->grid_list[first_offset].blend_type = (EJoint::Joint_t) ((offset - first_offset)/2);
+    }
+    assert( offset == total_size );
 
-        off_bone += tree->_bone_aranged.size();
+    // Leaves now point to their blending list in 'grid_list'
+    env->grid = grid->_nodes;
+    for(unsigned i = 0; i < env->grid.size(); ++i)
+    {
+        const int node = env->grid[i];
+        if( node <= -2 )
+            env->grid[i] = Grid::leaf_to_node( leaf_offsets[Grid::node_to_leaf(node)] );
     }
 
-    hd_offset.update_device_mem(); // This is also done in update_device_tree maybe we can factorize
-    hd_grid.update_device_mem();
-    hd_grid_blending_list.update_device_mem();
-    hd_grid_data.update_device_mem();
-    hd_grid_bbox.update_device_mem();
-#endif
+    env->grid_slot.size      = env->grid.size();
+    env->grid_list_slot.size = total_size;
 }
 
 // -----------------------------------------------------------------------------
 
-/// Fill device array : hd_bone_types; hd_bone_hrbf;
-/// hd_bone_precomputed; hd_bulge_strength;
-static void fill_separated_bone_types(const std::vector<const Bone*>& generic_bones)
+/// @return wether the data of 'env' fits in its reserved slots
+static bool fits_slots(const SkeletonEnv* env)
 {
-    assert( !binded   );
-    assert( allocated );
-
-    const int nb_bones = generic_bones.size();
-    hd_bone_arrays->resize( nb_bones );
-
-    // For each bone, store the type, and the bone's HRBF and primitive ID.  We can store
-    // the IDs even if the bone is in a different mode.
-    for(int i = 0; i < nb_bones; i++)
-    {
-        const Bone* b = generic_bones[i];
-        hd_bone_arrays->hd_bone_hrbf[i] = b->get_hrbf();
-        hd_bone_arrays->hd_bone_precomputed[i] = b->get_primitive();
-        hd_bone_arrays->hd_bone_types[i] = b->get_type();
-    }
-    // Upload every arrays to GPU
-    hd_bone_arrays->update_device_mem();
+    return env->bone_slot.     fits() &&
+           env->list_slot.     fits() &&
+           env->grid_slot.     fits() &&
+           env->grid_list_slot.fits();
 }
 
 // -----------------------------------------------------------------------------
 
-
-/// Fill device array : hd_blending_list; hd_offset (only list_data field);
-/// h_generic_bones; _hidx_to_didx; _didx_to_hidx;
-static void update_device_tree(std::vector<const Bone*> &h_generic_bones)
+/// Reserve a slot for every skeleton in the concatenated arrays and
+/// reallocate them. Previous content of the arrays is lost.
+static void compute_layout()
 {
-    assert( !binded );
-    // Convert host layout to the GPU friendly layout
-    // And compute some array sizes.
+    assert( !binded   );
+    assert( allocated );
 
-    int s_blend_list = 0; // Total size of all blending lists
+    int off_bone      = 0;
+    int off_list      = 0;
+    int off_grid      = 0;
+    int off_grid_list = 0;
     for(unsigned i = 0; i < h_envs.size(); ++i)
     {
-        if(h_envs[i] == NULL)
+        SkeletonEnv* env = h_envs[i];
+        if(env == NULL)
             continue;
 
-        // Convert tree to GPU layout
-        delete h_envs[i]->h_tree_cu_instance;
-        h_envs[i]->h_tree_cu_instance = new Tree_cu( h_envs[i]->h_tree );
-        s_blend_list += h_envs[i]->h_tree_cu_instance->_blending_list.size();
+        // The number of bones and the blending list of a skeleton only
+        // depend on its topology which never changes
+        env->bone_slot.offset   = off_bone;
+        env->bone_slot.capacity = env->bone_slot.size;
+        off_bone += env->bone_slot.capacity;
+
+        env->list_slot.offset   = off_list;
+        env->list_slot.capacity = env->list_slot.size;
+        off_list += env->list_slot.capacity;
+
+        const int nb_nodes = env->grid_slot.size;
+        env->grid_slot.offset   = off_grid;
+        env->grid_slot.capacity = nb_nodes + (nb_nodes * GRID_LIST_SLACK) / 100;
+        off_grid += env->grid_slot.capacity;
+
+        const int size = env->grid_list_slot.size;
+        env->grid_list_slot.offset   = off_grid_list;
+        env->grid_list_slot.capacity = size + (size * GRID_LIST_SLACK) / 100;
+        off_grid_list += env->grid_list_slot.capacity;
     }
 
-    // Now we can allocate memory
     hd_offset.malloc( h_envs.size() );
+    hd_grid_bbox.malloc( h_envs.size() * 2 ); // Two points for a bbox
+    hd_grid_transfo.malloc( h_envs.size() * 3 ); // Three rows of a 3x4 matrix
+
+    hd_bone_arrays->resize( off_bone );
+
+    hd_blending_list.malloc( off_list );
+    hd_cluster_data. malloc( off_list );
+
+    hd_grid.malloc( off_grid, -1 );
 
-    hd_blending_list.malloc( s_blend_list );
-    hd_cluster_data. malloc( s_blend_list );
+    hd_grid_blending_list.malloc( off_grid_list );
+    hd_grid_data.         malloc( off_grid_list );
 
     _hidx_to_didx.clear();
     _didx_to_hidx.clear();
+}
 
-    // Concatenate bones and blending list.
-    // Note that the bone identifiers in the new blending list must
-    // be changed to match the list of concatenated bones
+// -----------------------------------------------------------------------------
 
-    int off_bone  = 0; // Offset to store bones in h_bone_device
-    int off_blist = 0; // Offset to store blending list in
-    for(unsigned t = 0; t < h_envs.size(); ++t)
-    {
-        if(h_envs[t] == NULL)
-            continue;
+/// Copy the grid frame of the skeleton 'skel_id' in hd_grid_transfo
+static void write_env_frame(Skel_id skel_id)
+{
+    const Transfo& tr = h_envs[skel_id]->h_grid->world_to_grid();
+    for(int i = 0; i < 3; ++i)
+        hd_grid_transfo[skel_id*3 + i] = make_float4(tr.m[i*4 + 0], tr.m[i*4 + 1],
+                                                     tr.m[i*4 + 2], tr.m[i*4 + 3]);
+}
 
-        const Tree_cu* tree_cu = h_envs[t]->h_tree_cu_instance;
+// -----------------------------------------------------------------------------
 
-        for(unsigned i = 0; i < tree_cu->_bone_aranged.size(); ++i){
-            DBone_id new_didx = DBone_id(i) + off_bone;
-            Hbone_id hidx(t, tree_cu->get_id_bone_aranged( i ) );
-            h_generic_bones.push_back(tree_cu->_bone_aranged[i]);
-            // Build correspondance between device/host index for the
-            // concatenated bones
-            _hidx_to_didx[ hidx     ] = new_didx;
-            _didx_to_hidx[ new_didx ] = hidx;
-        }
+/// Copy the data of the skeleton 'skel_id' in its slots of the concatenated
+/// host arrays. Bones identifiers and offsets are changed to match the
+/// concatenated representation.
+/// Fill : hd_bone_arrays; hd_blending_list; hd_cluster_data; hd_grid;
+/// hd_grid_blending_list; hd_grid_data; hd_offset; hd_grid_bbox;
+/// _hidx_to_didx; _didx_to_hidx
+static void write_env(Skel_id skel_id)
+{
+    const SkeletonEnv* env = h_envs[skel_id];
+    const Tree_cu* tree_cu = env->h_tree_cu_instance;
+    assert( fits_slots(env) );
 
-        // Concatenate blending list and update bone index accordingly
-        auto it = tree_cu->_blending_list.begin();
-        for(int i = 0; it != tree_cu->_blending_list.end(); ++it, ++i)
-        {
-            Cluster c = *it;
-            c.first_bone += off_bone;
-            // Convert in device representation
-            Cluster_cu new_c( c );
-            hd_blending_list[off_blist + i] = new_c;
-            hd_cluster_data [off_blist + i]._bulge_strength = c.datas._bulge_strength;
-        }
-        // We store nb_pairs in the first element of the list
-        assert(tree_cu->_blending_list.size() > 0); // unless we have no elements
-        hd_blending_list[off_blist].nb_pairs      = tree_cu->_blending_list.size()/2;
+    // For each bone, store the type, and the bone's HRBF and primitive ID.  We can store
+    // the IDs even if the bone is in a different mode.
+    const int off_bone = env->bone_slot.offset;
+    for(int i = 0; i < env->bone_slot.size; ++i)
+    {
+        const Bone* b = tree_cu->_bone_aranged[i];
+        hd_bone_arrays->hd_bone_hrbf       [off_bone + i] = b->get_hrbf();
+        hd_bone_arrays->hd_bone_precomputed[off_bone + i] = b->get_primitive();
+        hd_bone_arrays->hd_bone_types      [off_bone + i] = b->get_type();
+
+        // Build correspondance between device/host index for the
+        // concatenated bones
+        DBone_id new_didx = DBone_id(i) + off_bone;
+        Hbone_id hidx(skel_id, tree_cu->get_id_bone_aranged( i ) );
+        _hidx_to_didx[ hidx     ] = new_didx;
+        _didx_to_hidx[ new_didx ] = hidx;
+    }
 
-        hd_offset[t].list_data = off_blist;
+    const int off_list = env->list_slot.offset;
+    for(int i = 0; i < env->list_slot.size; ++i)
+    {
+        Cluster_cu c = env->blending_list[i];
+        c.first_bone += off_bone;
+        hd_blending_list[off_list + i] = c;
+        hd_cluster_data [off_list + i] = env->cluster_data[i];
+    }
 
-        off_blist += tree_cu->_blending_list.size();
-        off_bone  += tree_cu->_bone_aranged.size();
+    // Inner nodes are relative to the root of the skeleton's octree while
+    // leaves are absolute offsets in hd_grid_blending_list
+    const int off_grid_list = env->grid_list_slot.offset;
+    const int off_grid      = env->grid_slot.offset;
+    for(int i = 0; i < env->grid_slot.size; ++i)
+    {
+        const int node = env->grid[i];
+        if( node <= -2 )
+            hd_grid[off_grid + i] = Grid::leaf_to_node( Grid::node_to_leaf(node) + off_grid_list );
+        else
+            hd_grid[off_grid + i] = node;
     }
 
-    // Upload to GPU
+    for(int i = 0; i < env->grid_list_slot.size; ++i)
+    {
+        Cluster_cu c = env->grid_list[i];
+        c.first_bone += off_bone;
+        hd_grid_blending_list[off_grid_list + i] = c;
+        hd_grid_data         [off_grid_list + i] = env->grid_data[i];
+    }
+
+    hd_offset[skel_id].list_data = off_list;
+    hd_offset[skel_id].grid_data = off_grid;
+
+    // Update grid bbox and depth
+    const Grid* grid = env->h_grid;
+    BBox_cu bb = grid->bbox();
+    hd_grid_bbox[skel_id*2 + 0] = bb.pmin.to_float4();
+    hd_grid_bbox[skel_id*2 + 1] = bb.pmax.to_float4();
+    hd_grid_bbox[skel_id*2 + 0].w = (float)grid->depth();
+
+    write_env_frame( skel_id );
+}
+
+// -----------------------------------------------------------------------------
+
+/// Upload to GPU the slots of the skeleton 'skel_id' only
+static void upload_env(Skel_id skel_id)
+{
+    const SkeletonEnv* env = h_envs[skel_id];
+    const Slot& bone      = env->bone_slot;
+    const Slot& list      = env->list_slot;
+    const Slot& grid      = env->grid_slot;
+    const Slot& grid_list = env->grid_list_slot;
+
+    hd_bone_arrays->update_device_mem(bone.offset, bone.size);
+
+    hd_blending_list.update_device_mem(list.offset, list.size);
+    hd_cluster_data. update_device_mem(list.offset, list.size);
+
+    hd_grid.update_device_mem(grid.offset, grid.size);
+
+    hd_grid_blending_list.update_device_mem(grid_list.offset, grid_list.size);
+    hd_grid_data.         update_device_mem(grid_list.offset, grid_list.size);
+
+    hd_offset.   update_device_mem(skel_id    , 1);
+    hd_grid_bbox.update_device_mem(skel_id * 2, 2);
+    hd_grid_transfo.update_device_mem(skel_id * 3, 3);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Upload every arrays to GPU
+static void upload_all()
+{
+    hd_bone_arrays->update_device_mem();
     hd_offset.update_device_mem();
     hd_blending_list.update_device_mem();
     hd_cluster_data. update_device_mem();
-    assert( off_blist == s_blend_list );
+    hd_grid.update_device_mem();
+    hd_grid_blending_list.update_device_mem();
+    hd_grid_data.update_device_mem();
+    hd_grid_bbox.update_device_mem();
+    hd_grid_transfo.update_device_mem();
 }
 
 // -----------------------------------------------------------------------------
 
-/// Convert CPU representation to GPU
+/// Load in Blending_env the predefined operators the joints of 'env' blend
+/// with (see fetch_binop_and_blend()). They are generated or read from the
+/// cache the first time a joint uses them. The operator blending the bones of
+/// a cluster (U_OH) is always loaded by Blending_env::init_env().
+/// @return true if an operator was added
+static bool load_blending_operators(const SkeletonEnv* env)
+{
+    bool added = false;
+    for(const auto& it: env->h_tree->joints_data())
+    {
+        switch( it.second._blend_type )
+        {
+        case EJoint::GC_ARC_CIRCLE_TWEAK:
+            added = Blending_env::load_predefined_operator( Blending_env::C_D ) || added;
+            break;
+        case EJoint::BULGE:
+            added = Blending_env::load_predefined_operator( Blending_env::B_D ) || added;
+            break;
+        default: // MAX and custom operators
+            break;
+        }
+    }
+    return added;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Convert CPU representation to GPU.
+/// Only skeletons flagged 'dirty' are converted. When they still fit in
+/// their slots only their regions are uploaded and textures stay binded.
+/// Otherwise every slots are recomputed and the whole arrays are uploaded.
+/// Skeletons flagged 'frame_dirty' only upload their grid frame.
 void update_device()
 {
-    unbind();
-    
-    // List of concatened bones for all skeletons in 'h_envs'.  Note that a bone may
-    // appear in h_generic_bones more than once, if it's used in multiple skeletons.
-    std::vector<const Bone*> h_generic_bones;
-    update_device_tree(h_generic_bones);
-
-    fill_separated_bone_types( h_generic_bones );
-    update_device_grid();
-    bind();
+    bool relayout = layout_dirty;
+    bool new_operators = false;
+    for(unsigned i = 0; i < h_envs.size(); ++i)
+    {
+        SkeletonEnv* env = h_envs[i];
+        if(env == NULL || !env->dirty)
+            continue;
+
+        new_operators = load_blending_operators( env ) || new_operators;
+        build_env_tree( env );
+        build_env_grid( env );
+        relayout = relayout || !fits_slots( env );
+    }
+
+    // Concatenate the new operators with the ones already used
+    if( new_operators )
+        Blending_env::update_operators();
+
+    if( relayout )
+    {
+        unbind();
+        compute_layout();
+        for(unsigned i = 0; i < h_envs.size(); ++i)
+        {
+            if(h_envs[i] == NULL)
+                continue;
+            write_env( i );
+            h_envs[i]->dirty       = false;
+            h_envs[i]->frame_dirty = false;
+        }
+        upload_all();
+        bind();
+        layout_dirty = false;
+        return;
+    }
+
+    for(unsigned i = 0; i < h_envs.size(); ++i)
+    {
+        SkeletonEnv* env = h_envs[i];
+        if(env == NULL)
+            continue;
+
+        if( env->dirty )
+        {
+            write_env( i );
+            upload_env( i );
+        }
+        else if( env->frame_dirty )
+        {
+            write_env_frame( i );
+            hd_grid_transfo.update_device_mem(i * 3, 3);
+        }
+        env->dirty       = false;
+        env->frame_dirty = false;
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -454,33 +674,18 @@ void clean_env()
     hd_grid.update_device_mem();
     hd_grid_bbox.erase();
     hd_grid_bbox.update_device_mem();
+    hd_grid_transfo.erase();
+    hd_grid_transfo.update_device_mem();
     hd_blending_list.erase();
     hd_blending_list.update_device_mem();
+    hd_cluster_data.erase();
+    hd_cluster_data.update_device_mem();
     hd_bone_arrays->clear();
     hd_bone_arrays->update_device_mem();
     delete hd_bone_arrays;
     hd_bone_arrays = 0;
     allocated = false;
-}
-
-// -----------------------------------------------------------------------------
-
-void alloc_hd_grid()
-{
-    assert( binded );
-    unbind();
-
-    int total_size = 0;
-    for(unsigned i = 0; i < h_envs.size(); ++i){
-        if(h_envs[i] == NULL)
-            continue;
-        const int res = h_envs[i]->h_grid->res();
-        total_size += res*res*res;
-    }
-    hd_grid.malloc(total_size, -1);
-    hd_grid_bbox.malloc( h_envs.size() * 2 ); // Two points for a bbox
-
-    bind();
+    layout_dirty = true;
 }
 
 // -----------------------------------------------------------------------------
@@ -520,7 +725,7 @@ Skel_id new_skel_instance(const std::vector<const Bone*>& bones,
     
     h_envs[id] = env;
 
-    alloc_hd_grid();
+    layout_dirty = true;
     update_device();
     return id;
 }
@@ -535,8 +740,8 @@ void delete_skel_instance(Skel_id skel_id)
     // Set the slot to NULL to allow reuse.
     delete h_envs[skel_id];
     h_envs[skel_id] = NULL;
-    
-    alloc_hd_grid();
+
+    layout_dirty = true;
     update_device();
 }
 
@@ -544,7 +749,13 @@ void delete_skel_instance(Skel_id skel_id)
 
 void update_bones_data(Skel_id i)
 {
-    h_envs[i]->h_grid->build_grid();
+    // When the bones stayed in the cells they were inserted in, relatively
+    // to the root, the grid cells and their blending lists are still valid:
+    // only upload the new grid frame
+    if( h_envs[i]->h_grid->update_grid() )
+        h_envs[i]->dirty = true;
+    else
+        h_envs[i]->frame_dirty = true;
     update_device();
 }
 
@@ -554,6 +765,7 @@ void update_joints_data(Skel_id i, const std::map<Bone::Id, Joint_data>& joints)
 {
     h_envs[i]->h_tree->set_joints_data( joints );
     h_envs[i]->h_grid->build_grid();
+    h_envs[i]->dirty = true;
     update_device();
 }
 
@@ -563,12 +775,51 @@ void set_grid_res(Skel_id i, int res)
 {
     assert( res > 0);
     h_envs[i]->h_grid->set_res( res );
-    alloc_hd_grid();
+    // A larger grid won't fit its slot anymore, update_device() handles it
+    h_envs[i]->dirty = true;
     update_device();
 }
 
 // -----------------------------------------------------------------------------
 
+Grid_stats grid_stats(Skel_id id, const std::vector<Point_cu>& points)
+{
+    const SkeletonEnv* env = h_envs[id];
+    const Grid* grid = env->h_grid;
+
+    Grid_stats stats;
+    stats.nb_nodes = grid->_nodes.size();
+    for(int node: grid->_nodes)
+        stats.nb_leaves += node <= -2 ? 1 : 0;
+    stats.nb_lists   = grid->_leaves.size();
+    stats.depth      = grid->depth();
+    stats.nb_bones   = env->bone_slot.size;
+    stats.nb_queries = points.size();
+
+    // Same walk as compute_potential() but only counting bones
+    double sum = 0.;
+    for(const Point_cu& p: points)
+    {
+        Cluster_id off_cid = fetch_grid_blending_list_offset(id, p.to_vector());
+        if( !off_cid.is_valid() ){
+            stats.nb_outside++;
+            continue;
+        }
+
+        const int nb_pairs = fetch_grid_blending_list( off_cid ).nb_pairs;
+        int nb_bones = 0;
+        for(int i = 0; i < nb_pairs*2; ++i)
+            nb_bones += fetch_grid_blending_list( off_cid + i ).nb_bone;
+
+        sum += nb_bones;
+        stats.max_bones_per_query = std::max(stats.max_bones_per_query, nb_bones);
+    }
+    stats.avg_bones_per_query = points.size() > 0 ? sum / points.size() : 0.;
+    return stats;
+}
+
+// -----------------------------------------------------------------------------
+
 DBone_id bone_hidx_to_didx(Skel_id skel_id, Bone::Id bone_hidx)
 {
     // TODO: array of maps by skeleton ids would be more efficient
@@ -53,13 +53,21 @@ extern Cuda_utils::HD_Array<Cluster_data> hd_cluster_data;
 /// memory as well as the blending list.
 extern Cuda_utils::HD_Array<Cluster_cu> hd_grid_blending_list;
 
-/// hd_grid[ hd_offset[Skel_id].grid_data + cell_idx] == offset in hd_grid_blending_list or -1 if empty cell
+/// Concatenated flattened octrees of every skeletons (see Grid).
+/// hd_grid[ hd_offset[Skel_id].grid_data + node] == index of the first child
+/// relative to hd_offset[Skel_id].grid_data, -1 if empty leaf or
+/// Grid::leaf_to_node( offset in hd_grid_blending_list )
 extern Cuda_utils::HD_Array<int> hd_grid;
 
 /// Bbox of each skeleton's grid.
 /// (hd_grid_bbox[i*2 + 0], hd_grid_bbox[i*2 + 0]) == ith_skel_bbox
 extern Cuda_utils::HD_Array<float4> hd_grid_bbox;
 
+/// Transformation from world space to the space of each skeleton's grid.
+/// (hd_grid_transfo[i*3 + 0], hd_grid_transfo[i*3 + 1], hd_grid_transfo[i*3 + 2])
+/// == three first rows of ith_skel Grid::world_to_grid()
+extern Cuda_utils::HD_Array<float4> hd_grid_transfo;
+
 /// d_offset[bone_id] == offset in lists
 extern Cuda_utils::HD_Array<Offset>  hd_offset;
 
@@ -84,6 +92,8 @@ Skel_id new_skel_instance(const std::vector<const Bone*>& bones,
 void delete_skel_instance(Skel_id i);
 
 /// Update the bone data ( type length etc.) of the skeleton in device memory
+/// @note only the memory region of the skeleton 'i' is uploaded, other
+/// skeleton instances are left untouched unless 'i' outgrows its region.
 void update_bones_data(Skel_id i);
 
 /// Update the joints data (type, controller id, bulge strength)
@@ -92,6 +102,11 @@ void update_bones_data(Skel_id i);
 /// parent bone.
 void update_joints_data(Skel_id i, const std::map<Bone::Id, Joint_data>& joints);
 
+/// Look up 'points' in the acceleration structure of the skeleton and count
+/// how many bones compute_potential() evaluates for them.
+/// Used to benchmark the acceleration structure on real rigs.
+Grid_stats grid_stats(Skel_id id, const std::vector<Point_cu>& points);
+
 DBone_id bone_hidx_to_didx(Skel_id skel_id, Bone::Id bone_hidx);
 Bone::Id bone_didx_to_hidx(Skel_id skel_id, DBone_id bone_didx);
 
@@ -110,16 +125,24 @@ extern texture<int4, 1, cudaReadModeElementType> tex_blending_list;
 /// @see Skeleton_env::Cluster_cu tex_blending_list
 extern texture<int4, 1, cudaReadModeElementType> tex_grid_list;
 
-/// Concatenated grid cells stored linearly
+/// Concatenated flattened octrees
+/// @see hd_grid
 extern texture<int, 1, cudaReadModeElementType> tex_grid;
 
-/// every grids bbox and resolution.
+/// every grids bbox and octree depth.
 /// (bbox.pmin.x, bbox.pmin.y, bbox.pmin.z) == tex_grid_bbox[id_skel*2+0]{x,y,z}
-/// res == (int)tex_grid_bbox[id_skel*2+0]{w}
+/// depth == (int)tex_grid_bbox[id_skel*2+0]{w}
 /// (bbox.pmax.x, bbox.pmax.y, bbox.pmax.z) == tex_grid_bbox[id_skel*2+1]{x,y,z}
 /// dummy float == tex_grid_bbox[id_skel*2+1]{w}
 extern texture<float4, 1, cudaReadModeElementType> tex_grid_bbox;
 
+/// every grids world to grid transformation (Grid::world_to_grid()).
+/// Grids follow the root bone and are reused as long as the other bones stay
+/// close to their position relative to it (see Grid::update_grid()),
+/// positions must be transformed before looking up the grid.
+/// row i of the 3x4 matrix == tex_grid_transfo[id_skel*3+i]
+extern texture<float4, 1, cudaReadModeElementType> tex_grid_transfo;
+
 // TODO: store nb_pairs and singletons in offset
 /// Offset to access the blending list or grid according to the skeleton
 /// instance tex_offset[skel_id] = offset
@@ -161,6 +184,12 @@ void unbind();
 IF_CUDA_DEVICE_HOST static inline
 Cluster_id fetch_grid_blending_list_offset(Skel_id id, const Vec3_cu& pos);
 
+/// Same as above but reuses the blending list of 'cell' when 'pos' still lies
+/// inside it. Otherwise the octree is walked and 'cell' is updated with the
+/// leaf containing 'pos'.
+IF_CUDA_DEVICE_HOST static inline
+Cluster_id fetch_grid_blending_list_offset(Skel_id id, const Vec3_cu& pos, Grid_cell& cell);
+
 /// Blending list of every skeletons for every grid's cells
 IF_CUDA_DEVICE_HOST static inline
 Cluster_cu fetch_grid_blending_list(Cluster_id i);
@@ -171,7 +200,7 @@ Cluster_cu fetch_grid_blending_list(Cluster_id i);
 
 /// Fetch the offset needed to use fetch_blending_list() given a specific
 /// skeleton instance.
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Cluster_id fetch_blending_list_offset(Skel_id id);
 
 /// List of cluster pairs. The list is composed in two parts pairs to be blended
@@ -180,7 +209,7 @@ Cluster_id fetch_blending_list_offset(Skel_id id);
 /// The first element does not specify the blending type and controller id but :
 /// z == nb_pairs and w = nb_singletons after the pairs.
 /// @param i : identifier of the cluster plus fetch_blending_list_offset()
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Cluster_cu fetch_blending_list(Cluster_id i);
 
 // -----------------------------------------------------------------------------
@@ -190,28 +219,32 @@ Cluster_cu fetch_blending_list(Cluster_id i);
 /// Read data of a bone of type hrbf
 /// @warning User must ensure that the bone i is of the right type with
 /// fetch_bone_type() otherwise returned value is undefined
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 HermiteRBF fetch_bone_hrbf(DBone_id i);
 
 /// Read data of a bone of type precomputed
 /// @warning User must ensure that the bone i is of the right type with
 /// fetch_bone_type() otherwise returned value is undefined
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Precomputed_prim fetch_bone_precomputed(DBone_id i);
 
 /// @return the bone type defined in the enum of Bone_type namespace
 /// @see Bone_type
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 EBone::Bone_t fetch_bone_type(DBone_id bone_id);
 
 /// Fetch a bone and evaluate its potential.
+/// @note on host precomputed bones are sampled from the grids' host copies
+/// (see Precomputed_prim::fngf())
 /// @param bone_id the bone id
 /// @param gf the gradient at point x
 /// @return Potential at point x
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 float fetch_and_eval_bone(DBone_id bone_id, Vec3_cu& gf, const Point_cu& x);
 
 /// Fetch a blending operator and blend the potential
+/// @note on host operators sample the host copies of the blending textures
+/// (see Host_tex) and match the device up to the interpolation rounding.
 /// @param gf the blended gradient
 /// @param type The blending type
 /// @param ctrl_id the controller id for the blending op if any.
@@ -220,7 +253,7 @@ float fetch_and_eval_bone(DBone_id bone_id, Vec3_cu& gf, const Point_cu& x);
 /// @param gf1 First gradient to blend
 /// @param gf2 Second gradient to blend
 /// @return the blended potential
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 float fetch_binop_and_blend(Vec3_cu& gf,
                             EJoint::Joint_t type,
                             Blending_env::Ctrl_id ctrl_id,
@@ -11,7 +11,7 @@ namespace Skeleton_env {
 // =============================================================================
 
 IF_CUDA_DEVICE_HOST static inline
-BBox_cu fetch_grid_bbox_and_res(Skel_id id, Vec3i_cu& res)
+BBox_cu fetch_grid_bbox(Skel_id id)
 {
     #ifdef __CUDA_ARCH__
     float4 a = tex1Dfetch(tex_grid_bbox, id*2 + 0);
@@ -20,13 +20,32 @@ BBox_cu fetch_grid_bbox_and_res(Skel_id id, Vec3i_cu& res)
     float4 a = hd_grid_bbox[id*2 + 0];
     float4 b = hd_grid_bbox[id*2 + 1];
     #endif
-    res.x = res.y = res.z = (int)a.w;
     return BBox_cu(a.x, a.y, a.z,
                    b.x, b.y, b.z);
 }
 
 // -----------------------------------------------------------------------------
 
+IF_CUDA_DEVICE_HOST static inline
+Transfo fetch_grid_transfo(Skel_id id)
+{
+    #ifdef __CUDA_ARCH__
+    float4 a = tex1Dfetch(tex_grid_transfo, id*3 + 0);
+    float4 b = tex1Dfetch(tex_grid_transfo, id*3 + 1);
+    float4 c = tex1Dfetch(tex_grid_transfo, id*3 + 2);
+    #else
+    float4 a = hd_grid_transfo[id*3 + 0];
+    float4 b = hd_grid_transfo[id*3 + 1];
+    float4 c = hd_grid_transfo[id*3 + 2];
+    #endif
+    return Transfo(a.x, a.y, a.z, a.w,
+                   b.x, b.y, b.z, b.w,
+                   c.x, c.y, c.z, c.w,
+                   0.f, 0.f, 0.f, 1.f);
+}
+
+// -----------------------------------------------------------------------------
+
 IF_CUDA_DEVICE_HOST static inline
 int fetch_grid_offset(Skel_id id){
     #ifdef __CUDA_ARCH__
@@ -51,27 +70,58 @@ int fetch_grid(int offset, int cell_id){
 // -----------------------------------------------------------------------------
 
 IF_CUDA_DEVICE_HOST static inline
-Cluster_id fetch_grid_blending_list_offset(Skel_id id, const Vec3_cu& pos)
+Cluster_id fetch_grid_blending_list_offset(Skel_id id, const Vec3_cu& pos, Grid_cell& cell)
 {
-    Vec3i_cu res;
-    BBox_cu bb = fetch_grid_bbox_and_res( id, res);
-    // compute linear grid index
-    Vec3i_cu i3 = bb.index_grid_cell( res, pos );
-    Idx3_cu idx(res, i3);
+    // The grid may have been built for a previous position of the root bone
+    Point_cu p = fetch_grid_transfo( id ) * pos.to_point();
+
+    // Still in the last cell we looked up
+    if( cell.contains(p) ) return cell.off_cid;
+
+    cell.nb_lookups++;
+    BBox_cu bb = fetch_grid_bbox( id );
 
     // test if in grid
-    if( idx.is_out() ) return Cluster_id(-1);
+    if( !bb.inside(p) ){
+        cell.off_cid = Cluster_id(-1);
+        cell.bbox    = BBox_cu();
+        return cell.off_cid;
+    }
 
-    // retreive offset
+    // Walk down the octree, children are computed exactly like
+    // Grid::subdivide() does
     int offset = fetch_grid_offset(id);
-    int ptr_list = fetch_grid(offset, idx.to_linear());
+    Point_cu pmin = bb.pmin;
+    Vec3_cu  size = bb.pmax - bb.pmin;
+    int node = fetch_grid(offset, 0);
+    while( node >= 0 )
+    {
+        size = size * 0.5f;
+        int child = 0;
+        if( p.x >= pmin.x + size.x ){ child |= 1; pmin.x += size.x; }
+        if( p.y >= pmin.y + size.y ){ child |= 2; pmin.y += size.y; }
+        if( p.z >= pmin.z + size.z ){ child |= 4; pmin.z += size.z; }
+        node = fetch_grid(offset, node + child);
+    }
+
+    // Empty leaf or leaf pointing to its blending list (see Grid::leaf_to_node())
+    cell.off_cid = Cluster_id( node == -1 ? -1 : -node - 2 );
+    cell.bbox    = BBox_cu(pmin, pmin + size);
+    return cell.off_cid;
+}
+
+// -----------------------------------------------------------------------------
 
-    return Cluster_id(ptr_list);
+IF_CUDA_DEVICE_HOST static inline
+Cluster_id fetch_grid_blending_list_offset(Skel_id id, const Vec3_cu& pos)
+{
+    Grid_cell cell;
+    return fetch_grid_blending_list_offset(id, pos, cell);
 }
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Cluster_cu fetch_grid_blending_list(Cluster_id cid)
 {
     #ifdef __CUDA_ARCH__
@@ -84,51 +134,73 @@ Cluster_cu fetch_grid_blending_list(Cluster_id cid)
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Cluster_id fetch_blending_list_offset(Skel_id id){
+    #ifdef __CUDA_ARCH__
     int2 s = tex1Dfetch(tex_offset, id);
     return Cluster_id( s.x );
+    #else
+    return Cluster_id( hd_offset[id].list_data );
+    #endif
 }
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Cluster_cu fetch_blending_list(Cluster_id cid)
 {
+    #ifdef __CUDA_ARCH__
     int4 s = tex1Dfetch(tex_blending_list, cid.id());
     return *reinterpret_cast<Cluster_cu*>(&s);
+    #else
+    return hd_blending_list[ cid.id() ];
+    #endif
 }
 
-__device__ static inline
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST static inline
 HermiteRBF fetch_bone_hrbf(DBone_id i)
 {
+    #ifdef __CUDA_ARCH__
     int internal = tex1Dfetch(tex_bone_hrbf, i.id());
     return *reinterpret_cast<HermiteRBF*>(&internal);
+    #else
+    return hd_bone_arrays->hd_bone_hrbf[ i.id() ];
+    #endif
 }
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 Precomputed_prim fetch_bone_precomputed(DBone_id i)
 {
+    #ifdef __CUDA_ARCH__
     int internal = tex1Dfetch(tex_bone_precomputed, i.id());
     return *reinterpret_cast<Precomputed_prim*>(&internal);
+    #else
+    return hd_bone_arrays->hd_bone_precomputed[ i.id() ];
+    #endif
 }
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 EBone::Bone_t fetch_bone_type(DBone_id bone_id)
 {
+    #ifdef __CUDA_ARCH__
     return (EBone::Bone_t)tex1Dfetch(tex_bone_type, bone_id.id());
+    #else
+    return (EBone::Bone_t)hd_bone_arrays->hd_bone_types[ bone_id.id() ];
+    #endif
 }
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 float fetch_and_eval_bone(DBone_id bone_id, Vec3_cu& gf, const Point_cu& x)
 {
-    EBone::Bone_t bone_type = (EBone::Bone_t)tex1Dfetch(tex_bone_type, bone_id.id());
+    EBone::Bone_t bone_type = fetch_bone_type(bone_id);
 
     if( bone_type == EBone::HRBF)
     {
@@ -149,7 +221,7 @@ float fetch_and_eval_bone(DBone_id bone_id, Vec3_cu& gf, const Point_cu& x)
 
 // -----------------------------------------------------------------------------
 
-__device__ static inline
+IF_CUDA_DEVICE_HOST static inline
 float fetch_binop_and_blend(Vec3_cu& grad,
                             EJoint::Joint_t type,
                             Blending_env::Ctrl_id ctrl_id,
@@ -165,7 +237,9 @@ float fetch_binop_and_blend(Vec3_cu& grad,
         return Circle_anim::fngf(grad, f1, f2, gf1, gf2);
         #endif
     }
-    #ifndef FAST_COMPILE
+    // On host the operators below sample the host copies of the blending
+    // textures (see Host_tex)
+    #if !defined(FAST_COMPILE) || !defined(__CUDA_ARCH__)
     else if( type == EJoint::GC_ARC_CIRCLE_TWEAK)
     {
         #if 1
@@ -184,6 +258,9 @@ float fetch_binop_and_blend(Vec3_cu& grad,
         {
             Blending_env::Op_id id;
             id = Blending_env::predefined_op_id_fetch( Blending_env::B_D );
+            // Not loaded (see Blending_env::load_predefined_operator())
+            if( id < 0 )
+                return Umax::fngf(grad, f1, f2, gf1, gf2);
             return Dyn_Operator3D_cu(id, ctrl_id).fngf(f1, f2, gf1, gf2, grad);
         }
 
@@ -1,5 +1,9 @@
 #include "skeleton_env_evaluator.hpp"
 #include "blending_functions.hpp"
+#include "thread_utils.hpp"
+
+#include <vector>
+#include <algorithm>
 
 
 /**
@@ -35,7 +39,17 @@ typedef BulgeFreeBlending Cluster;
 
 #define USE_GRID_ // Not compatible with had_hoc hand !
 
-__device__ static
+/// Blend a bone with the bones of its cluster previously blended
+IF_CUDA_DEVICE_HOST static inline
+float blend_cluster_bone(Vec3_cu& gf_clus, float f_clus, float f, const Vec3_cu& gf)
+{
+    // On host the operator samples the host copies of its textures
+    return Blend_func::Cluster::fngf(gf_clus, f_clus, f, gf_clus, gf);
+}
+
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST static
 float eval_cluster(Vec3_cu& gf_clus, const Point_cu& p, int size, Skeleton_env::DBone_id first_bone)
 {
     gf_clus = Vec3_cu(0.f, 0.f, 0.f);
@@ -47,12 +61,14 @@ float eval_cluster(Vec3_cu& gf_clus, const Point_cu& p, int size, Skeleton_env::
     Vec3_cu gf;
     for(int i = 0; i < size; i++){
         f = fetch_and_eval_bone(first_bone+i, gf, p);
-        f_clus = Blend_func::Cluster::fngf(gf_clus, f_clus, f, gf_clus, gf);
+        f_clus = blend_cluster_bone(gf_clus, f_clus, f, gf);
     }
     return f_clus;
 }
 
-__device__ static inline
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST static inline
 Skeleton_env::Cluster_cu fetch_blending_list_int(Skeleton_env::Cluster_id cid)
 {
 #ifndef USE_GRID_
@@ -62,23 +78,33 @@ Skeleton_env::Cluster_cu fetch_blending_list_int(Skeleton_env::Cluster_id cid)
 #endif
 }
 
-__device__
-float Skeleton_env::compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_cu& gf)
+// -----------------------------------------------------------------------------
+
+/// @return true if 'bone' belongs to the cluster 'c'
+IF_CUDA_DEVICE_HOST static inline
+bool cluster_contains(const Skeleton_env::Cluster_cu& c, Skeleton_env::DBone_id bone)
 {
+    return bone >= c.first_bone && bone < c.first_bone + c.nb_bone;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Evaluate the blending list starting at 'off_cid' at point 'p'
+/// @param bone0, bone1 : if valid only the pairs whose first cluster contains
+/// one of these bones are evaluated. When no such pair is in the list every
+/// pair is evaluated.
+IF_CUDA_DEVICE_HOST static
+float eval_blending_list(Skeleton_env::Cluster_id off_cid,
+                         const Point_cu& p,
+                         Vec3_cu& gf,
+                         Skeleton_env::DBone_id bone0 = Skeleton_env::DBone_id(-1),
+                         Skeleton_env::DBone_id bone1 = Skeleton_env::DBone_id(-1))
+{
+    using namespace Skeleton_env;
     typedef Cluster_cu Clus;
     float f = 0.f;
     gf = Vec3_cu(1.f, 0.f, 0.f);
 
-#ifndef USE_GRID_
-    // Without space acceleration structure
-    Cluster_id off_cid = fetch_blending_list_offset( skel_id );
-#else
-    // With a grid as acceleration structure
-    Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, p.to_vector());
-    if( !off_cid.is_valid() /*Means we are outside the skeleton bbox*/)
-        return 0.f;
-#endif
-
     // Clusters contains at first a list of pairs with dynamic blending
     // each pair is blend to others with a max then the rest of the skeleton
     // is blended  with a max
@@ -87,9 +113,28 @@ float Skeleton_env::compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_c
     // In the first cluster we don't store the blending type and controller id
     const int nb_pairs      = clus.nb_pairs;
 
+    // Pairs are filtered until we find out none of them holds the bones
+    bool filter = bone0.is_valid() || bone1.is_valid();
+    int nb_filtered = 0;
+
     // Blend the pairs
     for(int i = 0; i < nb_pairs*2; i += 2)
     {
+        if( filter )
+        {
+            const Clus c0 = fetch_blending_list_int( off_cid + i );
+            if( !cluster_contains(c0, bone0) && !cluster_contains(c0, bone1) )
+            {
+                nb_filtered++;
+                // Every pair filtered: fall back to a full evaluation
+                if( nb_filtered == nb_pairs ){
+                    filter = false;
+                    i = -2;
+                }
+                continue;
+            }
+        }
+
         bool first = true;
         float fn;
         Vec3_cu gfn;
@@ -122,3 +167,212 @@ float Skeleton_env::compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_c
 
     return f;
 }
+
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST
+float Skeleton_env::compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_cu& gf)
+{
+#ifndef USE_GRID_
+    // Without space acceleration structure
+    Cluster_id off_cid = fetch_blending_list_offset( skel_id );
+#else
+    // With a grid as acceleration structure
+    Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, p.to_vector());
+    if( !off_cid.is_valid() /*Means we are outside the skeleton bbox*/){
+        gf = Vec3_cu(1.f, 0.f, 0.f);
+        return 0.f;
+    }
+#endif
+    return eval_blending_list(off_cid, p, gf);
+}
+
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST
+float Skeleton_env::compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_cu& gf, Grid_cell& cell)
+{
+#ifndef USE_GRID_
+    Cluster_id off_cid = fetch_blending_list_offset( skel_id );
+#else
+    Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, p.to_vector(), cell);
+    if( !off_cid.is_valid() ){
+        gf = Vec3_cu(1.f, 0.f, 0.f);
+        return 0.f;
+    }
+#endif
+    return eval_blending_list(off_cid, p, gf);
+}
+
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST
+float Skeleton_env::compute_potential(Skel_id skel_id,
+                                      const Point_cu& p,
+                                      Vec3_cu& gf,
+                                      Grid_cell& cell,
+                                      DBone_id bone0,
+                                      DBone_id bone1)
+{
+#ifndef USE_GRID_
+    Cluster_id off_cid = fetch_blending_list_offset( skel_id );
+#else
+    Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, p.to_vector(), cell);
+    if( !off_cid.is_valid() ){
+        gf = Vec3_cu(1.f, 0.f, 0.f);
+        return 0.f;
+    }
+#endif
+    return eval_blending_list(off_cid, p, gf, bone0, bone1);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Host batched version of eval_cluster() for 'n' points (n <= HOST_BATCH_SIZE)
+static void eval_cluster_batch(int n,
+                               const float* px, const float* py, const float* pz,
+                               int size,
+                               Skeleton_env::DBone_id first_bone,
+                               float* f_clus,
+                               Vec3_cu* gf_clus)
+{
+    using namespace Skeleton_env;
+    float f[HOST_BATCH_SIZE], gx[HOST_BATCH_SIZE], gy[HOST_BATCH_SIZE], gz[HOST_BATCH_SIZE];
+
+    for(int b = 0; b < n; b++){
+        f_clus [b] = 0.f;
+        gf_clus[b] = Vec3_cu(0.f, 0.f, 0.f);
+    }
+
+    for(int i = 0; i < size; i++)
+    {
+        const DBone_id bone_id = first_bone + i;
+        if( fetch_bone_type(bone_id) == EBone::HRBF )
+        {
+            fetch_bone_hrbf(bone_id).fngf_batch(n, px, py, pz, f, gx, gy, gz);
+        }
+        else
+        {
+            for(int b = 0; b < n; b++){
+                Vec3_cu gf;
+                f[b] = fetch_and_eval_bone(bone_id, gf, Point_cu(px[b], py[b], pz[b]));
+                gx[b] = gf.x; gy[b] = gf.y; gz[b] = gf.z;
+            }
+        }
+
+        for(int b = 0; b < n; b++)
+            f_clus[b] = blend_cluster_bone(gf_clus[b], f_clus[b], f[b], Vec3_cu(gx[b], gy[b], gz[b]));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Host batched version of compute_potential() for 'n' points
+/// (n <= HOST_BATCH_SIZE) sharing the same blending list 'off_cid'
+static void compute_potential_batch(Skeleton_env::Cluster_id off_cid,
+                                    int n,
+                                    const float* px, const float* py, const float* pz,
+                                    float* f,
+                                    Vec3_cu* gf)
+{
+    using namespace Skeleton_env;
+    float   fn [HOST_BATCH_SIZE], xfn [HOST_BATCH_SIZE];
+    Vec3_cu gfn[HOST_BATCH_SIZE], xgfn[HOST_BATCH_SIZE];
+
+    for(int b = 0; b < n; b++){
+        f [b] = 0.f;
+        gf[b] = Vec3_cu(1.f, 0.f, 0.f);
+    }
+
+    Cluster_cu clus = fetch_blending_list_int( off_cid );
+    const int nb_pairs = clus.nb_pairs;
+
+    for(int i = 0; i < nb_pairs*2; i += 2)
+    {
+        bool first = true;
+        for(int j = 0; j < 2; j++)
+        {
+            clus = fetch_blending_list_int( off_cid + i + j );
+            if(clus.nb_bone == 0)
+                continue;
+
+            eval_cluster_batch(n, px, py, pz, clus.nb_bone, clus.first_bone, xfn, xgfn);
+
+            for(int b = 0; b < n; b++)
+            {
+                if(first){
+                    fn [b] = xfn [b];
+                    gfn[b] = xgfn[b];
+                } else {
+                    fn[b] = fetch_binop_and_blend(gfn[b], clus.blend_type, clus.ctrl_id, off_cid + i,
+                                                  fn[b], xfn[b], gfn[b], xgfn[b]);
+                }
+            }
+            first = false;
+        }
+
+        if(first) continue; // Both clusters are empty
+
+        for(int b = 0; b < n; b++)
+            f[b] = Blend_func::Pairs::fngf(gf[b], f[b], fn[b], gf[b], gfn[b]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Skeleton_env::compute_potential_cpu(Skel_id skel_id,
+                                         const Point_cu* points,
+                                         int nb_points,
+                                         float* f,
+                                         Vec3_cu* gf)
+{
+    // Points of a chunk are sorted by blending list and evaluated by batches
+    // sharing the same list. Chunks are big enough for neighbor vertices to
+    // fall in the same grid cell.
+    const int chunk_size = 256;
+    Thread_utils::parallel_for(0, nb_points, chunk_size, [&](int begin, int end)
+    {
+        std::vector< std::pair<int, int> > order; // (blending list, point idx)
+        order.reserve(end - begin);
+        for(int p = begin; p < end; ++p)
+        {
+#ifndef USE_GRID_
+            Cluster_id off_cid = fetch_blending_list_offset( skel_id );
+#else
+            Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, points[p].to_vector());
+            if( !off_cid.is_valid() /*Means we are outside the skeleton bbox*/)
+            {
+                f[p] = 0.f;
+                if(gf != 0) gf[p] = Vec3_cu(1.f, 0.f, 0.f);
+                continue;
+            }
+#endif
+            order.push_back( std::make_pair(off_cid.id(), p) );
+        }
+        std::sort(order.begin(), order.end());
+
+        float px[HOST_BATCH_SIZE], py[HOST_BATCH_SIZE], pz[HOST_BATCH_SIZE];
+        float   f_batch [HOST_BATCH_SIZE];
+        Vec3_cu gf_batch[HOST_BATCH_SIZE];
+        for(unsigned i = 0; i < order.size(); )
+        {
+            const int list = order[i].first;
+            int n = 0;
+            for(; n < HOST_BATCH_SIZE && (i+n) < order.size() && order[i+n].first == list; n++)
+            {
+                const Point_cu& p = points[ order[i+n].second ];
+                px[n] = p.x; py[n] = p.y; pz[n] = p.z;
+            }
+
+            compute_potential_batch(Cluster_id(list), n, px, py, pz, f_batch, gf_batch);
+
+            for(int b = 0; b < n; b++)
+            {
+                const int p = order[i+b].second;
+                f[p] = f_batch[b];
+                if(gf != 0) gf[p] = gf_batch[b];
+            }
+            i += n;
+        }
+    });
+}
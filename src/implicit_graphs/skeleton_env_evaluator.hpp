@@ -11,9 +11,51 @@ namespace Skeleton_env {
 // =============================================================================
 
 /// @brief compute the potential of the whole skeleton
-__device__
+/// @note on host use compute_potential_cpu() to evaluate many points.
+IF_CUDA_DEVICE_HOST
 float compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_cu& gf);
 
+/// @brief compute the potential of the whole skeleton reusing the grid cell
+/// of a previous evaluation.
+/// Meant for points that move by small steps (e.g. vertices marching toward
+/// their iso-surface): the octree is only walked again when 'p' leaves
+/// 'cell', which is then updated. 'cell.nb_lookups' counts those walks.
+IF_CUDA_DEVICE_HOST
+float compute_potential(Skel_id skel_id, const Point_cu& p, Vec3_cu& gf, Grid_cell& cell);
+
+/// @brief compute the potential of the cluster pairs of the two bones 'bone0'
+/// and 'bone1' only (i.e. the pairs made of the bones' cluster and the cluster
+/// of its parent).
+/// Used to fit vertices against the few clusters that dominate their
+/// neighborhood. If the blending list of 'cell' holds none of these pairs the
+/// whole skeleton is evaluated. An invalid bone is ignored.
+/// @see compute_potential(Skel_id, const Point_cu&, Vec3_cu&, Grid_cell&)
+IF_CUDA_DEVICE_HOST
+float compute_potential(Skel_id skel_id,
+                        const Point_cu& p,
+                        Vec3_cu& gf,
+                        Grid_cell& cell,
+                        DBone_id bone0,
+                        DBone_id bone1);
+
+/// @brief compute the potential of the whole skeleton on the CPU for an array
+/// of points.
+/// Points are dispatched over the threads of Thread_utils. Each thread groups
+/// its points by grid cell so that a blending list is walked once for a batch
+/// of HOST_BATCH_SIZE points, HRBF bones being evaluated with
+/// HermiteRBF::fngf_batch().
+/// @param points : 'nb_points' points where the potential is evaluated
+/// @param f : output potential (size nb_points)
+/// @param gf : output gradient (size nb_points) or NULL if not needed
+void compute_potential_cpu(Skel_id skel_id,
+                           const Point_cu* points,
+                           int nb_points,
+                           float* f,
+                           Vec3_cu* gf);
+
+/// Number of points evaluated together by compute_potential_cpu()
+const int HOST_BATCH_SIZE = 16;
+
 }// END Skeleton_env ===========================================================
 
 
@@ -6,6 +6,7 @@
 #include "bone.hpp"
 #include "blending_env_type.hpp"
 #include "joint_type.hpp"
+#include "bbox.hpp"
 
 // =============================================================================
 namespace Skeleton_env {
@@ -78,6 +79,47 @@ struct Offset {
     int grid_data; ///< offset to acces data in grid list
 };
 
+/// Octree leaf of a skeleton grid remembered between two evaluations of the
+/// skeleton. While the evaluated point stays inside 'bbox' the blending list
+/// 'off_cid' is reused without walking down the octree again.
+/// @see Skeleton_env::compute_potential()
+struct Grid_cell {
+    IF_CUDA_DEVICE_HOST
+    Grid_cell() : off_cid(-1), nb_lookups(0) { }
+
+    /// @return if 'p' (in grid space) lies in the cell. Cells are half open
+    /// like in the octree walk (see fetch_grid_blending_list_offset())
+    IF_CUDA_DEVICE_HOST
+    bool contains(const Point_cu& p) const {
+        return (p.x >= bbox.pmin.x) & (p.y >= bbox.pmin.y) & (p.z >= bbox.pmin.z) &
+               (p.x <  bbox.pmax.x) & (p.y <  bbox.pmax.y) & (p.z <  bbox.pmax.z);
+    }
+
+    Cluster_id off_cid; ///< blending list of the cell (-1 for empty cells)
+    BBox_cu    bbox;    ///< cell bounds in grid space (empty if none cached)
+    int nb_lookups;     ///< number of octree walks done to update the cell
+};
+
+/// Statistics of the acceleration structure of a skeleton instance
+/// @see Skeleton_env::grid_stats()
+struct Grid_stats {
+    Grid_stats() :
+        nb_nodes(0), nb_leaves(0), nb_lists(0), depth(0), nb_bones(0),
+        nb_queries(0), nb_outside(0), max_bones_per_query(0),
+        avg_bones_per_query(0.)
+    { }
+
+    int nb_nodes;   ///< number of nodes of the octree
+    int nb_leaves;  ///< number of non empty leaves of the octree
+    int nb_lists;   ///< number of distinct blending lists
+    int depth;      ///< maximal depth of the octree
+    int nb_bones;   ///< bones evaluated per query without acceleration
+    int nb_queries; ///< number of points looked up
+    int nb_outside; ///< number of points outside of any bone
+    int max_bones_per_query;    ///< maximal number of bones evaluated
+    double avg_bones_per_query; ///< average number of bones evaluated
+};
+
 } // END SKELETON_ENV NAMESPACE ================================================
 
 #endif // SKELETON_ENV_TYPE_HPP
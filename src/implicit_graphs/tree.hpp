@@ -29,6 +29,7 @@ struct Tree {
     }
 
     void set_joints_data(const std::map<Bone::Id, Joint_data>& datas){ _datas = datas; }
+    const std::map<Bone::Id, Joint_data>& joints_data() const { return _datas; }
 
     bool is_leaf(Bone::Id bid) const { return _sons.at(bid).size() == 0; }
 
@@ -0,0 +1,180 @@
+#define NO_CUDA
+
+#include "deformer_cache.hpp"
+
+#include <string.h>
+
+using namespace std;
+
+namespace {
+    const int cacheMagic = 0x49534b43; // "ISKC"
+
+    // Increase this when the layout of the blob or the way any of its data is computed changes.
+    const int cacheVersion = 1;
+
+    // Magic, version and the two halves of the checksum.
+    const int headerSize = 4;
+
+    uint64_t checksum(const int *data, int size)
+    {
+        // 64-bit FNV-1a on whole words.
+        uint64_t h = 0xcbf29ce484222325ull;
+        for(int i = 0; i < size; ++i)
+            h = (h ^ (uint32_t) data[i]) * 0x100000001b3ull;
+        return h;
+    }
+
+    class Writer
+    {
+    public:
+        Writer(vector<int> &blob_): blob(blob_) { }
+
+        void put(int value) { blob.push_back(value); }
+
+        void put(uint64_t value)
+        {
+            put((int) (uint32_t) value);
+            put((int) (uint32_t) (value >> 32));
+        }
+
+        void put(const vector<int> &values)
+        {
+            put((int) values.size());
+            blob.insert(blob.end(), values.begin(), values.end());
+        }
+
+        void put(const vector<char> &values)
+        {
+            put((int) values.size());
+            blob.insert(blob.end(), values.begin(), values.end());
+        }
+
+        // Floats are stored bit for bit, so they read back exactly.
+        void put(const vector<float> &values)
+        {
+            put((int) values.size());
+            size_t start = blob.size();
+            blob.resize(start + values.size());
+            if(!values.empty())
+                memcpy(&blob[start], values.data(), values.size() * sizeof(float));
+        }
+
+    private:
+        vector<int> &blob;
+    };
+
+    // Each get() returns false if the data is truncated, in which case the blob is rejected.
+    class Reader
+    {
+    public:
+        Reader(const int *data_, int size_): data(data_), size(size_), pos(0) { }
+
+        bool get(int &value)
+        {
+            if(pos >= size)
+                return false;
+            value = data[pos++];
+            return true;
+        }
+
+        bool get(uint64_t &value)
+        {
+            int lo, hi;
+            if(!get(lo) || !get(hi))
+                return false;
+            value = (uint64_t) (uint32_t) lo | ((uint64_t) (uint32_t) hi << 32);
+            return true;
+        }
+
+        bool get(vector<int> &values)
+        {
+            const int *p = get_array(values);
+            if(p == NULL) return false;
+            values.assign(p, p + values.size());
+            return true;
+        }
+
+        bool get(vector<char> &values)
+        {
+            const int *p = get_array(values);
+            if(p == NULL) return false;
+            for(size_t i = 0; i < values.size(); ++i)
+                values[i] = (char) p[i];
+            return true;
+        }
+
+        bool get(vector<float> &values)
+        {
+            const int *p = get_array(values);
+            if(p == NULL) return false;
+            if(!values.empty())
+                memcpy(values.data(), p, values.size() * sizeof(float));
+            return true;
+        }
+
+        bool done() const { return pos == size; }
+
+    private:
+        // Read an array length, resize values to it, and return the array data.
+        template<typename T>
+        const int *get_array(vector<T> &values)
+        {
+            int count;
+            if(!get(count) || count < 0 || count > size - pos)
+                return NULL;
+            values.resize(count);
+            const int *result = data + pos;
+            pos += count;
+            return result;
+        }
+
+        const int *data;
+        int size;
+        int pos;
+    };
+}
+
+void DeformerCache::write(const Data &data, vector<int> &blob)
+{
+    blob.assign(headerSize, 0);
+
+    Writer writer(blob);
+    writer.put(data.topologyHash);
+    writer.put(data.geometryHash);
+    writer.put(data.adjacency.edge_list);
+    writer.put(data.adjacency.edge_list_offsets);
+    writer.put(data.adjacency.is_side);
+    writer.put(data.animesh.edge_lengths);
+    writer.put(data.animesh.edge_mvc);
+    writer.put(data.animesh.nearest_bones);
+    writer.put(data.animesh.skeleton_key);
+
+    uint64_t sum = checksum(blob.data() + headerSize, (int) blob.size() - headerSize);
+    blob[0] = cacheMagic;
+    blob[1] = cacheVersion;
+    blob[2] = (int) (uint32_t) sum;
+    blob[3] = (int) (uint32_t) (sum >> 32);
+}
+
+bool DeformerCache::read(const int *blob, int size, Data &data)
+{
+    if(size < headerSize || blob[0] != cacheMagic || blob[1] != cacheVersion)
+        return false;
+
+    uint64_t sum = checksum(blob + headerSize, size - headerSize);
+    if(blob[2] != (int) (uint32_t) sum || blob[3] != (int) (uint32_t) (sum >> 32))
+        return false;
+
+    Reader reader(blob + headerSize, size - headerSize);
+    bool ok =
+        reader.get(data.topologyHash) &&
+        reader.get(data.geometryHash) &&
+        reader.get(data.adjacency.edge_list) &&
+        reader.get(data.adjacency.edge_list_offsets) &&
+        reader.get(data.adjacency.is_side) &&
+        reader.get(data.animesh.edge_lengths) &&
+        reader.get(data.animesh.edge_mvc) &&
+        reader.get(data.animesh.nearest_bones) &&
+        reader.get(data.animesh.skeleton_key);
+    return ok && reader.done();
+}
@@ -0,0 +1,37 @@
+#ifndef DEFORMER_CACHE_HPP
+#define DEFORMER_CACHE_HPP
+
+#include "mesh.hpp"
+#include "animesh_base.hpp"
+
+#include <vector>
+#include <stdint.h>
+
+// Serialization of the data ImplicitDeformer computes when it loads a mesh, so it can be saved
+// with the scene and reused instead of computed again.  The blob is an array of ints, so it can
+// be stored in a kIntArray attribute.  It starts with a magic number, a format version and a
+// checksum of the rest of the data.  Anything that doesn't match is rejected by read(), and the
+// data is simply computed again.
+namespace DeformerCache
+{
+    struct Data
+    {
+        Data(): topologyHash(0), geometryHash(0) { }
+
+        // MayaData::topology_hash() and MayaData::geometry_hash() of the mesh the data was
+        // computed from.  The adjacency is only valid for the same topology, and the animesh
+        // data for the same topology and geometry.
+        uint64_t topologyHash;
+        uint64_t geometryHash;
+
+        Mesh::Adjacency adjacency;
+        Animesh_precomputed animesh;
+    };
+
+    void write(const Data &data, std::vector<int> &blob);
+
+    // Return false if blob isn't a valid cache of the current version.
+    bool read(const int *blob, int size, Data &data);
+}
+
+#endif
@@ -17,6 +17,7 @@
 #include <maya/MFnCompoundAttribute.h>
 #include <maya/MFnMatrixAttribute.h>
 #include <maya/MFnFloatArrayData.h>
+#include <maya/MFnIntArrayData.h>
 #include <maya/MFnTypedAttribute.h>
 #include <maya/MFnMatrixData.h>
 #include <maya/MFnEnumAttribute.h>
@@ -30,15 +31,20 @@
 #include <maya/MDataBlock.h>
 #include <maya/MDataHandle.h>
 #include <maya/MPointArray.h>
+#include <maya/MIntArray.h>
+#include <maya/MFloatArray.h>
 #include <maya/MMatrix.h>
+#include <maya/MAnimControl.h>
 
 #include "maya/maya_helpers.hpp"
 #include "maya/maya_data.hpp"
+#include "maya/deformer_cache.hpp"
 
 #include "skeleton.hpp"
 
 #include <algorithm>
 #include <map>
+#include <mutex>
 using namespace std;
 
 
@@ -67,10 +73,16 @@ using namespace std;
 const MTypeId ImplicitDeformer::id(0xEA115);
 MObject ImplicitDeformer::implicit;
 MObject ImplicitDeformer::basePotential;
+MObject ImplicitDeformer::basePotentialData;
+MObject ImplicitDeformer::basePotentialHalf;
+MObject ImplicitDeformer::compressBasePotential;
 MObject ImplicitDeformer::deformerIterations;
 MObject ImplicitDeformer::iterativeSmoothing;
 MObject ImplicitDeformer::finalFitting;
+MObject ImplicitDeformer::nearestClusters;
+MObject ImplicitDeformer::warmStart;
 MObject ImplicitDeformer::finalSmoothingMode;
+MObject ImplicitDeformer::precomputed;
 
 DagHelpers::MayaDependencies ImplicitDeformer::dependencies;
 
@@ -107,6 +119,14 @@ MStatus ImplicitDeformer::initialize()
         finalFitting = numAttr.create("finalFitting", "finalFitting", MFnNumericData::Type::kBoolean, true, &status);
         addAttribute(finalFitting);
         dependencies.add(ImplicitDeformer::finalFitting, ImplicitDeformer::outputGeom);
+
+        nearestClusters = numAttr.create("nearestClusters", "nearestClusters", MFnNumericData::Type::kBoolean, false, &status);
+        addAttribute(nearestClusters);
+        dependencies.add(ImplicitDeformer::nearestClusters, ImplicitDeformer::outputGeom);
+
+        warmStart = numAttr.create("warmStart", "warmStart", MFnNumericData::Type::kBoolean, false, &status);
+        addAttribute(warmStart);
+        dependencies.add(ImplicitDeformer::warmStart, ImplicitDeformer::outputGeom);
     
         // Don't use the raw values of EAnimesh::Smooth_type here.  Maya saves the integer value
         // to the file for some reason (it should save the string), and we shouldn't embed the
@@ -120,15 +140,39 @@ MStatus ImplicitDeformer::initialize()
         addAttribute(finalSmoothingMode);
         dependencies.add(ImplicitDeformer::finalSmoothingMode, ImplicitDeformer::outputGeom);
 
-        // The base potential of the mesh.
+        // The base potential of the mesh.  It's stored as a single array, so it's written and
+        // read with one call instead of one plug per vertex.
+        basePotentialData = typedAttr.create("basePotentialData", "bpd", MFnData::kFloatArray, MObject::kNullObj, &status); merr("typedAttr.create(basePotentialData)");
+        typedAttr.setHidden(true);
+        addAttribute(basePotentialData);
+        dependencies.add(implicit, basePotentialData);
+
+        basePotentialHalf = typedAttr.create("basePotentialHalf", "bph", MFnData::kIntArray, MObject::kNullObj, &status); merr("typedAttr.create(basePotentialHalf)");
+        typedAttr.setHidden(true);
+        addAttribute(basePotentialHalf);
+        dependencies.add(implicit, basePotentialHalf);
+
+        // This only changes how the base potential is saved, so it doesn't affect anything.
+        compressBasePotential = numAttr.create("compressBasePotential", "compressBasePotential", MFnNumericData::Type::kBoolean, false, &status);
+        addAttribute(compressBasePotential);
+
+        // The per-vertex base potential of older scenes.  Keep it so they still load.
         basePotential = numAttr.create("basePotential", "bp", MFnNumericData::Type::kFloat, 0, &status);
         numAttr.setArray(true);
         numAttr.setUsesArrayDataBuilder(true);
+        numAttr.setHidden(true);
         addAttribute(basePotential);
         dependencies.add(implicit, basePotential);
 
+        // This is only a cache, so it doesn't affect anything: don't add dependencies.
+        precomputed = typedAttr.create("precomputed", "precomputed", MFnData::kIntArray, MObject::kNullObj, &status); merr("typedAttr.create(precomputed)");
+        typedAttr.setHidden(true);
+        addAttribute(precomputed);
+
         dependencies.add(ImplicitDeformer::implicit, ImplicitDeformer::outputGeom);
         dependencies.add(ImplicitDeformer::basePotential, ImplicitDeformer::outputGeom);
+        dependencies.add(ImplicitDeformer::basePotentialData, ImplicitDeformer::outputGeom);
+        dependencies.add(ImplicitDeformer::basePotentialHalf, ImplicitDeformer::outputGeom);
         dependencies.add(ImplicitDeformer::input, ImplicitDeformer::outputGeom);
         dependencies.add(ImplicitDeformer::inputGeom, ImplicitDeformer::outputGeom);
 
@@ -140,6 +184,10 @@ void ImplicitDeformer::postConstructor()
 {
     implicitIsConnected = false;
     basePotentialIsDirty = false;
+    lastFrame = 0;
+    lastFrameValid = false;
+    meshTopologyHash = 0;
+    meshGeometryHash = 0;
 }
 
 MStatus ImplicitDeformer::setDependentsDirty(const MPlug &plug, MPlugArray &plugArray)
@@ -147,9 +195,10 @@ MStatus ImplicitDeformer::setDependentsDirty(const MPlug &plug, MPlugArray &plug
     MStatus status = MS::kSuccess;
     MPlug array = plug.array(&status);
 
-    // Remember when the basePotential array is modified, so we know when we need to
-    // reload it into the animesh.
-    if(array == ImplicitDeformer::basePotential)
+    // Remember when the base potential is modified, so we know when we need to reload it
+    // into the animesh.
+    if(plug == ImplicitDeformer::basePotentialData || plug == ImplicitDeformer::basePotentialHalf ||
+        array == ImplicitDeformer::basePotential)
         basePotentialIsDirty = true;
 
     return MPxDeformerNode::setDependentsDirty(plug, plugArray);
@@ -189,6 +238,13 @@ MStatus ImplicitDeformer::compute(const MPlug& plug, MDataBlock& dataBlock)
     });
 }
 
+EAnimesh::Fit_stats ImplicitDeformer::get_fit_stats() const
+{
+    if(animesh.get() == NULL)
+        return EAnimesh::Fit_stats();
+    return animesh->get_fit_stats();
+}
+
 MStatus ImplicitDeformer::deform(MDataBlock &dataBlock, MItGeometry &geomIter, const MMatrix &mat, unsigned int multiIndex)
 {
     return handle_exceptions([&] {
@@ -222,6 +278,20 @@ MStatus ImplicitDeformer::deform(MDataBlock &dataBlock, MItGeometry &geomIter, c
     bool finalFitting = DagHelpers::readHandle<bool>(dataBlock, ImplicitDeformer::finalFitting, &status); merr("finalFitting");
     animesh->set_final_fitting(finalFitting);
 
+    bool nearestClusters = DagHelpers::readHandle<bool>(dataBlock, ImplicitDeformer::nearestClusters, &status); merr("nearestClusters");
+    animesh->set_nearest_clusters(nearestClusters);
+
+    bool warmStart = DagHelpers::readHandle<bool>(dataBlock, ImplicitDeformer::warmStart, &status); merr("warmStart");
+    animesh->set_warm_start(warmStart);
+
+    // The previous solution is only a good guess for neighbouring frames.  Start from
+    // scratch when the time jumps, and let the animesh check how far the bones moved.
+    double frame = MAnimControl::currentTime().as(MTime::uiUnit());
+    if(!lastFrameValid || fabs(frame - lastFrame) > 1.5)
+        animesh->reset_warm_start();
+    lastFrame = frame;
+    lastFrameValid = true;
+
     int smoothMode = DagHelpers::readHandle<short>(dataBlock, ImplicitDeformer::finalSmoothingMode, &status); merr("finalSmoothingMode");
     EAnimesh::Smooth_type smoothType = EAnimesh::Smooth_type::LAPLACIAN;
 
@@ -236,19 +306,30 @@ MStatus ImplicitDeformer::deform(MDataBlock &dataBlock, MItGeometry &geomIter, c
     }
     animesh->set_smoothing_type(smoothType);
 
+    // Count the controller uploads of this evaluation only.  transform_vertices() sends the
+    // modified controllers to the GPU.
+    Blending_env::reset_ctrl_upload_stats();
     animesh->transform_vertices();
+    ctrlUploadStats = Blending_env::get_ctrl_upload_stats();
+
+    // Read the result back in object space.  The inverse matrix is applied by animesh while
+    // it copies the vertices into the staging buffer.
+    animesh->get_vertices(vertexStaging, DagHelpers::MMatrixToTransfo(mat.inverse()));
 
-    vector<Point_cu> result_verts;
-    animesh->get_vertices(result_verts);
+    if(geomIter.count() == vertexStaging.size())
+    {
+        // We're deforming the whole mesh, so set every vertex at once.
+        MPointArray points(vertexStaging.ptr(), vertexStaging.size());
+        status = geomIter.setAllPositions(points, MSpace::kObject); merr("setAllPositions");
+        return;
+    }
 
     // Copy out the vertices that we were actually asked to process.
-    MMatrix invMat = mat.inverse();
     for ( ; !geomIter.isDone(); geomIter.next()) {
         int vertex_index = geomIter.index();
 
-        Point_cu v = result_verts[vertex_index];
-        MPoint pt = MPoint(v.x, v.y, v.z) * invMat;
-        status = geomIter.setPosition(pt, MSpace::kObject); merr("setPosition");
+        const float *v = vertexStaging.ptr()[vertex_index];
+        status = geomIter.setPosition(MPoint(v[0], v[1], v[2]), MSpace::kObject); merr("setPosition");
     }
     });
 }
@@ -294,56 +375,114 @@ void ImplicitDeformer::load_mesh(MDataBlock &dataBlock)
     // in animMesh, because animMesh won't release its previous Skeleton.
     bool skeletonChanged = animesh.get() == NULL || animesh->get_skel() != skel.get();
 
-    // Hack: We calculate a bunch of properties from the mesh, such as the nearest joint to each
-    // vertex.  We don't want to recalculate that every time our input (skinned) geometry changes.
-    // Maya only tells us that the input data has changed, not how.  For now, if we already have
-    // geometry loaded and it has the same number of vertices, assume that we already have the correct
-    // mesh loaded.  This will handle the mesh being disconnected, etc.  Don't do this if we still
-    // need to load base potential.
-    //
-    // This will fail on the edge case of switching out the geometry with another mesh that has the
-    // same number of vertices but a completely different topology.  XXX
-    if(!skeletonChanged && animesh.get() != NULL && !basePotentialIsDirty)
+    // We calculate a bunch of properties from the mesh, such as the nearest joint to each vertex.
+    // We don't want to recalculate that every time our input (skinned) geometry changes.  Maya
+    // only tells us that the input data has changed, not how, so compare the topology hash of
+    // the input with the one of the mesh we loaded.  If it's the same, only the vertex positions
+    // changed.  This will handle the mesh being disconnected, etc.  Don't do this if we still need
+    // to load base potential.
+    uint64_t topologyHash = MayaData::topology_hash(geom);
+    if(!skeletonChanged && animesh.get() != NULL && !basePotentialIsDirty && topologyHash == meshTopologyHash)
     {
         MItGeometry allGeomIter(inputGeomDataHandle, true);
 
         MPointArray points;
         status = allGeomIter.allPositions(points, MSpace::kObject); merr("allGeomIter.allPositions");
+        assert(points.length() == mesh->get_nb_vertices());
+
+        // Set the deformed vertex data.  Input normals are only used during sampling, not during
+        // deformation, so we don't need to update them here.  The points are copied into the
+        // staging buffer in one go, and animesh applies the world matrix while loading them.
+        vertexStaging.resize(points.length());
+        status = points.get(vertexStaging.ptr()); merr("points.get");
 
-        if(points.length() == mesh.get()->get_nb_vertices())
-        {
-            // Set the deformed vertex data.  Input normals are only used during sampling,
-            // not during deformation, so we don't need to update them here.
-            vector<Vec3_cu> inputVerts;
-            inputVerts.reserve(points.length());
-            for(int i = 0; i < (int) points.length(); ++i)
-            {
-                MPoint point = points[i] * worldMatrix;
-                inputVerts.push_back(Vec3_cu((float) point.x, (float) point.y, (float) point.z));
-            }
-
-            animesh->set_vertices(inputVerts);
-
-            return;
-        }
+        animesh->set_vertices(vertexStaging, DagHelpers::MMatrixToTransfo(worldMatrix));
+        return;
     }
 
-    // Load the input mesh from the unskinned geometry.
-    Loader::Abs_mesh loaderMesh;
+    // The animesh points to the mesh, so release it before the mesh.
+    animesh.reset();
 
-    MayaData::load_mesh(geom, loaderMesh, worldMatrix);
+    // Read the data saved by calculate_base_potential().  The edges only depend on the topology,
+    // and the rest on the vertex positions too, so only use what still matches the mesh.
+    uint64_t geometryHash = MayaData::geometry_hash(geom, worldMatrix);
+    DeformerCache::Data cache;
+    MObject cacheObj = dataBlock.inputValue(ImplicitDeformer::precomputed, &status).data(); merr("inputValue(precomputed)");
+    bool cacheValid = false;
+    if(!cacheObj.isNull())
+    {
+        MFnIntArrayData cacheData(cacheObj, &status); merr("MFnIntArrayData(precomputed)");
+        MIntArray blob = cacheData.array();
+        cacheValid = blob.length() > 0 && DeformerCache::read(&blob[0], blob.length(), cache) && cache.topologyHash == topologyHash;
+    }
 
-    // Create our Mesh from the loaderMesh, discarding any previous mesh.
-    mesh.reset(new Mesh(loaderMesh));
-    mesh->check_integrity();
+    // Load the input mesh from the unskinned geometry, or reuse it if it's already loaded.
+    mesh = get_cached_mesh(geom, worldMatrix, topologyHash, geometryHash, cacheValid? &cache.adjacency:NULL);
+    meshTopologyHash = topologyHash;
+    meshGeometryHash = geometryHash;
 
-    // Create a new animMesh with the current mesh and skeleton.
-    animesh.reset(AnimeshBase::create(mesh.get(), skel));
+    // Create a new animMesh with the current mesh and skeleton.  The animesh checks the nearest
+    // bones against the skeleton itself.
+    bool animeshCacheValid = cacheValid && cache.geometryHash == geometryHash;
+    animesh.reset(AnimeshBase::create(mesh.get(), skel, animeshCacheValid? &cache.animesh:NULL));
 
     // Load base potential.
     load_base_potential(dataBlock);
 }
 
+// Return the Mesh for the given geometry in world space.  Meshes are cached by topology and
+// vertex positions, so deformers on identical geometry and reconnected deformers share the
+// same Mesh and its derived data (normals, edges, etc.) instead of loading it again.  The cache
+// only holds weak references: a Mesh is released with the last deformer using it.
+//
+// The adjacency only depends on the topology.  If adjacency isn't null, it's the saved adjacency
+// of a mesh with the same topology.  Otherwise, it's copied from a loaded mesh with the same
+// topology if there's one, and only computed if neither is available.
+//
+// Deformers can be evaluated in parallel, so the cache is locked while it's used.
+std::shared_ptr<const Mesh> ImplicitDeformer::get_cached_mesh(MObject geom, const MMatrix &worldMatrix, uint64_t topologyHash, uint64_t geometryHash, const Mesh::Adjacency *adjacency)
+{
+    static map<pair<uint64_t, uint64_t>, weak_ptr<const Mesh> > meshCache;
+    static std::mutex meshCacheMutex;
+    std::lock_guard<std::mutex> lock(meshCacheMutex);
+
+    pair<uint64_t, uint64_t> key(topologyHash, geometryHash);
+    shared_ptr<const Mesh> cachedMesh = meshCache[key].lock();
+    if(cachedMesh.get() != NULL)
+        return cachedMesh;
+
+    // Entries are sorted by topology first, so meshes with the same topology are adjacent.
+    Mesh::Adjacency sharedAdjacency;
+    for(auto it = meshCache.lower_bound(make_pair(topologyHash, (uint64_t) 0));
+        adjacency == NULL && it != meshCache.end() && it->first.first == topologyHash; ++it)
+    {
+        shared_ptr<const Mesh> sameTopology = it->second.lock();
+        if(sameTopology.get() == NULL)
+            continue;
+
+        sameTopology->get_adjacency(sharedAdjacency);
+        adjacency = &sharedAdjacency;
+    }
+
+    Loader::Abs_mesh loaderMesh;
+    MayaData::load_mesh(geom, loaderMesh, worldMatrix);
+
+    shared_ptr<Mesh> newMesh(new Mesh(loaderMesh, adjacency));
+    newMesh->check_integrity();
+    meshCache[key] = newMesh;
+
+    // Drop the entries of meshes that have been released.
+    for(auto it = meshCache.begin(); it != meshCache.end(); )
+    {
+        if(it->second.expired())
+            it = meshCache.erase(it);
+        else
+            ++it;
+    }
+
+    return newMesh;
+}
+
 // Update the base potential for the current mesh and input implicit surface.
 MStatus ImplicitDeformer::calculate_base_potential()
 {
@@ -363,14 +502,47 @@ MStatus ImplicitDeformer::calculate_base_potential()
     vector<float> pot;
     animesh->calculate_base_potential(pot);
 
-    // Save it to ImplicitDeformer::basePotential.
-    MPlug basePotentialPlug(thisMObject(), ImplicitDeformer::basePotential);
-    for(int i = 0; i < (int) pot.size(); ++i)
+    // Save it to basePotentialData, or basePotentialHalf if we're compressing it, and clear
+    // the other one so it isn't saved too.
+    bool compress = DagHelpers::readHandle<bool>(dataBlock, ImplicitDeformer::compressBasePotential, &status); check("compressBasePotential");
+
+    vector<int> packed;
+    if(compress)
+        MayaData::pack_half_floats(pot, packed);
+
+    MFnFloatArrayData floatData;
+    MObject floatObj = floatData.create(compress? MFloatArray():MFloatArray(pot.data(), (unsigned) pot.size()), &status); check("floatData.create");
+    status = MPlug(thisMObject(), ImplicitDeformer::basePotentialData).setValue(floatObj); check("basePotentialData.setValue");
+
+    MFnIntArrayData halfData;
+    MObject halfObj = halfData.create(MIntArray(packed.data(), (unsigned) packed.size()), &status); check("halfData.create");
+    status = MPlug(thisMObject(), ImplicitDeformer::basePotentialHalf).setValue(halfObj); check("basePotentialHalf.setValue");
+
+    // Clear the per-vertex array of older scenes, if there is one, so it isn't saved with the
+    // scene anymore.
+    MArrayDataHandle legacyHandle = dataBlock.outputArrayValue(ImplicitDeformer::basePotential, &status); check("outputArrayValue(basePotential)");
+    if(legacyHandle.elementCount() > 0)
     {
-        MPlug item = basePotentialPlug.elementByLogicalIndex(i, &status); merr("basePotentialPlug.elementByLogicalIndex");
-        item.setFloat(pot[i]);
+        MArrayDataBuilder builder(&dataBlock, ImplicitDeformer::basePotential, 0, &status); check("MArrayDataBuilder(basePotential)");
+        status = legacyHandle.set(builder); check("legacyHandle.set");
     }
 
+    // Save the mesh setup data along with the base potential, so it doesn't need to be computed
+    // when the scene is loaded.
+    DeformerCache::Data cache;
+    cache.topologyHash = meshTopologyHash;
+    cache.geometryHash = meshGeometryHash;
+    mesh->get_adjacency(cache.adjacency);
+    animesh->get_precomputed(cache.animesh);
+
+    vector<int> blob;
+    DeformerCache::write(cache, blob);
+
+    MFnIntArrayData cacheData;
+    MObject cacheObj = cacheData.create(MIntArray(blob.data(), (unsigned) blob.size()), &status); check("cacheData.create");
+    MPlug precomputedPlug(thisMObject(), ImplicitDeformer::precomputed);
+    status = precomputedPlug.setValue(cacheObj); check("precomputedPlug.setValue");
+
     return MStatus::kSuccess;
 }
 
@@ -392,10 +564,41 @@ void ImplicitDeformer::load_base_potential(MDataBlock &dataBlock)
     if(animesh.get() == NULL)
         return;
 
-    MArrayDataHandle basePotentialHandle = dataBlock.inputArrayValue(ImplicitDeformer::basePotential, &status); merr("basePotential");
-
+    // Use whichever of basePotentialData or basePotentialHalf was saved.  If neither was, this
+    // is an older scene, so read the per-vertex array.
     vector<float> pot;
-    status = DagHelpers::readArray(basePotentialHandle, pot); merr("readArray(basePotential)");
+    MObject floatObj = dataBlock.inputValue(ImplicitDeformer::basePotentialData, &status).data(); merr("inputValue(basePotentialData)");
+    MObject halfObj = dataBlock.inputValue(ImplicitDeformer::basePotentialHalf, &status).data(); merr("inputValue(basePotentialHalf)");
+
+    MFloatArray floatArray;
+    if(!floatObj.isNull())
+    {
+        MFnFloatArrayData floatData(floatObj, &status); merr("MFnFloatArrayData(basePotentialData)");
+        floatArray = floatData.array();
+    }
+
+    MIntArray halfArray;
+    if(!halfObj.isNull())
+    {
+        MFnIntArrayData halfData(halfObj, &status); merr("MFnIntArrayData(basePotentialHalf)");
+        halfArray = halfData.array();
+    }
+
+    if(floatArray.length() > 0)
+    {
+        pot.resize(floatArray.length());
+        status = floatArray.get(pot.data()); merr("floatArray.get");
+    }
+    else if(halfArray.length() > 0)
+    {
+        if(!MayaData::unpack_half_floats(&halfArray[0], halfArray.length(), pot))
+            throw runtime_error("basePotentialHalf is invalid.");
+    }
+    else
+    {
+        MArrayDataHandle basePotentialHandle = dataBlock.inputArrayValue(ImplicitDeformer::basePotential, &status); merr("basePotential");
+        status = DagHelpers::readArray(basePotentialHandle, pot); merr("readArray(basePotential)");
+    }
 
     // Set the base potential that we loaded.
     animesh->set_base_potential(pot);
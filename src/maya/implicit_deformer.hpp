@@ -4,10 +4,12 @@
 #include "mesh.hpp"
 #include "maya_helpers.hpp"
 #include "animesh_base.hpp"
+#include "blending_env_type.hpp"
 
 #include <maya/MPxDeformerNode.h> 
 
 #include <memory>
+#include <stdint.h>
 
 class ImplicitDeformer: public MPxDeformerNode
 {
@@ -25,10 +27,28 @@ public:
     MStatus setDependentsDirty(const MPlug &plug_, MPlugArray &plugArray);
 
     // Calculate the base potential based on the current mesh, and store it to the
-    // basePotential attribute.
+    // basePotentialData attribute, or basePotentialHalf if compressBasePotential is set.
     MStatus calculate_base_potential();
 
-    // The base potential of the mesh.
+    // Counters of the vertex fitting of the last deformation.  They are reset by each
+    // deformation.
+    EAnimesh::Fit_stats get_fit_stats() const;
+
+    // Controller uploads to the GPU done by the last deformation.
+    Blending_env::Ctrl_upload_stats get_ctrl_upload_stats() const { return ctrlUploadStats; }
+
+    // The base potential of the mesh, as a float array.
+    static MObject basePotentialData;
+
+    // The base potential of the mesh, packed as half floats (see MayaData::pack_half_floats).
+    static MObject basePotentialHalf;
+
+    // If enabled, calculate_base_potential() stores the base potential in basePotentialHalf,
+    // which halves its size in the scene file at the cost of precision.
+    static MObject compressBasePotential;
+
+    // The base potential of the mesh, one element per vertex.  This is how older scenes
+    // stored it.  It's only read if basePotentialData and basePotentialHalf are empty.
     static MObject basePotential;
 
     // The input implicit surface.
@@ -44,26 +64,60 @@ public:
     // pass of final smoothing.
     static MObject finalFitting;
 
+    // If enabled, fitting passes before final fitting only evaluate the two clusters
+    // nearest to each vertex, instead of the whole skeleton.
+    static MObject nearestClusters;
+
+    // If enabled, fitting starts from the result of the previous evaluation, moved along
+    // with the bones, instead of from the SSD pose.  Time jumps and large pose changes
+    // fall back on the SSD pose.
+    static MObject warmStart;
+
     // The final smoothing method.  Note that this is independent of iterativeSmoothing.
     static MObject finalSmoothingMode;
+
+    // Data computed when the mesh was loaded (edges, mean value coordinates, nearest bones),
+    // saved with the scene by calculate_base_potential() so loading the scene doesn't compute
+    // it again.  See DeformerCache.
+    static MObject precomputed;
     
 private:
     static DagHelpers::MayaDependencies dependencies;
 
     void load_mesh(MDataBlock &dataBlock);
+    static std::shared_ptr<const Mesh> get_cached_mesh(MObject geom, const MMatrix &worldMatrix, uint64_t topologyHash, uint64_t geometryHash, const Mesh::Adjacency *adjacency);
     void load_base_potential(MDataBlock &dataBlock);
     std::shared_ptr<const Skeleton> get_implicit_skeleton(MDataBlock &dataBlock);
 
     bool implicitIsConnected;
 
-    // If true, the contents of basePotential have been modified and not yet loaded.
+    // If true, the contents of the base potential attributes have been modified and not yet
+    // loaded.
     bool basePotentialIsDirty;
 
-    // The loaded mesh.  We own this object.
-    std::unique_ptr<Mesh> mesh;
+    // The frame of the last deformation, to discard the warm start on time jumps.
+    double lastFrame;
+    bool lastFrameValid;
+
+    // The loaded mesh.  Meshes are shared between deformers with identical input geometry,
+    // see get_cached_mesh().
+    std::shared_ptr<const Mesh> mesh;
+
+    // MayaData::topology_hash() and MayaData::geometry_hash() of the geometry mesh was
+    // loaded from.
+    uint64_t meshTopologyHash;
+    uint64_t meshGeometryHash;
 
     // The main deformer implementation.
     std::unique_ptr<AnimeshBase> animesh;
+
+    // Vertices going to and coming from animesh.  This is kept between evaluations, so we
+    // don't allocate (page-locked) memory every frame.
+    Vertex_staging vertexStaging;
+
+    // The controller uploads of the last deformation.  The counters of Blending_env are shared
+    // by every deformer, so they're copied here after each evaluation.
+    Blending_env::Ctrl_upload_stats ctrlUploadStats;
 };
 
 #endif
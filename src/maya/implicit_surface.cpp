@@ -31,6 +31,7 @@
 #include "maya/maya_data.hpp"
 
 #include "skeleton.hpp"
+#include "hrbf_env.hpp"
 
 #include "implicit_surface_data.hpp"
 
@@ -241,6 +242,74 @@ void ImplicitSurface::save_sampleset(const SampleSet::InputSample &inputSample)
     }
 }
 
+void ImplicitSurface::solve_samplesets(const std::vector<ImplicitSurface *> &surfaces, const std::vector<SampleSet::InputSample> &samples)
+{
+    assert(surfaces.size() == samples.size());
+
+    std::vector<HermiteRBF *> hrbfs;
+    std::vector<std::vector<Vec3_cu> > nodes, normals;
+    for(int i = 0; i < (int) surfaces.size(); ++i)
+    {
+        if(samples[i].nodes.empty())
+            continue;
+
+        // The samples are solved wholesale: end any edit session
+        surfaces[i]->bone->get_hrbf().end_edits();
+        hrbfs.push_back(&surfaces[i]->bone->get_hrbf());
+        nodes.push_back(samples[i].nodes);
+        normals.push_back(samples[i].n_nodes);
+        surfaces[i]->solvedSample = samples[i];
+    }
+
+    HermiteRBF::init_coeffs_batch(hrbfs, nodes, normals);
+}
+
+static bool same_samples(const SampleSet::InputSample &a, const SampleSet::InputSample &b)
+{
+    if(a.nodes.size() != b.nodes.size() || a.n_nodes.size() != b.n_nodes.size())
+        return false;
+
+    for(int i = 0; i < (int) a.nodes.size(); ++i)
+    {
+        if(a.nodes[i].x != b.nodes[i].x || a.nodes[i].y != b.nodes[i].y || a.nodes[i].z != b.nodes[i].z)
+            return false;
+    }
+    for(int i = 0; i < (int) a.n_nodes.size(); ++i)
+    {
+        if(a.n_nodes[i].x != b.n_nodes[i].x || a.n_nodes[i].y != b.n_nodes[i].y || a.n_nodes[i].z != b.n_nodes[i].z)
+            return false;
+    }
+    return true;
+}
+
+// Fill edits with the samples of b which differ from a.  Return false if the
+// sample sets are too different to be edited in place.
+static bool sample_edits(const SampleSet::InputSample &a, const SampleSet::InputSample &b, HRBF_env::Sample_edits &edits)
+{
+    edits.clear();
+    if(a.nodes.empty() || a.nodes.size() != b.nodes.size() || a.n_nodes.size() != b.n_nodes.size())
+        return false;
+
+    int changed = 0;
+    for(int i = 0; i < (int) b.nodes.size(); ++i)
+    {
+        const Point_cu &p = b.nodes[i];
+        const Vec3_cu &n = b.n_nodes[i];
+        bool moved = p.x != a.nodes[i].x || p.y != a.nodes[i].y || p.z != a.nodes[i].z;
+        bool turned = n.x != a.n_nodes[i].x || n.y != a.n_nodes[i].y || n.z != a.n_nodes[i].z;
+        if(moved)
+            edits.set_sample(i, p.to_vector());
+        if(turned)
+            edits.set_normal(i, n);
+        if(moved || turned)
+            changed++;
+    }
+
+    // The low rank refit only pays off when a few samples are edited, like when
+    // the user drags a sample around.
+    return changed * 4 <= (int) b.nodes.size();
+}
+
 void ImplicitSurface::load_sampleset(MDataBlock &dataBlock)
 {
     MStatus status = MStatus::kSuccess;
@@ -283,8 +352,28 @@ void ImplicitSurface::load_sampleset(MDataBlock &dataBlock)
         // Solve/compute HRBF weights
         bone->set_enabled(true);
         bone->discard_precompute();
-        bone->get_hrbf().init_coeffs(inputSample.nodes, inputSample.n_nodes);
-        printf("update_bone_samples: Solved %i nodes\n", (int) inputSample.nodes.size());
+
+        // Skip the solve if solve_samplesets() already did it for these samples.
+        if(!same_samples(inputSample, solvedSample))
+        {
+            HermiteRBF &hrbf = bone->get_hrbf();
+            HRBF_env::Sample_edits edits;
+            if(sample_edits(solvedSample, inputSample, edits))
+            {
+                // A few samples changed: refit the previous solve.  The edit session stays
+                // open until the samples are solved wholesale again.
+                hrbf.begin_edits();
+                hrbf.apply_edits(edits);
+                printf("update_bone_samples: Refit %i nodes\n", (int) inputSample.nodes.size());
+            }
+            else
+            {
+                hrbf.end_edits();
+                hrbf.init_coeffs(inputSample.nodes, inputSample.n_nodes);
+                printf("update_bone_samples: Solved %i nodes\n", (int) inputSample.nodes.size());
+            }
+            solvedSample = inputSample;
+        }
 
         // Make sure the current transforms are applied now that we've changed the bone.
         // XXX: If this is needed, Bone should probably do this internally.
@@ -47,6 +47,11 @@ public:
 
     void save_sampleset(const SampleSet::InputSample &inputSample);
 
+    // Solve the HRBF of each surface from its sample set, in parallel.  The samples must
+    // also be stored with save_sampleset(), so load_sampleset() doesn't solve them again.
+    static void solve_samplesets(const std::vector<ImplicitSurface *> &surfaces,
+                                 const std::vector<SampleSet::InputSample> &samples);
+
     const MeshGeom &get_mesh_geometry();
 
     // This is only used during creation.  Set the object-space direction of the bone away
@@ -74,6 +79,9 @@ private:
     // A skeleton containing just our bone.
     std::shared_ptr<Skeleton> boneSkeleton;
 
+    // The samples the HRBF of our bone was last solved with.
+    SampleSet::InputSample solvedSample;
+
     // This is updated by meshGeometryUpdateAttr, and contains a mesh reprensentation of the
     // implicit surface.  This is used for preview rendering.  If the surface shape is hidden
     // (which is normally is, when being used for deformation), this won't be evaluated.
@@ -3,10 +3,11 @@
 #include "maya_data.hpp"
 
 #include <assert.h>
+#include <string.h>
 
-#include <maya/MItMeshVertex.h>
-#include <maya/MItMeshPolygon.h>
+#include <maya/MFnMesh.h>
 #include <maya/MPointArray.h>
+#include <maya/MFloatVectorArray.h>
 #include <maya/MIntArray.h>
 #include <maya/MFnSkinCluster.h>
 #include <maya/MMatrix.h>
@@ -14,69 +15,204 @@
 
 using namespace std;
 
+namespace {
+    // Mix count 32-bit words into the hash h (64-bit FNV-1a on whole words).
+    uint64_t hash_words(uint64_t h, const void *data, size_t count)
+    {
+        const unsigned char *bytes = (const unsigned char *) data;
+        for(size_t i = 0; i < count; ++i)
+        {
+            uint32_t word;
+            memcpy(&word, bytes + i*sizeof(uint32_t), sizeof(uint32_t));
+            h = (h ^ word) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    const uint64_t hash_seed = 0xcbf29ce484222325ull;
+
+    // Round to the nearest half float, ties to even.  Values too large for a half become
+    // infinity and values too small become zero.
+    uint16_t float_to_half(float value)
+    {
+        uint32_t f;
+        memcpy(&f, &value, sizeof(f));
+
+        uint32_t sign = (f >> 16) & 0x8000;
+        int exponent = (int) ((f >> 23) & 0xff);
+        uint32_t mantissa = f & 0x7fffff;
+
+        // Infinity and NaN.
+        if(exponent == 0xff)
+            return (uint16_t) (sign | 0x7c00 | (mantissa? 0x200:0));
+
+        exponent = exponent - 127 + 15;
+        if(exponent >= 0x1f)
+            return (uint16_t) (sign | 0x7c00);
+
+        int shift = 13;
+        if(exponent <= 0)
+        {
+            // The result is a denormal half, or zero.
+            if(exponent < -10)
+                return (uint16_t) sign;
+            mantissa |= 0x800000;
+            shift = 14 - exponent;
+            exponent = 0;
+        }
+
+        uint32_t half = ((uint32_t) exponent << 10) | (mantissa >> shift);
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+
+        // A carry out of the mantissa correctly moves on to the next exponent.
+        if(remainder > halfway || (remainder == halfway && (half & 1)))
+            half++;
+        return (uint16_t) (sign | half);
+    }
+
+    float half_to_float(uint16_t half)
+    {
+        uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+        int exponent = (half >> 10) & 0x1f;
+        uint32_t mantissa = half & 0x3ff;
+
+        uint32_t f;
+        if(exponent == 0x1f)
+            f = sign | 0x7f800000 | (mantissa << 13);
+        else if(exponent != 0)
+            f = sign | ((uint32_t) (exponent - 15 + 127) << 23) | (mantissa << 13);
+        else if(mantissa == 0)
+            f = sign;
+        else
+        {
+            // Normalize the denormal half.
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            f = sign | ((uint32_t) exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+
+        float value;
+        memcpy(&value, &f, sizeof(value));
+        return value;
+    }
+}
+
 void MayaData::load_mesh(MObject inputObject, Loader::Abs_mesh &mesh, MMatrix vertexTransform)
 {
     MStatus status = MS::kSuccess;
-    MItMeshVertex meshIt(inputObject, &status); merr("MItMeshVertex");
+    MFnMesh fnMesh(inputObject, &status); merr("MFnMesh");
 
     // Load vertices and normals.
-    int num_verts = meshIt.count(&status); merr("meshIt.count");
+    MPointArray points;
+    status = fnMesh.getPoints(points, MSpace::kObject); merr("fnMesh.getPoints");
+
+    // If the vertex has unshared normals, this retrieves the averaged normal.  Since we're
+    // normally blending soft surfaces, this is usually okay.
+    MFloatVectorArray normals;
+    status = fnMesh.getVertexNormals(false, normals, MSpace::kObject); merr("fnMesh.getVertexNormals");
+
+    int num_verts = points.length();
+    assert(normals.length() == (unsigned) num_verts);
 
     mesh._vertices.resize(num_verts);
     mesh._normals.resize(num_verts);
 
-    int idx = 0;
-    for ( ; !meshIt.isDone(); meshIt.next())
+    for(int idx = 0; idx < num_verts; ++idx)
     {
-        MPoint point = meshIt.position(MSpace::kObject, &status); merr("meshIt.position");
-
         // If specified, transform the point from object space to another coordinate space.
-        point = point * vertexTransform;
-
+        MPoint point = points[idx] * vertexTransform;
         mesh._vertices[idx] = Point_cu((float)point.x, (float)point.y, (float)point.z);
 
-        // Load the vertex's normal.  If the normal has unshared normals, this will retrieve
-        // the averaged normal.  Since we're normally blending soft surfaces, this is usually
-        // okay.
-        MVector normal;
-        status = meshIt.getNormal(normal, MSpace::kObject); merr("meshIt.getNormal");
-        normal = normal.transformAsNormal(vertexTransform);
-
+        MVector normal = MVector(normals[idx]).transformAsNormal(vertexTransform);
         mesh._normals[idx] = Vec3_cu((float)normal[0], (float)normal[1], (float)normal[2]);
-
-        ++idx;
     }
 
-    // Load tris using Maya's triangulation.
-    MItMeshPolygon polyIt(inputObject);
-    int num_faces = polyIt.count(&status); merr("polyIt.count");
+    // Load tris using Maya's triangulation.  Polygons without a valid triangulation have no
+    // triangles.
+    MIntArray triangleCounts, triangleVertices;
+    status = fnMesh.getTriangles(triangleCounts, triangleVertices); merr("fnMesh.getTriangles");
+
+    assert(triangleVertices.length() % 3 == 0);
+    for(int polyIdx = 0; polyIdx < (int) triangleCounts.length(); ++polyIdx)
+    {
+        if(triangleCounts[polyIdx] == 0)
+            printf("Warning: Polygon with index %i doesn't have a valid triangulation", polyIdx);
+    }
 
-    for ( ; !polyIt.isDone(); polyIt.next())
+    mesh._triangles.reserve(triangleVertices.length() / 3);
+    for(int triIdx = 0; triIdx < (int) triangleVertices.length(); triIdx += 3)
     {
-        if(!polyIt.hasValidTriangulation())
+        Loader::Tri_face f;
+        for(int faceIdx = 0; faceIdx < 3; ++faceIdx)
         {
-            int idx = polyIt.index(&status);
-            printf("Warning: Polygon with index %i doesn't have a valid triangulation", idx);
-            continue;
+            f.v[faceIdx] = triangleVertices[triIdx+faceIdx];
+            f.n[faceIdx] = triangleVertices[triIdx+faceIdx];
         }
 
-        MPointArray trianglePoints;
-        MIntArray triangleIndexes;
-        status = polyIt.getTriangles(trianglePoints, triangleIndexes, MSpace::kObject); merr("polyIt.getTriangles");
+        mesh._triangles.push_back(f);
+    }
+}
 
-        assert(triangleIndexes.length() % 3 == 0);
-        for(int triIdx = 0; triIdx < (int) triangleIndexes.length(); triIdx += 3)
-        {
-            Loader::Tri_face f;
-            for(int faceIdx = 0; faceIdx < 3; ++faceIdx)
-            {
-                f.v[faceIdx] = triangleIndexes[triIdx+faceIdx];
-                f.n[faceIdx] = triangleIndexes[triIdx+faceIdx];
-            }
+uint64_t MayaData::topology_hash(MObject inputObject)
+{
+    MStatus status = MS::kSuccess;
+    MFnMesh fnMesh(inputObject, &status); merr("MFnMesh");
+
+    MIntArray vertexCounts, vertexList;
+    status = fnMesh.getVertices(vertexCounts, vertexList); merr("fnMesh.getVertices");
+
+    int header[2] = { fnMesh.numVertices(), (int) vertexCounts.length() };
+    uint64_t h = hash_words(hash_seed, header, 2);
+    if(vertexCounts.length() > 0)
+        h = hash_words(h, &vertexCounts[0], vertexCounts.length());
+    if(vertexList.length() > 0)
+        h = hash_words(h, &vertexList[0], vertexList.length());
+    return h;
+}
 
-            mesh._triangles.push_back(f);
-        }
+uint64_t MayaData::geometry_hash(MObject inputObject, MMatrix vertexTransform)
+{
+    MStatus status = MS::kSuccess;
+    MFnMesh fnMesh(inputObject, &status); merr("MFnMesh");
+
+    const float *rawPoints = fnMesh.getRawPoints(&status); merr("fnMesh.getRawPoints");
+
+    uint64_t h = hash_words(hash_seed, vertexTransform.matrix, sizeof(vertexTransform.matrix) / sizeof(uint32_t));
+    if(rawPoints != NULL)
+        h = hash_words(h, rawPoints, 3 * fnMesh.numVertices());
+    return h;
+}
+
+void MayaData::pack_half_floats(const vector<float> &values, vector<int> &packed)
+{
+    int count = (int) values.size();
+    packed.assign(1 + (count + 1) / 2, 0);
+    packed[0] = count;
+    for(int i = 0; i < count; ++i)
+    {
+        uint32_t half = float_to_half(values[i]);
+        packed[1 + i/2] |= (int) (half << ((i & 1) * 16));
+    }
+}
+
+bool MayaData::unpack_half_floats(const int *packed, int size, vector<float> &values)
+{
+    if(size < 1 || packed[0] < 0 || size != 1 + (packed[0] + 1) / 2)
+        return false;
+
+    int count = packed[0];
+    values.resize(count);
+    for(int i = 0; i < count; ++i)
+    {
+        uint32_t word = (uint32_t) packed[1 + i/2];
+        values[i] = half_to_float((uint16_t) (word >> ((i & 1) * 16)));
     }
+    return true;
 }
 
 void MayaData::loadSkeletonHierarchyFromSkinCluster(const std::map<int,MDagPath> &logicalIndexToInfluenceObjects, std::map<int,int> &logicalIndexToParentIdx)
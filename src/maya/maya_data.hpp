@@ -9,10 +9,28 @@
 #include <maya/MPlug.h>
 #include <maya/MMatrix.h>
 #include <map>
+#include <vector>
+#include <stdint.h>
 
 namespace MayaData
 {
     void load_mesh(MObject inputObject, Loader::Abs_mesh &mesh, MMatrix vertexTransform = MMatrix::identity);
+
+    // Return a hash of the mesh's topology: its vertex count, the vertex count of each face and
+    // the face vertex indices.  Two meshes with the same hash can be assumed to have the same
+    // topology.  This only uses bulk MFnMesh queries, so it's cheap enough to run every frame.
+    uint64_t topology_hash(MObject inputObject);
+
+    // Return a hash of the mesh's object space vertex positions, transformed by vertexTransform.
+    uint64_t geometry_hash(MObject inputObject, MMatrix vertexTransform = MMatrix::identity);
+    // Convert floats to IEEE half floats, two per int, preceded by the number of values.  This
+    // halves the size of data that doesn't need full precision, like the base potential.
+    // Values are rounded to the nearest half float.
+    void pack_half_floats(const std::vector<float> &values, std::vector<int> &packed);
+
+    // Reverse pack_half_floats().  Return false if packed isn't a valid packed array.
+    bool unpack_half_floats(const int *packed, int size, std::vector<float> &values);
+
     void loadSkeletonHierarchyFromSkinCluster(const std::map<int,MDagPath> &logicalIndexToInfluenceObjects, std::map<int,int> &logicalIndexToParentIdx);
 }
 
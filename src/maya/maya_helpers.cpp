@@ -40,6 +40,7 @@
 
 #include <maya/MDataBlock.h>
 #include <maya/MDataHandle.h>
+#include <maya/MDGContext.h>
 #include <maya/MArrayDataHandle.h>
 
 #include <maya/MDoubleArray.h>
@@ -199,10 +200,11 @@ namespace DagHelpers
         }
         return MStatus::kSuccess;
     }
-    /* Return the skin weights for all vertices.  weightsPerIndex[vtx] is the weights for vertex n.
-     * weightsPerIndex[vtx][physical_idx] is the weight for a single influence on the vertex.  Note
-     * that this uses physical indexes, not logical indexes. */
-    MStatus getWeightsForAllVertices(MObject skinClusterNode, vector<vector<double> > &weightsPerIndex)
+    /* Return the skin weights for all vertices, using physical influence indexes, not logical
+     * indexes.  The weights are read straight from the sparse weightList[vtx].weights[logical]
+     * array of the skinCluster, so only the weights that are actually set are visited, and never
+     * a dense vertices * influences array. */
+    MStatus getWeightsForAllVertices(MObject skinClusterNode, SkinWeights &skinWeights)
     {
         MStatus status = MStatus::kSuccess;
         MFnSkinCluster skinCluster(skinClusterNode, &status);
@@ -214,30 +216,83 @@ namespace DagHelpers
 
         MItGeometry geomIter(dagPath, &status);
         if(status != MS::kSuccess) return status;
+        int numVertices = geomIter.count();
 
-        weightsPerIndex.reserve(geomIter.count());
-
+        // Map the logical indexes of the weights array to physical indexes, the order of
+        // influenceObjects().
         MDagPathArray influenceObjects;
         skinCluster.influenceObjects(influenceObjects, &status);
         if(status != MS::kSuccess) return status;
 
-        int expectedWeightsPerIndex = -1;
-        for( ; !geomIter.isDone(); geomIter.next() ) {
-            MObject component = geomIter.component(&status);
+        map<int,int> logicalIndexToPhysicalIndex;
+        for(int i = 0; i < (int) influenceObjects.length(); ++i)
+        {
+            int logicalIndex = skinCluster.indexForInfluenceObject(influenceObjects[i], &status);
             if(status != MS::kSuccess) return status;
+            logicalIndexToPhysicalIndex[logicalIndex] = i;
+        }
+
+        MPlug weightListPlug = skinCluster.findPlug("weightList", &status);
+        if(status != MS::kSuccess) return status;
+        MObject weightsAttr = skinCluster.attribute("weights", &status);
+        if(status != MS::kSuccess) return status;
 
-            MDoubleArray weights;
-            unsigned influenceCount;
-            status = skinCluster.getWeights(dagPath, component, weights, influenceCount);
+        // Read the sparse weights once as (vertex, influence, weight), in the order they're stored.
+        vector<int> vertices;
+        vector<int> influences;
+        vector<double> weights;
+        {
+            MDataHandle weightListHandle = weightListPlug.asMDataHandle(MDGContext::fsNormal, &status);
             if(status != MS::kSuccess) return status;
 
-            // We should get the same number of influences for all vertices.
-            if(expectedWeightsPerIndex == -1)
-                expectedWeightsPerIndex = influenceCount;
-            else
-                assert(expectedWeightsPerIndex == influenceCount);
+            MArrayDataHandle weightListArray(weightListHandle);
+            for(unsigned i = 0; i < weightListArray.elementCount(); ++i)
+            {
+                status = weightListArray.jumpToArrayElement(i);
+                if(status != MS::kSuccess) break;
+
+                int vtx = (int) weightListArray.elementIndex();
+                if(vtx >= numVertices)
+                    continue;
 
-            weightsPerIndex.emplace_back(&weights[0], &weights[0] + weights.length());
+                MArrayDataHandle weightsArray(weightListArray.inputValue().child(weightsAttr));
+                for(unsigned j = 0; j < weightsArray.elementCount(); ++j)
+                {
+                    status = weightsArray.jumpToArrayElement(j);
+                    if(status != MS::kSuccess) break;
+
+                    double weight = weightsArray.inputValue().asDouble();
+                    auto it = logicalIndexToPhysicalIndex.find((int) weightsArray.elementIndex());
+                    if(weight == 0 || it == logicalIndexToPhysicalIndex.end())
+                        continue;
+
+                    vertices.push_back(vtx);
+                    influences.push_back(it->second);
+                    weights.push_back(weight);
+                }
+                if(status != MS::kSuccess) break;
+            }
+            weightListPlug.destructHandle(weightListHandle);
+            if(status != MS::kSuccess) return status;
+        }
+
+        // Bucket them by vertex.  Weights of a vertex keep their order.
+        skinWeights.nbInfluences = (int) influenceObjects.length();
+        skinWeights.offsets.assign(numVertices+1, 0);
+        for(int vtx: vertices)
+            skinWeights.offsets[vtx+1]++;
+
+        for(int vtx = 0; vtx < numVertices; ++vtx)
+            skinWeights.offsets[vtx+1] += skinWeights.offsets[vtx];
+
+        skinWeights.influences.resize(weights.size());
+        skinWeights.weights.resize(weights.size());
+        vector<int> next(skinWeights.offsets.begin(), skinWeights.offsets.end()-1);
+        for(int i = 0; i < (int) weights.size(); ++i)
+        {
+            int idx = next[vertices[i]]++;
+            skinWeights.influences[idx] = influences[i];
+            skinWeights.weights[idx] = weights[i];
         }
 
         return MStatus::kSuccess;
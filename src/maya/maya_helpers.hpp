@@ -86,11 +86,28 @@ namespace DagHelpers
     };
     Transfo MMatrixToTransfo(const MMatrix &mmat);
 
+    // Skin weights of a skinCluster stored sparsely (CSR): the nonzero weights of vertex vtx
+    // are weights[offsets[vtx]] to weights[offsets[vtx+1]-1], and influences[] holds the
+    // physical influence index of each of them.  Memory scales with the number of nonzero
+    // weights rather than vertices * influences.
+    struct SkinWeights {
+        SkinWeights(): nbInfluences(0) { }
+
+        int numVertices() const { return offsets.empty()? 0: (int) offsets.size() - 1; }
+        int begin(int vtx) const { return offsets[vtx]; }
+        int end(int vtx) const { return offsets[vtx+1]; }
+
+        int nbInfluences;
+        vector<int> offsets;
+        vector<int> influences;
+        vector<double> weights;
+    };
+
     MStatus getConnectedPlugWithName(MObject inputNode, std::string name, MObject &result);
     MMatrix getMatrixFromPlug(MPlug plug, MStatus *status);
     MStatus findAncestorDeformer(MObject node, MFn::Type type, MObject &resultNode);
     MStatus getInfluenceObjectsForSkinCluster(MObject skinClusterNode, map<int,MDagPath> &logicalIndexToInfluenceObjects, map<int,int> &logicalIndexToPhysicalIndex);
-    MStatus getWeightsForAllVertices(MObject skinClusterNode, vector<vector<double> > &weightsPerIndex);
+    MStatus getWeightsForAllVertices(MObject skinClusterNode, SkinWeights &skinWeights);
     MStatus getMDagPathsFromSkinCluster(MObject skinClusterNode, std::vector<MDagPath> &out);
     int findClosestAncestor(const std::map<int,MDagPath> &logicalIndexToInfluenceObjects, MDagPath dagPath);
     MStatus setMatrixPlug(MObject node, MObject attr, MMatrix matrix);
@@ -40,6 +40,7 @@
 #include "maya/maya_data.hpp"
 #include "utils/misc_utils.hpp"
 #include "utils/std_utils.hpp"
+#include "utils/thread_utils.hpp"
 
 #include "skeleton.hpp"
 #include "sample_set.hpp"
@@ -64,6 +65,7 @@ public:
 
     void init(MString nodeName);
     void calculate_base_potential(MString deformerName);
+    void report_stats(MString deformerName);
 
     ImplicitDeformer *getDeformerByName(MString nodeName);
 
@@ -112,6 +114,24 @@ void ImplicitCommand::calculate_base_potential(MString deformerName)
     status = deformer->calculate_base_potential(); merr("calculate_base_potential");
 }
 
+// Return the counters of the last evaluation of the deformer: the number of potential evaluations
+// of the vertex fitting, how many of them walked down the skeleton grid, then the bytes of
+// controllers uploaded to the GPU, the number of controllers uploaded alone and the number of
+// full uploads.
+void ImplicitCommand::report_stats(MString deformerName)
+{
+    ImplicitDeformer *deformer = getDeformerByName(deformerName);
+
+    EAnimesh::Fit_stats fitStats = deformer->get_fit_stats();
+    appendToResult(fitStats.nb_evals);
+    appendToResult(fitStats.nb_lookups);
+
+    Blending_env::Ctrl_upload_stats uploadStats = deformer->get_ctrl_upload_stats();
+    appendToResult((double) uploadStats.nb_bytes);
+    appendToResult(uploadStats.nb_grids);
+    appendToResult(uploadStats.nb_full_uploads);
+}
+
 // Create a shape node of a custom type, and return its interface.
 //
 // The shape name will be suffixed with "Shape", and the given name will be assigned to
@@ -329,58 +349,64 @@ namespace {
     void clusterVerticesToBones(MObject skinClusterNode, const Mesh *mesh, const std::map<Bone::Id, BoneItem> &boneItems, std::vector< std::vector<Bone::Id> > &bonesPerVertex)
     {
         // Retrieve skin weights.  We'll use these to cluster vertices to surfaces.
-        vector<vector<double> > weightsPerIndex;
-        MStatus status = DagHelpers::getWeightsForAllVertices(skinClusterNode, weightsPerIndex); merr("DagHelpers::getWeightsForAllVertices");
-
-        // Make a list of bones that we want each vertex to be a part of.  A vertex can be in
-        // more than one bone.
-        bonesPerVertex.reserve(weightsPerIndex.size());
-        for(int vertIdx = 0; vertIdx < (int) weightsPerIndex.size(); ++vertIdx)
+        DagHelpers::SkinWeights skinWeights;
+        MStatus status = DagHelpers::getWeightsForAllVertices(skinClusterNode, skinWeights); merr("DagHelpers::getWeightsForAllVertices");
+
+        // We create a surface going from each joint to its parent, using the vertices that are
+        // influenced by the parent.  List the candidate bones of each physical influence index,
+        // so each vertex only looks at the bones of its nonzero weights.  Root joints don't create
+        // surfaces, and parents with no physical index don't influence any vertices.
+        vector<vector<Bone::Id> > bonesPerInfluence(skinWeights.nbInfluences);
+        for(auto &it: boneItems)
         {
-            vector<double> &weights = weightsPerIndex[vertIdx];
-            bonesPerVertex.emplace_back();
-            std::vector<int> &bones = bonesPerVertex.back();
+            Bone::Id parentBoneId = it.second.parent;
+            if(parentBoneId == -1)
+                continue;
 
-            Point_cu currentVertex = mesh->get_vertex(vertIdx).to_point();
+            int physicalIndex = boneItems.at(parentBoneId).physicalIndex;
+            if(physicalIndex == -1 || physicalIndex >= skinWeights.nbInfluences)
+                continue;
 
-            // Look at each bone, and decide if we want this vertex to be included in it.
-            int closestBoneId = -1;
-            double closestBoneDistance = 999999;
-            for(auto &it: boneItems)
+            bonesPerInfluence[physicalIndex].push_back(it.first);
+        }
+
+        // Make a list of bones that we want each vertex to be a part of.  A vertex can be in
+        // more than one bone.
+        int numVertices = skinWeights.numVertices();
+        bonesPerVertex.assign(numVertices, std::vector<Bone::Id>());
+        Thread_utils::parallel_for(0, numVertices, 256, [&](int begin, int end) {
+            for(int vertIdx = begin; vertIdx < end; ++vertIdx)
             {
-                Bone::Id boneId = it.first;
-                const BoneItem &boneItem = it.second;
-
-                // We create a surface going from each joint to its parent, using the vertices
-                // that are influenced by the parent.  Root joints don't create surfaces, so skip
-                // them.
-                Bone::Id parentBoneId = boneItem.parent;
-                if(parentBoneId == -1)
-                    continue;
-
-                // If the parent joint has no physical index, then it doesn't influence any
-                // vertices.
-                const BoneItem &parentBoneItem = boneItems.at(parentBoneId);
-                if(parentBoneItem.physicalIndex == -1)
-                    continue;
-
-                // Ignore very low weights.
-                double weight = weights[parentBoneItem.physicalIndex];
-                double threshold = 0.05;
-                if(weight < threshold)
-                    continue;
-
-                float distanceFromBone = boneItem.bone->dist_sq_to(currentVertex);
-                if(distanceFromBone < closestBoneDistance)
+                Point_cu currentVertex = mesh->get_vertex(vertIdx).to_point();
+
+                // Look at each candidate bone, and decide if we want this vertex to be included in it.
+                int closestBoneId = -1;
+                double closestBoneDistance = 999999;
+                for(int idx = skinWeights.begin(vertIdx); idx < skinWeights.end(vertIdx); ++idx)
                 {
-                    closestBoneDistance = distanceFromBone;
-                    closestBoneId = boneId;
+                    // Ignore very low weights.
+                    double weight = skinWeights.weights[idx];
+                    double threshold = 0.05;
+                    if(weight < threshold)
+                        continue;
+
+                    for(Bone::Id boneId: bonesPerInfluence[skinWeights.influences[idx]])
+                    {
+                        // Break ties on the lowest bone ID, like a scan over all bones would.
+                        float distanceFromBone = boneItems.at(boneId).bone->dist_sq_to(currentVertex);
+                        if(distanceFromBone < closestBoneDistance ||
+                           (distanceFromBone == closestBoneDistance && boneId < closestBoneId))
+                        {
+                            closestBoneDistance = distanceFromBone;
+                            closestBoneId = boneId;
+                        }
+                    }
                 }
-            }
 
-            if(closestBoneId != -1)
-                bones.push_back(closestBoneId);
-        }
+                if(closestBoneId != -1)
+                    bonesPerVertex[vertIdx].push_back(closestBoneId);
+            }
+        });
     }
 
     // Remove items from loaderSkeleton that have no samples, reparenting children.
@@ -476,6 +502,7 @@ void ImplicitCommand::init(MString skinClusterName)
 
     // The surfaces that we're creating, and their corresponding parents.
     vector<ImplicitSurface *> surfaces;
+    vector<SampleSet::InputSample> surfaceSamples;
     vector<int> parent_index;
     map<Bone::Id, int> sourceBoneIdToIdx;
     MFn::kSkinClusterFilter;
@@ -550,6 +577,7 @@ void ImplicitCommand::init(MString skinClusterName)
 
         // Store this surface's samples.
         surface->save_sampleset(inputSample);
+        surfaceSamples.push_back(inputSample);
 
         if(bone_item.parent != -1)
         {
@@ -571,6 +599,9 @@ void ImplicitCommand::init(MString skinClusterName)
             parent_index.push_back(-1);
     }
 
+    // Solve every surface's HRBF at once rather than one at a time as the surfaces are evaluated.
+    ImplicitSurface::solve_samplesets(surfaces, surfaceSamples);
+
     int nextBlendInputIdx = 0;
 
     MDGModifier dgModifier;
@@ -639,6 +670,14 @@ MStatus ImplicitCommand::doIt(const MArgList &args)
 
                 test(nodeName);
             }
+            else if(args.asString(i, &status) == MString("-stats") && MS::kSuccess == status)
+            {
+                ++i;
+                MString nodeName = args.asString(i, &status);
+                if(status != MS::kSuccess) merr("args.asString");
+
+                report_stats(nodeName);
+            }
         }
     });
 }
@@ -653,12 +692,15 @@ class ImplicitSkinConfig: public MPxCommand
 {
     bool origCudaDebugChecking;
     bool cudaDebugChecking;
+    bool origRaphson;
+    bool raphson;
 
 public:
     MStatus doIt(const MArgList &args)
     {
         return handle_exceptions_ret([&] {
             origCudaDebugChecking = cudaDebugChecking = Cuda_utils::getCudaDebugChecking();
+            origRaphson = raphson = Cuda_ctrl::_debug._raphson;
             
             MStatus status;
             for(int i = 0; i < (int) args.length(); ++i)
@@ -669,6 +711,13 @@ public:
                     cudaDebugChecking = args.asBool(i, &status);
                     if(status != MS::kSuccess) throw invalid_argument("-debug requires a boolean argument");
                 }
+                // Fit vertices with Newton steps instead of marching with a fixed step.
+                else if(args.asString(i, &status) == MString("-raphson") && MS::kSuccess == status)
+                {
+                    ++i;
+                    raphson = args.asBool(i, &status);
+                    if(status != MS::kSuccess) throw invalid_argument("-raphson requires a boolean argument");
+                }
             }
 
             return redoIt();
@@ -678,12 +727,14 @@ public:
     MStatus redoIt()
     {
         Cuda_utils::setCudaDebugChecking(cudaDebugChecking);
+        Cuda_ctrl::_debug._raphson = raphson;
         return MS::kSuccess;
     }
 
     MStatus undoIt()
     {
         Cuda_utils::setCudaDebugChecking(origCudaDebugChecking);
+        Cuda_ctrl::_debug._raphson = origRaphson;
         return MS::kSuccess;
     }
 
@@ -694,10 +745,10 @@ public:
 MStatus initializePlugin(MObject obj)
 {
     return handle_exceptions([&] {
+        // Operators are loaded when a joint first blends with them (see
+        // Skeleton_env::update_device()). The cluster operator U_OH is
+        // always loaded by Blending_env::init_env().
         std::vector<Blending_env::Op_t> op;
-        op.push_back( Blending_env::B_D  );
-        op.push_back( Blending_env::U_OH );
-        op.push_back( Blending_env::C_D  );
 
         // If CUDA initialization fails, this will throw an exception.  Don't call Cuda_ctrl::cleanup
         // in this case.
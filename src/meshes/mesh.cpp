@@ -8,12 +8,16 @@
 #include <limits>
 #include <deque>
 #include <map>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "macros.hpp"
 #include "mesh.hpp"
 #include "loader_mesh.hpp"
 #include "timer.hpp"
 #include "std_utils.hpp"
+#include "thread_utils.hpp"
 
 Mesh::Mesh(const Mesh& m) :
     _is_initialized(m._is_initialized),
@@ -102,95 +106,129 @@ void Mesh::free_mesh_data()
     _edge_list_offsets = 0;
 }
 
-void Mesh::compute_piv()
+void Mesh::compute_vert_corners(std::vector<int>& offsets,
+                                std::vector<int>& corners) const
+{
+    // Count the corners of each vertex
+    std::unique_ptr<std::atomic<int>[]> count(new std::atomic<int>[_nb_vert]);
+    for(int i = 0; i < _nb_vert; i++) count[i] = 0;
+    Thread_utils::parallel_for(0, _nb_tri, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+            for(int j = 0; j < 3; j++)
+                count[ _tri[3*i + j] ].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    offsets.resize(_nb_vert + 1);
+    for(int i = 0; i < _nb_vert; i++) offsets[i] = count[i];
+    offsets[_nb_vert] = 0;
+    Thread_utils::exclusive_scan(offsets.data(), _nb_vert + 1);
+
+    // Scatter the corners then sort them back in the triangle order
+    for(int i = 0; i < _nb_vert; i++) count[i] = offsets[i];
+    corners.resize(offsets[_nb_vert]);
+    Thread_utils::parallel_for(0, _nb_tri, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+            for(int j = 0; j < 3; j++)
+                corners[ count[ _tri[3*i + j] ].fetch_add(1, std::memory_order_relaxed) ] = 3*i + j;
+    });
+
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+            std::sort(corners.begin() + offsets[i], corners.begin() + offsets[i+1]);
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void Mesh::compute_piv(const std::vector<int>& offsets,
+                       const std::vector<int>& corners)
 {
     delete[] _piv;
     _piv = new int [4 * _nb_tri];
-    int* pic = new int [_nb_vert]; // Nb faces per vertices
-    for(int i = 0; i < _nb_vert; i++){
-        pic[i] = 0;
-    }
+
+    // The ith corner of a vertex gets the offset i
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+            for(int c = offsets[i]; c < offsets[i+1]; c++)
+                _piv[4*(corners[c]/3) + corners[c]%3] = c - offsets[i];
+    });
+
     int imax = 0; // Max number of faces for every vertices
-    for(int i = 0; i < _nb_tri; i++){
-        int ia = _tri[3*i    ];
-        int ib = _tri[3*i + 1];
-        int ic = _tri[3*i + 2];
-
-        _piv[4*i] = pic[ia]++;
-        if(imax < pic[ia]) imax = pic[ia];
-        _piv[4*i+1] = pic[ib]++;
-        if(imax < pic[ib]) imax = pic[ib];
-        _piv[4*i+2] = pic[ic]++;
-        if(imax < pic[ic]) imax = pic[ic];
+    for(int i = 0; i < _nb_tri; i++)
         _piv[4*i+3] = 0;
-    }
+    for(int i = 0; i < _nb_vert; i++)
+        imax = std::max(imax, offsets[i+1] - offsets[i]);
     _max_faces_per_vertex = imax;
-    delete [] pic;
 }
 
 // -----------------------------------------------------------------------------
 
-void Mesh::compute_normals()
+void Mesh::compute_normals(const std::vector<int>& offsets,
+                           const std::vector<int>& corners)
 {
     delete[] _normals;
-    float* new_normals = new float[_nb_vert * 3];
+    std::vector<float> tri_normals(_nb_tri * 3);
+    std::vector<float> new_normals(_nb_vert * 3);
 
     _has_normals = true;
-    for(int i = 0; i < 3 * _nb_vert; i++){
-        new_normals[i] = 0.0f;
-    }
-    for(int i = 0; i < _nb_tri; i++){
-        int va = _tri[3*i  ];
-        int vb = _tri[3*i+1];
-        int vc = _tri[3*i+2];
-        float xa = _vert[3*va], ya = _vert[3*va+1], za = _vert[3*va+2];
-        float xb = _vert[3*vb], yb = _vert[3*vb+1], zb = _vert[3*vb+2];
-        float xc = _vert[3*vc], yc = _vert[3*vc+1], zc = _vert[3*vc+2];
-        float x0 = xb - xa, y0 = yb - ya, z0 = zb - za;
-        float x1 = xc - xa, y1 = yc - ya, z1 = zc - za;
-        float nx = y0 * z1 - z0 * y1;
-        float ny = z0 * x1 - x0 * z1;
-        float nz = x0 * y1 - y0 * x1;
-        float norm = -sqrtf(nx * nx + ny * ny + nz * nz);
-        nx /= norm; ny /= norm, nz /= norm;
-        float fnx =  nx, fny = ny, fnz = nz;
-        new_normals[3 * va] += fnx;	new_normals[3 * va + 1] += fny;	new_normals[3 * va + 2] += fnz;
-        new_normals[3 * vb] += fnx;	new_normals[3 * vb + 1] += fny;	new_normals[3 * vb + 2] += fnz;
-        new_normals[3 * vc] += fnx;	new_normals[3 * vc + 1] += fny;	new_normals[3 * vc + 2] += fnz;
-    }
-
-    std::cout << "normals :\n";
-    for(int i = 0; i < _nb_vert; i++){
-        float& nx = new_normals[3 * i    ];
-        float& ny = new_normals[3 * i + 1];
-        float& nz = new_normals[3 * i + 2];
-        float norm = sqrtf(nx * nx + ny * ny + nz * nz);
-        if(norm > 0.f){
-            nx /= -norm; ny /= -norm, nz /= -norm;
+    Thread_utils::parallel_for(0, _nb_tri, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++){
+            int va = _tri[3*i  ];
+            int vb = _tri[3*i+1];
+            int vc = _tri[3*i+2];
+            float xa = _vert[3*va], ya = _vert[3*va+1], za = _vert[3*va+2];
+            float xb = _vert[3*vb], yb = _vert[3*vb+1], zb = _vert[3*vb+2];
+            float xc = _vert[3*vc], yc = _vert[3*vc+1], zc = _vert[3*vc+2];
+            float x0 = xb - xa, y0 = yb - ya, z0 = zb - za;
+            float x1 = xc - xa, y1 = yc - ya, z1 = zc - za;
+            float nx = y0 * z1 - z0 * y1;
+            float ny = z0 * x1 - x0 * z1;
+            float nz = x0 * y1 - y0 * x1;
+            float norm = -sqrtf(nx * nx + ny * ny + nz * nz);
+            nx /= norm; ny /= norm, nz /= norm;
+            tri_normals[3*i] = nx; tri_normals[3*i+1] = ny; tri_normals[3*i+2] = nz;
         }
-    }
+    });
+
+    // Gather the normals of the faces around each vertex. Faces are summed in
+    // the triangle order so the result doesn't depend on the threads.
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++){
+            float nx = 0.f, ny = 0.f, nz = 0.f;
+            for(int c = offsets[i]; c < offsets[i+1]; c++){
+                const int t = corners[c] / 3;
+                nx += tri_normals[3*t]; ny += tri_normals[3*t+1]; nz += tri_normals[3*t+2];
+            }
+            float norm = sqrtf(nx * nx + ny * ny + nz * nz);
+            if(norm > 0.f){
+                nx /= -norm; ny /= -norm, nz /= -norm;
+            }
+            new_normals[3*i] = nx; new_normals[3*i+1] = ny; new_normals[3*i+2] = nz;
+        }
+    });
 
     // unpack the normals we've just calculated in new_normals
     int n_size = _size_unpacked_vert_array * 3;
     _normals = new float [n_size];
 
-    for(int i = 0; i < _nb_vert; i++)
-    {
-        const Packed_data d = _packed_vert_map[i];
-        for(int j = 0; j < d.nb_ocurrence; j++)
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
         {
-            const int p_idx = d.idx_data_unpacked + j;
-            _normals[p_idx*3    ] = new_normals[i*3    ];
-            _normals[p_idx*3 + 1] = new_normals[i*3 + 1];
-            _normals[p_idx*3 + 2] = new_normals[i*3 + 2];
+            const Packed_data d = _packed_vert_map[i];
+            for(int j = 0; j < d.nb_ocurrence; j++)
+            {
+                const int p_idx = d.idx_data_unpacked + j;
+                _normals[p_idx*3    ] = new_normals[i*3    ];
+                _normals[p_idx*3 + 1] = new_normals[i*3 + 1];
+                _normals[p_idx*3 + 2] = new_normals[i*3 + 2];
+            }
         }
-    }
-    delete[] new_normals;
+    });
 }
 
 // -----------------------------------------------------------------------------
 
-Mesh::Mesh(const Loader::Abs_mesh& mesh):
+Mesh::Mesh(const Loader::Abs_mesh& mesh, const Adjacency* adjacency):
     _is_initialized(false),
     _has_normals(false),
     _offset(0.f,0.f,0.f),
@@ -220,97 +258,99 @@ Mesh::Mesh(const Loader::Abs_mesh& mesh):
     _is_connected = new bool[_nb_vert];
     _is_side.resize(_nb_vert, false);
 
-    // Copy vertex coordinates
-    for( int i = 0; i < _nb_vert; i++)
-    {
-        (*(Point_cu*)(_vert+i*3)) = mesh._vertices[i];
-        _is_connected[i] = false;
-    }
-
-    // Build the list of texture coordinates indices and normals indices per
-    // vertices indices.
-    // Also we copy the packed triangle index in '_tri'
-    std::vector<std::map<int,int> > pair_per_vert(_nb_vert);
-    std::vector<int> nb_pair_per_vert(_nb_vert, 0);
-    for( int i = 0; i < _nb_tri; i++)
-    {
-        for(int j = 0; j < 3; j++)
+    // Copy vertex coordinates and the packed triangle index in '_tri'
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+            (*(Point_cu*)(_vert+i*3)) = mesh._vertices[i];
+    });
+    Thread_utils::parallel_for(0, _nb_tri, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+            for(int j = 0; j < 3; j++)
+                _tri[i*3+j] = mesh._triangles[i].v[j];
+    });
+
+    std::vector<int> corner_offsets, corners;
+    compute_vert_corners(corner_offsets, corners);
+
+    // Build the list of normals indices per vertices indices, in the order
+    // they appear in the triangle list. The normal indices of the ith vertex
+    // are stored from vert_normals[corner_offsets[i]] as there can't be more
+    // than its number of corners.
+    std::vector<int> vert_normals(corners.size());
+    std::vector<int> nb_pair_per_vert(_nb_vert + 1, 0);
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
         {
-            // Fill triangle index
-            int v_idx = mesh._triangles[i].v[j];
-            int n_idx = mesh._triangles[i].n[j];
-
-            _is_connected[v_idx] = true;
-            _tri[i*3+j] = v_idx;
+            _is_connected[i] = corner_offsets[i+1] > corner_offsets[i];
 
-            std::map<int,int>& map = pair_per_vert[v_idx];
-            if( map.find(n_idx) == map.end() )
+            int* pairs = vert_normals.data() + corner_offsets[i];
+            int nb = 0;
+            for(int c = corner_offsets[i]; c < corner_offsets[i+1]; c++)
             {
-                map[n_idx] = nb_pair_per_vert[v_idx];
-                nb_pair_per_vert[v_idx]++;
+                int n_idx = mesh._triangles[corners[c]/3].n[corners[c]%3];
+                if( std::find(pairs, pairs+nb, n_idx) == pairs+nb )
+                    pairs[nb++] = n_idx;
             }
+            nb_pair_per_vert[i] = nb;
         }
-    }
+    });
 
     // We now build the mapping between packed vertex coordinates and unpacked
     // vertex coortinates, so that each vertex in the unpacked form has its own
     // texture coordinates and/or normal direction.
+    std::vector<int> unpacked_offsets(_nb_vert + 1, 0);
+    for( int i = 0; i < _nb_vert; i++)
+        unpacked_offsets[i] = std::max(1, nb_pair_per_vert[i]);
+    _size_unpacked_vert_array = Thread_utils::exclusive_scan(unpacked_offsets.data(), _nb_vert + 1);
+
     _packed_vert_map = new Packed_data[_nb_vert];
-    int off = 0;
     for( int i = 0; i < _nb_vert; i++)
     {
-        int nb_elt = std::max(1, nb_pair_per_vert[i]);
-
         Packed_data tuple;
-        tuple.idx_data_unpacked = off;
-        tuple.nb_ocurrence      = nb_elt;
+        tuple.idx_data_unpacked = unpacked_offsets[i];
+        tuple.nb_ocurrence      = std::max(1, nb_pair_per_vert[i]);
 
         _packed_vert_map[i] = tuple;
-
-        off += nb_elt;
     }
 
-
-    _size_unpacked_vert_array = off;
     _normals    = new float [_size_unpacked_vert_array * 3];
 
     // Copy triangle normals.
-    _has_normals    = false;
-    for( int i = 0; i < _nb_tri; i++)
-    {
-        for( int j = 0; j < 3; j++)
+    std::atomic<bool> has_normals(false);
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
         {
-            int v_idx = mesh._triangles[i].v[j];
-            int n_idx = mesh._triangles[i].n[j];
-
-            int off = pair_per_vert[v_idx][n_idx];
-
-            assert(off < _packed_vert_map[v_idx].nb_ocurrence);
-
-            int v_unpacked = _packed_vert_map[v_idx].idx_data_unpacked + off;
-
-            // Fill normal as there index match the unpacked vertex array
-            if( n_idx != -1 )
+            const int* pairs = vert_normals.data() + corner_offsets[i];
+            for(int off = 0; off < nb_pair_per_vert[i]; off++)
             {
-                _has_normals = true;
-                *((Vec3_cu*)(_normals+v_unpacked*3)) = mesh._normals[n_idx];
+                int n_idx = pairs[off];
+                int v_unpacked = _packed_vert_map[i].idx_data_unpacked + off;
+
+                // Fill normal as there index match the unpacked vertex array
+                if( n_idx != -1 )
+                {
+                    has_normals = true;
+                    *((Vec3_cu*)(_normals+v_unpacked*3)) = mesh._normals[n_idx];
+                }
+                else
+                    *((Vec3_cu*)(_normals+v_unpacked*3)) = Vec3_cu();
             }
-            else
-                *((Vec3_cu*)(_normals+v_unpacked*3)) = Vec3_cu();
         }
-    }
+    });
+    _has_normals = has_normals;
 
     // XXX: We could ignore input normals, so we wouldn't be affected by normals set to special
     // values for lighting purposes and we wouldn't interact as much with the host.
     if( !_has_normals )
-        compute_normals();
+        compute_normals(corner_offsets, corners);
     // Initialize VBOs
-    compute_piv();
-    compute_edges();
+    compute_piv(corner_offsets, corners);
+    if( adjacency == 0 || !load_adjacency(*adjacency) )
+        compute_edges(corner_offsets, corners);
     _is_initialized = true;
 }
 
-std::pair<int, int> Mesh::pair_from_tri(int index_tri, int current_vert)
+std::pair<int, int> Mesh::pair_from_tri(int index_tri, int current_vert) const
 {
     for(int i=0; i<3; i++){
         int vert_id = _tri[index_tri*3 + i];
@@ -368,81 +408,81 @@ bool add_to_ring(std::deque<int>& ring, int neigh)
 
 // -----------------------------------------------------------------------------
 
-void Mesh::compute_edges()
+void Mesh::compute_edges(const std::vector<int>& offsets,
+                         const std::vector<int>& corners)
 {
-    // Create a list of the tris each vertex is in.
-    std::vector<std::vector<int> > tri_list_per_vert(_nb_vert);
-    for(int i = 0; i < _nb_tri; i++){
-        for(int j = 0; j < 3; j++){
-            int v = _tri[3*i +j ];
-            assert(v>=0);
-            tri_list_per_vert[v].push_back(i);
-        }
-    }
-
     Timer t;
     t.start();
 
-    _is_side.resize(_nb_vert, false);
+    // Vertices are processed in parallel, flags are gathered in arrays of
+    // chars as std::vector<bool> can't be written concurrently.
+    std::vector<char> is_side(_nb_vert, 0);
+    std::vector<char> non_manifold(_nb_vert, 0);
     std::vector<std::vector<int> > neighborhood_list(_nb_vert);
-    std::vector<std::pair<int, int> > list_pairs;
-    list_pairs.reserve(16);
-    for(int i = 0; i < _nb_vert; i++)
+    Thread_utils::parallel_for(0, _nb_vert, 256, [&](int begin, int end)
     {
-        // We suppose the faces are tris to reserve memory
-        if( _max_faces_per_vertex > 0)
-            neighborhood_list.reserve(_max_faces_per_vertex*3);
-
-        if( is_disconnect(i) ) continue; // TODO should be is_side = true no ?
-
-        list_pairs.clear();
-        // fill pairs with the first ring of neighborhood of quads and triangles
-        for(unsigned int j=0; j<tri_list_per_vert[i].size(); j++)
-            list_pairs.push_back(pair_from_tri(tri_list_per_vert[i][j], i));
-
-        // Try to build the ordered list of the first ring of neighborhood of i
-        std::deque<int> ring;
-        ring.push_back(list_pairs[0].first );
-        ring.push_back(list_pairs[0].second);
-        std::vector<std::pair<int, int> >::iterator it = list_pairs.begin();
-        list_pairs.erase(it);
-        size_t pairs_left = list_pairs.size();
-        bool manifold   = true;
-        while( (pairs_left = list_pairs.size()) != 0)
+        std::vector<std::pair<int, int> > list_pairs;
+        list_pairs.reserve(16);
+        for(int i = begin; i < end; i++)
         {
-            for(it = list_pairs.begin(); it < list_pairs.end(); ++it)
+            if( is_disconnect(i) ) continue; // TODO should be is_side = true no ?
+
+            list_pairs.clear();
+            // fill pairs with the first ring of neighborhood of quads and triangles
+            for(int c = offsets[i]; c < offsets[i+1]; c++)
+                list_pairs.push_back(pair_from_tri(corners[c] / 3, i));
+
+            // Try to build the ordered list of the first ring of neighborhood of i
+            std::deque<int> ring;
+            ring.push_back(list_pairs[0].first );
+            ring.push_back(list_pairs[0].second);
+            std::vector<std::pair<int, int> >::iterator it = list_pairs.begin();
+            list_pairs.erase(it);
+            size_t pairs_left = list_pairs.size();
+            bool manifold   = true;
+            while( (pairs_left = list_pairs.size()) != 0)
             {
-                if(add_to_ring(ring, *it))
+                for(it = list_pairs.begin(); it < list_pairs.end(); ++it)
                 {
-                    list_pairs.erase(it);
-                    break;
+                    if(add_to_ring(ring, *it))
+                    {
+                        list_pairs.erase(it);
+                        break;
+                    }
                 }
-            }
 
-            if(pairs_left == list_pairs.size())
-            {
-                // Not manifold we push neighborhoods of vert 'i'
-                // in a random order
-                add_to_ring(ring, list_pairs[0].first );
-                add_to_ring(ring, list_pairs[0].second);
-                list_pairs.erase(list_pairs.begin());
-                manifold = false;
+                if(pairs_left == list_pairs.size())
+                {
+                    // Not manifold we push neighborhoods of vert 'i'
+                    // in a random order
+                    add_to_ring(ring, list_pairs[0].first );
+                    add_to_ring(ring, list_pairs[0].second);
+                    list_pairs.erase(list_pairs.begin());
+                    manifold = false;
+                }
             }
-        }
 
-        if(!manifold)
+            non_manifold[i] = !manifold;
+
+            if(ring[0] != ring[ring.size()-1]){
+                is_side[i] = true;
+            }else
+                ring.pop_back();
+
+            neighborhood_list[i].assign(ring.begin(), ring.end());
+        }// END FOR( EACH VERTEX )
+    });
+
+    _is_side.assign(_nb_vert, false);
+    for(int i = 0; i < _nb_vert; i++)
+    {
+        _is_side[i] = is_side[i] != 0;
+        if(non_manifold[i])
         {
             std::cerr << "WARNING : The mesh is clearly not 2-manifold !\n";
             std::cerr << "Check vertex index : " << i << std::endl;
         }
-
-        if(ring[0] != ring[ring.size()-1]){
-            _is_side[i] = true;
-        }else
-            ring.pop_back();
-
-        neighborhood_list[i].insert(neighborhood_list[i].begin(), ring.begin(), ring.end());
-    }// END FOR( EACH VERTEX )
+    }
 
     load_edges(neighborhood_list);
 
@@ -453,26 +493,64 @@ void Mesh::load_edges(const std::vector<std::vector<int> > &neighborhood_list)
 {
     assert(neighborhood_list.size() == _nb_vert);
 
-    _nb_edges = 0;
-
-    for(int i = 0; i < _nb_vert; i++)
-        _nb_edges += (int) neighborhood_list[i].size();
-
     // Copy results on a more GPU friendly layout for future use
     delete[] _edge_list;
     delete[] _edge_list_offsets;
-    _edge_list = new int[_nb_edges];
     _edge_list_offsets = new int[2*_nb_vert];
 
-    int edge_list_idx = 0;
+    std::vector<int> first(_nb_vert + 1, 0);
+    for(int i = 0; i < _nb_vert; i++)
+        first[i] = (int) neighborhood_list[i].size();
+    _nb_edges = Thread_utils::exclusive_scan(first.data(), _nb_vert + 1);
+    _edge_list = new int[_nb_edges];
+
+    Thread_utils::parallel_for(0, _nb_vert, 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++)
+        {
+            int size = (int) neighborhood_list[i].size();
+            _edge_list_offsets[i*2+0] = first[i];
+            _edge_list_offsets[i*2+1] = size;
+            std::copy(neighborhood_list[i].begin(), neighborhood_list[i].end(), _edge_list + first[i]);
+        }
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void Mesh::get_adjacency(Adjacency& adj) const
+{
+    adj.edge_list.assign(_edge_list, _edge_list + _nb_edges);
+    adj.edge_list_offsets.assign(_edge_list_offsets, _edge_list_offsets + 2*_nb_vert);
+    adj.is_side.assign(_is_side.begin(), _is_side.end());
+}
+
+// -----------------------------------------------------------------------------
+
+bool Mesh::load_adjacency(const Adjacency& adj)
+{
+    const int nb_edges = (int)adj.edge_list.size();
+    if( (int)adj.edge_list_offsets.size() != 2*_nb_vert || (int)adj.is_side.size() != _nb_vert )
+        return false;
+
+    // Every neighborhood must lie in the edge list and point to a vertex
     for(int i = 0; i < _nb_vert; i++)
     {
-        int size = (int) neighborhood_list[i].size();
-        _edge_list_offsets[i*2+0] = edge_list_idx;
-        _edge_list_offsets[i*2+1] = size;
-        for(int j = 0; j <  size; j++)
-            _edge_list[edge_list_idx++] = neighborhood_list[i][j];
+        const int dep = adj.edge_list_offsets[2*i], nb = adj.edge_list_offsets[2*i+1];
+        if( dep < 0 || nb < 0 || dep > nb_edges - nb ) return false;
+        if( is_disconnect(i) && nb != 0 ) return false;
     }
+    for(int i = 0; i < nb_edges; i++)
+        if( adj.edge_list[i] < 0 || adj.edge_list[i] >= _nb_vert ) return false;
+
+    delete[] _edge_list;
+    delete[] _edge_list_offsets;
+    _nb_edges = nb_edges;
+    _edge_list = new int[_nb_edges];
+    _edge_list_offsets = new int[2*_nb_vert];
+    std::copy(adj.edge_list.begin(), adj.edge_list.end(), _edge_list);
+    std::copy(adj.edge_list_offsets.begin(), adj.edge_list_offsets.end(), _edge_list_offsets);
+    _is_side.assign(adj.is_side.begin(), adj.is_side.end());
+    return true;
 }
 
 // -----------------------------------------------------------------------------
@@ -95,6 +95,17 @@ public:
         }
     };
 
+    /// @struct Adjacency
+    /// First ring neighborhoods of the vertices as computed by compute_edges().
+    /// It only depends on the mesh topology and can be saved to skip its
+    /// computation when loading the same mesh again.
+    /// @see get_adjacency()
+    struct Adjacency{
+        std::vector<int>  edge_list;         ///< @see get_edge()
+        std::vector<int>  edge_list_offsets; ///< @see get_edge_offset()
+        std::vector<char> is_side;           ///< @see is_vert_on_side()
+    };
+
     //  ------------------------------------------------------------------------
     // End Inner structs
     //  ------------------------------------------------------------------------
@@ -103,7 +114,10 @@ public:
     Mesh(const Mesh& m);
 
     /// Load a mesh from the abstract representation of our file loader
-    Mesh(const Loader::Abs_mesh& mesh);
+    /// @param adjacency : neighborhoods previously computed for the same
+    /// topology (see get_adjacency()). They are computed if NULL or if their
+    /// size doesn't match the mesh.
+    Mesh(const Loader::Abs_mesh& mesh, const Adjacency* adjacency = 0);
 
     ~Mesh();
 
@@ -182,6 +196,9 @@ public:
     /// Is the ith vertex on the mesh boundary
     bool is_vert_on_side(int i) const { return _is_side[i]; }
 
+    /// Copy the first ring neighborhoods of the vertices into 'adj'
+    void get_adjacency(Adjacency& adj) const;
+
 private:
 
     //  ------------------------------------------------------------------------
@@ -191,25 +208,42 @@ private:
     /// Free memory for every attributes even std::vectors
     void free_mesh_data();
 
+    /// List the triangle corners (3*tri_idx + corner) of each vertex in
+    /// increasing order. Corners of the ith vertex are
+    /// corners[offsets[i]] to corners[offsets[i+1]-1].
+    /// Built in parallel with a prefix sum over the vertex valences.
+    void compute_vert_corners(std::vector<int>& offsets,
+                              std::vector<int>& corners) const;
+
     /// Allocate and compute the offsets for the computation of the normals
     /// on the GPU
-    void compute_piv();
+    /// @param offsets, corners : see compute_vert_corners()
+    void compute_piv(const std::vector<int>& offsets,
+                     const std::vector<int>& corners);
 
     /// Compute the normals on CPU
-    void compute_normals();
+    /// @param offsets, corners : see compute_vert_corners()
+    void compute_normals(const std::vector<int>& offsets,
+                         const std::vector<int>& corners);
 
     /// Compute the list of the mesh edges
     /// updates 'edge_list' and 'edge_list_offsets'
-    void compute_edges();
+    /// @param offsets, corners : see compute_vert_corners()
+    void compute_edges(const std::vector<int>& offsets,
+                       const std::vector<int>& corners);
 
     // Load _edge_list and _edge_list_offsets, given an array of neighbors for each vertex.
     void load_edges(const std::vector<std::vector<int> > &neighborhood_list);
 
+    /// Load the neighborhoods from 'adj' instead of computing them
+    /// @return false if 'adj' doesn't match the mesh, nothing is loaded then
+    bool load_adjacency(const Adjacency& adj);
+
     // Mesh edges computation tool functions.
     //{
     /// given a triangle 'index_tri' and one of its vertex index 'current_vert'
     /// return the pair corresponding to the vertex index opposite to 'current_vert'
-    std::pair<int, int> pair_from_tri(int index_tri, int current_vert);
+    std::pair<int, int> pair_from_tri(int index_tri, int current_vert) const;
 
     //  ------------------------------------------------------------------------
     /// @name Attributes
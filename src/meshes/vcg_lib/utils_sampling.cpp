@@ -3,11 +3,11 @@
 #include "utils_sampling.hpp"
 #include "bbox.hpp"
 #include "idx3_cu.hpp"
+#include "thread_utils.hpp"
 #include <assert.h>
+#include <stdint.h>
 #include <functional>
 #include <vector>
-#include <unordered_map>
-#include <map>
 #include <algorithm>
 using namespace std;
 
@@ -22,33 +22,51 @@ using namespace std;
 /*
  * Simple poisson disk sampling.
  *
- * This is based on "Parallel Poisson Disk Sampling with Spectrum Analysis on Surfaces":
- *
- * http://research.microsoft.com/pubs/135760/c95-f95_199-a16-paperfinal-v5.pdf
- *
- * That paper targets parallel evaluation.  That's not actually implemented.  Since we don't need a lot
- * of samples, and this is only done at initialization time, it's probably not worthwhile.  However, the
- * algorithm in this paper is simple to implement and doesn't need to be paralellized.
- *
- * This works by doing a naive, dense random point sampling of the mesh to get a set of points, hashing
- * the points on a grid with a resolution of the point size that we want, then dart throwing on the points
- * to select samples.
+ * This is based on "Parallel Poisson Disk Sampling with Spectrum Analysis on Surfaces":
+ *
+ * http://research.microsoft.com/pubs/135760/c95-f95_199-a16-paperfinal-v5.pdf
+ *
+ * This works by doing a naive, dense random point sampling of the mesh to get a set of points, hashing
+ * the points on a grid with a resolution of the point size that we want, then dart throwing on the points
+ * to select samples.
+ *
+ * As in the paper, cells are split in phase groups: two cells of the same group are never adjacent, so
+ * the cells of a group are processed in parallel without conflicts.  Random numbers come from generators
+ * seeded per chunk of raw samples, and cells are visited in a fixed order, so the result only depends on
+ * the seed and not on the number of threads.
  */
 namespace 
 {
+/// Number of raw samples generated with the same random generator
+const int RAW_SAMPLES_CHUNK = 1024;
+
 float area_of_triangle(const Vec3_cu &a, const Vec3_cu &b, const Vec3_cu &c)
 {
     float ab = (a - b).norm();
     float bc = (b - c).norm();
     float ca = (c - a).norm();
     float p = (ab + bc + ca) / 2;
-    return sqrtf(p * (p - ab) * (p - bc) * (p - ca));
+    return sqrtf(std::max(p * (p - ab) * (p - bc) * (p - ca), 0.f));
 }
 
-float random_float(float maximum)
+/// Small deterministic random generator (splitmix64)
+struct Random_gen
 {
-    return float((double)rand()/(double)(RAND_MAX/maximum));
-}
+    Random_gen(uint64_t seed) : state(seed) { }
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /// @return uniform number in [0, 1)
+    double uniform() { return (double)(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    uint64_t state;
+};
 
 struct sample_point
 {
@@ -69,17 +87,17 @@ float approximate_geodesic_distance(Point_cu p1, Point_cu p2, Vec3_cu n1, Vec3_c
 #else
     n1.normalize();
     n2.normalize();
-
-    Vec3_cu v = (p2-p1);
-    v.normalize();
-
-    float c1 = n1.dot(v);
-    float c2 = n2.dot(v);
-    float result = p1.distance_squared(p2);
-    // Check for division by zero:
-    if(fabs(c1 - c2) > 0.0001)
-        result *= (asin(c1) - asin(c2)) / (c1 - c2);
-    return result;
+
+    Vec3_cu v = (p2-p1);
+    v.normalize();
+
+    float c1 = n1.dot(v);
+    float c2 = n2.dot(v);
+    float result = p1.distance_squared(p2);
+    // Check for division by zero:
+    if(fabs(c1 - c2) > 0.0001)
+        result *= (asin(c1) - asin(c2)) / (c1 - c2);
+    return result;
 #endif
 }
 
@@ -88,84 +106,79 @@ float create_raw_samples(int num_samples,
     const std::vector<Vec3_cu>& verts,
     const std::vector<Vec3_cu>& nors,
     const std::vector<int>& tris,
+    unsigned seed,
     vector<sample_point> &samples)
 {
     // Calculate the area of each triangle.  We'll use this to randomly select triangles with probability proportional
     // to their area.
-    vector<float> tri_area;
-    for(int tri = 0; tri < tris.size(); tri += 3)
-    {
-        int vert_idx_0 = tris[tri+0];
-        int vert_idx_1 = tris[tri+1];
-        int vert_idx_2 = tris[tri+2];
-        const Vec3_cu &v0 = verts[vert_idx_0];
-        const Vec3_cu &v1 = verts[vert_idx_1];
-        const Vec3_cu &v2 = verts[vert_idx_2];
-        float area = area_of_triangle(v0, v1, v2);
-        tri_area.push_back(area);
-    }
+    const int nb_tris = (int) tris.size() / 3;
+    vector<double> area_sum(nb_tris);
+    Thread_utils::parallel_for(0, nb_tris, 4096, [&](int begin, int end) {
+        for(int tri = begin; tri < end; ++tri)
+        {
+            const Vec3_cu &v0 = verts[tris[tri*3+0]];
+            const Vec3_cu &v1 = verts[tris[tri*3+1]];
+            const Vec3_cu &v2 = verts[tris[tri*3+2]];
+            area_sum[tri] = area_of_triangle(v0, v1, v2);
+        }
+    });
 
-    // Map the sums of the areas to a triangle index.  For example, if we have triangles with areas
-    // 2, 7, 1 and 4, create:
-    //
-    // 0: 0
-    // 2: 1
-    // 9: 2
-    // 10: 3
-    //
-    // A random number in 0...14 can then be mapped to an index.
-    map<float, int> area_sum_to_index;
-    float max_area_sum = 0;
-    for(int i = 0; i < tri_area.size(); ++i)
-    {
-        area_sum_to_index[max_area_sum] = i;
-        max_area_sum += tri_area[i];
-    }
+    // Prefix sum of the areas.  For example, if we have triangles with areas 2, 7, 1 and 4, create
+    // 2, 9, 10, 14.  A random number in [0, 14) is then mapped to the first sum above it.
+    for(int i = 1; i < nb_tris; ++i)
+        area_sum[i] += area_sum[i-1];
+    const double max_area_sum = nb_tris > 0 ? area_sum.back() : 0.;
 
-    for(int i = 0; i < num_samples; ++i)
-    {
-        // Select a random triangle.
-        float r = random_float(max_area_sum);
-        auto it = area_sum_to_index.upper_bound(r);
-        assert(it != area_sum_to_index.begin());
-        --it;
-        int tri = it->second;
-
-        // The vertices (and corresponding normals) of the triangle that we've selected:
-        int vert_idx_0 = tris[tri*3+0];
-        int vert_idx_1 = tris[tri*3+1];
-        int vert_idx_2 = tris[tri*3+2];
-        const Vec3_cu &v0 = verts[vert_idx_0];
-        const Vec3_cu &v1 = verts[vert_idx_1];
-        const Vec3_cu &v2 = verts[vert_idx_2];
-        const Vec3_cu &n0 = nors[vert_idx_0];
-        const Vec3_cu &n1 = nors[vert_idx_1];
-        const Vec3_cu &n2 = nors[vert_idx_2];
-
-        // Select a random point on the triangle.
-        float u = random_float(1), v = random_float(1);
-
-        Vec3_cu pos = 
-            v0 * (1 - sqrt(u)) +
-            v1 * (sqrt(u) * (1 - v)) +
-            v2 * (v * sqrt(u));
-
-        // XXX: Is this normal calculation correct?
-        Vec3_cu normal = 
-            n0 * (1 - sqrt(u)) +
-            n1 * (sqrt(u) * (1 - v)) +
-            n2 * (v * sqrt(u));
-        normal.normalize();
-
-        samples.emplace_back();
-        sample_point &p = samples.back();
-        p.cell_id = -1;
-        p.pos = pos.to_point();
-        p.normal = normal;
-        p.tri_id = tri;
-    }
+    samples.resize(num_samples);
+    const int nb_chunks = (num_samples + RAW_SAMPLES_CHUNK - 1) / RAW_SAMPLES_CHUNK;
+    Thread_utils::parallel_for(0, nb_chunks, 1, [&](int chunk_begin, int chunk_end) {
+        for(int chunk = chunk_begin; chunk < chunk_end; ++chunk)
+        {
+            Random_gen rng( ((uint64_t)seed << 32) ^ (uint64_t)chunk );
+            const int end = std::min(num_samples, (chunk+1) * RAW_SAMPLES_CHUNK);
+            for(int i = chunk * RAW_SAMPLES_CHUNK; i < end; ++i)
+            {
+                // Select a random triangle.
+                double r = rng.uniform() * max_area_sum;
+                int tri = (int) (upper_bound(area_sum.begin(), area_sum.end(), r) - area_sum.begin());
+                tri = std::min(tri, nb_tris - 1);
+
+                // The vertices (and corresponding normals) of the triangle that we've selected:
+                int vert_idx_0 = tris[tri*3+0];
+                int vert_idx_1 = tris[tri*3+1];
+                int vert_idx_2 = tris[tri*3+2];
+                const Vec3_cu &v0 = verts[vert_idx_0];
+                const Vec3_cu &v1 = verts[vert_idx_1];
+                const Vec3_cu &v2 = verts[vert_idx_2];
+                const Vec3_cu &n0 = nors[vert_idx_0];
+                const Vec3_cu &n1 = nors[vert_idx_1];
+                const Vec3_cu &n2 = nors[vert_idx_2];
+
+                // Select a random point on the triangle.
+                float u = (float) rng.uniform(), v = (float) rng.uniform();
+
+                Vec3_cu pos = 
+                    v0 * (1 - sqrt(u)) +
+                    v1 * (sqrt(u) * (1 - v)) +
+                    v2 * (v * sqrt(u));
+
+                // XXX: Is this normal calculation correct?
+                Vec3_cu normal = 
+                    n0 * (1 - sqrt(u)) +
+                    n1 * (sqrt(u) * (1 - v)) +
+                    n2 * (v * sqrt(u));
+                normal.normalize();
+
+                sample_point &p = samples[i];
+                p.cell_id = -1;
+                p.pos = pos.to_point();
+                p.normal = normal;
+                p.tri_id = tri;
+            }
+        }
+    });
 
-    return max_area_sum;
+    return (float) max_area_sum;
 }
 
 void poisson_disk_from_samples(float radius,
@@ -173,6 +186,8 @@ void poisson_disk_from_samples(float radius,
                 std::vector<Vec3_cu>& samples_pos,
                 std::vector<Vec3_cu>& samples_nor)
 {
+    if(raw_samples.empty())
+        return;
 
     // Get the bounding box of the samples.
     BBox_cu bbox;
@@ -180,23 +195,31 @@ void poisson_disk_from_samples(float radius,
         bbox.add_point(p.pos);
     const Vec3_cu bbox_size = bbox.lengths();
 
+    // Cells must be at least 'radius' wide, so that conflicting samples are at most one cell apart.
     const float radius_squared = radius*radius;
     Vec3_cu grid_size = bbox_size / radius;
-    Vec3i_cu grid_size_int(lrintf(grid_size.x), lrintf(grid_size.y), lrintf(grid_size.z));
+    Vec3i_cu grid_size_int((int) grid_size.x, (int) grid_size.y, (int) grid_size.z);
     grid_size_int.x = max(grid_size_int.x, 1);
     grid_size_int.y = max(grid_size_int.y, 1);
     grid_size_int.z = max(grid_size_int.z, 1);
 
     // Assign a cell ID to each sample.
-    for(auto &p: raw_samples)
-    {
-        Vec3i_cu idx = bbox.index_grid_cell(grid_size_int, p.pos);
-        Idx3_cu offset(grid_size_int, idx);
-        p.cell_id = offset.to_linear();
-    }
+    Thread_utils::parallel_for(0, (int) raw_samples.size(), 4096, [&](int begin, int end) {
+        for(int i = begin; i < end; ++i)
+        {
+            sample_point &p = raw_samples[i];
+            Vec3i_cu idx = bbox.index_grid_cell(grid_size_int, p.pos);
+            idx.x = std::min(std::max(idx.x, 0), grid_size_int.x - 1);
+            idx.y = std::min(std::max(idx.y, 0), grid_size_int.y - 1);
+            idx.z = std::min(std::max(idx.z, 0), grid_size_int.z - 1);
+            Idx3_cu offset(grid_size_int, idx);
+            p.cell_id = offset.to_linear();
+        }
+    });
 
-    // Sort samples by cell ID.
-    sort(raw_samples.begin(), raw_samples.end(), [](const sample_point &lhs, const sample_point &rhs) {
+    // Sort samples by cell ID.  Samples of a cell keep their generation order so that the result
+    // is reproducible.
+    stable_sort(raw_samples.begin(), raw_samples.end(), [](const sample_point &lhs, const sample_point &rhs) {
         return lhs.cell_id < rhs.cell_id;
     });
 
@@ -205,7 +228,10 @@ void poisson_disk_from_samples(float radius,
         Vec3_cu normal;
     };
 
-    struct hash_data {
+    struct cell_data {
+        int cell_id;
+        Vec3i_cu idx;
+
         // Resulting output sample points for this cell:
         vector<poisson_sample> poisson_samples;
 
@@ -214,113 +240,108 @@ void poisson_disk_from_samples(float radius,
         int sample_cnt;
     };
 
-    // Map from cell IDs to hash_data.  Each hash_data points to the range in raw_samples corresponding to that cell.
-    // (We could just store the samples in hash_data.  This implementation is an artifact of the reference paper, which
-    // is optimizing for GPU acceleration that we haven't implemented currently.)
-    unordered_map<int, hash_data> cells;
-
+    // Non empty cells sorted by ID.  Each cell points to the range in raw_samples corresponding to that cell.
+    vector<cell_data> cells;
+    for(int i = 0; i < (int) raw_samples.size(); ++i)
     {
-        int last_id = -1;
-        unordered_map<int, hash_data>::iterator last_id_it;
-
-        for(int i = 0; i < raw_samples.size(); ++i)
+        const auto &sample = raw_samples[i];
+        if(!cells.empty() && sample.cell_id == cells.back().cell_id)
         {
-            const auto &sample = raw_samples[i];
-            if(sample.cell_id == last_id)
-            {
-                // This sample is in the same cell as the previous, so just increase the count.  Cells are
-                // always contiguous, since we've sorted raw_samples by cell ID.
-                ++last_id_it->second.sample_cnt;
-                continue;
-            }
-
-            // This is a new cell.
-            hash_data data;
-            data.first_sample_idx = i;
-            data.sample_cnt = 1;
-
-            auto result = cells.insert({sample.cell_id, data});
-            last_id = sample.cell_id;
-            last_id_it = result.first;
+            // This sample is in the same cell as the previous, so just increase the count.  Cells are
+            // always contiguous, since we've sorted raw_samples by cell ID.
+            ++cells.back().sample_cnt;
+            continue;
         }
+
+        // This is a new cell.
+        cells.emplace_back();
+        cell_data &data = cells.back();
+        data.cell_id = sample.cell_id;
+        data.idx = Idx3_cu(grid_size_int, sample.cell_id).to_3d();
+        data.first_sample_idx = i;
+        data.sample_cnt = 1;
     }
 
-    // Make a list of offsets to neighboring cell indexes, and to ourself (0).
-    vector<int> neighbor_cell_offsets;
+    auto find_cell = [&](int cell_id) -> const cell_data* {
+        auto it = lower_bound(cells.begin(), cells.end(), cell_id, [](const cell_data &c, int id) {
+            return c.cell_id < id;
+        });
+        return (it != cells.end() && it->cell_id == cell_id) ? &(*it) : nullptr;
+    };
+
+    // Phase groups: cells whose coordinates have the same parity on each axis are at least two cells
+    // apart, so they don't read each other's samples.
+    vector< vector<int> > phases(8);
+    for(int i = 0; i < (int) cells.size(); ++i)
     {
-        Idx3_cu offset(grid_size_int, 0);
-        for(int x = -1; x <= +1; ++x)
-        {
-            for(int y = -1; y <= +1; ++y)
-            {
-                for(int z = -1; z <= +1; ++z)
-                {
-                    offset.set_3d(x, y, z);
-                    neighbor_cell_offsets.push_back(offset.to_linear());
-                }
-            }
-        }
+        const Vec3i_cu &c = cells[i].idx;
+        phases[(c.x & 1) | ((c.y & 1) << 1) | ((c.z & 1) << 2)].push_back(i);
     }
 
     int max_trials = 5;
     for(int trial = 0; trial < max_trials; ++trial)
     {
-        // Create sample points for each entry in cells.
-        for(auto &it: cells)
+        for(const vector<int> &phase: phases)
         {
-            int cell_id = it.first;
-            hash_data &data = it.second;
-
-            // This cell's raw sample points start at first_sample_idx.  On trial 0, try the first one.
-            // On trial 1, try first_sample_idx + 1.
-            int next_sample_idx = data.first_sample_idx + trial;
-            if(trial >= data.sample_cnt)
-            {
-                // There are no more points to try for this cell.
-                continue;
-            }
-            const auto &candidate = raw_samples[next_sample_idx];
-
-            // See if this point conflicts with any other points in this cell, or with any points in
-            // neighboring cells.  Note that it's possible to have more than one point in the same cell.
-            bool conflict = false;
-            for(int neighbor_offset: neighbor_cell_offsets)
-            {
-                int neighbor_cell_id = cell_id + neighbor_offset;
-                const auto &it = cells.find(neighbor_cell_id);
-                if(it == cells.end())
-                    continue;
-
-                const hash_data &neighbor = it->second;
-                for(const auto &sample: neighbor.poisson_samples)
+            // Create sample points for each cell of the phase group.
+            Thread_utils::parallel_for(0, (int) phase.size(), 64, [&](int begin, int end) {
+                for(int c = begin; c < end; ++c)
                 {
-                    float distance = approximate_geodesic_distance(sample.pos, candidate.pos, sample.normal, candidate.normal);
-                    if(distance < radius_squared)
+                    cell_data &data = cells[phase[c]];
+
+                    // This cell's raw sample points start at first_sample_idx.  On trial 0, try the first one.
+                    // On trial 1, try first_sample_idx + 1.
+                    if(trial >= data.sample_cnt)
                     {
-                        // The candidate is too close to this existing sample.
-                        conflict = true;
-                        break;
+                        // There are no more points to try for this cell.
+                        continue;
+                    }
+                    const auto &candidate = raw_samples[data.first_sample_idx + trial];
+
+                    // See if this point conflicts with any other points in this cell, or with any points in
+                    // neighboring cells.  Note that it's possible to have more than one point in the same cell.
+                    bool conflict = false;
+                    for(int x = -1; x <= +1 && !conflict; ++x)
+                    for(int y = -1; y <= +1 && !conflict; ++y)
+                    for(int z = -1; z <= +1 && !conflict; ++z)
+                    {
+                        Vec3i_cu n(data.idx.x + x, data.idx.y + y, data.idx.z + z);
+                        if(n.x < 0 || n.y < 0 || n.z < 0 || n.x >= grid_size_int.x || n.y >= grid_size_int.y || n.z >= grid_size_int.z)
+                            continue;
+
+                        const cell_data *neighbor = find_cell(Idx3_cu(grid_size_int, n).to_linear());
+                        if(neighbor == nullptr)
+                            continue;
+
+                        for(const auto &sample: neighbor->poisson_samples)
+                        {
+                            float distance = approximate_geodesic_distance(sample.pos, candidate.pos, sample.normal, candidate.normal);
+                            if(distance < radius_squared)
+                            {
+                                // The candidate is too close to this existing sample.
+                                conflict = true;
+                                break;
+                            }
+                        }
                     }
-                }
-                if(conflict)
-                    break;
-            }
 
-            if(conflict)
-                continue;
+                    if(conflict)
+                        continue;
 
-            // Store the new sample.
-            data.poisson_samples.emplace_back();
-            poisson_sample &new_sample = data.poisson_samples.back();
-            new_sample.pos = candidate.pos;
-            new_sample.normal = candidate.normal;
+                    // Store the new sample.
+                    data.poisson_samples.emplace_back();
+                    poisson_sample &new_sample = data.poisson_samples.back();
+                    new_sample.pos = candidate.pos;
+                    new_sample.normal = candidate.normal;
+                }
+            });
         }
     }
 
     // Copy the results to the output.
-    for(const auto it: cells)
+    for(const auto &cell: cells)
     {
-        for(const auto &sample: it.second.poisson_samples)
+        for(const auto &sample: cell.poisson_samples)
         {
             samples_pos.push_back(sample.pos.to_vector());
             samples_nor.push_back(sample.normal);
@@ -339,7 +360,8 @@ void poisson_disk(float radius,
                   const std::vector<Vec3_cu>& nors,
                   const std::vector<int>& tris,
                   std::vector<Vec3_cu>& samples_pos,
-                  std::vector<Vec3_cu>& samples_nor)
+                  std::vector<Vec3_cu>& samples_nor,
+                  unsigned seed)
 {
     assert(verts.size() == nors.size());
     assert(verts.size() > 0);
@@ -376,7 +398,7 @@ void poisson_disk(float radius,
     // Create random sample points to sample.  We usually aren't doing very high-resolution sampling,
     // so we don't need a lot.
     vector<sample_point> raw_samples;
-    float surface_area = create_raw_samples(10000, verts, nors, tris, raw_samples);
+    float surface_area = create_raw_samples(10000, verts, nors, tris, seed, raw_samples);
 
     if(radius <= 0)
     {
@@ -1,6 +1,9 @@
 #include "hermiteRBF.hpp"
 #include "hrbf_env.hpp"
 #include "distance_field.hpp"
+#include "bbox.hpp"
+
+#include <cmath>
 
 void HermiteRBF::initialize()
 {
@@ -31,6 +34,43 @@ void HermiteRBF::init_coeffs(const std::vector<Vec3_cu>& nodes,
     // Add nodes and compute the hrbf weights
     HRBF_env::add_samples(_id, nodes, normals);
 
+    HRBF_env::apply_hrbf_transfos();
+    update_support();
+}
+
+void HermiteRBF::init_coeffs_batch(const std::vector<HermiteRBF*>& hrbfs,
+                                   const std::vector< std::vector<Vec3_cu> >& nodes,
+                                   const std::vector< std::vector<Vec3_cu> >& normals)
+{
+    using namespace HRBF_wrapper;
+    const int nb_hrbf = (int)hrbfs.size();
+    assert( nodes.size() == hrbfs.size() && normals.size() == hrbfs.size() );
+
+    std::vector<HRBF_coeffs>  coeffs(nb_hrbf);
+    std::vector<HRBF_fit_job> jobs  (nb_hrbf);
+    for(int i = 0; i < nb_hrbf; ++i)
+    {
+        assert( nodes[i].size() == normals[i].size() );
+        jobs[i].points  = nodes  [i].empty() ? 0 : &(nodes  [i][0]);
+        jobs[i].normals = normals[i].empty() ? 0 : &(normals[i][0]);
+        jobs[i].size    = (int)nodes[i].size();
+        jobs[i].res     = &(coeffs[i]);
+    }
+
+    // The expensive part, independent for each HRBF
+    hermite_fit_batch( jobs );
+
+    // Uploading to HRBF_env is sequential
+    for(int i = 0; i < nb_hrbf; ++i)
+    {
+        std::vector<float4> weights( coeffs[i].size );
+        for(int j = 0; j < coeffs[i].size; ++j) {
+            const Vec3_cu b = coeffs[i].betas[j];
+            weights[j] = make_float4(b.x, b.y, b.z, coeffs[i].alphas[j]);
+        }
+        hrbfs[i]->init_coeffs(nodes[i], normals[i], weights);
+    }
+
     HRBF_env::apply_hrbf_transfos();
 }
 
@@ -46,11 +86,34 @@ void HermiteRBF::init_coeffs(const std::vector<Vec3_cu>& nodes,
 
     // Add nodes and hrbf weights
     HRBF_env::add_samples(_id, nodes, normals, weights);
+    update_support();
+}
+
+void HermiteRBF::begin_edits(){
+    assert(_id >= 0);
+    HRBF_env::begin_edits(_id);
+}
+
+void HermiteRBF::apply_edits(const HRBF_env::Sample_edits& edits)
+{
+    assert(_id >= 0);
+    HRBF_env::apply_edits(_id, edits);
+
+    HRBF_env::apply_hrbf_transfos();
+    update_support();
+}
+
+void HermiteRBF::end_edits(){
+    assert(_id >= 0);
+    HRBF_env::end_edits(_id);
 }
 
 /// Sets the radius of the HRBF used to transform the potential field from
 /// global to compact
-void HermiteRBF::set_radius(float r){ HRBF_env::set_inst_radius(_id, r); }
+void HermiteRBF::set_radius(float r){
+    HRBF_env::set_inst_radius(_id, r);
+    update_support();
+}
 
 float HermiteRBF::get_radius() const { return HRBF_env::get_inst_radius( _id ); }
 
@@ -62,78 +125,109 @@ void HermiteRBF::get_normals(std::vector<Vec3_cu>& list) const {
     HRBF_env::get_normals(_id, list);
 }
 
-IF_CUDA_DEVICE_HOST
-float HermiteRBF::fngf_global(Vec3_cu& grad, const Point_cu& x) const
+/// Add to 'ret' and 'grad' the contribution of the node 'node' of weights
+/// 'alpha' and 'beta' to the global potential at 'x'
+IF_CUDA_DEVICE_HOST static inline
+void add_node_contribution(float& ret, Vec3_cu& grad,
+                           const Point_cu& x,
+                           const Point_cu& node,
+                           const Vec3_cu& beta,
+                           float alpha)
 {
-    grad = Vec3_cu(0., 0., 0.);
+    Vec3_cu diff  = x - node;
 
-    float ret  = 0;
-    int2 size_off = HRBF_env::fetch_inst_size_and_offset(_id);
+    Vec3_cu diffNormalized = diff;
+    float l = diffNormalized.safe_normalize();
 
-    if(size_off.y == 0) return 0.f;
+    // thin plates + generalisation
+    #if defined(HERMITE_WITH_X3)
+    float _3l      = 3 * l;
+    float alpha3l  = alpha * _3l;
+    float bDotd3   = beta.dot(diff) * 3;
 
-    for(int i = 0; i<size_off.y; i++)
-    {
-        Point_cu  node;
-        Vec3_cu beta;
-        float alpha     = HRBF_env::fetch_weights_point(beta, node, i+size_off.x);
-        Vec3_cu diff  = x - node;
+    grad.x += alpha3l * diff.x;
+    grad.x += beta.x * _3l + diffNormalized.x * bDotd3;
 
-        Vec3_cu diffNormalized = diff;
-        float l = diffNormalized.safe_normalize();
+    grad.y += alpha3l * diff.y;
+    grad.y += beta.y * _3l + diffNormalized.y * bDotd3;
 
-        // thin plates + generalisation
-        #if defined(HERMITE_WITH_X3)
-        float _3l      = 3 * l;
-        float alpha3l  = alpha * _3l;
-        float bDotd3   = beta.dot(diff) * 3;
+    grad.z += alpha3l * diff.z;
+    grad.z += beta.z * _3l + diffNormalized.z * bDotd3;
 
-        grad.x += alpha3l * diff.x;
-        grad.x += beta.x * _3l + diffNormalized.x * bDotd3;
+    ret += (alpha * l * l + beta.dot(diff) * 3.f) * l ;
 
-        grad.y += alpha3l * diff.y;
-        grad.y += beta.y * _3l + diffNormalized.y * bDotd3;
+    #elif defined(HERMITE_RBF_HPP__)
+    // cf wxMaxima with function = alpha * phi(sqrt((cx-x)^2 + (cy-y)^2 + (cz-z)^2))
+    //                             + dphi(sqrt((cx-x)^2 + (cy-y)^2 + (cz-z)^2)) * ((cx-x)*bx + (cy-y)*by + (cz-z)*bz) / sqrt((cx-x)^2 + (cy-y)^2 + (cz-z)^2);
 
-        grad.z += alpha3l * diff.z;
-        grad.z += beta.z * _3l + diffNormalized.z * bDotd3;
+    if( l > 0.00001f)
+    {
+        float dphi = RBFWrapper::PHI_TYPE::df(l);
+        float ddphi = RBFWrapper::PHI_TYPE::ddf(l);
 
-        ret += (alpha * l * l + beta.dot(diff) * 3.f) * l ;
+        float alpha_dphi = alpha * dphi;
 
-        #elif defined(HERMITE_RBF_HPP__)
-        // cf wxMaxima with function = alpha * phi(sqrt((cx-x)^2 + (cy-y)^2 + (cz-z)^2))
-        //                             + dphi(sqrt((cx-x)^2 + (cy-y)^2 + (cz-z)^2)) * ((cx-x)*bx + (cy-y)*by + (cz-z)*bz) / sqrt((cx-x)^2 + (cy-y)^2 + (cz-z)^2);
+        float bDotd_l = beta.dot(diff)/l;
+        float squared_l = diff.norm_squared();
 
-        if( l > 0.00001f)
-        {
-            float dphi = RBFWrapper::PHI_TYPE::df(l);
-            float ddphi = RBFWrapper::PHI_TYPE::ddf(l);
+        grad.x += alpha_dphi * diffNormalized.x;
+        grad.x += bDotd_l * (ddphi * diffNormalized.x - diff.x * dphi / squared_l) + beta.x * dphi / l ;
 
-            float alpha_dphi = alpha * dphi;
+        grad.y += alpha_dphi * diffNormalized.y;
+        grad.y += bDotd_l * (ddphi * diffNormalized.y - diff.y * dphi / squared_l) + beta.y * dphi / l ;
 
-            float bDotd_l = beta.dot(diff)/l;
-            float squared_l = diff.norm_squared();
+        grad.z += alpha_dphi * diffNormalized.z;
+        grad.z += bDotd_l * (ddphi * diffNormalized.z - diff.z * dphi / squared_l) + beta.z * dphi / l ;
 
-            grad.x += alpha_dphi * diffNormalized.x;
-            grad.x += bDotd_l * (ddphi * diffNormalized.x - diff.x * dphi / squared_l) + beta.x * dphi / l ;
+        ret += alpha * RBFWrapper::PHI_TYPE::f(l) + beta.dot(diff)*dphi/l;
+    }
+    #endif
+}
 
-            grad.y += alpha_dphi * diffNormalized.y;
-            grad.y += bDotd_l * (ddphi * diffNormalized.y - diff.y * dphi / squared_l) + beta.y * dphi / l ;
+// -----------------------------------------------------------------------------
 
-            grad.z += alpha_dphi * diffNormalized.z;
-            grad.z += bDotd_l * (ddphi * diffNormalized.z - diff.z * dphi / squared_l) + beta.z * dphi / l ;
+IF_CUDA_DEVICE_HOST
+float HermiteRBF::fngf_global(Vec3_cu& grad, const Point_cu& x) const
+{
+    grad = Vec3_cu(0., 0., 0.);
 
-            ret += alpha * RBFWrapper::PHI_TYPE::f(l) + beta.dot(diff)*dphi/l;
-        }
-        #endif
+    float ret  = 0;
+    int2 size_off = HRBF_env::fetch_inst_size_and_offset(_id);
 
+    if(size_off.y == 0) return 0.f;
+
+    for(int i = 0; i<size_off.y; i++)
+    {
+        Point_cu  node;
+        Vec3_cu beta;
+        float alpha     = HRBF_env::fetch_weights_point(beta, node, i+size_off.x);
+        add_node_contribution(ret, grad, x, node, beta, alpha);
     }
 
     return ret;
 }
 
+// -----------------------------------------------------------------------------
+
+IF_CUDA_DEVICE_HOST
+bool HermiteRBF::out_of_support(const Point_cu& x) const
+{
+    const float4 sphere = HRBF_env::fetch_support(_id);
+    const Vec3_cu diff = x - Point_cu(sphere.x, sphere.y, sphere.z);
+    return sphere.w >= 0.f && diff.norm_squared() > sphere.w * sphere.w;
+}
+
 IF_CUDA_DEVICE_HOST
 float HermiteRBF::fngf(Vec3_cu& grad, const Point_cu& x) const
 {
+#if defined(POLY_C2) || defined(TANH_CINF)
+    // Skip the nodes where the compact potential is known to be null
+    if( out_of_support(x) ){
+        grad = Vec3_cu(0.f, 0.f, 0.f);
+        return 0.f;
+    }
+#endif
+
     const float ret = fngf_global(grad, x);
 #if defined(POLY_C2)
     Field::grad_to_compact_poly_c2(ret, HRBF_env::fetch_radius(_id), grad);
@@ -146,3 +240,103 @@ float HermiteRBF::fngf(Vec3_cu& grad, const Point_cu& x) const
 #endif
 }
 
+
+void HermiteRBF::fngf_batch(int n,
+                            const float* px, const float* py, const float* pz,
+                            float* f,
+                            float* gx, float* gy, float* gz) const
+{
+#if !defined(HERMITE_WITH_X3)
+    // Generic phi: no batched version, fall back to the scalar evaluation
+    for(int b = 0; b < n; b++){
+        Vec3_cu gf;
+        f[b] = fngf(gf, Point_cu(px[b], py[b], pz[b]));
+        gx[b] = gf.x; gy[b] = gf.y; gz[b] = gf.z;
+    }
+#else
+    bool any_inside = false;
+    for(int b = 0; b < n; b++){
+        f [b] = 0.f;
+        gx[b] = 0.f; gy[b] = 0.f; gz[b] = 0.f;
+        any_inside |= !out_of_support( Point_cu(px[b], py[b], pz[b]) );
+    }
+
+    // Every point is outside the support, potentials are null
+    if( !any_inside ) return;
+
+    const int2 size_off = HRBF_env::fetch_inst_size_and_offset(_id);
+    for(int i = 0; i < size_off.y; i++)
+    {
+        Point_cu node;
+        Vec3_cu  beta;
+        const float alpha = HRBF_env::fetch_weights_point(beta, node, i+size_off.x);
+
+        for(int b = 0; b < n; b++)
+        {
+            const float dx = px[b] - node.x;
+            const float dy = py[b] - node.y;
+            const float dz = pz[b] - node.z;
+            const float l  = sqrtf(dx*dx + dy*dy + dz*dz);
+
+            // Same as fngf_global() where safe_normalize() is replaced by a
+            // null inverse length: every term vanishes when l == 0 anyway.
+            const float inv_l   = l > 1e-10f ? 1.f / l : 0.f;
+            const float _3l     = 3.f * l;
+            const float alpha3l = alpha * _3l;
+            const float bDotd   = beta.x * dx + beta.y * dy + beta.z * dz;
+            const float bDotd3  = bDotd * 3.f * inv_l;
+
+            gx[b] += alpha3l * dx + beta.x * _3l + dx * bDotd3;
+            gy[b] += alpha3l * dy + beta.y * _3l + dy * bDotd3;
+            gz[b] += alpha3l * dz + beta.z * _3l + dz * bDotd3;
+
+            f[b] += (alpha * l * l + bDotd * 3.f) * l;
+        }
+    }
+
+    const float radius = HRBF_env::fetch_radius(_id);
+    for(int b = 0; b < n; b++)
+    {
+        if( out_of_support( Point_cu(px[b], py[b], pz[b]) ) ){
+            f[b] = 0.f;
+            gx[b] = 0.f; gy[b] = 0.f; gz[b] = 0.f;
+            continue;
+        }
+
+        Vec3_cu grad(gx[b], gy[b], gz[b]);
+        const float ret = f[b];
+#if defined(POLY_C2)
+        Field::grad_to_compact_poly_c2(ret, radius, grad);
+        f[b] = Field::to_compact_poly_c2(ret, radius);
+#elif defined(TANH_CINF)
+        Field::grad_to_compact_tanh(ret, radius, TO_, grad);
+        f[b] = Field::to_compact_tanh(ret, radius, TO_);
+#endif
+        gx[b] = grad.x; gy[b] = grad.y; gz[b] = grad.z;
+    }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+void HermiteRBF::update_support()
+{
+#if defined(POLY_C2) || defined(TANH_CINF)
+    std::vector<Vec3_cu> nodes;
+    HRBF_env::get_samples(_id, nodes);
+    if(nodes.size() == 0)
+        return;
+
+    // The compact potential is null where the global potential is above the
+    // radius, i.e. farther than the radius from the surface the samples lie
+    // on.  The bbox of the samples inflated by the radius bounds it, we store
+    // the bounding sphere of that box.
+    BBox_cu bb;
+    for(unsigned i = 0; i < nodes.size(); i++)
+        bb.add_point( nodes[i].to_point() );
+
+    const Point_cu center = bb.pmin + (bb.pmax - bb.pmin) * 0.5f;
+    const float    radius = (bb.pmax - bb.pmin).norm() * 0.5f + fabsf( HRBF_env::get_inst_radius(_id) );
+    HRBF_env::set_inst_support(_id, center, radius);
+#endif
+}
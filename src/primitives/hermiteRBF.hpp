@@ -18,6 +18,8 @@
 // thin plates + generalisation
 #include "hrbf_wrapper.hpp"
 
+namespace HRBF_env { struct Sample_edits; }
+
 // -----------------------------------------------------------------------------
 
 
@@ -56,6 +58,13 @@ struct HermiteRBF
     /// before calling this one must initialize the hrbf with initialize()
     void init_coeffs(const std::vector<Vec3_cu>& nodes,
                             const std::vector<Vec3_cu>& normals);
+
+    /// Same as calling hrbfs[i]->init_coeffs(nodes[i], normals[i]) for each
+    /// HRBF, except the weights are solved in parallel on the CPU.
+    /// Use this when many bones are set up at once.
+    static void init_coeffs_batch(const std::vector<HermiteRBF*>& hrbfs,
+                                  const std::vector< std::vector<Vec3_cu> >& nodes,
+                                  const std::vector< std::vector<Vec3_cu> >& normals);
 #if !defined(NO_CUDA)
     /// init HRBF from samples and user defined weights
     /// before calling this one must initialize the hrbf with initialize()
@@ -64,6 +73,17 @@ struct HermiteRBF
                             const std::vector<float4>&  weights);
 #endif
 
+    /// Open an edit session: following apply_edits() reuse the factorization
+    /// of the previous fit. @see HRBF_env::begin_edits()
+    void begin_edits();
+
+    /// Move, re-orient or delete some samples and update the weights
+    /// @see HRBF_env::apply_edits()
+    void apply_edits(const HRBF_env::Sample_edits& edits);
+
+    /// Close the edit session and free the factorization
+    void end_edits();
+
     /// Sets the radius of the HRBF used to transform the potential field from
     /// global to compact
     void set_radius(float r);
@@ -74,18 +94,39 @@ struct HermiteRBF
 
     void get_normals(std::vector<Vec3_cu>& list) const;
 
+    /// Compute the bounding sphere of the region where the compact potential
+    /// is not null (see HRBF_env::set_inst_support()): the bbox of the samples
+    /// inflated by the radius. fngf() returns immediately outside of it.
+    /// Called when the samples or radius change.
+    void update_support();
+
     // =========================================================================
     /// @name Evaluation of the potential and gradient (compact support)
     // =========================================================================
     IF_CUDA_DEVICE_HOST
     float fngf(Vec3_cu& gf, const Point_cu& p) const;
 
+    /// @return true if the compact potential is null at 'p' because 'p' lies
+    /// outside the support of the HRBF. (false when the support is unknown)
+    IF_CUDA_DEVICE_HOST
+    bool out_of_support(const Point_cu& p) const;
+
     // =========================================================================
     /// @name Evaluation of the potential and gradient (global support)
     // =========================================================================
     IF_CUDA_DEVICE_HOST
     float fngf_global(Vec3_cu& gf, const Point_cu& p) const;
 
+    /// Host only: evaluate fngf() for a batch of 'n' points given as a
+    /// structure of arrays (px, py, pz). Results are written in f and
+    /// (gx, gy, gz). Each node is fetched once for the whole batch and the
+    /// inner loop over the points is branchless so that the compiler can
+    /// vectorize it.
+    void fngf_batch(int n,
+                    const float* px, const float* py, const float* pz,
+                    float* f,
+                    float* gx, float* gy, float* gz) const;
+
     /// @return id of the hrbf in HRBF_env namespace @see HRBF_env
     inline int get_id() const { return _id; }
 
@@ -6,7 +6,10 @@
 #define HRBF_CORE_HPP__
 
 #include <Eigen/LU>
+#include <Eigen/QR>
 #include <vector>
+#include <limits>
+#include <cmath>
 #include <iostream>
 
 // =============================================================================
@@ -30,8 +33,48 @@ public:
     typedef Eigen::Matrix<Scalar,Dim,Eigen::Dynamic>            MatrixDX;
     typedef Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> MatrixXX;
     typedef Eigen::Matrix<Scalar,Eigen::Dynamic,1>              VectorX;
+    typedef Eigen::Matrix<Scalar,Dim+1,Dim+1>                   MatrixBB;
 
-    HRBF_fit() {}
+    /// hermite_refit() falls back on a full fit when more than one sample
+    /// out of REFIT_RATIO has been edited since the last factorization
+    /// and tries at most REFIT_MAX_STEPS steps of iterative refinement
+    enum { REFIT_RATIO = 16, REFIT_MAX_STEPS = 4 };
+
+    HRBF_fit() : _fact_residual(0) {}
+
+    // --------------------------------------------------------------------------
+
+    /// @return the block of the hermite system linking the constraints of a
+    /// sample to the weights of a node, 'diff' being sample - node.
+    /// (value row then gradient rows, alpha column then beta columns)
+    static MatrixBB hermite_block(const Vector& diff)
+    {
+        MatrixBB b;
+        Scalar l = diff.norm();
+        if( l == 0 ) {
+            b.setZero();
+        } else {
+            Scalar w    = Rbf::f(l);
+            Scalar dw_l = Rbf::df(l)/l;
+            Scalar ddw  = Rbf::ddf(l);
+            Vector g    = diff * dw_l;
+            b(0,0) = w;
+            b.row(0).template segment<Dim>(1) = g.transpose();
+            b.col(0).template segment<Dim>(1) = g;
+            b.template block<Dim,Dim>(1,1) = (ddw - dw_l)/(l*l) * (diff * diff.transpose());
+            b.template block<Dim,Dim>(1,1).diagonal().array() += dw_l;
+        }
+        return b;
+    }
+
+    /// Same as hermite_block() with the gradient rows negated: blocks of the
+    /// symmetric form of the system (see hermite_fit())
+    static MatrixBB sym_block(const Vector& diff)
+    {
+        MatrixBB b = hermite_block(diff);
+        b.template bottomRows<Dim>() *= Scalar(-1);
+        return b;
+    }
 
     // --------------------------------------------------------------------------
 
@@ -51,6 +94,8 @@ public:
         int nb_hrbf_constraints = (Dim+1)*nb_points;
         int nb_constraints      = nb_hrbf_constraints;
         int nb_coeffs           = (Dim+1)*nb_nodes;
+        // nodes at the sample points give a symmetric system
+        bool symmetric          = &nodes == &points;
 
         _node_centers.resize(Dim, nb_nodes);
         _betas.       resize(Dim, nb_nodes);
@@ -78,25 +123,39 @@ public:
             {
                 int jo = (Dim + 1) * j;
                 Vector diff = p - _node_centers.col(j);
-                Scalar l = diff.norm();
-                if( l == 0 ) {
-                    D.template block<Dim+1,Dim+1>(io,jo).setZero();
-                } else {
-                    Scalar w    = Rbf::f(l);
-                    Scalar dw_l = Rbf::df(l)/l;
-                    Scalar ddw  = Rbf::ddf(l);
-                    Vector g    = diff * dw_l;
-                    D(io,jo) = w;
-                    D.row(io).template segment<Dim>(jo+1) = g.transpose();
-                    D.col(jo).template segment<Dim>(io+1) = g;
-                    D.template block<Dim,Dim>(io+1,jo+1)  = (ddw - dw_l)/(l*l) * (diff * diff.transpose());
-                    D.template block<Dim,Dim>(io+1,jo+1).diagonal().array() += dw_l;
-                }
+                D.template block<Dim+1,Dim+1>(io,jo) = hermite_block(diff);
             }
         }
 
-        if(nb_points == nb_nodes) x = D.lu().solve(f);
-        else                      x = (D.transpose()*D).lu().solve(D.transpose()*f);
+        _fact_points.clear();
+        _fact_idx.clear();
+
+        if( symmetric )
+        {
+            // Negating the gradient constraints (rows of 'D' and 'f') makes
+            // the system symmetric, the form hermite_refit() updates. It is
+            // indefinite with a null diagonal: the blocked partial pivoting
+            // LU is still the fastest factorization for it.
+            for(int i = 0; i < nb_points; ++i) {
+                int io = (Dim+1) * i;
+                D.template middleRows<Dim>(io+1) *= Scalar(-1);
+                f.template segment<Dim>(io+1)    *= Scalar(-1);
+            }
+            _lu.compute(D);
+            x = _lu.solve(f);
+            // Keep the factorization for hermite_refit()
+            _fact_points = points;
+            _fact_idx.resize(nb_points);
+            for(int i = 0; i < nb_points; ++i) _fact_idx[i] = i;
+            _fact_residual = relative_residual(D * x, f);
+        }
+        else if(nb_points == nb_nodes)
+            x = D.lu().solve(f);
+        else
+        {
+            // Least squares without squaring the condition number of 'D'
+            x = D.colPivHouseholderQr().solve(f);
+        }
 
         Eigen::Map< Eigen::Matrix<Scalar,Dim+1,Eigen::Dynamic> > mx( x.data(), Dim + 1, nb_nodes);
 
@@ -106,6 +165,131 @@ public:
 
     // --------------------------------------------------------------------------
 
+    /// Fit again after some samples of the last fit were moved, deleted or
+    /// had their normal changed. The factorization of the last fit is reused:
+    /// the system only changes in the rows and columns of the moved and
+    /// deleted samples, a low rank update solved with the Woodbury identity.
+    /// Deleted samples are kept in the factorized system with decoupled
+    /// identity rows. Changing normals only is a mere forward/backward solve.
+    /// @param origin : index in the last fit of each sample (-1 if new)
+    /// @return false when the factorization can't be reused (new samples,
+    /// too many edits, inaccurate update) and hermite_fit() has to be
+    /// called instead.
+    bool hermite_refit(const std::vector<Vector>& points,
+                       const std::vector<Vector>& normals,
+                       const std::vector<int>& origin)
+    {
+        assert( points.size() == normals.size() && points.size() == origin.size() );
+        const int B       = Dim + 1;
+        const int nb_fact = (int)_fact_points.size();
+        const int n       = B * nb_fact;
+        if(nb_fact == 0) return false;
+
+        // Current sample of each node of the factorized system (-1 if deleted)
+        std::vector<int> sample_of(nb_fact, -1);
+        for(unsigned i = 0; i < points.size(); ++i)
+        {
+            if(origin[i] < 0) return false;
+            sample_of[ _fact_idx[origin[i]] ] = i;
+        }
+
+        std::vector<int> edited;
+        for(int j = 0; j < nb_fact; ++j)
+            if(sample_of[j] < 0 || points[sample_of[j]] != _fact_points[j])
+                edited.push_back(j);
+        const int nb_edit = (int)edited.size();
+        if(nb_edit * REFIT_RATIO > nb_fact) return false;
+
+        // Current system A' in symmetric form
+        MatrixXX A(n, n);
+        VectorX  f = VectorX::Zero(n);
+        for(int i = 0; i < nb_fact; ++i)
+        {
+            if(sample_of[i] >= 0)
+                f.template segment<Dim>(B*i+1) = -normals[sample_of[i]];
+            for(int j = 0; j < nb_fact; ++j)
+            {
+                if(sample_of[i] >= 0 && sample_of[j] >= 0)
+                    A.template block<B,B>(B*i, B*j) = sym_block(points[sample_of[i]] - points[sample_of[j]]);
+                else if(i == j)
+                    A.template block<B,B>(B*i, B*j).setIdentity();
+                else
+                    A.template block<B,B>(B*i, B*j).setZero();
+            }
+        }
+
+        // A' = A0 + W M W^t with W = [P E] where P selects the 's' edited
+        // columns, E = (A' - A0) P and M = [-Ess I; I 0]
+        const int s = B * nb_edit;
+        MatrixXX W = MatrixXX::Zero(n, 2*s);
+        for(int c = 0; c < nb_edit; ++c)
+        {
+            const int jc = edited[c];
+            W.template block<B,B>(B*jc, B*c).setIdentity();
+            for(int r = 0; r < nb_fact; ++r)
+                W.template block<B,B>(B*r, s + B*c) =
+                        A.template block<B,B>(B*r, B*jc) -
+                        sym_block(_fact_points[r] - _fact_points[jc]);
+        }
+
+        MatrixXX Z(n, 2*s);
+        for(int c = 0; c < 2*s; ++c)
+            Z.col(c) = _lu.solve( W.col(c) );
+
+        // Capacitance matrix K = M^-1 + W^t A0^-1 W, M^-1 = [0 I; I Ess]
+        MatrixXX K = W.transpose() * Z;
+        for(int c = 0; c < nb_edit; ++c)
+            for(int r = 0; r < nb_edit; ++r)
+                K.template block<B,B>(s + B*r, s + B*c) +=
+                        W.template block<B,B>(B*edited[r], s + B*c);
+        K.block(0, s, s, s).diagonal().array() += Scalar(1);
+        K.block(s, 0, s, s).diagonal().array() += Scalar(1);
+        Eigen::PartialPivLU<MatrixXX> K_lu;
+        if(s > 0) K_lu.compute(K);
+
+        // Woodbury: A'^-1 r = y - Z K^-1 W^t y with y = A0^-1 r. The update
+        // loses accuracy with the number of edits and the system is badly
+        // conditioned: refine until the residual stops decreasing, it must
+        // end close to the one of a full fit.
+        const Scalar max_residual = Scalar(2) * _fact_residual +
+                                    std::sqrt(std::numeric_limits<Scalar>::epsilon());
+        VectorX x = VectorX::Zero(n);
+        VectorX r = f;
+        Scalar residual = Scalar(1);
+        for(int it = 0; it < REFIT_MAX_STEPS; ++it)
+        {
+            VectorX y = _lu.solve(r);
+            if(s > 0) y -= Z * K_lu.solve( W.transpose() * y );
+            VectorX x_next = x + y;
+            VectorX r_next = f - A * x_next;
+            const Scalar res_next = relative_residual(f - r_next, f);
+            if( !(res_next < residual) ) break;
+            const bool stalled = res_next > Scalar(0.5) * residual;
+            x.swap( x_next );
+            r.swap( r_next );
+            residual = res_next;
+            if( stalled ) break;
+        }
+        if(residual > max_residual) return false;
+
+        std::vector<int> fact_idx( points.size() );
+        _node_centers.resize(Dim, points.size());
+        _alphas.      resize(points.size());
+        _betas.       resize(Dim, points.size());
+        for(unsigned i = 0; i < points.size(); ++i)
+        {
+            const int j = _fact_idx[origin[i]];
+            fact_idx[i] = j;
+            _node_centers.col(i) = points[i];
+            _alphas(i)           = x(B*j);
+            _betas.col(i)        = x.template segment<Dim>(B*j+1);
+        }
+        _fact_idx.swap( fact_idx );
+        return true;
+    }
+
+    // --------------------------------------------------------------------------
+
     /// evaluate potential at position 'x'
     Scalar eval(const Vector& x) const
     {
@@ -165,6 +349,19 @@ public:
     VectorX   _alphas;
     MatrixDX  _betas;
 
+private:
+    static Scalar relative_residual(const VectorX& ax, const VectorX& f)
+    {
+        Scalar nf = f.norm();
+        return (ax - f).norm() / (nf > Scalar(0) ? nf : Scalar(1));
+    }
+
+    // Factorization of the last symmetric fit reused by hermite_refit() ------
+    Eigen::PartialPivLU<MatrixXX> _lu;
+    std::vector<Vector> _fact_points;   ///< samples of the factorized system
+    std::vector<int>    _fact_idx;      ///< node in the factorized system of each sample
+    Scalar              _fact_residual; ///< relative residual of the factorized fit
+
 }; // END HermiteRbfReconstruction Class =======================================
 
 }// END RBFWrapper =============================================================
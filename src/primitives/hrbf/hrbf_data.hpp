@@ -23,6 +23,10 @@ namespace HRBF_wrapper {
         Vec3_cu* betas;
         int size;        ///< size of the previous arrays
 
+        HRBF_coeffs() :
+            alphas(0), nodeCenters(0), normals(0), betas(0), size(0)
+        { }
+
         ~HRBF_coeffs (){
             delete[] alphas;
             delete[] nodeCenters;
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <limits>
 #include <iostream>
+#include <algorithm>
 
 #include "cuda_utils.hpp"
 #include "hrbf_env.hpp"
@@ -30,6 +31,25 @@ HA_Vec3_cu h_normals;
 
 HDA_float hd_radius;
 
+HDA_float4 hd_support;
+HA_float4  h_init_support;
+
+HA_int h_capacity;
+
+/// Factorization of the last fit of each instance in an edit session (null if
+/// none) to refit quickly when samples are edited.
+/// @see HRBF_wrapper::hermite_refit() begin_edits()
+static std::vector<HRBF_wrapper::HRBF_factor*> h_factors;
+
+/// Is an edit session opened for each instance. @see begin_edits()
+static std::vector<bool> h_editing;
+
+/// @see get_inst_shape_sequence()
+static std::vector<uint64_t> h_shape_sequence;
+
+/// Last value given to an element of h_shape_sequence
+static uint64_t shape_sequence_counter = 0;
+
 /// Transformations associated to each HRBF instances
 HD_Array<Transfo> hd_transfo;
 
@@ -43,6 +63,7 @@ texture<float4, 1, cudaReadModeElementType> tex_points;
 texture<float4, 1, cudaReadModeElementType> tex_alphas_betas;
 texture<int2, 1, cudaReadModeElementType> tex_offset;
 texture<float, 1, cudaReadModeElementType> tex_radius;
+texture<float4, 1, cudaReadModeElementType> tex_support;
 
 /// Are textures currently binded with arrays
 bool binded = false;
@@ -70,6 +91,11 @@ static void setup_tex()
     tex_radius.addressMode[1] = cudaAddressModeWrap;
     tex_radius.filterMode = cudaFilterModePoint;
     tex_radius.normalized = false;
+    // tex_support setup
+    tex_support.addressMode[0] = cudaAddressModeWrap;
+    tex_support.addressMode[1] = cudaAddressModeWrap;
+    tex_support.filterMode = cudaFilterModePoint;
+    tex_support.normalized = false;
 }
 
 /// Bind hermite array data.
@@ -82,6 +108,7 @@ void bind()
     hd_alphas_betas.device_array().bind_tex( tex_alphas_betas );
     hd_points.      device_array().bind_tex( tex_points       );
     hd_radius.      device_array().bind_tex( tex_radius       );
+    hd_support.     device_array().bind_tex( tex_support      );
 }
 
 // -----------------------------------------------------------------------------
@@ -93,6 +120,7 @@ void unbind()
     CUDA_SAFE_CALL( cudaUnbindTexture(tex_alphas_betas) );
     CUDA_SAFE_CALL( cudaUnbindTexture(tex_offset)       );
     CUDA_SAFE_CALL( cudaUnbindTexture(tex_radius)       );
+    CUDA_SAFE_CALL( cudaUnbindTexture(tex_support)      );
 }
 
 void clean_env()
@@ -110,6 +138,15 @@ void clean_env()
     h_normals.erase();
     hd_radius.erase();
     hd_radius.update_device_mem();
+    hd_support.erase();
+    hd_support.update_device_mem();
+    h_init_support.erase();
+    h_capacity.erase();
+    for(unsigned i = 0; i < h_factors.size(); i++)
+        HRBF_wrapper::delete_factor( h_factors[i] );
+    h_factors.clear();
+    h_editing.clear();
+    h_shape_sequence.clear();
     hd_transfo.erase();
     hd_transfo.update_device_mem();
     d_map_transfos.erase();
@@ -337,13 +374,52 @@ Transfo get_transfo(int hrbf_id)
 
 // -----------------------------------------------------------------------------
 
+float4 get_inst_support(int hrbf_id)
+{
+    assert(hrbf_id < h_offset.size());
+    assert(hrbf_id >= 0);
+    assert( h_offset[hrbf_id].x >= 0 );
+
+    return h_init_support[hrbf_id];
+}
+
+// -----------------------------------------------------------------------------
+
+/// Private function
+/// @return the sphere 'init_sphere' (center x, y, z radius w) moved by 'tr'
+static float4 transform_support(const Transfo& tr, const float4& init_sphere)
+{
+    if(init_sphere.w < 0.f) return init_sphere;
+    const Point_cu c = tr * Point_cu(init_sphere.x, init_sphere.y, init_sphere.z);
+    return make_float4(c.x, c.y, c.z, init_sphere.w);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Private function
+/// Mark the support of the instance as unknown and its shape as changed
+/// (get_inst_shape_sequence()). Must be called when the samples, weights or
+/// radius of the instance change.
+static void invalidate_support(int hrbf_id)
+{
+    assert(!HRBF_env::binded);
+    h_shape_sequence[hrbf_id] = ++shape_sequence_counter;
+    const float4 unknown = make_float4(0.f, 0.f, 0.f, -1.f);
+    h_init_support[hrbf_id] = unknown;
+    hd_support.set_hd(hrbf_id, unknown);
+}
+
+// -----------------------------------------------------------------------------
+
 /// Private function
 /// re-compute every elements of h_offset[].x given the value in
-/// h_offset[].y and setting h_offset[hrbf_id].y = new_size;
+/// h_capacity[] and setting h_offset[hrbf_id].y = new_size;
 static void update_offset(int hrbf_id, int new_size)
 {
     assert(!HRBF_env::binded);
     assert(d_offset.size() == h_offset.size());
+    assert(h_capacity.size() == h_offset.size());
+    assert(new_size <= h_capacity[hrbf_id]);
     assert(!binded);
 
     h_offset[hrbf_id].x = 0;
@@ -357,7 +433,7 @@ static void update_offset(int hrbf_id, int new_size)
         if(h_offset[i].x >= 0)
         {
             h_offset[i].x = acc;
-            acc += h_offset[i].y;
+            acc += h_capacity[i];
         }
     }
     d_offset.copy_from(h_offset);
@@ -365,6 +441,48 @@ static void update_offset(int hrbf_id, int new_size)
 
 // -----------------------------------------------------------------------------
 
+/// Private function
+/// Grow the slot of the instance so that 'nb_samples' more samples fit in.
+/// The capacity is at least doubled to amortize the reallocations of the
+/// concatenated arrays. Unused elements of the slot are transformed along
+/// with the instance but never evaluated.
+static void reserve_samples(int hrbf_id, int nb_samples)
+{
+    assert(!HRBF_env::binded);
+    const int size     = h_offset[hrbf_id].y;
+    const int capacity = h_capacity[hrbf_id];
+    if(size + nb_samples <= capacity)
+        return;
+
+    const int extra = std::max(size + nb_samples - capacity, capacity);
+    const int end   = h_offset[hrbf_id].x + capacity;
+    const std::vector<float4> pad_points (extra, make_float4(0.f, 0.f, 0.f, 1.f));
+    const std::vector<float4> pad_weights(extra, make_float4(0.f, 0.f, 0.f, 0.f));
+    d_init_points.    insert(end, pad_points );
+    d_init_alpha_beta.insert(end, pad_weights);
+    d_map_transfos.   insert(end, std::vector<int>(extra, hrbf_id) );
+    h_normals.        insert(end, std::vector<Vec3_cu>(extra, Vec3_cu(0.f, 0.f, 0.f)) );
+    hd_points.        insert(end, pad_points );
+    hd_alphas_betas.  insert(end, pad_weights);
+    hd_points.      update_device_mem();
+    hd_alphas_betas.update_device_mem();
+
+    h_capacity[hrbf_id] = capacity + extra;
+    update_offset(hrbf_id, size);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Private function
+/// Forget the factorization of the last fit of the instance
+static void discard_factor(int hrbf_id)
+{
+    HRBF_wrapper::delete_factor( h_factors[hrbf_id] );
+    h_factors[hrbf_id] = 0;
+}
+
+// -----------------------------------------------------------------------------
+
 /// Allocate one more element at the top of the array to store another hrbf
 /// instance
 static void add_instance_memory()
@@ -377,18 +495,28 @@ static void add_instance_memory()
     assert(d_offset.  size() == h_offset.size());
 
     const int size = h_offset.size() + 1;
-    h_offset.  realloc( size );
-    d_offset.  realloc( size );
-    hd_radius. realloc( size );
-    hd_transfo.realloc( size );
+    h_offset.      realloc( size );
+    d_offset.      realloc( size );
+    hd_radius.     realloc( size );
+    hd_transfo.    realloc( size );
+    hd_support.    realloc( size );
+    h_init_support.realloc( size );
+    h_capacity.    realloc( size );
+    h_factors.push_back( 0 );
+    h_editing.push_back( false );
+    h_shape_sequence.push_back( ++shape_sequence_counter );
 
     h_offset[size - 1] = make_int2(0, 0);
+    h_capacity[size - 1] = 0;
     d_offset.set(size - 1, make_int2(0, 0));
     hd_radius [size - 1] = 5.f;
     hd_transfo[size - 1] = Transfo::identity();
+    hd_support    [size - 1] = make_float4(0.f, 0.f, 0.f, -1.f);
+    h_init_support[size - 1] = make_float4(0.f, 0.f, 0.f, -1.f);
 
     hd_radius. update_device_mem();
     hd_transfo.update_device_mem();
+    hd_support.update_device_mem();
 }
 
 // -----------------------------------------------------------------------------
@@ -402,13 +530,21 @@ static void erase_instance_memory()
     assert(hd_radius.size() == h_offset.size());
     assert(d_offset. size() == h_offset.size());
 
-    h_offset.  realloc(h_offset.  size() - 1);
-    d_offset.  realloc(d_offset.  size() - 1);
-    hd_radius. realloc(hd_radius. size() - 1);
-    hd_transfo.realloc(hd_transfo.size() - 1);
+    h_offset.      realloc(h_offset.      size() - 1);
+    d_offset.      realloc(d_offset.      size() - 1);
+    hd_radius.     realloc(hd_radius.     size() - 1);
+    hd_transfo.    realloc(hd_transfo.    size() - 1);
+    hd_support.    realloc(hd_support.    size() - 1);
+    h_init_support.realloc(h_init_support.size() - 1);
+    h_capacity.    realloc(h_capacity.    size() - 1);
+    HRBF_wrapper::delete_factor( h_factors.back() );
+    h_factors.pop_back();
+    h_editing.pop_back();
+    h_shape_sequence.pop_back();
 
     hd_radius.update_device_mem();
     hd_transfo.update_device_mem();
+    hd_support.update_device_mem();
 }
 
 // -----------------------------------------------------------------------------
@@ -430,6 +566,8 @@ int new_instance()
         add_instance_memory();
 
     update_offset(idx, 0);
+    invalidate_support(idx);
+    h_editing[idx] = false;
 
     nb_hrbf_instance++;
 
@@ -448,12 +586,12 @@ void delete_instance(int hrbf_id)
     assert(nb_hrbf_instance > 0);
     HRBF_env::unbind();
 
-    int inst_size = get_instance_size(hrbf_id);
+    int capacity = h_capacity[hrbf_id];
 
-    if(inst_size > 0)
+    if(capacity > 0)
     {
         int start = h_offset[hrbf_id].x;
-        int end   = start + inst_size - 1;
+        int end   = start + capacity - 1;
         assert(start >= 0);
         d_init_points.    erase(start, end);
         d_init_alpha_beta.erase(start, end);
@@ -467,7 +605,10 @@ void delete_instance(int hrbf_id)
     }
 
     // Compute the new offsets
+    h_capacity[hrbf_id] = 0;
     update_offset(hrbf_id, 0);
+    discard_factor(hrbf_id);
+    h_editing[hrbf_id] = false;
 
     if(hrbf_id == (h_offset.size()-1))
     {
@@ -501,6 +642,7 @@ void reset_instance(int hrbf_id)
     HRBF_env::unbind();
     float radius = hd_radius[hrbf_id];
     Transfo tr = get_transfo(hrbf_id);
+    const bool editing = h_editing[hrbf_id];
     HRBF_env::bind();
 
     delete_instance(hrbf_id);
@@ -512,7 +654,9 @@ void reset_instance(int hrbf_id)
     // Compute the new offsets
     update_offset(hrbf_id, 0);
     hd_radius.set_hd(hrbf_id, radius);
+    invalidate_support(hrbf_id);
     set_transfo( hrbf_id, tr);
+    h_editing[hrbf_id] = editing;
     nb_hrbf_instance++;
     HRBF_env::bind();
 }
@@ -520,37 +664,51 @@ void reset_instance(int hrbf_id)
 // -----------------------------------------------------------------------------
 
 /// private function
-/// Compute hrbf coeffs from d_points and h_normals. usefull when you
-/// change/delete/add a sample.
-/// the function is design to facilitate updates of HRBF_Env global variables
+/// Compute the hrbf weights of an instance from d_init_points and h_normals
+/// and store them in d_init_alpha_beta. Usefull when you change/delete/add a
+/// sample.
+/// @param origin : index before the edit of each sample of the instance
+/// (-1 for new samples), used to update the last fit of the instance.
+/// When null the weights are computed from scratch.
+/// Outside of an edit session the fit is solved in single precision and its
+/// factorization is not kept.
 /// @warning don't forget to unbind array to textures before calling this
-/// @param h_normals array in host memory
-/// (parameter is likely to be HRBF_Env::h_normals.ptr()+offset)
-/// @param d_points  array in device memory most likely
-/// (parameter is likely to be HRBF_Env::d_init_points.ptr()+offset)
-/// @param d_alphas_betas array in device memory
-/// (parameter is likely to be HRBF_Env::d_init_alpha_beta.ptr()+offset)
-/// @param nb_points size of the arrays
-static void update_coeff(const Vec3_cu* h_normals,
-                         const float4* d_points,
-                         float4* d_alphas_betas,
-                         int nb_points)
+static void update_coeff(int hrbf_id, const int* origin)
 {
     assert(!HRBF_env::binded);
     using namespace HRBF_wrapper;
 
+    const int offset    = h_offset[hrbf_id].x;
+    const int nb_points = h_offset[hrbf_id].y;
+    if(nb_points == 0) return;
+
     HA_float4  vert_float(nb_points);
     HA_Vec3_cu vertices  (nb_points);
-    HA_Vec3_cu normals   (nb_points);
-    mem_cpy_hth(normals.ptr(), h_normals, nb_points);
-    mem_cpy_dth(vert_float.ptr(), d_points, nb_points);
+    mem_cpy_dth(vert_float.ptr(), d_init_points.ptr()+offset, nb_points);
     for(int i=0; i<nb_points; i++){
         float4 v    = vert_float[i];
         vertices[i] = Vec3_cu(v.x, v.y, v.z);
     }
 
     HRBF_coeffs coeffs;
-    hermite_fit(vertices.ptr(), normals.ptr(), nb_points, coeffs);
+    HRBF_factor*& fact = h_factors[hrbf_id];
+    if( !h_editing[hrbf_id] )
+    {
+        hermite_fit(vertices.ptr(), h_normals.ptr()+offset, nb_points, coeffs);
+    }
+    else if(origin != 0 && fact != 0)
+    {
+        hermite_refit(vertices.ptr(), h_normals.ptr()+offset, origin, nb_points,
+                      coeffs, fact);
+    }
+    else
+    {
+        // First fit of the session: keep its factorization
+        if(fact == 0) fact = new_factor();
+        hermite_fit(vertices.ptr(), h_normals.ptr()+offset, nb_points,
+                    coeffs, fact);
+    }
+
     // updates weights with the newly computed weights
     HA_float4 h_alpha_beta(nb_points);
     for(int i=0; i<nb_points; i++){
@@ -558,7 +716,7 @@ static void update_coeff(const Vec3_cu* h_normals,
         h_alpha_beta[i] = make_float4(vBeta.x,vBeta.y,vBeta.z,coeffs.alphas[i]);
     }
 
-    mem_cpy_htd(d_alphas_betas, h_alpha_beta.ptr(), nb_points );
+    mem_cpy_htd(d_init_alpha_beta.ptr()+offset, h_alpha_beta.ptr(), nb_points );
 }
 
 // -----------------------------------------------------------------------------
@@ -577,33 +735,169 @@ static void update_anim_alpha_betas(int hrbf_id)
 
 // -----------------------------------------------------------------------------
 
-void set_sample(int hrbf_id,
-                int sample_index,
-                const Vec3_cu& p)
+void Sample_edits::set_sample(int sample_idx, const Vec3_cu& p)
+{
+    moved_idx.push_back( sample_idx );
+    moved_pos.push_back( p );
+}
+
+// -----------------------------------------------------------------------------
+
+void Sample_edits::set_normal(int sample_idx, const Vec3_cu& n)
+{
+    normal_idx.push_back( sample_idx );
+    normal_dir.push_back( n );
+}
+
+// -----------------------------------------------------------------------------
+
+void Sample_edits::delete_sample(int sample_idx)
+{
+    deleted_idx.push_back( sample_idx );
+}
+
+// -----------------------------------------------------------------------------
+
+bool Sample_edits::empty() const
+{
+    return moved_idx.empty() && normal_idx.empty() && deleted_idx.empty();
+}
+
+// -----------------------------------------------------------------------------
+
+void Sample_edits::clear()
+{
+    moved_idx. clear(); moved_pos. clear();
+    normal_idx.clear(); normal_dir.clear();
+    deleted_idx.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t get_inst_shape_sequence(int hrbf_id)
 {
     assert(hrbf_id < h_offset.size());
     assert(hrbf_id >= 0);
     assert( h_offset[hrbf_id].x >= 0 );
-    assert( sample_index < get_instance_size(hrbf_id) );
-    assert( sample_index >= 0 );
+    return h_shape_sequence[hrbf_id];
+}
 
-    HRBF_env::unbind();
+// -----------------------------------------------------------------------------
+
+void begin_edits(int hrbf_id)
+{
+    assert(hrbf_id < h_offset.size());
+    assert(hrbf_id >= 0);
+    assert( h_offset[hrbf_id].x >= 0 );
+    h_editing[hrbf_id] = true;
+}
+
+// -----------------------------------------------------------------------------
+
+void end_edits(int hrbf_id)
+{
+    assert(hrbf_id < h_offset.size());
+    assert(hrbf_id >= 0);
+    assert( h_offset[hrbf_id].x >= 0 );
+    h_editing[hrbf_id] = false;
+    discard_factor(hrbf_id);
+}
+
+// -----------------------------------------------------------------------------
+
+bool apply_edits(int hrbf_id, const Sample_edits& edits)
+{
+    assert(hrbf_id < h_offset.size());
+    assert(hrbf_id >= 0);
+    assert( h_offset[hrbf_id].x >= 0 );
+    assert( edits.moved_idx. size() == edits.moved_pos. size() );
+    assert( edits.normal_idx.size() == edits.normal_dir.size() );
+    assert(HRBF_env::binded);
 
     const int inst_size = get_instance_size(hrbf_id);
     const int offset    = h_offset[hrbf_id].x;
-    assert(offset >= 0);
-    float4 fpoint = make_float4(p.x, p.y, p.z, 1.f);
-    int    idx    = sample_index+offset;
-    d_init_points.set(idx, fpoint);
-    hd_points.set_hd(idx, fpoint);
-    // re-compute the weights
-    update_coeff(h_normals.ptr()+offset,
-                 d_init_points.ptr()+offset,
-                 d_init_alpha_beta.ptr()+offset,
-                 inst_size);
 
+    // Check everything before touching the instance
+    std::vector<const std::vector<int>*> idx_lists(3);
+    idx_lists[0] = &edits.moved_idx;
+    idx_lists[1] = &edits.normal_idx;
+    idx_lists[2] = &edits.deleted_idx;
+    for(unsigned l = 0; l < idx_lists.size(); l++)
+        for(unsigned i = 0; i < idx_lists[l]->size(); i++)
+        {
+            const int idx = (*idx_lists[l])[i];
+            if(idx < 0 || idx >= inst_size){
+                std::cerr << "HRBF_env::apply_edits(): sample " << idx;
+                std::cerr << " out of bounds, no edit applied" << std::endl;
+                return false;
+            }
+        }
+
+    if( edits.empty() )
+        return true;
+
+    HRBF_env::unbind();
+
+    // Apply edits in the order moves, normals, deletions
+    HA_float4 points(inst_size);
+    mem_cpy_dth(points.ptr(), d_init_points.ptr()+offset, inst_size);
+    std::vector<Vec3_cu> normals(h_normals.ptr()+offset, h_normals.ptr()+offset+inst_size);
+
+    for(unsigned i = 0; i < edits.moved_idx.size(); i++){
+        const Vec3_cu& p = edits.moved_pos[i];
+        points[ edits.moved_idx[i] ] = make_float4(p.x, p.y, p.z, 1.f);
+    }
+    for(unsigned i = 0; i < edits.normal_idx.size(); i++)
+        normals[ edits.normal_idx[i] ] = edits.normal_dir[i];
+
+    std::vector<bool> deleted(inst_size, false);
+    for(unsigned i = 0; i < edits.deleted_idx.size(); i++)
+        deleted[ edits.deleted_idx[i] ] = true;
+
+    // Compact the remaining samples at the begining of the slot: the arrays
+    // keep their size and are not reallocated
+    std::vector<int> origin;
+    origin.reserve(inst_size);
+    for(int i = 0; i < inst_size; i++)
+    {
+        if( deleted[i] ) continue;
+        const int j = (int)origin.size();
+        points [j] = points [i];
+        normals[j] = normals[i];
+        origin.push_back( i );
+    }
+    const int new_size = (int)origin.size();
+
+    if(new_size > 0)
+    {
+        mem_cpy_htd(d_init_points.ptr()+offset, points.ptr(), new_size);
+        mem_cpy_hth(hd_points.ptr()+offset, points.ptr(), new_size);
+        mem_cpy_hth(h_normals.ptr()+offset, &(normals[0]), new_size);
+        hd_points.update_device_mem(offset, new_size);
+    }
+
+    if(new_size != inst_size)
+        update_offset(hrbf_id, new_size);
+    invalidate_support(hrbf_id);
+
+    // re-compute the weights
+    if(new_size > 0)
+        update_coeff(hrbf_id, &(origin[0]));
     update_anim_alpha_betas(hrbf_id);
+
     HRBF_env::bind();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void set_sample(int hrbf_id,
+                int sample_index,
+                const Vec3_cu& p)
+{
+    Sample_edits edits;
+    edits.set_sample(sample_index, p);
+    apply_edits(hrbf_id, edits);
 }
 
 // -----------------------------------------------------------------------------
@@ -611,41 +905,37 @@ void set_sample(int hrbf_id,
 void set_sample_normal(int hrbf_id,
                        int sample_index,
                        const Vec3_cu& n)
+{
+    Sample_edits edits;
+    edits.set_normal(sample_index, n);
+    apply_edits(hrbf_id, edits);
+}
+
+// -----------------------------------------------------------------------------
+
+void set_inst_radius(int hrbf_id, float radius)
 {
     assert(hrbf_id < h_offset.size());
     assert(hrbf_id >= 0);
     assert( h_offset[hrbf_id].x >= 0 );
-    assert( sample_index < get_instance_size(hrbf_id) );
-    assert( sample_index >= 0 );
 
     HRBF_env::unbind();
-
-    const int inst_size = get_instance_size(hrbf_id);
-    const int offset    = h_offset[hrbf_id].x;
-    assert(offset >= 0);
-    int idx = sample_index+offset;
-    h_normals[idx] = n;
-    // re-compute the weights
-    update_coeff(h_normals.ptr()+offset,
-                 d_init_points.ptr()+offset,
-                 d_init_alpha_beta.ptr()+offset,
-                 inst_size);
-
-    update_anim_alpha_betas(hrbf_id);
-
+    hd_radius.set_hd(hrbf_id, radius);
+    invalidate_support(hrbf_id);
     HRBF_env::bind();
 }
 
 // -----------------------------------------------------------------------------
 
-void set_inst_radius(int hrbf_id, float radius)
+void set_inst_support(int hrbf_id, const Point_cu& center, float radius)
 {
     assert(hrbf_id < h_offset.size());
     assert(hrbf_id >= 0);
     assert( h_offset[hrbf_id].x >= 0 );
 
     HRBF_env::unbind();
-    hd_radius.set_hd(hrbf_id, radius);
+    h_init_support[hrbf_id] = make_float4(center.x, center.y, center.z, radius);
+    hd_support.set_hd(hrbf_id, transform_support(hd_transfo[hrbf_id], h_init_support[hrbf_id]));
     HRBF_env::bind();
 }
 
@@ -670,6 +960,14 @@ void set_transfo(int hrbf_id, const Transfo& tr)
 void apply_hrbf_transfos()
 {
     hd_transfo.update_device_mem();
+
+    for(int i = 0; i < h_offset.size(); i++)
+        if(h_offset[i].x >= 0)
+            hd_support[i] = transform_support(hd_transfo[i], h_init_support[i]);
+    HRBF_env::unbind();
+    hd_support.update_device_mem();
+    HRBF_env::bind();
+
     HRBF_kernels::hrbf_transform(hd_transfo.device_array(), d_map_transfos);
 }
 
@@ -677,49 +975,14 @@ void apply_hrbf_transfos()
 
 void delete_samples(int hrbf_id, const std::vector<int>& samples_idx)
 {
-    assert(hrbf_id < h_offset.size());
-    assert(hrbf_id >= 0);
-    assert( h_offset[hrbf_id].x >= 0 );
-    assert(HRBF_env::binded);
-
-    HRBF_env::unbind();
-
-    int size_inst = get_instance_size(hrbf_id);
-    if( size_inst < 1 ){
+    if( get_instance_size(hrbf_id) < 1 ){
         std::cerr << "There is no samples to delete";
         return;
     }
 
-    // TODO:
-    // delete samples, it's a prety ineficient way to do it because of the use
-    // of erase() which duplicates the arrays each time it is called. But for
-    // now its enough
-    int offset = h_offset[hrbf_id].x;
-    assert(offset >= 0);
-    for(unsigned i=0; i<samples_idx.size(); i++)
-    {
-        int idx = samples_idx[i];
-        d_init_points.    erase(idx + offset);
-        d_init_alpha_beta.erase(idx + offset);
-        d_map_transfos.   erase(idx + offset);
-        h_normals.        erase(idx + offset);
-        hd_points.        erase(idx + offset);
-        hd_alphas_betas.  erase(idx + offset);
-        hd_alphas_betas.update_device_mem();
-        hd_points.      update_device_mem();
-    }
-
-    // Compute new offsets
-    update_offset(hrbf_id, size_inst - samples_idx.size());
-
-    update_coeff(h_normals.ptr()+offset,
-                 d_init_points.ptr()+offset,
-                 d_init_alpha_beta.ptr()+offset,
-                 get_instance_size(hrbf_id));
-
-    update_anim_alpha_betas(hrbf_id);
-
-    HRBF_env::bind();
+    Sample_edits edits;
+    edits.deleted_idx = samples_idx;
+    apply_edits(hrbf_id, edits);
 }
 
 // -----------------------------------------------------------------------------
@@ -750,52 +1013,46 @@ int add_samples(int hrbf_id,
 
     HRBF_env::unbind();
 
-    // add sample
-    HA_float4 ha_points( points.size() );
-    for(unsigned i = 0; i < points.size(); i++){
+    const int nb_new    = (int)points.size();
+    const int inst_size = get_instance_size(hrbf_id);
+    reserve_samples(hrbf_id, nb_new);
+
+    // The new samples go at the end of the instance, in its free slots
+    HA_float4 ha_points( nb_new );
+    for(int i = 0; i < nb_new; i++){
         Vec3_cu pt   = points[i];
         ha_points[i] = make_float4(pt.x, pt.y, pt.z, 1.f);
     }
 
-    int inst_size = get_instance_size(hrbf_id);
-    int offset    = h_offset[hrbf_id].x;
-    assert(offset >= 0);
-    d_init_points. insert(offset, ha_points);
-    hd_points.     insert(offset, ha_points);
-    h_normals.     insert(offset, normals  );
-    d_map_transfos.insert(offset, std::vector<int>(points.size(), hrbf_id) );
-    hd_points.update_device_mem();
+    const int start = h_offset[hrbf_id].x + inst_size;
+    mem_cpy_htd(d_init_points.ptr()+start, ha_points.ptr(), nb_new);
+    mem_cpy_hth(hd_points.ptr()+start, ha_points.ptr(), nb_new);
+    mem_cpy_hth(h_normals.ptr()+start, &(normals[0]), nb_new);
+    hd_points.update_device_mem(start, nb_new);
     assert( h_normals.     size() == hd_points.    size() );
     assert( d_init_points. size() == hd_points.    size() );
     assert( d_map_transfos.size() == d_init_points.size() );
 
-    // Compute new offsets
-    update_offset(hrbf_id, inst_size+points.size());
+    update_offset(hrbf_id, inst_size + nb_new);
+    invalidate_support(hrbf_id);
 
     if(weights.size() == 0)
     {
-        // We don't care what's in alpha_beta cause its gonna be erased by
-        // update_coeff()
-        d_init_alpha_beta.insert(offset, ha_points/*insert dummy data*/ );
-        hd_alphas_betas  .insert(offset, ha_points/*insert dummy data*/ );
-
-        update_coeff(h_normals.ptr()+offset,
-                     d_init_points.ptr()+offset,
-                     d_init_alpha_beta.ptr()+offset,
-                     get_instance_size(hrbf_id));
-
+        update_coeff(hrbf_id, 0);
         update_anim_alpha_betas(hrbf_id);
     }
     else
     {
-        d_init_alpha_beta.insert(offset, weights );
-        hd_alphas_betas  .insert(offset, weights );
-        hd_alphas_betas.update_device_mem();
+        // User weights: the last factorization doesn't match them anymore
+        discard_factor(hrbf_id);
+        mem_cpy_htd(d_init_alpha_beta.ptr()+start, &(weights[0]), nb_new);
+        mem_cpy_hth(hd_alphas_betas.ptr()+start, &(weights[0]), nb_new);
+        hd_alphas_betas.update_device_mem(start, nb_new);
     }
 
     HRBF_env::bind();
 
-    return get_instance_size(hrbf_id) - points.size();
+    return inst_size;
 }
 
 // -----------------------------------------------------------------------------
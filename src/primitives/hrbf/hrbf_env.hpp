@@ -10,6 +10,7 @@
 
 #include <fstream>
 #include <vector>
+#include <stdint.h>
 
 // -----------------------------------------------------------------------------
 
@@ -61,16 +62,30 @@ extern Cuda_utils::DA_float4 d_init_alpha_beta;
 /// to acces the hermiteRBF's coefficients (d_alphas_betas[] array)
 /// and points (d_points[] array). d_offset[HRBF_ID].x = offset
 /// d_offset[HRBF_ID].y == nb_samples_hrbf
-/// d_offset[is].x is the prefix sum of HRBF instances size.
+/// d_offset[is].x is the prefix sum of HRBF instances capacity.
 /// When the offset is negative this means there is no instance associated
 /// to the id
 extern Cuda_utils::DA_int2 d_offset;
 extern Cuda_utils::HA_int2 h_offset;
 
+/// Number of elements reserved for each instance in the concatenated arrays.
+/// Instances are stored in slots of h_capacity[HRBF_ID] elements starting at
+/// h_offset[HRBF_ID].x, only the first h_offset[HRBF_ID].y are samples.
+/// Deleting samples compacts the slot without reallocating the arrays.
+extern Cuda_utils::HA_int h_capacity;
+
 extern Cuda_utils::HA_Vec3_cu h_normals;
 
 /// Radius of the hrbfs to transform from global to compact support.
 extern Cuda_utils::HDA_float hd_radius;
+
+/// Bounding sphere of the region where the compact potential of each instance
+/// is not null: (x, y, z) center and w radius. Spheres are transformed along
+/// with the samples by apply_hrbf_transfos(). A negative radius means the
+/// region is unknown and the whole space has to be evaluated.
+extern Cuda_utils::HDA_float4 hd_support;
+/// Same as 'hd_support' with the samples in their initial position
+extern Cuda_utils::HA_float4 h_init_support;
 #endif
 
 // -----------------------------------------------------------------------------
@@ -102,9 +117,45 @@ void reset_instance(int hrbf_id);
 /// @name Handling instance datas
 //------------------------------------------------------------------------------
 
+/// A set of modifications of the samples of one instance, applied at once by
+/// apply_edits(). Sample indices are the ones before any edit is applied.
+struct Sample_edits {
+    std::vector<int>     moved_idx;   ///< samples to move
+    std::vector<Vec3_cu> moved_pos;   ///< their new positions
+    std::vector<int>     normal_idx;  ///< samples with a new normal
+    std::vector<Vec3_cu> normal_dir;  ///< their new normals
+    std::vector<int>     deleted_idx; ///< samples to delete
+
+    void set_sample(int sample_idx, const Vec3_cu& p);
+    void set_normal(int sample_idx, const Vec3_cu& n);
+    void delete_sample(int sample_idx);
+    bool empty() const;
+    void clear();
+};
+
+/// Open an edit session on the instance of id "hrbf_id": the next fit keeps
+/// its factorization so that the following apply_edits() refit the instance
+/// with a low rank update. The factorization is a dense double matrix four
+/// times the number of samples wide, call end_edits() to free it.
+/// Deleting the instance ends the session.
+void begin_edits(int hrbf_id);
+
+/// Close the edit session of the instance and free its factorization
+void end_edits(int hrbf_id);
+
+/// Apply every edit of 'edits' to the instance of id "hrbf_id" with a single
+/// transfer of the instance and a single update of the weights. Inside an
+/// edit session (begin_edits()) the previous fit is reused when few samples
+/// moved or were deleted (low rank update).
+/// The remaining samples keep their order.
+/// @return false if an index is out of bounds, in which case nothing is
+/// modified
+bool apply_edits(int hrbf_id, const Sample_edits& edits);
+
+
 /// delete a samples designated by the vector "samples_idx" from the hrbf
 /// instance of id "hrbf_id". The weights are updated with the new samples
-/// @warning this operation could take a while..
+/// @see apply_edits() to delete and modify samples at once
 void delete_samples(int hrbf_id, const std::vector<int>& samples_idx);
 
 /// Function shortcut to delete a single sample
@@ -119,7 +170,7 @@ void delete_sample(int hrbf_id, int sample_idx);
 /// represents the beta vector, last float is the alpha scalar. If 'weights' is
 /// the zero sized vector then coefficients are computed again ignoring this
 /// vector
-/// @return the index of the first sample
+/// @return the index of the first sample (new samples are appended)
 /// @warning this operation could take a while as hrbf weights has to be
 /// computed
 #if !defined(NO_CUDA)
@@ -138,6 +189,7 @@ int add_sample(int hrbf_id, const Vec3_cu& point, const Vec3_cu& normal);
 //------------------------------------------------------------------------------
 
 /// set a new position for the ith point
+/// @see apply_edits() to modify several samples at once
 void set_sample(int hrbf_id,
                 int sample_index,
                 const Vec3_cu& p);
@@ -150,6 +202,13 @@ void set_sample_normal(int hrbf_id,
 /// Set the radius of the ith instance for going to global to compact support
 void set_inst_radius(int hrbf_id, float radius);
 
+/// Set the bounding sphere of the region where the compact potential of the
+/// instance is not null, in the initial position of the samples.
+/// Modifying the samples, weights or radius of the instance resets the
+/// sphere to unknown (negative radius).
+/// @see hd_support HermiteRBF::update_support()
+void set_inst_support(int hrbf_id, const Point_cu& center, float radius);
+
 /// Set transformations of the ith instance which will be used to compute
 /// Animated samples and weights of the HRBF
 /// @warning to apply the transformation call apply_hrbf_transfos()
@@ -221,11 +280,27 @@ float get_inst_radius(int hrbf_id);
 /// Get transformations of the ith instance
 Transfo get_transfo(int hrbf_id);
 
+/// @return a number which increases each time the samples, weights or radius
+/// of the instance change (never when it is only transformed).
+/// @see Bone::get_shape_sequence()
+uint64_t get_inst_shape_sequence(int hrbf_id);
+
+/// Get the bounding sphere set by set_inst_support() (initial position)
+/// @return center in (x, y, z) radius in w (negative if unknown)
+float4 get_inst_support(int hrbf_id);
+
 
 /// @return the instance radius to transform from global to compact support
 IF_CUDA_DEVICE_HOST static inline
 float fetch_radius(int id_instance);
 
+/// @return the bounding sphere of the non null potential of the instance
+/// (animated position) @see hd_support
+#if !defined(NO_CUDA)
+IF_CUDA_DEVICE_HOST static inline
+float4 fetch_support(int id_instance);
+#endif
+
 /// @return the instance offset in x and size in y
 #if !defined(NO_CUDA)
 IF_CUDA_DEVICE_HOST static inline
@@ -32,6 +32,8 @@ extern texture<float4, 1, cudaReadModeElementType> tex_alphas_betas;
 extern texture<int2, 1, cudaReadModeElementType> tex_offset;
 
 extern texture<float, 1, cudaReadModeElementType> tex_radius;
+
+extern texture<float4, 1, cudaReadModeElementType> tex_support;
 #endif
 
 // -----------------------------------------------------------------------------
@@ -46,6 +48,16 @@ float fetch_radius(int id_instance)
     #endif
 }
 
+IF_CUDA_DEVICE_HOST static inline
+float4 fetch_support(int id_instance)
+{
+    #ifdef __CUDA_ARCH__
+    return tex1Dfetch(tex_support, id_instance);
+    #else
+    return hd_support[id_instance];
+    #endif
+}
+
 IF_CUDA_DEVICE_HOST static inline
 int2 fetch_inst_size_and_offset(int id_instance)
 {
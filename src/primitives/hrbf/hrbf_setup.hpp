@@ -18,10 +18,15 @@ namespace HRBF_wrapper {
    // Change type in order to use another phi_function from rbf_phi_funcs.hpp :
 #if defined(HERMITE_WITH_X3)
    typedef Rbf_pow3<float> PHI_TYPE;
+   typedef Rbf_pow3<double> PHI_TYPE_FIT;
 #elif defined(HERMITE_WITH_THIN_PLATES)
    typedef Rbf_thin_plate<float> PHI_TYPE;
+   typedef Rbf_thin_plate<double> PHI_TYPE_FIT;
    //typedef Rbf_x_sqrt_x<float> PHI_TYPE;
 #endif
+   // Plain fits are solved with PHI_TYPE. The hermite system is badly
+   // conditioned so the factorization kept to refit edited samples uses
+   // double precision with PHI_TYPE_FIT. Evaluation is always single precision.
 
 }// END RBf_wrapper ============================================================
 
@@ -1,27 +1,31 @@
+#include "hrbf_wrapper.hpp"
+
 #include "hrbf_phi_funcs.hpp"
 #include "hrbf_data.hpp"
 #include "hrbf_setup.hpp"
 
 #include "hrbf_core.hpp" ///< This file must be compile with gcc
+#include "thread_utils.hpp"
 
 // =============================================================================
 namespace HRBF_wrapper {
 // =============================================================================
 
+/// Fits which are not refitted afterwards are solved in single precision
 typedef HRBF_fit< float, 3, PHI_TYPE> HRBF_3f;
+/// The low rank updates of hermite_refit() need double precision
+typedef HRBF_fit< double, 3, PHI_TYPE_FIT> HRBF_3d;
 
-HRBF_3f* g_hrbf = 0;
-
-typedef HRBF_3f::MatrixDD MatrixDD;
-typedef HRBF_3f::Vector   Vector;
-typedef HRBF_3f::MatrixXX MatrixDX;
-typedef HRBF_3f::MatrixXX MatrixXX;
-typedef HRBF_3f::VectorX  VectorX;
+/// The solver keeps the factorization of its last fit
+struct HRBF_factor {
+    HRBF_3d hrbf;
+};
 
 // Wrapper Tools ---------------------------------------------------------------
 
 /// convert a MatrixDX into a newly allocated Vec3_cu array of
 /// size MatriDX.cols()
+template<class MatrixDX>
 static void matrixDX_to_Vec3_cu_array(const MatrixDX& mat, Vec3_cu*& vec)
 {
     int nb_col = (int) mat.cols();
@@ -38,7 +42,7 @@ static void matrixDX_to_Vec3_cu_array(const MatrixDX& mat, Vec3_cu*& vec)
 
 /// Convert an VectorX of base type Scalar into a newly allocated
 /// array of size VectorX.rows()
-template<class Scalar>
+template<class Scalar, class VectorX>
 void vectorX_to_array(const VectorX& vec, Scalar*& tab)
 {
     int nb_row = (int) vec.rows();
@@ -47,33 +51,123 @@ void vectorX_to_array(const VectorX& vec, Scalar*& tab)
         tab[i] = vec(i);
 }
 
-// End  Wrapper Tools ----------------------------------------------------------
+// -----------------------------------------------------------------------------
 
-void hermite_fit(const Vec3_cu* points,
-                 const Vec3_cu* normals,
-                 int size,
-                 HRBF_coeffs& res)
+template<class Vector>
+static void to_vectors(const Vec3_cu* points,
+                       const Vec3_cu* normals,
+                       int size,
+                       std::vector<Vector>& vec_points,
+                       std::vector<Vector>& vec_normals)
 {
-    delete g_hrbf;
-    g_hrbf = new HRBF_fit< float, 3, PHI_TYPE>();
-
-    std::vector<Vector> vec_points, vec_normals;
+    vec_points. clear();
+    vec_normals.clear();
+    vec_points. reserve(size);
+    vec_normals.reserve(size);
     for(int i = 0; i < size; i++)
     {
         vec_points.push_back ( Vector(points [i].x, points [i].y, points [i].z));
         vec_normals.push_back( Vector(normals[i].x, normals[i].y, normals[i].z));
     }
+}
 
-    // Compute coeffs :
-    g_hrbf->hermite_fit(vec_points, vec_normals);
+// -----------------------------------------------------------------------------
 
-    // return Coeffs :
-    res.size = (int) g_hrbf->_node_centers.cols();
-    vectorX_to_array<float>  (g_hrbf->_alphas,       res.alphas      );
-    matrixDX_to_Vec3_cu_array(g_hrbf->_betas,        res.betas       );
-    matrixDX_to_Vec3_cu_array(g_hrbf->_node_centers, res.nodeCenters );
+template<class HRBF>
+static void get_coeffs(const HRBF& hrbf,
+                       const Vec3_cu* normals,
+                       int size,
+                       HRBF_coeffs& res)
+{
+    delete[] res.alphas;
+    delete[] res.betas;
+    delete[] res.nodeCenters;
+    delete[] res.normals;
+    res.size = (int) hrbf._node_centers.cols();
+    vectorX_to_array<float>  (hrbf._alphas,       res.alphas      );
+    matrixDX_to_Vec3_cu_array(hrbf._betas,        res.betas       );
+    matrixDX_to_Vec3_cu_array(hrbf._node_centers, res.nodeCenters );
     res.normals = new Vec3_cu[size];
     memcpy(res.normals, normals, size*sizeof(Vec3_cu));
 }
 
+// -----------------------------------------------------------------------------
+
+/// Fit 'hrbf' and return its coeffs in 'res'
+template<class HRBF>
+static void fit(HRBF& hrbf,
+                const Vec3_cu* points,
+                const Vec3_cu* normals,
+                int size,
+                HRBF_coeffs& res)
+{
+    std::vector<typename HRBF::Vector> vec_points, vec_normals;
+    to_vectors(points, normals, size, vec_points, vec_normals);
+
+    // Compute coeffs :
+    hrbf.hermite_fit(vec_points, vec_normals);
+
+    // return Coeffs :
+    get_coeffs(hrbf, normals, size, res);
+}
+
+// End  Wrapper Tools ----------------------------------------------------------
+
+void hermite_fit(const Vec3_cu* points,
+                 const Vec3_cu* normals,
+                 int size,
+                 HRBF_coeffs& res,
+                 HRBF_factor* fact)
+{
+    if( fact ) {
+        fit(fact->hrbf, points, normals, size, res);
+    } else {
+        // Local solver: fits can run concurrently from several threads
+        HRBF_3f hrbf;
+        fit(hrbf, points, normals, size, res);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool hermite_refit(const Vec3_cu* points,
+                   const Vec3_cu* normals,
+                   const int* origin,
+                   int size,
+                   HRBF_coeffs& res,
+                   HRBF_factor* fact)
+{
+    assert( fact != 0 );
+    std::vector<HRBF_3d::Vector> vec_points, vec_normals;
+    to_vectors(points, normals, size, vec_points, vec_normals);
+
+    std::vector<int> vec_origin(origin, origin + size);
+    const bool reused = fact->hrbf.hermite_refit(vec_points, vec_normals, vec_origin);
+    if( !reused )
+        fact->hrbf.hermite_fit(vec_points, vec_normals);
+
+    get_coeffs(fact->hrbf, normals, size, res);
+    return reused;
+}
+
+// -----------------------------------------------------------------------------
+
+HRBF_factor* new_factor(){ return new HRBF_factor(); }
+
+// -----------------------------------------------------------------------------
+
+void delete_factor(HRBF_factor* fact){ delete fact; }
+
+// -----------------------------------------------------------------------------
+
+void hermite_fit_batch(const std::vector<HRBF_fit_job>& jobs)
+{
+    // Fits are O(n^3) and their sizes vary a lot: one job per grain so that
+    // threads pick the next bone as soon as they are done.
+    Thread_utils::parallel_for(0, (int)jobs.size(), 1, [&](int begin, int end){
+        for(int i = begin; i < end; ++i)
+            hermite_fit(jobs[i].points, jobs[i].normals, jobs[i].size, *jobs[i].res, 0);
+    });
+}
+
 }// END RBFWrapper =============================================================
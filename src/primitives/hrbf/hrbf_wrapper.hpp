@@ -5,6 +5,8 @@
 #include "hrbf_data.hpp"
 #include "hrbf_setup.hpp"
 
+#include <vector>
+
 /** @brief Wrapper interface of the RBF's classes
     The wrapper is design to separate nvcc code to gcc code.
 
@@ -23,12 +25,50 @@
 namespace HRBF_wrapper {
 // =============================================================================
 
+/// Factorization of the system of the last fit of an HRBF, kept to refit it
+/// quickly when a few samples are edited (defined in hrbf_wrapper.cpp).
+/// It is a dense (4n)^2 matrix in double precision: only keep it while the
+/// samples are being edited.
+struct HRBF_factor;
+
+HRBF_factor* new_factor();
+void delete_factor(HRBF_factor* fact);
+
 /// Compute Hermite RBF coeffs with the given points and normals
 /// @param res : result of the fit with the computed coeficients
+/// @param fact : if not null the fit is solved in double precision and its
+/// factorization stored for hermite_refit(). Otherwise it is solved in
+/// single precision and nothing is kept.
 void hermite_fit(const Vec3_cu* points,
                  const Vec3_cu* normals,
                  int size,
-                 HRBF_coeffs& res);
+                 HRBF_coeffs& res,
+                 HRBF_factor* fact = 0);
+
+/// Compute again Hermite RBF coeffs after samples of the last fit with
+/// 'fact' were moved, deleted or had their normal changed. The factorization
+/// is reused when few samples moved (low rank update) otherwise this is a
+/// full fit which updates 'fact'.
+/// @param origin : index of each sample in the last fit, -1 for new samples
+/// @return true if the factorization was reused, false if this was a full fit
+bool hermite_refit(const Vec3_cu* points,
+                   const Vec3_cu* normals,
+                   const int* origin,
+                   int size,
+                   HRBF_coeffs& res,
+                   HRBF_factor* fact);
+
+/// Input and output of one fit for hermite_fit_batch()
+struct HRBF_fit_job {
+    const Vec3_cu* points;
+    const Vec3_cu* normals;
+    int size;          ///< size of 'points' and 'normals'
+    HRBF_coeffs* res;  ///< result of the fit
+};
+
+/// Compute the coeffs of several independent HRBFs. Fits are spread over
+/// the threads of Thread_utils::parallel_for(), one job per thread at a time.
+void hermite_fit_batch(const std::vector<HRBF_fit_job>& jobs);
 
 }// END RBF_WRAPPER ============================================================
 
@@ -21,6 +21,14 @@
 
 #include <deque>
 #include <iostream>
+#include <vector>
+
+// SSE is part of every x86-64 target, the host sampler falls back on scalar
+// code elsewhere
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define PRECOMPUTED_PRIM_SSE
+#include <xmmintrin.h>
+#endif
 
 using namespace Cuda_utils;
 
@@ -33,7 +41,8 @@ struct PrecomputedInfo
     __host__ PrecomputedInfo():
         id(-1),
         tex_grid(0),
-        d_grid(NULL)
+        d_grid(NULL),
+        h_grid(NULL)
     {
     }
     int id;
@@ -54,6 +63,10 @@ struct PrecomputedInfo
     Transfo grid_transfo_buffer;
 
     Device::CuArray<float4> *d_grid;
+
+    /// Host copy of 'd_grid' (GRID_RES_3 elements) stored by bricks
+    /// @see brick_index() below
+    float4 *h_grid;
 };
 
 std::vector<PrecomputedInfo> h_precomputed_info;
@@ -186,34 +199,142 @@ static void fill_grid(PrecomputedInfo &info,
     CUDA_CHECK_ERRORS();
 }
 
-__device__
-float fetch_potential(const PrecomputedInfo &info, const Point_cu& p)
+// -----------------------------------------------------------------------------
+
+/// @return the index of the grid element (x, y, z) in the host copy of a grid
+/// Bricks are stored in x, y, z order and so are elements inside a brick.
+static inline int brick_index(int x, int y, int z)
 {
-    Point_cu  r = info.grid_transfo_buffer * p;
+    const unsigned nb_bricks = GRID_RES / BRICK_RES;
+    const unsigned mask = BRICK_RES - 1;
+    const unsigned ux = x, uy = y, uz = z;
+    const unsigned brick = ((uz / BRICK_RES) * nb_bricks + (uy / BRICK_RES)) * nb_bricks + (ux / BRICK_RES);
+    const unsigned elt   = ((uz & mask) * BRICK_RES + (uy & mask)) * BRICK_RES + (ux & mask);
+    return (int)(brick * BRICK_RES_3 + elt);
+}
 
-//    if( is_in_grid(r) )
-//    {
-//        float4 res = tex3D(tex_grid, r.x, r.y, r.z);
-//        return res.x;
-//    }
+// -----------------------------------------------------------------------------
 
-    return 0.f;
+/// Copy the grid computed in 'info.d_grid' to 'info.h_grid'
+static void download_grid(PrecomputedInfo &info)
+{
+    std::vector<float4> linear( GRID_RES_3 );
+
+    cudaMemcpy3DParms copyParams = {0};
+    copyParams.srcArray = info.d_grid->getCudaArray();
+    copyParams.dstPtr   = make_cudaPitchedPtr(reinterpret_cast<void*>(&linear[0]),
+                                              GRID_RES*sizeof(float4),
+                                              GRID_RES, GRID_RES);
+    copyParams.extent   = info.d_grid->get_extent();
+    copyParams.kind     = cudaMemcpyDeviceToHost;
+    CUDA_SAFE_CALL( cudaMemcpy3D(&copyParams) );
+
+    if(info.h_grid == NULL)
+        info.h_grid = new float4[GRID_RES_3];
+
+    for(int z = 0; z < GRID_RES; z++)
+        for(int y = 0; y < GRID_RES; y++)
+            for(int x = 0; x < GRID_RES; x++)
+                info.h_grid[brick_index(x, y, z)] = linear[(z * GRID_RES + y) * GRID_RES + x];
 }
 
 // -----------------------------------------------------------------------------
 
-__device__
-Vec3_cu fetch_gradient(const PrecomputedInfo &info, const Point_cu& p)
+#ifdef PRECOMPUTED_PRIM_SSE
+static inline __m128 lerp(__m128 a, __m128 b, __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+#else
+static inline float4 lerp(const float4& a, const float4& b, float t) {
+    return make_float4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+                       a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+}
+#endif
+
+/// Trilinear interpolation of the host copy of a grid, the potential and
+/// gradient are interpolated at once.
+/// Matches tex3D() with unnormalized coordinates and linear filtering: the
+/// center of the element (x, y, z) is at (x+0.5, y+0.5, z+0.5).
+/// @param r : point in grid space inside the grid (see is_in_grid())
+/// @return the gradient in (x, y, z) and the potential in w
+static float4 sample_grid_host(const float4* grid, const Point_cu& r)
 {
-    Point_cu  r = info.grid_transfo_buffer * p;
+    const float x = r.x - 0.5f;
+    const float y = r.y - 0.5f;
+    const float z = r.z - 0.5f;
+    // Coordinates are positive: truncation is the floor.
+    const int ix = min((int)x, GRID_RES - 2);
+    const int iy = min((int)y, GRID_RES - 2);
+    const int iz = min((int)z, GRID_RES - 2);
+    const float tx = x - (float)ix;
+    const float ty = y - (float)iy;
+    const float tz = z - (float)iz;
+
+    const float4& c000 = grid[brick_index(ix    , iy    , iz    )];
+    const float4& c100 = grid[brick_index(ix + 1, iy    , iz    )];
+    const float4& c010 = grid[brick_index(ix    , iy + 1, iz    )];
+    const float4& c110 = grid[brick_index(ix + 1, iy + 1, iz    )];
+    const float4& c001 = grid[brick_index(ix    , iy    , iz + 1)];
+    const float4& c101 = grid[brick_index(ix + 1, iy    , iz + 1)];
+    const float4& c011 = grid[brick_index(ix    , iy + 1, iz + 1)];
+    const float4& c111 = grid[brick_index(ix + 1, iy + 1, iz + 1)];
+
+#ifdef PRECOMPUTED_PRIM_SSE
+    const __m128 vx = _mm_set1_ps(tx);
+    const __m128 vy = _mm_set1_ps(ty);
+    const __m128 vz = _mm_set1_ps(tz);
+    const __m128 c00 = lerp(_mm_loadu_ps(&c000.x), _mm_loadu_ps(&c100.x), vx);
+    const __m128 c10 = lerp(_mm_loadu_ps(&c010.x), _mm_loadu_ps(&c110.x), vx);
+    const __m128 c01 = lerp(_mm_loadu_ps(&c001.x), _mm_loadu_ps(&c101.x), vx);
+    const __m128 c11 = lerp(_mm_loadu_ps(&c011.x), _mm_loadu_ps(&c111.x), vx);
+    const __m128 res = lerp(lerp(c00, c10, vy), lerp(c01, c11, vy), vz);
+
+    float4 out;
+    _mm_storeu_ps(&out.x, res);
+    return out;
+#else
+    const float4 c00 = lerp(c000, c100, tx);
+    const float4 c10 = lerp(c010, c110, tx);
+    const float4 c01 = lerp(c001, c101, tx);
+    const float4 c11 = lerp(c011, c111, tx);
+    return lerp(lerp(c00, c10, ty), lerp(c01, c11, ty), tz);
+#endif
+}
+
+// -----------------------------------------------------------------------------
 
-//    if( is_in_grid(r) )
-//    {
-//        float4 res = tex3D(tex_grid, r.x, r.y, r.z);
-//        return Vec3_cu(res.y, res.z, res.w);
-//    }
+IF_CUDA_DEVICE_HOST static inline
+bool is_in_grid(const Point_cu& pt)
+{
+    const float res = (float)GRID_RES;
 
-    return Vec3_cu(0.f, 0.f, 0.f);
+    return pt.x >= 0.5f       && pt.y >= 0.5f       && pt.z >= 0.5f &&
+           pt.x <  res - 0.5f && pt.y <  res - 0.5f && pt.z <  res - 0.5f;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Fetch the grid of 'info' at 'p' (world space)
+/// @return the gradient in (x, y, z) (world space) and the potential in w
+IF_CUDA_DEVICE_HOST static inline
+float4 fetch_grid(const PrecomputedInfo &info, const Point_cu& p)
+{
+    const Point_cu r = info.grid_transfo_buffer * p;
+
+    // XXX: Can we avoid needing to check this using texture borders, since each grid is now in
+    // a separate texture?
+    if( !is_in_grid( r ) )
+        return make_float4(0.f, 0.f, 0.f, 0.f);
+
+#ifdef __CUDA_ARCH__
+    float4 res = tex3D<float4>(info.tex_grid, r.x, r.y, r.z);
+#else
+    assert(info.h_grid != NULL);
+    float4 res = sample_grid_host(info.h_grid, r);
+#endif
+
+    const Vec3_cu grad = info.user_transform * Vec3_cu(res.x, res.y, res.z);
+    return make_float4(grad.x, grad.y, grad.z, res.w);
 }
 
 }
@@ -321,6 +442,9 @@ void Precomputed_prim::clear() {
     delete info.d_grid;
     info.d_grid = NULL;
 
+    delete[] info.h_grid;
+    info.h_grid = NULL;
+
     info.id = -1;
     int old_id = _id;
     _id = -1;
@@ -370,6 +494,7 @@ void Precomputed_prim::fill_grid_with(Skeleton_env::Skel_id skel_id, const Bone*
 
     // Compute the primive's grid
     fill_grid(info, bone_id, skel_id, obbox, GRID_RES);
+    download_grid(info);
 
     // Adding the transformation to evaluate the grid
     info.grid_transform = world_coord_to_grid(obbox, GRID_RES);
@@ -377,57 +502,33 @@ void Precomputed_prim::fill_grid_with(Skeleton_env::Skel_id skel_id, const Bone*
     update_device(_id);
 }
 
-__device__
+IF_CUDA_DEVICE_HOST
 float Precomputed_prim::f(const Point_cu& x) const
 {
     using namespace Precomputed_env;
 
-    const PrecomputedInfo &info = get_info();
-    return fetch_potential(info, x);
+    return fetch_grid(get_info(), x).w;
 }
 
 // -----------------------------------------------------------------------------
 
-__device__
+IF_CUDA_DEVICE_HOST
 Vec3_cu Precomputed_prim::gf(const Point_cu& x) const
 {
     using namespace Precomputed_env;
 
-    const PrecomputedInfo &info = get_info();
-    return fetch_gradient(info, x);
+    const float4 res = fetch_grid(get_info(), x);
+    return Vec3_cu(res.x, res.y, res.z);
 }
 
 // -----------------------------------------------------------------------------
-__device__
-bool is_in_grid(const Point_cu& pt)
-{
-    const float res = (float)GRID_RES;
-
-    return pt.x >= 0.5        && pt.y >= 0.5f       && pt.z >= 0.5f &&
-           pt.x <  res - 0.5f && pt.y <  res - 0.5f && pt.z <  res - 0.5f;
-}
 
-__device__
+IF_CUDA_DEVICE_HOST
 float Precomputed_prim::fngf(Vec3_cu& grad, const Point_cu& p) const
 {
     using namespace Precomputed_env;
 
-    const PrecomputedInfo &info = get_info();
-    Point_cu  r = info.grid_transfo_buffer * p;
-
-    // XXX: Can we avoid needing to check this using texture borders, since each grid is now in
-    // a separate texture?
-    if( !is_in_grid( r ) )
-    {
-        grad = Vec3_cu(0.f, 0.f, 0.f);
-        return 0.f;
-    }
-
-    float4 res = tex3D<float4>(info.tex_grid, r.x, r.y, r.z);
-    grad.x = res.x;
-    grad.y = res.y;
-    grad.z = res.z;
-
-    grad = info.user_transform * grad;
+    const float4 res = fetch_grid(get_info(), p);
+    grad = Vec3_cu(res.x, res.y, res.z);
     return res.w;
 }
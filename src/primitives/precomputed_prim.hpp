@@ -17,7 +17,8 @@ class Bone;
     @brief Environment storing 3D grids representing implicit primitives
 
     Precomputed_Env provides a way to store in Cuda textures 3d grids and
-    fetch them with trilinear interpolation
+    fetch them with trilinear interpolation. A host copy of every grid is
+    kept so primitives can also be evaluated by host code.
 
     How to upload one primitive and transform it:
     @code
@@ -72,12 +73,14 @@ struct Precomputed_prim {
 
 #if !defined(NO_CUDA)
     /// @name Evaluation of the potential and gradient
+    /// On device the grid is fetched from its texture, on host the
+    /// grid's host copy is sampled with the same trilinear filtering.
     /// @{
-    __device__
+    IF_CUDA_DEVICE_HOST
     float f(const Point_cu& p) const;
-    __device__
+    IF_CUDA_DEVICE_HOST
     Vec3_cu gf(const Point_cu& p) const;
-    __device__
+    IF_CUDA_DEVICE_HOST
     float fngf (Vec3_cu& gf, const Point_cu& p) const;
     /// @}
 #endif
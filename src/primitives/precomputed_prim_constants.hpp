@@ -12,4 +12,12 @@
 
 #define GRID_RES_3 (GRID_RES*GRID_RES*GRID_RES)
 
+/// Host copies of the grids are stored by cubic bricks of BRICK_RES^3
+/// elements, so that the 8 neighbours of a trilinear fetch are most of the
+/// time in the same 1KB of memory.
+/// @warning must be a power of two dividing GRID_RES
+#define BRICK_RES 4
+
+#define BRICK_RES_3 (BRICK_RES*BRICK_RES*BRICK_RES)
+
 #endif // PRECOMPUTED_PRIM_CONSTANTS_HPP__
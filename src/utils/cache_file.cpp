@@ -0,0 +1,432 @@
+#include "cache_file.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace {
+
+/// Increase when the layout of the file changes
+const uint32_t file_version = 1;
+
+const char file_magic[8] = {'I', 'M', 'P', 'L', 'C', 'A', 'C', 'H'};
+
+const int max_name_length = 64;
+
+struct File_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint32_t nb_config;      ///< number of ints following the header
+    uint32_t nb_sections;    ///< number of File_entry following the config
+    uint64_t table_checksum; ///< checksum of the config and the entries
+};
+
+struct File_entry {
+    char     name[max_name_length]; ///< null terminated
+    uint64_t key;
+    uint64_t offset;   ///< from the beginning of the file
+    uint64_t size;     ///< in bytes
+    uint64_t checksum; ///< of the section's content
+};
+
+uint64_t align(uint64_t offset, uint64_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+}
+
+// -----------------------------------------------------------------------------
+
+Cache_file::Cache_file(const std::string& path, const std::vector<int>& config) :
+    _path(path),
+    _config(config),
+    _data(0),
+    _size(0),
+    _handle(0)
+{
+    for(int i = 0; i < NB_ERRORS; i++) _reported[i] = false;
+    open();
+}
+
+// -----------------------------------------------------------------------------
+
+Cache_file::~Cache_file()
+{
+    unmap();
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t Cache_file::hash(const void* data, size_t size, uint64_t h)
+{
+    // Not cryptographic: this detects stale keys and corrupted data
+    const uint64_t prime = 0x100000001b3ull;
+    const unsigned char* bytes = (const unsigned char*)data;
+    const size_t nb_words = size / sizeof(uint64_t);
+    for(size_t i = 0; i < nb_words; i++)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+        h = (h ^ word) * prime;
+    }
+    for(size_t i = nb_words * sizeof(uint64_t); i < size; i++)
+        h = (h ^ bytes[i]) * prime;
+    return h;
+}
+
+// -----------------------------------------------------------------------------
+
+void Cache_file::open()
+{
+    unmap();
+
+#if defined(WIN32)
+    HANDLE file = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if(file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER file_size;
+    HANDLE mapping = 0;
+    if(GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    // The mapping keeps the file opened
+    CloseHandle(file);
+    if(mapping == 0)
+        return;
+
+    const void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(ptr == 0){
+        CloseHandle(mapping);
+        return;
+    }
+    _handle = mapping;
+    _size   = (uint64_t)file_size.QuadPart;
+#else
+    int fd = ::open(_path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0){
+        ::close(fd);
+        return;
+    }
+
+    void* ptr = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file opened
+    ::close(fd);
+    if(ptr == MAP_FAILED)
+        return;
+    _size = (uint64_t)st.st_size;
+#endif
+    _data = (const char*)ptr;
+
+    // Check the header and read the table of sections
+    File_header header;
+    bool ok = _size >= sizeof(File_header);
+    if( ok )
+    {
+        memcpy(&header, _data, sizeof(File_header));
+        ok = memcmp(header.magic, file_magic, sizeof(file_magic)) == 0;
+    }
+
+    if( ok && (header.version   != file_version              ||
+               header.alignment != (uint32_t)alignment       ||
+               header.nb_config != (uint32_t)_config.size()) )
+    {
+        report(OUT_OF_DATE);
+        unmap();
+        return;
+    }
+
+    const uint64_t config_size = sizeof(int) * (uint64_t)_config.size();
+    const uint64_t table_offset = sizeof(File_header) + config_size;
+    if( ok )
+    {
+        const uint64_t table_size = sizeof(File_entry) * (uint64_t)header.nb_sections;
+        ok = table_offset + table_size <= _size &&
+             header.table_checksum == hash(_data + sizeof(File_header), (size_t)(config_size + table_size));
+    }
+
+    if( ok && config_size > 0 && memcmp(_data + sizeof(File_header), _config.data(), (size_t)config_size) != 0 )
+    {
+        report(OUT_OF_DATE);
+        unmap();
+        return;
+    }
+
+    for(uint32_t i = 0; ok && i < header.nb_sections; i++)
+    {
+        File_entry entry;
+        memcpy(&entry, _data + table_offset + i * sizeof(File_entry), sizeof(File_entry));
+        ok = memchr(entry.name, 0, max_name_length) != 0 &&
+             entry.offset % alignment == 0 &&
+             entry.offset <= _size && entry.size <= _size - entry.offset;
+        if( !ok ) break;
+
+        Section& sec = _sections[entry.name];
+        sec.key      = entry.key;
+        sec.offset   = entry.offset;
+        sec.size     = entry.size;
+        sec.checksum = entry.checksum;
+    }
+
+    if( !ok )
+    {
+        report(CORRUPTED);
+        unmap();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Cache_file::unmap()
+{
+    if(_data != 0)
+    {
+#if defined(WIN32)
+        UnmapViewOfFile(_data);
+        CloseHandle((HANDLE)_handle);
+#else
+        munmap((void*)_data, (size_t)_size);
+#endif
+    }
+    _data   = 0;
+    _size   = 0;
+    _handle = 0;
+    _sections.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+void Cache_file::close()
+{
+    unmap();
+    _pending.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+const char* Cache_file::check(const std::string& name)
+{
+    std::map<std::string, Section>::iterator it = _sections.find(name);
+    if(it == _sections.end())
+        return 0;
+
+    // Sections are only checked the first time they're used
+    Section& sec = it->second;
+    if( !sec.checked )
+    {
+        if(hash(_data + sec.offset, (size_t)sec.size) != sec.checksum)
+        {
+            discard(name);
+            return 0;
+        }
+        sec.checked = true;
+    }
+    return _data + sec.offset;
+}
+
+// -----------------------------------------------------------------------------
+
+void Cache_file::discard(const std::string& name)
+{
+    report(CORRUPTED, name);
+    _sections.erase(name);
+}
+
+// -----------------------------------------------------------------------------
+
+void Cache_file::report(Error err, const std::string& detail)
+{
+    if(_reported[err])
+        return;
+    _reported[err] = true;
+
+    std::cout << "Cache " << _path;
+    switch(err)
+    {
+    case OUT_OF_DATE:
+        std::cout << " is out of date, its data will be regenerated";
+        break;
+    case CORRUPTED:
+        std::cout << " is corrupted";
+        if( !detail.empty() ) std::cout << " (section " << detail << ")";
+        std::cout << ", corrupted data will be regenerated";
+        break;
+    case NAME_TOO_LONG:
+        std::cout << ": section name too long, " << detail << " won't be cached";
+        break;
+    case WRITE_FAILED:
+        std::cout << " could not be written, its data will be regenerated next time";
+        break;
+    default: break;
+    }
+    std::cout << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+const void* Cache_file::get_raw(const std::string& name, uint64_t key, uint64_t size)
+{
+    std::map<std::string, Pending>::const_iterator p = _pending.find(name);
+    if(p != _pending.end())
+    {
+        const Pending& pen = p->second;
+        if(pen.key != key || pen.data.size() != size) return 0;
+        return pen.data.empty() ? (const void*)&pen : pen.data.data();
+    }
+
+    std::map<std::string, Section>::iterator it = _sections.find(name);
+    if(it == _sections.end())
+        return 0;
+
+    const Section& sec = it->second;
+    if(sec.key != key || sec.size != size)
+        return 0;
+
+    return check(name);
+}
+
+// -----------------------------------------------------------------------------
+
+void Cache_file::set_raw(const std::string& name, uint64_t key, const void* data, uint64_t size)
+{
+    if((int)name.size() >= max_name_length){
+        report(NAME_TOO_LONG, name);
+        return;
+    }
+
+    Pending& pen = _pending[name];
+    pen.key = key;
+    pen.data.assign((const char*)data, (const char*)data + size);
+}
+
+// -----------------------------------------------------------------------------
+
+bool Cache_file::write()
+{
+    if(_pending.empty())
+        return true;
+
+    // Gather the sections to write: the new ones and the valid old ones
+    std::vector<File_entry>  entries;
+    std::vector<const char*> contents;
+    // check() discards corrupted sections: iterate over a copy of the names
+    std::vector<std::string> names;
+    for(std::map<std::string, Section>::const_iterator it = _sections.begin(); it != _sections.end(); ++it)
+        if(_pending.find(it->first) == _pending.end())
+            names.push_back(it->first);
+
+    for(unsigned i = 0; i < names.size(); i++)
+    {
+        const char* ptr = check(names[i]);
+        if(ptr == 0)
+            continue;
+
+        const Section& sec = _sections[names[i]];
+        File_entry entry;
+        memset(&entry, 0, sizeof(File_entry));
+        strcpy(entry.name, names[i].c_str());
+        entry.key      = sec.key;
+        entry.size     = sec.size;
+        entry.checksum = sec.checksum;
+        entries. push_back(entry);
+        contents.push_back(ptr);
+    }
+
+    for(std::map<std::string, Pending>::const_iterator it = _pending.begin(); it != _pending.end(); ++it)
+    {
+        const std::vector<char>& data = it->second.data;
+        File_entry entry;
+        memset(&entry, 0, sizeof(File_entry));
+        strcpy(entry.name, it->first.c_str());
+        entry.key      = it->second.key;
+        entry.size     = data.size();
+        entry.checksum = hash(data.data(), data.size());
+        entries. push_back(entry);
+        contents.push_back(data.data());
+    }
+
+    // Lay out the sections after the table
+    const uint64_t config_size = sizeof(int) * (uint64_t)_config.size();
+    const uint64_t table_size  = sizeof(File_entry) * (uint64_t)entries.size();
+    uint64_t offset = sizeof(File_header) + config_size + table_size;
+    for(unsigned i = 0; i < entries.size(); i++)
+    {
+        offset = align(offset, alignment);
+        entries[i].offset = offset;
+        offset += entries[i].size;
+    }
+
+    std::vector<char> table((size_t)(config_size + table_size));
+    if(config_size > 0) memcpy(&table[0], _config.data(), (size_t)config_size);
+    if(table_size  > 0) memcpy(&table[(size_t)config_size], entries.data(), (size_t)table_size);
+
+    File_header header;
+    memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version        = file_version;
+    header.alignment      = alignment;
+    header.nb_config      = (uint32_t)_config.size();
+    header.nb_sections    = (uint32_t)entries.size();
+    header.table_checksum = hash(table.data(), table.size());
+
+    const std::string tmp_path = _path + ".tmp";
+    std::ofstream file(tmp_path.c_str(), std::ios::trunc | std::ios::out | std::ios::binary);
+    if( !file.is_open() ){
+        report(WRITE_FAILED);
+        return false;
+    }
+
+    file.write((const char*)&header, sizeof(File_header));
+    file.write(table.data(), table.size());
+    const char padding[alignment] = {0};
+    uint64_t pos = sizeof(File_header) + table.size();
+    for(unsigned i = 0; i < entries.size(); i++)
+    {
+        file.write(padding, (std::streamsize)(entries[i].offset - pos));
+        file.write(contents[i], (std::streamsize)entries[i].size);
+        pos = entries[i].offset + entries[i].size;
+    }
+    file.close();
+
+    // The old file can only be replaced once it's unmapped
+    const bool written = !file.fail();
+    unmap();
+    bool renamed = false;
+    if( written )
+    {
+#if defined(WIN32)
+        renamed = MoveFileExA(tmp_path.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        renamed = rename(tmp_path.c_str(), _path.c_str()) == 0;
+#endif
+    }
+
+    if( !renamed )
+    {
+        report(WRITE_FAILED);
+        remove(tmp_path.c_str());
+        open();
+        return false;
+    }
+
+    _pending.clear();
+    open();
+    return true;
+}
@@ -0,0 +1,152 @@
+#ifndef CACHE_FILE_HPP__
+#define CACHE_FILE_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <cstddef>
+
+/**
+    @class Cache_file
+    @brief Named binary sections stored in a single file read through a memory
+    mapping.
+
+    The file starts with a header holding the format version and the
+    configuration the data was computed with (a list of ints, e.g. sampling
+    constants). Each section records the key of the parameters it was computed
+    with, its size and a checksum of its content. Sections are aligned so they
+    can be used in place from the mapping.
+
+    Anything that doesn't match (version, configuration, key, size or checksum)
+    is reported as missing. The caller computes the data again and stores it
+    back with set(), so a stale or corrupted cache is rebuilt instead of being
+    used. A file out of date or corrupted is reported once on std::cout, a
+    corrupted section is discarded and never looked up again (see discard()).
+
+    usage:
+    @code
+    Cache_file cache(path, config);
+    const float* vals = cache.get<float>("op_vals", op_key, nb_vals);
+    if( vals == 0 ){
+        std::vector<float> new_vals = compute();
+        cache.set("op_vals", op_key, new_vals.data(), nb_vals);
+        cache.write();
+    }
+    @endcode
+*/
+class Cache_file {
+public:
+    /// Alignment in bytes of the sections inside the file
+    static const int alignment = 64;
+
+    static const uint64_t hash_seed = 0xcbf29ce484222325ull;
+
+    /// @param config : configuration shared by every section, the whole file
+    /// is ignored when it doesn't match
+    Cache_file(const std::string& path, const std::vector<int>& config);
+
+    ~Cache_file();
+
+    /// @return section 'name' in the mapped file, or NULL if it's missing,
+    /// corrupted, or wasn't stored with 'key' and 'nb_elts' elements.
+    /// Sections added with set() and not yet written are returned as well.
+    /// @warning the pointer is invalidated by set(), write() and close()
+    template<class T>
+    const T* get(const std::string& name, uint64_t key, int nb_elts)
+    {
+        return (const T*)get_raw(name, key, sizeof(T) * (uint64_t)nb_elts);
+    }
+
+    /// Copy the section 'name' into 'dst' (see get())
+    /// @return false if the section can't be used, 'dst' is left untouched
+    template<class T>
+    bool read(const std::string& name, uint64_t key, T* dst, int nb_elts)
+    {
+        const T* src = get<T>(name, key, nb_elts);
+        if( src == 0 ) return false;
+        for(int i = 0; i < nb_elts; i++) dst[i] = src[i];
+        return true;
+    }
+
+    /// Add or replace the section 'name'. It's kept in memory until write()
+    template<class T>
+    void set(const std::string& name, uint64_t key, const T* data, int nb_elts)
+    {
+        set_raw(name, key, data, sizeof(T) * (uint64_t)nb_elts);
+    }
+
+    /// Write the sections added with set() along with the valid sections
+    /// already in the file. The new file is written aside and then renamed so
+    /// an interrupted write never leaves a truncated cache.
+    /// Does nothing if no section was added.
+    /// @return false if the file couldn't be written
+    bool write();
+
+    /// Unmap the file and drop the sections not written
+    void close();
+
+    /// 64 bits FNV-1a hash of 'size' bytes (on whole words when possible).
+    /// Used for the checksums and to compute keys.
+    /// @param h : previous hash to chain several calls
+    static uint64_t hash(const void* data, size_t size, uint64_t h = hash_seed);
+
+private:
+    struct Section {
+        Section() : key(0), offset(0), size(0), checksum(0), checked(false) { }
+        uint64_t key;
+        uint64_t offset;   ///< in the mapped file
+        uint64_t size;
+        uint64_t checksum;
+        bool checked;      ///< checksum already verified
+    };
+
+    /// Problems reported to the user, each of them only once
+    enum Error {
+        OUT_OF_DATE,   ///< version or configuration mismatch
+        CORRUPTED,     ///< bad table or section checksum
+        NAME_TOO_LONG,
+        WRITE_FAILED,
+        NB_ERRORS
+    };
+
+    struct Pending {
+        uint64_t key;
+        std::vector<char> data;
+    };
+
+    Cache_file(const Cache_file&);
+    Cache_file& operator=(const Cache_file&);
+
+    const void* get_raw(const std::string& name, uint64_t key, uint64_t size);
+    void set_raw(const std::string& name, uint64_t key, const void* data, uint64_t size);
+
+    /// Map the file and read its section table, if it matches '_config'
+    void open();
+    void unmap();
+
+    /// @return the mapped content of the section 'name' if its checksum is
+    /// right, otherwise the section is discarded and NULL is returned
+    const char* check(const std::string& name);
+
+    /// Drop the section 'name': it's reported missing from now on and isn't
+    /// kept by write(), so the caller regenerates it and set() replaces it.
+    void discard(const std::string& name);
+
+    /// Print 'err' on std::cout the first time it happens
+    void report(Error err, const std::string& detail = "");
+
+    std::string      _path;
+    std::vector<int> _config;
+
+    const char* _data;  ///< mapped file (NULL if not mapped)
+    uint64_t    _size;  ///< size of the mapping
+    void*       _handle;///< OS handles of the mapping
+
+    std::map<std::string, Section> _sections;
+    std::map<std::string, Pending> _pending;
+
+    bool _reported[NB_ERRORS];
+};
+
+#endif // CACHE_FILE_HPP__
@@ -169,6 +169,19 @@ void mem_cpy_2D_htd(cudaArray* dst, const T* src, int2 nb_elt){
     CUDA_SAFE_CALL(cudaMemcpyToArray(dst, 0, 0, src, data_size, cudaMemcpyHostToDevice));
 }
 
+/// Safe memory copy host to a sub-rectangle of a 2D cudaArray
+/// @param offset : position of the rectangle in 'dst' (in elements)
+/// @param nb_elt : size of the rectangle (in elements)
+/// @param src_width : number of elements of a row of 'src'
+template <class T>
+inline
+void mem_cpy_2D_htd(cudaArray* dst, int2 offset, const T* src, int src_width, int2 nb_elt){
+    CUDA_SAFE_CALL(cudaMemcpy2DToArray(dst, sizeof(T) * offset.x, offset.y,
+                                       src, sizeof(T) * src_width,
+                                       sizeof(T) * nb_elt.x, nb_elt.y,
+                                       cudaMemcpyHostToDevice));
+}
+
 /// Safe memory copy host to 3D cudaArray
 template <class T>
 inline
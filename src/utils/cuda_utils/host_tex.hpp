@@ -0,0 +1,181 @@
+#ifndef HOST_TEX_HPP__
+#define HOST_TEX_HPP__
+
+#include "cuda_compiler_interop.hpp"
+#include <cmath>
+#include <algorithm>
+
+// SSE is part of every x86-64 target, the 3D lookups fall back on scalar code
+// elsewhere
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define HOST_TEX_SSE
+#include <xmmintrin.h>
+#endif
+
+/**
+  @namespace Host_tex
+  @brief Sampling of host arrays the way CUDA textures with unnormalized
+  coordinates, linear filtering and clamp addressing sample them.
+
+  Host copies of arrays bound to textures can be fetched with the same
+  coordinates as the device code:
+  @code
+  // device
+  float v = tex3D(tex, x, y, z);
+  // host
+  float v = Host_tex::fetch_3D(h_vals, size, x, y, z);
+  @endcode
+  The element 'i' is centered at 'i + 0.5'. Like the texture unit the
+  interpolation weights are rounded to 8 bits of fractional value (CUDA
+  programming guide, "Linear Filtering"), so host and device results only
+  differ by the rounding of the interpolation itself.
+*/
+// =============================================================================
+namespace Host_tex {
+// =============================================================================
+
+/// Elements and interpolation weight of a coordinate along one axis
+struct Axis {
+    int   i0; ///< element before the coordinate (clamped)
+    int   i1; ///< element after the coordinate (clamped)
+    float t;  ///< weight of 'i1'
+};
+
+/// @param x : unnormalized coordinate
+/// @param size : number of elements along the axis
+static inline Axis axis(float x, int size)
+{
+    const float xb = x - 0.5f;
+    const float fl = std::floor(xb);
+    const int   i  = (int)fl;
+    Axis a;
+    a.i0 = std::min(std::max(i    , 0), size - 1);
+    a.i1 = std::min(std::max(i + 1, 0), size - 1);
+    // 9 bits fixed point weight with 8 bits of fractional value
+    a.t  = std::floor((xb - fl) * 256.f + 0.5f) * (1.f / 256.f);
+    return a;
+}
+
+// -----------------------------------------------------------------------------
+
+static inline float lerp(float a, float b, float t){
+    return (1.f - t) * a + t * b;
+}
+
+static inline float2 lerp(const float2& a, const float2& b, float t){
+    return make_float2(lerp(a.x, b.x, t), lerp(a.y, b.y, t));
+}
+
+// -----------------------------------------------------------------------------
+
+/// tex1D() of the array 'data' of 'size' elements
+template<class T>
+static inline T fetch_1D(const T* data, int size, float x)
+{
+    const Axis ax = axis(x, size);
+    return lerp(data[ax.i0], data[ax.i1], ax.t);
+}
+
+// -----------------------------------------------------------------------------
+
+/// tex2D() of the array 'data' stored row by row
+template<class T>
+static inline T fetch_2D(const T* data, int2 size, float x, float y)
+{
+    const Axis ax = axis(x, size.x);
+    const Axis ay = axis(y, size.y);
+    const T* row0 = data + ay.i0 * size.x;
+    const T* row1 = data + ay.i1 * size.x;
+    return lerp(lerp(row0[ax.i0], row0[ax.i1], ax.t),
+                lerp(row1[ax.i0], row1[ax.i1], ax.t), ay.t);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Linear indices of the 8 neighbors of a 3D coordinate and its weights
+struct Cell {
+    int   idx[8]; ///< (x, y, z) = (i&1, (i>>1)&1, (i>>2)&1) offsets
+    float tx, ty, tz;
+};
+
+static inline Cell cell(int3 size, float x, float y, float z)
+{
+    const Axis ax = axis(x, size.x);
+    const Axis ay = axis(y, size.y);
+    const Axis az = axis(z, size.z);
+    const int sxy = size.x * size.y;
+    const int y0 = ay.i0 * size.x, y1 = ay.i1 * size.x;
+    const int z0 = az.i0 * sxy   , z1 = az.i1 * sxy;
+    Cell c;
+    c.idx[0] = ax.i0 + y0 + z0; c.idx[1] = ax.i1 + y0 + z0;
+    c.idx[2] = ax.i0 + y1 + z0; c.idx[3] = ax.i1 + y1 + z0;
+    c.idx[4] = ax.i0 + y0 + z1; c.idx[5] = ax.i1 + y0 + z1;
+    c.idx[6] = ax.i0 + y1 + z1; c.idx[7] = ax.i1 + y1 + z1;
+    c.tx = ax.t; c.ty = ay.t; c.tz = az.t;
+    return c;
+}
+
+// -----------------------------------------------------------------------------
+
+#ifdef HOST_TEX_SSE
+static inline __m128 lerp(__m128 a, __m128 b, __m128 t){
+    return _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.f), t), a), _mm_mul_ps(t, b));
+}
+#endif
+
+/// tex3D() of the array 'data' stored slice by slice, row by row.
+/// Interpolates along x, then y, then z.
+static inline float fetch_3D(const float* data, int3 size, float x, float y, float z)
+{
+    const Cell c = cell(size, x, y, z);
+    const int* i = c.idx;
+#ifdef HOST_TEX_SSE
+    // Gather the 4 rows (y, z) of both x neighbors
+    const __m128 v0 = _mm_set_ps(data[i[6]], data[i[4]], data[i[2]], data[i[0]]);
+    const __m128 v1 = _mm_set_ps(data[i[7]], data[i[5]], data[i[3]], data[i[1]]);
+    // (y0z0, y1z0, y0z1, y1z1)
+    const __m128 vx = lerp(v0, v1, _mm_set1_ps(c.tx));
+    const __m128 y0 = _mm_shuffle_ps(vx, vx, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 y1 = _mm_shuffle_ps(vx, vx, _MM_SHUFFLE(3, 1, 3, 1));
+    // (z0, z1, z0, z1)
+    const __m128 vy = lerp(y0, y1, _mm_set1_ps(c.ty));
+    const __m128 vz = lerp(vy, _mm_shuffle_ps(vy, vy, _MM_SHUFFLE(1, 1, 1, 1)), _mm_set1_ps(c.tz));
+    return _mm_cvtss_f32(vz);
+#else
+    const float c0 = lerp(lerp(data[i[0]], data[i[1]], c.tx), lerp(data[i[2]], data[i[3]], c.tx), c.ty);
+    const float c1 = lerp(lerp(data[i[4]], data[i[5]], c.tx), lerp(data[i[6]], data[i[7]], c.tx), c.ty);
+    return lerp(c0, c1, c.tz);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+/// tex3D() of the array 'data' stored slice by slice, row by row.
+/// Interpolates along x, then y, then z.
+static inline float2 fetch_3D(const float2* data, int3 size, float x, float y, float z)
+{
+    const Cell c = cell(size, x, y, z);
+    const int* i = c.idx;
+#ifdef HOST_TEX_SSE
+    // Gather both rows y0 and y1 of a slice: (y0.x, y0.y, y1.x, y1.y)
+    #define HOST_TEX_GATHER(a, b) \
+        _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(data + (a))), (const __m64*)(data + (b)))
+    const __m128 vz0 = lerp(HOST_TEX_GATHER(i[0], i[2]), HOST_TEX_GATHER(i[1], i[3]), _mm_set1_ps(c.tx));
+    const __m128 vz1 = lerp(HOST_TEX_GATHER(i[4], i[6]), HOST_TEX_GATHER(i[5], i[7]), _mm_set1_ps(c.tx));
+    #undef HOST_TEX_GATHER
+    // (z0, z1) at y0 and at y1
+    const __m128 vy = lerp(_mm_movelh_ps(vz0, vz1), _mm_movehl_ps(vz1, vz0), _mm_set1_ps(c.ty));
+    const __m128 vz = lerp(vy, _mm_movehl_ps(vy, vy), _mm_set1_ps(c.tz));
+    float res[4];
+    _mm_storeu_ps(res, vz);
+    return make_float2(res[0], res[1]);
+#else
+    const float2 c0 = lerp(lerp(data[i[0]], data[i[1]], c.tx), lerp(data[i[2]], data[i[3]], c.tx), c.ty);
+    const float2 c1 = lerp(lerp(data[i[4]], data[i[5]], c.tx), lerp(data[i[6]], data[i[7]], c.tx), c.ty);
+    return lerp(c0, c1, c.tz);
+#endif
+}
+
+}// END Host_tex NAMESPACE =====================================================
+
+#endif // HOST_TEX_HPP__
@@ -0,0 +1,268 @@
+#include "thread_utils.hpp"
+
+#include <cassert>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// =============================================================================
+namespace Thread_utils {
+// =============================================================================
+
+/// True while the current thread is executing a parallel_for() body
+static thread_local bool t_in_parallel = false;
+
+// -----------------------------------------------------------------------------
+
+/// Chunks [head, tail) owned by a thread. The owner pops chunks at the head
+/// while other threads steal them from the tail.
+struct Chunk_queue {
+    std::mutex mutex;
+    int head, tail;
+
+    Chunk_queue() : head(0), tail(0) { }
+
+    bool pop(int& chunk){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(head >= tail) return false;
+        chunk = head++;
+        return true;
+    }
+
+    bool steal(int& chunk){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(head >= tail) return false;
+        chunk = --tail;
+        return true;
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+/// A parallel loop shared between the pool's threads. Each thread starts with
+/// a contiguous range of chunks (good locality) and steals chunks from the
+/// other threads once its own range is exhausted, so that uneven chunk costs
+/// don't leave threads idle.
+struct Job {
+    int begin, end, grain, nb_chunks;
+    const std::function<void (int, int)>* body;
+    std::vector<Chunk_queue> queues; ///< one per thread of the pool
+    std::atomic<int> done_chunks;
+
+    Job(int nb_queues) : queues(nb_queues) { }
+};
+
+// -----------------------------------------------------------------------------
+
+class Pool {
+public:
+    Pool(int nb) : _job(0), _job_gen(0), _active(0), _quit(false)
+    {
+        // Thread 0 is the caller of run(), workers are numbered from 1
+        for(int i = 1; i < nb; ++i)
+            _workers.push_back( std::thread(&Pool::worker_loop, this, i) );
+    }
+
+    ~Pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _wake.notify_all();
+        for(std::thread& t : _workers) t.join();
+    }
+
+    int size() const { return (int)_workers.size() + 1; }
+
+    void run(Job& job)
+    {
+        // Only one job in flight: concurrent callers are serialized
+        std::lock_guard<std::mutex> run_lock(_run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _job_gen++;
+        }
+        _wake.notify_all();
+
+        process(job, 0);
+
+        // Workers still holding a pointer to 'job' must be done with it before
+        // it goes out of scope
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [&]{ return _active == 0 && job.done_chunks.load() == job.nb_chunks; });
+        _job = 0;
+    }
+
+private:
+    static bool next_chunk(Job& job, int thread_id, int& chunk)
+    {
+        if( job.queues[thread_id].pop(chunk) )
+            return true;
+
+        const int nb = (int)job.queues.size();
+        for(int i = 1; i < nb; ++i)
+            if( job.queues[(thread_id + i) % nb].steal(chunk) )
+                return true;
+
+        return false;
+    }
+
+    static void process(Job& job, int thread_id)
+    {
+        t_in_parallel = true;
+        int c;
+        while( next_chunk(job, thread_id, c) )
+        {
+            int b = job.begin + c * job.grain;
+            int e = std::min(b + job.grain, job.end);
+            (*job.body)(b, e);
+            job.done_chunks.fetch_add(1);
+        }
+        t_in_parallel = false;
+    }
+
+    void worker_loop(int thread_id)
+    {
+        unsigned seen_gen = 0;
+        while(true)
+        {
+            Job* job = 0;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&]{ return _quit || (_job != 0 && _job_gen != seen_gen); });
+                if( _quit ) return;
+                seen_gen = _job_gen;
+                job = _job;
+                _active++;
+            }
+
+            process(*job, thread_id);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _active--;
+            _done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;     ///< protects _job, _job_gen, _active and _quit
+    std::mutex _run_mutex; ///< serializes calls to run()
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    Job* _job;
+    unsigned _job_gen;
+    int  _active;          ///< number of workers currently processing _job
+    bool _quit;
+};
+
+// -----------------------------------------------------------------------------
+
+static std::mutex g_pool_mutex;
+static Pool* g_pool = 0;
+
+static int hardware_threads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : (int)n;
+}
+
+// -----------------------------------------------------------------------------
+
+static Pool* get_pool()
+{
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    if( g_pool == 0 )
+        g_pool = new Pool( hardware_threads() );
+    return g_pool;
+}
+
+// -----------------------------------------------------------------------------
+
+int nb_threads(){ return get_pool()->size(); }
+
+// -----------------------------------------------------------------------------
+
+void set_nb_threads(int nb)
+{
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    delete g_pool;
+    g_pool = new Pool( nb <= 0 ? hardware_threads() : nb );
+}
+
+// -----------------------------------------------------------------------------
+
+void parallel_for(int begin, int end, int grain,
+                  const std::function<void (int, int)>& body)
+{
+    if( end <= begin ) return;
+    assert( grain > 0 );
+
+    const int nb_chunks = (end - begin + grain - 1) / grain;
+    Pool* pool = t_in_parallel ? 0 : get_pool();
+    if( nb_chunks == 1 || pool == 0 || pool->size() == 1 )
+    {
+        // Not worth waking up the workers (or nested call)
+        for(int b = begin; b < end; b += grain)
+            body(b, std::min(b + grain, end));
+        return;
+    }
+
+    const int nb = pool->size();
+    Job job( nb );
+    job.begin = begin;
+    job.end   = end;
+    job.grain = grain;
+    job.nb_chunks = nb_chunks;
+    job.body = &body;
+    job.done_chunks = 0;
+    // Distribute chunks in contiguous ranges
+    for(int i = 0; i < nb; ++i){
+        job.queues[i].head = (int)(((long long)nb_chunks *  i     ) / nb);
+        job.queues[i].tail = (int)(((long long)nb_chunks * (i + 1)) / nb);
+    }
+    pool->run( job );
+}
+
+// -----------------------------------------------------------------------------
+
+int exclusive_scan(int* values, int nb_values)
+{
+    // Sum blocks in parallel, scan the block sums, then scan each block
+    // starting from its offset.
+    const int block = 1 << 16;
+    const int nb_blocks = (nb_values + block - 1) / block;
+    std::vector<int> block_sums(nb_blocks + 1, 0);
+    parallel_for(0, nb_blocks, 1, [&](int b_begin, int b_end){
+        for(int b = b_begin; b < b_end; ++b)
+        {
+            const int end = std::min((b + 1) * block, nb_values);
+            int sum = 0;
+            for(int i = b * block; i < end; ++i) sum += values[i];
+            block_sums[b + 1] = sum;
+        }
+    });
+
+    for(int b = 0; b < nb_blocks; ++b)
+        block_sums[b + 1] += block_sums[b];
+
+    parallel_for(0, nb_blocks, 1, [&](int b_begin, int b_end){
+        for(int b = b_begin; b < b_end; ++b)
+        {
+            const int end = std::min((b + 1) * block, nb_values);
+            int acc = block_sums[b];
+            for(int i = b * block; i < end; ++i){
+                const int v = values[i];
+                values[i] = acc;
+                acc += v;
+            }
+        }
+    });
+    return block_sums[nb_blocks];
+}
+
+}// END Thread_utils ===========================================================
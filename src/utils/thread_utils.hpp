@@ -0,0 +1,53 @@
+#ifndef THREAD_UTILS_HPP__
+#define THREAD_UTILS_HPP__
+
+#include <functional>
+
+/**
+    @namespace Thread_utils
+    @brief Minimal CPU thread pool used by the host evaluation paths.
+
+    Worker threads are spawned on first use and kept alive until
+    set_nb_threads() is called again, so launching a parallel loop every frame
+    doesn't pay for thread creation. The calling thread takes part in the work.
+
+    usage:
+    @code
+    Thread_utils::parallel_for(0, nb_verts, 256, [&](int begin, int end){
+        for(int i = begin; i < end; ++i)
+            out[i] = eval( in[i] );
+    });
+    @endcode
+
+    @note parallel_for() called from inside a body runs serially on the
+    calling thread.
+*/
+// =============================================================================
+namespace Thread_utils {
+// =============================================================================
+
+/// @return number of threads used by parallel_for() (workers + caller)
+int nb_threads();
+
+/// Set the number of threads used by parallel_for().
+/// @param nb : thread count, if <= 0 we use the number of hardware threads
+void set_nb_threads(int nb);
+
+/// Split [begin, end) into chunks of at most 'grain' elements and process them
+/// in parallel by calling body(chunk_begin, chunk_end). Returns when every
+/// chunk has been processed.
+/// Chunks are first split in contiguous ranges between threads, a thread that
+/// runs out of chunks steals from the others (work stealing). Prefer small
+/// grains when the cost per element varies a lot.
+/// @warning 'body' is called concurrently and must be thread safe
+void parallel_for(int begin, int end, int grain,
+                  const std::function<void (int, int)>& body);
+
+/// In place exclusive prefix sum of 'values' computed in parallel: values[i]
+/// becomes the sum of the input values[0] ... values[i-1].
+/// @return the sum of every input values
+int exclusive_scan(int* values, int nb_values);
+
+}// END Thread_utils ===========================================================
+
+#endif // THREAD_UTILS_HPP__
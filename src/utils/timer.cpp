@@ -1,17 +1,18 @@
 #include "timer.hpp"
 
 void Timer::start() {
-    _boost_timer.restart();
+    _start = std::chrono::steady_clock::now();
 }
 
 double Timer::stop() {
-    _elapsed_time = _boost_timer.elapsed();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _start;
+    _elapsed_time = elapsed.count();
     return _elapsed_time;
 }
 
 void Timer::reset() {
     _elapsed_time = 0.;
-    _boost_timer.restart();
+    _start = std::chrono::steady_clock::now();
 }
 
 double Timer::get_value(){
@@ -1,12 +1,15 @@
 #pragma once
-#include <boost/timer.hpp>
+#include <chrono>
 
 typedef struct timeval tval_t;
 /** @class Timer
-    @brief boost timer wrapper class
+    @brief wall clock timer
+
+    Elapsed time is measured with a steady wall clock rather than the process
+    CPU time, so code running on several threads isn't reported as slower.
 */
 struct Timer{
-    Timer() {}
+    Timer() : _start(std::chrono::steady_clock::now()), _elapsed_time(0.) {}
     /// Restart the timer without erasing previous measured time
     /// (accessible with get_value())
     void start();
@@ -17,6 +20,6 @@ struct Timer{
     /// restart the timer and erase the previous results
     void reset();
 private:
-    boost::timer _boost_timer;
-    double       _elapsed_time;
+    std::chrono::steady_clock::time_point _start;
+    double _elapsed_time;
 };
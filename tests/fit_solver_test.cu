@@ -0,0 +1,167 @@
+/// @file fit_solver_test.cu
+/// @brief Fits the vertices of a posed skeleton with both solvers of the
+/// vertex fitting: the gradient march with a binary search refinement and the
+/// Newton steps with a secant refinement (Cuda_ctrl::_debug._raphson).
+///
+/// Vertices are sampled on the surface of each bone of the test skeleton
+/// (test_skeleton.hpp) in rest pose, where their base potential is computed.
+/// The elbow and the wrist are then bent, vertices follow their bone rigidly
+/// and are fitted back onto their base potential with
+/// Animesh_kers::match_base_potential_cpu(). The program fails if both
+/// solvers end up too far from each other, or if the Newton solver needs more
+/// potential evaluations per vertex than the bound below or than the march.
+///
+/// Without CUDA device the test is skipped: it exits with code 77, which ctest
+/// reports as skipped.
+///
+/// usage: fit_solver_test [nb_vertices_per_bone]
+
+#include "test_skeleton.hpp"
+
+#include "cuda_ctrl.hpp"
+#include "skeleton_env_evaluator.hpp"
+#include "animesh_kers.hpp"
+#include "timer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/// Step of the march and maximum number of steps, like Debug_ctrl and
+/// Animesh::nb_transform_steps
+const float step_length = 0.05f;
+const int   nb_steps    = 250;
+
+/// Maximum distance between the vertices fitted by both solvers. The march
+/// stops at most a step away from where the Newton solver stops when a
+/// vertex collides with another bone (gradient divergence).
+const float max_distance = 2.f * step_length;
+
+/// Maximum number of potential evaluations per vertex of the Newton solver
+const float max_newton_evals = 12.f;
+
+// -----------------------------------------------------------------------------
+
+struct Fit_result {
+    std::vector<Vec3_cu> verts;
+    EAnimesh::Fit_stats stats;
+    double time;
+};
+
+static Fit_result fit(Skeleton_env::Skel_id skel_id,
+                      const std::vector<Vec3_cu>& start,
+                      const std::vector<float>& base_potential,
+                      bool raphson)
+{
+    const int n = (int)start.size();
+    Fit_result res;
+    res.verts = start;
+
+    std::vector<int>     vert_to_fit( n );
+    std::vector<Vec3_cu> gradient( n );
+    std::vector<float>   smooth_iso( n, 0.f ), smooth( n, 0.f );
+    std::vector<EAnimesh::Vert_state> state( n, EAnimesh::NOT_DISPLACED );
+    for(int i = 0; i < n; ++i) vert_to_fit[i] = i;
+
+    Timer t;
+    t.start();
+    Animesh_kers::match_base_potential_cpu(skel_id, true, &(res.verts[0]), &(base_potential[0]),
+                                           &(gradient[0]), &(smooth_iso[0]), &(smooth[0]),
+                                           &(vert_to_fit[0]), n, (unsigned short)nb_steps,
+                                           0.9f/*collision threshold*/, step_length,
+                                           true/*potential pit*/, &(state[0]), 1.f,
+                                           2/*slope*/, raphson, 0, res.stats);
+    res.time = t.stop();
+    return res;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const int nb_per_bone = argc > 1 ? atoi(argv[1]) : 2000;
+    if(nb_per_bone <= 0){
+        printf("usage: %s [nb_vertices_per_bone]\n", argv[0]);
+        return 1;
+    }
+
+    int nb_devices = 0;
+    if(cudaGetDeviceCount(&nb_devices) != cudaSuccess || nb_devices == 0){
+        printf("No CUDA device, test skipped\n");
+        return 77; // SKIP_RETURN_CODE of the test in CMakeLists.txt
+    }
+
+    Cuda_ctrl::cuda_start( std::vector<Blending_env::Op_t>() );
+
+    bool ok = true;
+    {
+        Test_skeleton t = make_test_skeleton(EJoint::GC_ARC_CIRCLE_TWEAK, EJoint::MAX);
+        const Skeleton_env::Skel_id skel_id = t.skel->get_skel_id();
+
+        // Vertices on the surface of each bone in rest pose
+        std::vector<Point_cu> rest;
+        std::vector<int> vert_bone;
+        for(int b = 0; b < NB_TEST_BONES; ++b)
+        {
+            std::vector<Vec3_cu> nodes, normals;
+            ellipsoid_samples(t.bones[b]->length(), t.radius[b], nb_per_bone, nodes, normals);
+            const Transfo tr = t.bones[b]->get_world_space_matrix();
+            for(unsigned i = 0; i < nodes.size(); ++i)
+            {
+                rest.push_back( tr * nodes[i].to_point() );
+                vert_bone.push_back( b );
+            }
+        }
+        const int n = (int)rest.size();
+
+        std::vector<float> base_potential( n );
+        Skeleton_env::compute_potential_cpu(skel_id, &(rest[0]), n, &(base_potential[0]), 0);
+
+        // Bend the elbow and the wrist, vertices follow their bone rigidly
+        std::vector<Transfo> pose( NB_TEST_BONES );
+        const Transfo elbow = Transfo::rotate(Vec3_cu(2.f, 0.f, 0.f), Vec3_cu(0.f, 0.f, 1.f), 1.0f);
+        const Transfo wrist = Transfo::rotate(Vec3_cu(4.f, 0.f, 0.f), Vec3_cu(0.f, 0.f, 1.f), 0.6f);
+        pose[UPPER_ARM] = Transfo::identity();
+        pose[FOREARM]   = elbow;
+        pose[FINGER_0]  = pose[FINGER_1] = pose[FINGER_2] = elbow * wrist;
+        for(int b = 0; b < NB_TEST_BONES; ++b)
+            t.bones[b]->set_world_space_matrix( pose[b] * t.bones[b]->get_world_space_matrix() );
+        t.skel->update_bones_data();
+
+        std::vector<Vec3_cu> start( n );
+        for(int i = 0; i < n; ++i)
+            start[i] = (pose[vert_bone[i]] * rest[i]).to_vector();
+
+        const Fit_result march  = fit(skel_id, start, base_potential, false);
+        const Fit_result newton = fit(skel_id, start, base_potential, true);
+
+        double max_dist = 0., sum_dist = 0.;
+        for(int i = 0; i < n; ++i)
+        {
+            const double d = (march.verts[i] - newton.verts[i]).norm();
+            max_dist  = std::max(max_dist, d);
+            sum_dist += d;
+        }
+        const float march_evals  = (float)march. stats.nb_evals / n;
+        const float newton_evals = (float)newton.stats.nb_evals / n;
+
+        printf("%i vertices\n", n);
+        printf("march  : %6.2f evaluations per vertex, %8.3f sec\n", march_evals , march.time );
+        printf("newton : %6.2f evaluations per vertex, %8.3f sec\n", newton_evals, newton.time);
+        printf("distance between results: %g on average, %g max\n", sum_dist / n, max_dist);
+
+        if( !(max_dist <= max_distance) ){
+            printf("FAILED: the solvers are more than %g apart\n", max_distance);
+            ok = false;
+        }
+        if( newton_evals > max_newton_evals || newton_evals > march_evals ){
+            printf("FAILED: the Newton solver needs too many evaluations\n");
+            ok = false;
+        }
+    }
+
+    Cuda_ctrl::cleanup();
+    return ok ? 0 : 1;
+}
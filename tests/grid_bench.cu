@@ -0,0 +1,283 @@
+/// @file grid_bench.cu
+/// @brief Benchmark of the skeleton's acceleration structure.
+///
+/// Compares the adaptive octree Skeleton_env::Grid with the dense res^3 grid
+/// it replaced (one list of bones per cell over the whole skeleton bbox) on
+/// the arm and hand of test_skeleton.hpp. For both the build time and, per
+/// query, the number of structure lookups and of bones to evaluate are
+/// reported. Queries are spread over the bbox and over the surface of the
+/// bones, where mesh vertices lie. The octree is queried through the
+/// skeleton's own grid with Skeleton_env::fetch_grid_blending_list_offset(),
+/// like compute_potential() does. The program fails if a bone overlapping a
+/// query point is missing from its list.
+///
+/// Without CUDA device the benchmark is skipped: it exits with code 77, which ctest
+/// reports as skipped.
+///
+/// usage: grid_bench [res] [nb_queries]
+
+#include "test_skeleton.hpp"
+
+#include "cuda_ctrl.hpp"
+#include "skeleton_env.hpp"
+#include "grid.hpp"
+#include "tree.hpp"
+#include "timer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+
+using namespace Skeleton_env;
+
+/// Number of builds the build times are averaged over
+const int nb_builds = 20;
+
+// -----------------------------------------------------------------------------
+
+/// Dense grid of the skeleton before the octree: every cell of a res^3 grid
+/// over the skeleton's bbox lists the bones its overlaps.
+struct Uniform_grid {
+
+    Uniform_grid(int res) : _res(res) { }
+
+    /// @param bones : bones and their world space bbox
+    void build(const std::vector<std::pair<Bone::Id, BBox_cu> >& bones)
+    {
+        _cells.assign(_res * _res * _res, std::vector<Bone::Id>());
+        _pos = BBox_cu();
+        for(const auto& b: bones)
+            _pos = _pos.bbox_union( b.second );
+
+        // Slightly enlarge bbox to avoid being perfectly aligned with bone bbox
+        const float e = 0.00001f;
+        const Vec3_cu eps(e, e, e);
+        _pos.pmin = _pos.pmin - eps;
+        _pos.pmax = _pos.pmax + eps;
+
+        const Vec3i_cu grid_size(_res, _res, _res);
+        for(const auto& b: bones)
+        {
+            const Vec3i_cu min_idx = _pos.index_grid_cell(grid_size, b.second.pmin.to_vector()).clamp(0, _res-1);
+            const Vec3i_cu max_idx = _pos.index_grid_cell(grid_size, b.second.pmax.to_vector()).clamp(0, _res-1);
+            for(int z = min_idx.z; z <= max_idx.z; ++z)
+                for(int y = min_idx.y; y <= max_idx.y; ++y)
+                    for(int x = min_idx.x; x <= max_idx.x; ++x)
+                        _cells[(z * _res + y) * _res + x].push_back( b.first );
+        }
+    }
+
+    /// @return the bones of the cell containing 'p' or NULL outside the grid
+    const std::vector<Bone::Id>* lookup(const Point_cu& p) const
+    {
+        if( !_pos.inside(p) ) return 0;
+        const Vec3i_cu idx = _pos.index_grid_cell(Vec3i_cu(_res, _res, _res), p.to_vector()).clamp(0, _res-1);
+        return &_cells[(idx.z * _res + idx.y) * _res + idx.x];
+    }
+
+    int _res;
+    BBox_cu _pos;
+    std::vector< std::vector<Bone::Id> > _cells;
+};
+
+// -----------------------------------------------------------------------------
+
+/// Bones of the blending list the skeleton's grid gives at 'p'
+/// @param cell : cell of the previous query, see Grid_cell
+/// @param bones : the bones of the list or left empty outside the grid
+/// @return false if 'p' lies outside the grid or in an empty cell
+static bool lookup(Skel_id skel_id, const Point_cu& p, Grid_cell& cell, std::vector<Bone::Id>& bones)
+{
+    bones.clear();
+    const Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, p.to_vector(), cell);
+    if( !off_cid.is_valid() ) return false;
+
+    const int nb_pairs = fetch_grid_blending_list( off_cid ).nb_pairs;
+    for(int i = 0; i < nb_pairs*2; ++i)
+    {
+        const Cluster_cu c = fetch_grid_blending_list( off_cid + i );
+        for(int j = 0; j < c.nb_bone; ++j)
+            bones.push_back( bone_didx_to_hidx(skel_id, c.first_bone + j) );
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+struct Query_stats {
+    Query_stats() : nb_lookups(0), sum_bones(0), max_bones(0), nb_missed(0), time(0.) { }
+    long nb_lookups;
+    long sum_bones;
+    int  max_bones;
+    int  nb_missed; ///< queries missing a bone whose bbox contains them
+    double time;
+};
+
+/// @return if every bone of 'bones' whose bbox contains 'p' is in 'list'
+static bool is_conservative(const std::vector<std::pair<Bone::Id, BBox_cu> >& bones,
+                            const std::vector<Bone::Id>* list,
+                            const Point_cu& p)
+{
+    for(const auto& b: bones)
+    {
+        if( !b.second.inside(p) ) continue;
+        if( list == 0 || std::find(list->begin(), list->end(), b.first) == list->end() )
+            return false;
+    }
+    return true;
+}
+
+static void print_stats(const char* name, const Query_stats& s, int nb_queries, double build_time)
+{
+    printf("%s: build %8.3f ms, %5.2f lookups and %5.2f bones per query (%i max), %6.1f ns per query\n",
+           name, build_time * 1e3, (double)s.nb_lookups / nb_queries,
+           (double)s.sum_bones / nb_queries, s.max_bones, s.time * 1e9 / nb_queries);
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const int res        = argc > 1 ? atoi(argv[1]) : 32;
+    const int nb_queries = argc > 2 ? atoi(argv[2]) : 200000;
+    if(res <= 0 || nb_queries <= 0){
+        printf("usage: %s [res] [nb_queries]\n", argv[0]);
+        return 1;
+    }
+
+    int nb_devices = 0;
+    if(cudaGetDeviceCount(&nb_devices) != cudaSuccess || nb_devices == 0){
+        printf("No CUDA device, benchmark skipped\n");
+        return 77; // SKIP_RETURN_CODE of the test in CMakeLists.txt
+    }
+
+    Cuda_ctrl::cuda_start( std::vector<Blending_env::Op_t>() );
+
+    bool ok = true;
+    {
+        Test_skeleton t = make_test_skeleton(EJoint::MAX, EJoint::MAX);
+        const Skel_id skel_id = t.skel->get_skel_id();
+        const int nb_bones = (int)t.bones.size();
+
+        std::vector<const Bone*> bones;
+        std::map<Bone::Id, Bone::Id> parents;
+        for(int i = 0; i < nb_bones; ++i){
+            bones.push_back( t.bones[i].get() );
+            parents[t.bones[i]->get_bone_id()] = t.skel->parent( t.bones[i]->get_bone_id() );
+        }
+        const Tree tree(bones, parents);
+
+        // Bones' bboxes are computed once: the octree caches them as well
+        std::vector<std::pair<Bone::Id, BBox_cu> > bboxes;
+        BBox_cu bb;
+        for(const Bone* b: bones){
+            bboxes.push_back( std::make_pair(b->get_bone_id(), b->get_bbox()) );
+            bb = bb.bbox_union( b->get_bbox() );
+        }
+
+        // Builds. The octree rounds 'res' up to a power of two, so does the
+        // dense grid for both to have the same finest cells
+        Grid octree(&tree, res);
+        Uniform_grid uniform( octree.res() );
+
+        Timer timer;
+        timer.start();
+        for(int i = 0; i < nb_builds; ++i)
+            uniform.build( bboxes );
+        const double uniform_build = timer.stop() / nb_builds;
+
+        timer.reset();
+        timer.start();
+        for(int i = 0; i < nb_builds; ++i)
+            octree.build_grid();
+        const double octree_build = timer.stop() / nb_builds;
+
+        // The skeleton's own grid at the same resolution is the one queried
+        Skeleton_env::set_grid_res(skel_id, octree.res());
+
+        // Half the queries over the bbox, half over the surface of the bones
+        std::vector<Point_cu> queries;
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> x(bb.pmin.x, bb.pmax.x), y(bb.pmin.y, bb.pmax.y), z(bb.pmin.z, bb.pmax.z);
+        for(int i = 0; i < nb_queries / 2; ++i)
+            queries.push_back( Point_cu(x(rng), y(rng), z(rng)) );
+
+        const int nb_per_bone = std::max((nb_queries - (int)queries.size()) / std::max(nb_bones, 1), 1);
+        for(int i = 0; i < nb_bones; ++i)
+        {
+            std::vector<Vec3_cu> nodes, normals;
+            ellipsoid_samples(t.bones[i]->length(), t.radius[i], nb_per_bone, nodes, normals);
+            const Transfo tr = t.bones[i]->get_world_space_matrix();
+            for(const Vec3_cu& n: nodes)
+                queries.push_back( tr * n.to_point() );
+        }
+        const int n = (int)queries.size();
+
+        Query_stats us, os;
+        timer.reset();
+        timer.start();
+        for(const Point_cu& p: queries)
+        {
+            const std::vector<Bone::Id>* list = uniform.lookup( p );
+            us.nb_lookups++;
+            const int nb = list ? (int)list->size() : 0;
+            us.sum_bones += nb;
+            us.max_bones  = std::max(us.max_bones, nb);
+        }
+        us.time = timer.stop();
+
+        // Walks the octree like compute_potential(): a query falling in the
+        // cell of the previous one reuses its blending list
+        Grid_cell cell;
+        timer.reset();
+        timer.start();
+        for(const Point_cu& p: queries)
+        {
+            const Cluster_id off_cid = fetch_grid_blending_list_offset(skel_id, p.to_vector(), cell);
+            int nb = 0;
+            if( off_cid.is_valid() )
+            {
+                const int nb_pairs = fetch_grid_blending_list( off_cid ).nb_pairs;
+                for(int i = 0; i < nb_pairs*2; ++i)
+                    nb += fetch_grid_blending_list( off_cid + i ).nb_bone;
+            }
+            os.sum_bones += nb;
+            os.max_bones  = std::max(os.max_bones, nb);
+        }
+        os.time = timer.stop();
+        os.nb_lookups = cell.nb_lookups;
+
+        std::vector<Bone::Id> list;
+        Grid_cell check_cell;
+        for(const Point_cu& p: queries)
+        {
+            us.nb_missed += is_conservative(bboxes, uniform.lookup( p ), p) ? 0 : 1;
+            const bool inside = lookup(skel_id, p, check_cell, list);
+            os.nb_missed += is_conservative(bboxes, inside ? &list : 0, p) ? 0 : 1;
+        }
+
+        const Grid_stats gs = t.skel->get_grid_stats( queries );
+
+        printf("%i bones, %i queries, finest resolution %i\n", nb_bones, n, octree.res());
+        printf("uniform grid: %i cells\n", (int)uniform._cells.size());
+        printf("octree      : %i nodes, %i leaves, %i bone lists, depth %i\n",
+               gs.nb_nodes, gs.nb_leaves, gs.nb_lists, gs.depth);
+        print_stats("uniform grid", us, n, uniform_build);
+        print_stats("octree      ", os, n, octree_build);
+        printf("compute_potential(): %.2f bones per query on average, %i max, %i without grid\n",
+               gs.avg_bones_per_query, gs.max_bones_per_query, gs.nb_bones);
+
+        if( us.nb_missed > 0 || os.nb_missed > 0 ){
+            printf("FAILED: bones overlapping the queries are missing (%i uniform grid, %i octree)\n",
+                   us.nb_missed, os.nb_missed);
+            ok = false;
+        }
+    }
+
+    Cuda_ctrl::cleanup();
+    return ok ? 0 : 1;
+}
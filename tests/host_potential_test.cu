@@ -0,0 +1,129 @@
+/// @file host_potential_test.cu
+/// @brief Compares the CPU evaluation of a skeleton's potential
+/// (Skeleton_env::compute_potential_cpu()) with the CUDA one.
+///
+/// The test skeleton (test_skeleton.hpp) has a cluster of three fingers, so
+/// the cluster operator is evaluated on both sides, along with every joint
+/// blending type at the elbow and at the wrist. Points are spread over the
+/// skeleton's bounding box and along the bones, where blending happens. The
+/// program fails if both potentials differ by more than the interpolation
+/// rounding of the operators' textures.
+///
+/// Without CUDA device the test is skipped: it exits with code 77, which ctest
+/// reports as skipped.
+///
+/// usage: host_potential_test [nb_random_points]
+
+#include "test_skeleton.hpp"
+
+#include "cuda_ctrl.hpp"
+#include "skeleton_env_evaluator.hpp"
+#include "animesh_kers.hpp"
+#include "cuda_utils.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+/// Maximum difference between the host and device potentials (potentials are
+/// in [0, 1])
+const float max_error = 1e-3f;
+
+// -----------------------------------------------------------------------------
+
+static std::vector<Point_cu> make_points(int nb_random)
+{
+    std::vector<Point_cu> points;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> x(-1.f, 6.f), y(-1.5f, 1.5f), z(-0.8f, 0.8f);
+    for(int i = 0; i < nb_random; ++i)
+        points.push_back( Point_cu(x(rng), y(rng), z(rng)) );
+
+    // Around the axis of the arm and at the wrist, where the fingers blend
+    std::uniform_real_distribution<float> offset(-0.4f, 0.4f);
+    for(int i = 0; i <= 200; ++i){
+        const float t = 5.5f * i / 200.f;
+        points.push_back( Point_cu(t, offset(rng), offset(rng)) );
+    }
+    for(int i = 0; i < 200; ++i)
+        points.push_back( Point_cu(4.f + offset(rng), offset(rng), 0.5f * offset(rng)) );
+    return points;
+}
+
+// -----------------------------------------------------------------------------
+
+/// @return if the host and device potentials match for the given blending
+static bool compare(EJoint::Joint_t elbow, EJoint::Joint_t wrist, const std::vector<Point_cu>& points)
+{
+    static const char* names[EJoint::NB_JOINT_T] = { "arc of circle", "max", "bulge" };
+
+    Test_skeleton t = make_test_skeleton(elbow, wrist);
+    const Skeleton_env::Skel_id skel_id = t.skel->get_skel_id();
+    const int n = (int)points.size();
+
+    std::vector<float> f_host( n );
+    Skeleton_env::compute_potential_cpu(skel_id, &(points[0]), n, &(f_host[0]), 0);
+
+    Cuda_utils::Device::Array<Point_cu> d_points( n );
+    Cuda_utils::Device::Array<float>    d_f( n );
+    d_points.copy_from( points );
+    const int block_size = 256;
+    Animesh_kers::compute_base_potential<<<(n + block_size - 1) / block_size, block_size>>>
+        (skel_id, d_points.ptr(), n, d_f.ptr());
+    CUDA_CHECK_ERRORS();
+    const std::vector<float> f_device = d_f.to_host_vector();
+
+    float err = 0.f;
+    int worst = 0, nb_blended = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        const float e = std::abs(f_host[i] - f_device[i]);
+        if(e > err || e != e){ err = e; worst = i; }
+        if(f_device[i] > 0.f && f_device[i] < 1.f) nb_blended++;
+    }
+
+    const bool ok = err <= max_error;
+    printf("elbow %-13s wrist %-13s %i points (%i in the blending), max difference %g %s\n",
+           names[elbow], names[wrist], n, nb_blended, err, ok ? "" : "FAILED");
+    if(!ok){
+        const Point_cu p = points[worst];
+        printf("    at (%g, %g, %g): host %g device %g\n", p.x, p.y, p.z, f_host[worst], f_device[worst]);
+    }
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const int nb_random = argc > 1 ? atoi(argv[1]) : 5000;
+    if(nb_random < 0){
+        printf("usage: %s [nb_random_points]\n", argv[0]);
+        return 1;
+    }
+
+    int nb_devices = 0;
+    if(cudaGetDeviceCount(&nb_devices) != cudaSuccess || nb_devices == 0){
+        printf("No CUDA device, test skipped\n");
+        return 77; // SKIP_RETURN_CODE of the test in CMakeLists.txt
+    }
+
+    Cuda_ctrl::cuda_start( std::vector<Blending_env::Op_t>() );
+
+    const std::vector<Point_cu> points = make_points(nb_random);
+    bool ok = true;
+    for(int elbow = 0; elbow < EJoint::NB_JOINT_T; ++elbow)
+        for(int wrist = 0; wrist < EJoint::NB_JOINT_T; ++wrist)
+            ok = compare((EJoint::Joint_t)elbow, (EJoint::Joint_t)wrist, points) && ok;
+
+    Cuda_ctrl::cleanup();
+
+    if(!ok){
+        printf("FAILED: host and device potentials differ\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,333 @@
+/// @file host_tex_test.cu
+/// @brief Compares the host sampling of Blending_env's tables (Host_tex) with
+/// CUDA texture lookups.
+///
+/// Host evaluation samples host copies of the arrays bound to the textures
+/// (see Blending_env and Host_tex). This program binds its own textures to the
+/// device arrays of the controllers, the global controller, the profiles, the
+/// 3D operators atlas and the 4D bulge block, then fetches every table on both
+/// sides with the same coordinates: element centers, fractions, both edges and
+/// coordinates out of the array to test the clamping. Two small random arrays
+/// check edges whose values differ. The program fails if a lookup differs by
+/// more than the rounding of the interpolation.
+///
+/// Without CUDA device the test is skipped: it exits with code 77, which ctest
+/// reports as skipped.
+///
+/// usage: host_tex_test [nb_random_coords_per_table]
+
+#include "cuda_ctrl.hpp"
+#include "blending_env.hpp"
+#include "controller.hpp"
+#include "host_tex.hpp"
+#include "cuda_utils.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+/// Maximum difference between a host and a device lookup, relative to the
+/// largest value of the table
+const float max_relative_error = 1e-5f;
+
+// -----------------------------------------------------------------------------
+
+/// Tables compared, see fetch_device() and fetch_host()
+enum Table {
+    CONTROLLERS = 0,
+    GLOBAL_CONTROLLER,
+    HYPERBOLA,
+    HYPERBOLA_NORMALS,
+    PAN_HYPERBOLA,
+    OPERATORS_VALUES,
+    OPERATORS_GRADS,
+    BULGE_4D_VALUES,
+    BULGE_4D_GRADS,
+    RANDOM_2D,
+    RANDOM_3D,
+    NB_TABLES
+};
+
+static const char* table_names[NB_TABLES] = {
+    "controllers",
+    "global controller",
+    "hyperbola profile",
+    "hyperbola normals",
+    "opening hyperbola",
+    "operators values",
+    "operators gradients",
+    "4D bulge values",
+    "4D bulge gradients",
+    "random 2D",
+    "random 3D"
+};
+
+texture<float2, 2, cudaReadModeElementType> controllers_tex;
+texture<float2, 1, cudaReadModeElementType> global_controller_tex;
+texture<float , 1, cudaReadModeElementType> hyperbola_tex;
+texture<float2, 1, cudaReadModeElementType> hyperbola_normals_tex;
+texture<float , 1, cudaReadModeElementType> pan_hyperbola_tex;
+texture<float , 3, cudaReadModeElementType> operators_values_tex;
+texture<float2, 3, cudaReadModeElementType> operators_grads_tex;
+texture<float , 3, cudaReadModeElementType> bulge_4D_values_tex;
+texture<float2, 3, cudaReadModeElementType> bulge_4D_grads_tex;
+texture<float2, 2, cudaReadModeElementType> random_2D_tex;
+texture<float , 3, cudaReadModeElementType> random_3D_tex;
+
+// -----------------------------------------------------------------------------
+
+/// Linear filtering and clamp addressing, like Blending_env::bind()
+template<class T, int dim>
+static void bind(texture<T, dim, cudaReadModeElementType>& tex, const cudaArray* array, bool normalized = false)
+{
+    tex.normalized = normalized;
+    tex.addressMode[0] = cudaAddressModeClamp;
+    tex.addressMode[1] = cudaAddressModeClamp;
+    tex.addressMode[2] = cudaAddressModeClamp;
+    tex.filterMode = cudaFilterModeLinear;
+    CUDA_SAFE_CALL(cudaBindTextureToArray(tex, array));
+}
+
+// -----------------------------------------------------------------------------
+
+__device__ static float2 fetch_device(Table t, float3 c)
+{
+    switch(t){
+    case CONTROLLERS:       return tex2D(controllers_tex, c.x, c.y);
+    case GLOBAL_CONTROLLER: return tex1D(global_controller_tex, c.x);
+    case HYPERBOLA:         return make_float2(tex1D(hyperbola_tex, c.x), 0.f);
+    case HYPERBOLA_NORMALS: return tex1D(hyperbola_normals_tex, c.x);
+    case PAN_HYPERBOLA:     return make_float2(tex1D(pan_hyperbola_tex, c.x), 0.f);
+    case OPERATORS_VALUES:  return make_float2(tex3D(operators_values_tex, c.x, c.y, c.z), 0.f);
+    case OPERATORS_GRADS:   return tex3D(operators_grads_tex, c.x, c.y, c.z);
+    case BULGE_4D_VALUES:   return make_float2(tex3D(bulge_4D_values_tex, c.x, c.y, c.z), 0.f);
+    case BULGE_4D_GRADS:    return tex3D(bulge_4D_grads_tex, c.x, c.y, c.z);
+    case RANDOM_2D:         return tex2D(random_2D_tex, c.x, c.y);
+    case RANDOM_3D:         return make_float2(tex3D(random_3D_tex, c.x, c.y, c.z), 0.f);
+    default:                return make_float2(0.f, 0.f);
+    }
+}
+
+__global__ static void fetch_kernel(Table t, const float3* coords, float2* res, int n)
+{
+    const int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if(i < n) res[i] = fetch_device(t, coords[i]);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Host copies of the random arrays
+static Cuda_utils::HA_float2 h_random_2D;
+static Cuda_utils::HA_float  h_random_3D;
+static const int2 random_2D_size = {5, 3};
+static const int3 random_3D_size = {4, 3, 2};
+
+static float2 to_float2(float v){ return make_float2(v, 0.f); }
+static float2 to_float2(float2 v){ return v; }
+
+/// Same lookup as fetch_device() with the host copies.
+/// @param c : unnormalized coordinates
+static float2 fetch_host(Table t, float3 c)
+{
+    using namespace Blending_env;
+    const Vec3i_cu s = grid_operators_values->size();
+    const int3 op_size = make_int3(s.x, s.y, s.z);
+    switch(t){
+    case CONTROLLERS:       return Host_tex::fetch_2D(h_controllers.ptr(), h_controllers_size, c.x, c.y);
+    case GLOBAL_CONTROLLER: return Host_tex::fetch_1D(h_global_controller.ptr(), NB_SAMPLES, c.x);
+    case HYPERBOLA:         return to_float2(Host_tex::fetch_1D(h_hyperbola_profile, NB_SAMPLES, c.x));
+    case HYPERBOLA_NORMALS: return Host_tex::fetch_1D(h_hyperbola_normals_profile, NB_SAMPLES, c.x);
+    case PAN_HYPERBOLA:     return to_float2(Host_tex::fetch_1D(pan_hyperbola, NB_SAMPLES, c.x));
+    case OPERATORS_VALUES:  return to_float2(Host_tex::fetch_3D(grid_operators_values->get_vals().data(), op_size, c.x, c.y, c.z));
+    case OPERATORS_GRADS:   return Host_tex::fetch_3D(grid_operators_grads->get_vals().data(), op_size, c.x, c.y, c.z);
+    case BULGE_4D_VALUES:   return to_float2(Host_tex::fetch_3D(h_block_3D_bulge.ptr(), h_block_3D_bulge_size, c.x, c.y, c.z));
+    case BULGE_4D_GRADS:    return Host_tex::fetch_3D(h_block_3D_bulge_gradient.ptr(), h_block_3D_bulge_size, c.x, c.y, c.z);
+    case RANDOM_2D:         return Host_tex::fetch_2D(h_random_2D.ptr(), random_2D_size, c.x, c.y);
+    case RANDOM_3D:         return to_float2(Host_tex::fetch_3D(h_random_3D.ptr(), random_3D_size, c.x, c.y, c.z));
+    default:                return make_float2(0.f, 0.f);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Size of the array sampled by a table, 1 along the unused dimensions
+static int3 table_size(Table t)
+{
+    using namespace Blending_env;
+    const Vec3i_cu s = grid_operators_values->size();
+    switch(t){
+    case CONTROLLERS:       return make_int3(h_controllers_size.x, h_controllers_size.y, 1);
+    case OPERATORS_VALUES:
+    case OPERATORS_GRADS:   return make_int3(s.x, s.y, s.z);
+    case BULGE_4D_VALUES:
+    case BULGE_4D_GRADS:    return h_block_3D_bulge_size;
+    case RANDOM_2D:         return make_int3(random_2D_size.x, random_2D_size.y, 1);
+    case RANDOM_3D:         return random_3D_size;
+    default:                return make_int3(NB_SAMPLES, 1, 1);
+    }
+}
+
+/// Largest absolute value of a table, scales the tolerance
+static float table_max(Table t)
+{
+    const int3 s = table_size(t);
+    float m = 0.f;
+    for(int z = 0; z < s.z; ++z)
+        for(int y = 0; y < s.y; ++y)
+            for(int x = 0; x < s.x; ++x){
+                const float2 v = fetch_host(t, make_float3(x + 0.5f, y + 0.5f, z + 0.5f));
+                m = std::max(m, std::max(std::abs(v.x), std::abs(v.y)));
+            }
+    return m;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Coordinates along an axis of 'size' elements: out of the array on both
+/// sides, edges, element centers and fractions in between
+static std::vector<float> axis_coords(int size)
+{
+    const float s = (float)size;
+    const float c[] = { -3.7f, -0.5f, 0.f, 0.25f, 0.5f, 0.75f, 1.f, 1.5f, 1.3f,
+                        s*0.5f + 0.1f, s - 1.5f, s - 0.75f, s - 0.5f, s - 0.25f,
+                        s, s + 0.5f, s + 4.2f };
+    return std::vector<float>(c, c + sizeof(c) / sizeof(float));
+}
+
+static std::vector<float3> make_coords(Table t, int nb_random, std::mt19937& rng)
+{
+    const int3 s = table_size(t);
+    const std::vector<float> cx = axis_coords(s.x);
+    const std::vector<float> cy = s.y > 1 ? axis_coords(s.y) : std::vector<float>(1, 0.5f);
+    const std::vector<float> cz = s.z > 1 ? axis_coords(s.z) : std::vector<float>(1, 0.5f);
+
+    std::vector<float3> coords;
+    for(unsigned z = 0; z < cz.size(); ++z)
+        for(unsigned y = 0; y < cy.size(); ++y)
+            for(unsigned x = 0; x < cx.size(); ++x)
+                coords.push_back( make_float3(cx[x], cy[y], cz[z]) );
+
+    std::uniform_real_distribution<float> unit(-0.02f, 1.02f);
+    for(int i = 0; i < nb_random; ++i)
+        coords.push_back( make_float3(unit(rng) * s.x, unit(rng) * s.y, unit(rng) * s.z) );
+    return coords;
+}
+
+// -----------------------------------------------------------------------------
+
+/// @return if the host and device lookups of the table 't' match
+static bool compare(Table t, int nb_random, std::mt19937& rng)
+{
+    const std::vector<float3> coords = make_coords(t, nb_random, rng);
+    const int n = (int)coords.size();
+
+    // The global controller texture uses normalized coordinates
+    std::vector<float3> d_coords_h( coords );
+    if( t == GLOBAL_CONTROLLER )
+        for(int i = 0; i < n; ++i) d_coords_h[i].x /= NB_SAMPLES;
+
+    float3* d_coords = 0;
+    float2* d_res    = 0;
+    Cuda_utils::malloc_d(d_coords, n);
+    Cuda_utils::malloc_d(d_res   , n);
+    Cuda_utils::mem_cpy_htd(d_coords, &(d_coords_h[0]), n);
+    const int block_size = 256;
+    fetch_kernel<<<(n + block_size - 1) / block_size, block_size>>>(t, d_coords, d_res, n);
+    CUDA_CHECK_ERRORS();
+    std::vector<float2> res(n);
+    Cuda_utils::mem_cpy_dth(&(res[0]), d_res, n);
+    Cuda_utils::free_d(d_coords);
+    Cuda_utils::free_d(d_res);
+
+    const float tol = max_relative_error * std::max(1.f, table_max(t));
+    float max_err = 0.f;
+    int worst = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        const float2 h = fetch_host(t, coords[i]);
+        const float err = std::max(std::abs(h.x - res[i].x), std::abs(h.y - res[i].y));
+        if(err > max_err || err != err){ max_err = err; worst = i; }
+    }
+
+    const bool ok = max_err <= tol;
+    printf("%-20s %6i lookups, max difference %g %s\n", table_names[t], n, max_err, ok ? "" : "FAILED");
+    if(!ok){
+        const float3 c = coords[worst];
+        const float2 h = fetch_host(t, c);
+        printf("    at (%g, %g, %g): host (%g, %g) device (%g, %g)\n",
+               c.x, c.y, c.z, h.x, h.y, res[worst].x, res[worst].y);
+    }
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const int nb_random = argc > 1 ? atoi(argv[1]) : 2000;
+    if(nb_random < 0){
+        printf("usage: %s [nb_random_coords_per_table]\n", argv[0]);
+        return 1;
+    }
+
+    int nb_devices = 0;
+    if(cudaGetDeviceCount(&nb_devices) != cudaSuccess || nb_devices == 0){
+        printf("No CUDA device, test skipped\n");
+        return 77; // SKIP_RETURN_CODE of the test in CMakeLists.txt
+    }
+
+    Cuda_ctrl::cuda_start( std::vector<Blending_env::Op_t>() );
+    Blending_env::load_predefined_operator( Blending_env::B_OH_4D );
+
+    // Controllers: some are uploaded entirely, then one is changed so that
+    // only its grid is sent again
+    std::vector<Blending_env::Ctrl_id> ctrls;
+    for(int i = 0; i < 5; ++i){
+        ctrls.push_back( Blending_env::new_ctrl_instance() );
+        Blending_env::update_controller(ctrls.back(), i % 2 ? IBL::Shape::finger() : IBL::Shape::caml());
+    }
+    Blending_env::update_controllers_in_device();
+    Blending_env::update_controller(ctrls[2], IBL::Shape::elbow());
+    Blending_env::update_controllers_in_device();
+
+    // Random arrays
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> val(-1.f, 1.f);
+    h_random_2D.malloc(random_2D_size.x * random_2D_size.y);
+    for(int i = 0; i < h_random_2D.size(); ++i) h_random_2D[i] = make_float2(val(rng), val(rng));
+    h_random_3D.malloc(random_3D_size.x * random_3D_size.y * random_3D_size.z);
+    for(int i = 0; i < h_random_3D.size(); ++i) h_random_3D[i] = val(rng);
+    Cuda_utils::Device::CuArray<float2> d_random_2D(random_2D_size.x, random_2D_size.y);
+    Cuda_utils::Device::CuArray<float>  d_random_3D(random_3D_size.x, random_3D_size.y, random_3D_size.z);
+    d_random_2D.copy_from( h_random_2D );
+    d_random_3D.copy_from( h_random_3D );
+
+    bind(controllers_tex      , Blending_env::d_controllers);
+    bind(global_controller_tex, Blending_env::d_global_controller, true);
+    bind(hyperbola_tex        , Blending_env::d_hyperbola_profile);
+    bind(hyperbola_normals_tex, Blending_env::d_hyperbola_normals_profile);
+    bind(pan_hyperbola_tex    , Blending_env::d_pan_hyperbola);
+    bind(operators_values_tex , Blending_env::d_operators_values);
+    bind(operators_grads_tex  , Blending_env::d_operators_grads);
+    bind(bulge_4D_values_tex  , Blending_env::d_block_3D_bulge.getCudaArray());
+    bind(bulge_4D_grads_tex   , Blending_env::d_block_3D_bulge_gradient.getCudaArray());
+    bind(random_2D_tex        , d_random_2D.getCudaArray());
+    bind(random_3D_tex        , d_random_3D.getCudaArray());
+
+    bool ok = true;
+    for(int t = 0; t < NB_TABLES; ++t)
+        ok = compare((Table)t, nb_random, rng) && ok;
+
+    d_random_2D.erase();
+    d_random_3D.erase();
+    Cuda_ctrl::cleanup();
+
+    if(!ok){
+        printf("FAILED: host and device lookups differ\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+/// @file hrbf_fit_bench.cpp
+/// @brief Benchmark of the HRBF fit of many bones.
+///
+/// Compares the batched fit HermiteRBF::init_coeffs_batch() relies on
+/// (HRBF_wrapper::hermite_fit_batch(): LU of each system, bones solved in
+/// parallel) with the dense LU solve of the whole hermite system, one bone
+/// after the other as before the batch. Both factorize the same matrix in
+/// single precision, the speedup comes from the threads only. The potential of
+/// both fits is compared around the samples, the program fails if they differ.
+///
+/// usage: hrbf_fit_bench [nb_bones] [nb_samples_per_bone]
+
+#include "hrbf_wrapper.hpp"
+#include "hrbf_core.hpp"
+#include "thread_utils.hpp"
+#include "timer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+using namespace HRBF_wrapper;
+
+/// Same solver as the batch (hermite_fit() without factorization)
+typedef HRBF_fit<float, 3, PHI_TYPE> HRBF_3f;
+typedef HRBF_3f::Vector   Vector;
+typedef HRBF_3f::MatrixXX MatrixXX;
+typedef HRBF_3f::VectorX  VectorX;
+
+/// Maximum difference between the potentials of both fits, relative to the
+/// largest potential around the samples
+const double max_relative_error = 1e-3;
+
+// -----------------------------------------------------------------------------
+
+/// Samples of a bone: points spread over an ellipsoid with its normals, like
+/// the samples of a limb
+struct Bone_samples {
+    std::vector<Vec3_cu> points;
+    std::vector<Vec3_cu> normals;
+    Vec3_cu radius;
+};
+
+static Bone_samples make_bone(int nb_samples, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    Bone_samples bone;
+    bone.radius = Vec3_cu(1.f + 2.f * unit(rng), 0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng));
+
+    // Fibonacci sphere, jittered so that bones don't share the same layout
+    const float golden = 3.14159265f * (3.f - std::sqrt(5.f));
+    for(int i = 0; i < nb_samples; ++i)
+    {
+        const float z   = 1.f - 2.f * (i + 0.25f + 0.5f * unit(rng)) / nb_samples;
+        const float r   = std::sqrt(std::max(0.f, 1.f - z*z));
+        const float phi = golden * i;
+        const Vec3_cu s(r * std::cos(phi), r * std::sin(phi), z);
+        const Vec3_cu p(s.x * bone.radius.x, s.y * bone.radius.y, s.z * bone.radius.z);
+        const Vec3_cu n(p.x / (bone.radius.x * bone.radius.x),
+                        p.y / (bone.radius.y * bone.radius.y),
+                        p.z / (bone.radius.z * bone.radius.z));
+        bone.points. push_back( p );
+        bone.normals.push_back( n.normalized() );
+    }
+    return bone;
+}
+
+// -----------------------------------------------------------------------------
+
+/// The fit before the batch: the whole non symmetric hermite system is
+/// assembled and solved with a LU factorization
+static void dense_lu_fit(const Bone_samples& bone, HRBF_3f& hrbf)
+{
+    const int nb = (int)bone.points.size();
+    std::vector<Vector> points(nb), normals(nb);
+    for(int i = 0; i < nb; ++i) {
+        points [i] = Vector(bone.points [i].x, bone.points [i].y, bone.points [i].z);
+        normals[i] = Vector(bone.normals[i].x, bone.normals[i].y, bone.normals[i].z);
+    }
+
+    MatrixXX D(4 * nb, 4 * nb);
+    VectorX  f(4 * nb);
+    for(int i = 0; i < nb; ++i)
+    {
+        f(4*i) = 0;
+        f.segment<3>(4*i + 1) = normals[i];
+        for(int j = 0; j < nb; ++j)
+            D.block<4,4>(4*i, 4*j) = HRBF_3f::hermite_block(points[i] - points[j]);
+    }
+    VectorX x = D.lu().solve(f);
+
+    hrbf._node_centers.resize(3, nb);
+    hrbf._alphas.      resize(nb);
+    hrbf._betas.       resize(3, nb);
+    for(int i = 0; i < nb; ++i) {
+        hrbf._node_centers.col(i) = points[i];
+        hrbf._alphas(i)           = x(4*i);
+        hrbf._betas.col(i)        = x.segment<3>(4*i + 1);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+static void to_hrbf(const HRBF_coeffs& coeffs, HRBF_3f& hrbf)
+{
+    hrbf._node_centers.resize(3, coeffs.size);
+    hrbf._alphas.      resize(coeffs.size);
+    hrbf._betas.       resize(3, coeffs.size);
+    for(int i = 0; i < coeffs.size; ++i) {
+        const Vec3_cu c = coeffs.nodeCenters[i];
+        const Vec3_cu b = coeffs.betas[i];
+        hrbf._node_centers.col(i) = Vector(c.x, c.y, c.z);
+        hrbf._alphas(i)           = coeffs.alphas[i];
+        hrbf._betas.col(i)        = Vector(b.x, b.y, b.z);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const int nb_bones   = argc > 1 ? atoi(argv[1]) : 64;
+    const int nb_samples = argc > 2 ? atoi(argv[2]) : 100;
+    if(nb_bones <= 0 || nb_samples <= 0){
+        printf("usage: %s [nb_bones] [nb_samples_per_bone]\n", argv[0]);
+        return 1;
+    }
+
+    // Bones have between half and one and a half times 'nb_samples' samples
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> nb_dist(std::max(nb_samples / 2, 1), nb_samples + nb_samples / 2);
+    std::vector<Bone_samples> bones;
+    int total_samples = 0;
+    for(int i = 0; i < nb_bones; ++i) {
+        bones.push_back( make_bone(nb_dist(rng), rng) );
+        total_samples += (int)bones.back().points.size();
+    }
+
+    // Batched fit
+    std::vector<HRBF_coeffs>  coeffs(nb_bones);
+    std::vector<HRBF_fit_job> jobs  (nb_bones);
+    for(int i = 0; i < nb_bones; ++i) {
+        jobs[i].points  = &(bones[i].points [0]);
+        jobs[i].normals = &(bones[i].normals[0]);
+        jobs[i].size    = (int)bones[i].points.size();
+        jobs[i].res     = &(coeffs[i]);
+    }
+    Timer t;
+    t.start();
+    hermite_fit_batch( jobs );
+    const double batch_time = t.stop();
+
+    // Same LU, bone after bone
+    std::vector<HRBF_3f> ref(nb_bones);
+    t.reset();
+    t.start();
+    for(int i = 0; i < nb_bones; ++i)
+        dense_lu_fit(bones[i], ref[i]);
+    const double lu_time = t.stop();
+
+    // Compare the potentials on both sides of the samples
+    double max_err = 0., max_pot = 0.;
+    for(int i = 0; i < nb_bones; ++i)
+    {
+        HRBF_3f fit;
+        to_hrbf(coeffs[i], fit);
+        const Bone_samples& bone = bones[i];
+        const float offset = 0.2f * std::min(bone.radius.y, bone.radius.z);
+        for(unsigned j = 0; j < bone.points.size(); ++j)
+        {
+            for(int side = -1; side <= 1; ++side)
+            {
+                const Vec3_cu p = bone.points[j] + bone.normals[j] * (offset * side);
+                const Vector  x(p.x, p.y, p.z);
+                const double  f_ref = ref[i].eval(x);
+                max_pot = std::max(max_pot, std::abs(f_ref));
+                max_err = std::max(max_err, std::abs(fit.eval(x) - f_ref));
+            }
+        }
+    }
+    const double rel_err = max_err / (max_pot > 0. ? max_pot : 1.);
+
+    printf("%i bones, %i samples, %i threads\n", nb_bones, total_samples, Thread_utils::nb_threads());
+    printf("serial   : %8.3f sec\n", lu_time);
+    printf("batch    : %8.3f sec (x%.1f)\n", batch_time, lu_time / std::max(batch_time, 1e-9));
+    printf("max potential difference: %g (%g relative)\n", max_err, rel_err);
+
+    if( !(rel_err <= max_relative_error) ){
+        printf("FAILED: the batched fit differs from the dense LU solve\n");
+        return 1;
+    }
+    return 0;
+}
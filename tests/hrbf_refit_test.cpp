@@ -0,0 +1,164 @@
+/// @file hrbf_refit_test.cpp
+/// @brief Low rank refit of an HRBF against a full fit.
+///
+/// Fits the samples of a bone keeping the factorization, edits a few of them
+/// the way HRBF_env::apply_edits() does (moves, new normals, deletions) and
+/// refits with HRBF_wrapper::hermite_refit(). The potential of the refit is
+/// compared around the samples with a full hermite_fit() of the edited
+/// samples, the program fails if they differ or if the factorization was not
+/// reused.
+///
+/// usage: hrbf_refit_test [nb_samples] [nb_edits]
+
+#include "hrbf_wrapper.hpp"
+#include "hrbf_core.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+using namespace HRBF_wrapper;
+
+typedef HRBF_fit<double, 3, PHI_TYPE_FIT> HRBF_3d;
+typedef HRBF_3d::Vector Vector;
+
+/// Maximum difference between the potentials of both fits, relative to the
+/// largest potential around the samples
+const double max_relative_error = 1e-4;
+
+// -----------------------------------------------------------------------------
+
+/// Points spread over an ellipsoid of radii 'radius' with their normals
+static void ellipsoid_samples(int nb_samples,
+                              const Vec3_cu& radius,
+                              std::vector<Vec3_cu>& points,
+                              std::vector<Vec3_cu>& normals)
+{
+    const float golden = 3.14159265f * (3.f - std::sqrt(5.f));
+    for(int i = 0; i < nb_samples; ++i)
+    {
+        const float z   = 1.f - 2.f * (i + 0.5f) / nb_samples;
+        const float r   = std::sqrt(std::max(0.f, 1.f - z*z));
+        const float phi = golden * i;
+        const Vec3_cu p(r * std::cos(phi) * radius.x, r * std::sin(phi) * radius.y, z * radius.z);
+        const Vec3_cu n(p.x / (radius.x * radius.x),
+                        p.y / (radius.y * radius.y),
+                        p.z / (radius.z * radius.z));
+        points. push_back( p );
+        normals.push_back( n.normalized() );
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+static void to_hrbf(const HRBF_coeffs& coeffs, HRBF_3d& hrbf)
+{
+    hrbf._node_centers.resize(3, coeffs.size);
+    hrbf._alphas.      resize(coeffs.size);
+    hrbf._betas.       resize(3, coeffs.size);
+    for(int i = 0; i < coeffs.size; ++i) {
+        const Vec3_cu c = coeffs.nodeCenters[i];
+        const Vec3_cu b = coeffs.betas[i];
+        hrbf._node_centers.col(i) = Vector(c.x, c.y, c.z);
+        hrbf._alphas(i)           = coeffs.alphas[i];
+        hrbf._betas.col(i)        = Vector(b.x, b.y, b.z);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const int nb_samples = argc > 1 ? atoi(argv[1]) : 300;
+    const int nb_edits   = argc > 2 ? atoi(argv[2]) : 6;
+    // Moved and deleted samples must stay under the ratio hermite_refit()
+    // accepts
+    if(nb_samples <= 0 || nb_edits < 0 || 2 * nb_edits * HRBF_3d::REFIT_RATIO > nb_samples){
+        printf("usage: %s [nb_samples] [nb_edits]\n", argv[0]);
+        return 1;
+    }
+
+    const Vec3_cu radius(2.f, 0.7f, 0.6f);
+    std::vector<Vec3_cu> points, normals;
+    ellipsoid_samples(nb_samples, radius, points, normals);
+
+    // Fit keeping the factorization
+    HRBF_factor* fact = new_factor();
+    HRBF_coeffs coeffs;
+    hermite_fit(&(points[0]), &(normals[0]), nb_samples, coeffs, fact);
+
+    // Move 'nb_edits' samples, turn the normal of 'nb_edits' others and
+    // delete 'nb_edits' more. The remaining samples keep their order.
+    std::mt19937 rng(1234);
+    std::vector<int> order(nb_samples);
+    for(int i = 0; i < nb_samples; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::normal_distribution<float> noise(0.f, 0.05f);
+    std::vector<bool> deleted(nb_samples, false);
+    for(int e = 0; e < nb_edits; ++e)
+    {
+        const int moved  = order[e];
+        const int turned = order[nb_edits + e];
+        points [moved]  = points[moved] + normals[moved] * (0.1f + noise(rng));
+        normals[turned] = (normals[turned] + Vec3_cu(noise(rng), noise(rng), noise(rng))).normalized();
+        deleted[ order[2*nb_edits + e] ] = true;
+    }
+
+    std::vector<Vec3_cu> edit_points, edit_normals;
+    std::vector<int> origin;
+    for(int i = 0; i < nb_samples; ++i)
+    {
+        if( deleted[i] ) continue;
+        edit_points. push_back( points [i] );
+        edit_normals.push_back( normals[i] );
+        origin.      push_back( i );
+    }
+    const int nb_edited = (int)edit_points.size();
+
+    // Low rank refit against a full fit of the edited samples
+    HRBF_coeffs refit_coeffs, full_coeffs;
+    const bool reused = hermite_refit(&(edit_points[0]), &(edit_normals[0]), &(origin[0]),
+                                      nb_edited, refit_coeffs, fact);
+    HRBF_factor* full_fact = new_factor();
+    hermite_fit(&(edit_points[0]), &(edit_normals[0]), nb_edited, full_coeffs, full_fact);
+    delete_factor( fact );
+    delete_factor( full_fact );
+
+    HRBF_3d refit, full;
+    to_hrbf(refit_coeffs, refit);
+    to_hrbf(full_coeffs,  full );
+
+    // Compare the potentials on both sides of the samples
+    const float offset = 0.2f * std::min(radius.y, radius.z);
+    double max_err = 0., max_pot = 0.;
+    for(int i = 0; i < nb_edited; ++i)
+    {
+        for(int side = -1; side <= 1; ++side)
+        {
+            const Vec3_cu p = edit_points[i] + edit_normals[i] * (offset * side);
+            const Vector  x(p.x, p.y, p.z);
+            const double  f_ref = full.eval(x);
+            max_pot = std::max(max_pot, std::abs(f_ref));
+            max_err = std::max(max_err, std::abs(refit.eval(x) - f_ref));
+        }
+    }
+    const double rel_err = max_err / (max_pot > 0. ? max_pot : 1.);
+
+    printf("%i samples, %i moved, %i normals, %i deleted\n", nb_samples, nb_edits, nb_edits, nb_edits);
+    printf("factorization reused: %s\n", reused ? "yes" : "no");
+    printf("max potential difference: %g (%g relative)\n", max_err, rel_err);
+
+    if( !reused ){
+        printf("FAILED: the refit fell back on a full fit\n");
+        return 1;
+    }
+    if( !(rel_err <= max_relative_error) ){
+        printf("FAILED: the refit differs from the full fit\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef TEST_SKELETON_HPP__
+#define TEST_SKELETON_HPP__
+
+/// @file test_skeleton.hpp
+/// @brief Analytic skeleton shared by the tests: an arm made of two bones
+/// and a hand of three fingers. The fingers have the same parent so they form
+/// a cluster of three bones (see Skeleton_env). Each bone is an HRBF fitted on
+/// an ellipsoid around it.
+
+#include "skeleton.hpp"
+#include "bone.hpp"
+#include "controller.hpp"
+
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/// Bones of the test skeleton, in the order given to Skeleton
+enum Test_bone {
+    UPPER_ARM = 0,
+    FOREARM,
+    FINGER_0,
+    FINGER_1,
+    FINGER_2,
+    NB_TEST_BONES
+};
+
+struct Test_skeleton {
+    std::vector< std::shared_ptr<Bone> > bones;
+    /// Radius of the ellipsoid each bone is fitted on
+    std::vector<float> radius;
+    std::shared_ptr<Skeleton> skel;
+
+    Bone::Id id(Test_bone b) const { return bones[b]->get_bone_id(); }
+};
+
+// -----------------------------------------------------------------------------
+
+/// Samples over an ellipsoid around the segment [0, length] of the x axis
+/// (object space of a bone)
+static void ellipsoid_samples(float length, float radius, int nb_samples,
+                              std::vector<Vec3_cu>& nodes,
+                              std::vector<Vec3_cu>& normals)
+{
+    const Vec3_cu r(length * 0.5f + radius, radius, radius);
+    const float golden = 3.14159265f * (3.f - std::sqrt(5.f));
+    for(int i = 0; i < nb_samples; ++i)
+    {
+        const float z   = 1.f - 2.f * (i + 0.5f) / nb_samples;
+        const float rz  = std::sqrt(std::max(0.f, 1.f - z*z));
+        const float phi = golden * i;
+        const Vec3_cu s(rz * std::cos(phi), rz * std::sin(phi), z);
+        const Vec3_cu p(s.x * r.x, s.y * r.y, s.z * r.z);
+        nodes.  push_back( p + Vec3_cu(length * 0.5f, 0.f, 0.f) );
+        normals.push_back( Vec3_cu(p.x / (r.x*r.x), p.y / (r.y*r.y), p.z / (r.z*r.z)).normalized() );
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Build the test skeleton
+/// @param elbow : blending between the upper arm and the forearm
+/// @param wrist : blending between the forearm and the fingers' cluster
+static Test_skeleton make_test_skeleton(EJoint::Joint_t elbow, EJoint::Joint_t wrist)
+{
+    struct Layout { Vec3_cu org; float angle, length, radius; int parent; };
+    const Layout layout[NB_TEST_BONES] = {
+        { Vec3_cu(0.f, 0.f, 0.f),  0.0f, 2.0f, 0.35f, -1        },
+        { Vec3_cu(2.f, 0.f, 0.f),  0.0f, 2.0f, 0.30f, UPPER_ARM },
+        { Vec3_cu(4.f, 0.f, 0.f), -0.5f, 1.2f, 0.12f, FOREARM   },
+        { Vec3_cu(4.f, 0.f, 0.f),  0.0f, 1.2f, 0.12f, FOREARM   },
+        { Vec3_cu(4.f, 0.f, 0.f),  0.5f, 1.2f, 0.12f, FOREARM   },
+    };
+
+    Test_skeleton t;
+    std::vector< std::shared_ptr<const Bone> > const_bones;
+    std::vector<Bone::Id> parents;
+    for(int i = 0; i < NB_TEST_BONES; ++i)
+    {
+        const Layout& l = layout[i];
+        std::shared_ptr<Bone> bone(new Bone());
+        bone->set_object_space_dir( Vec3_cu(l.length, 0.f, 0.f) );
+        bone->set_world_space_matrix( Transfo::translate(l.org) * Transfo::rotate(Vec3_cu(0.f, 0.f, 1.f), l.angle) );
+
+        std::vector<Vec3_cu> nodes, normals;
+        ellipsoid_samples(l.length, l.radius, 60, nodes, normals);
+        bone->set_enabled(true);
+        bone->get_hrbf().init_coeffs(nodes, normals);
+
+        t.bones.push_back( bone );
+        t.radius.push_back( l.radius );
+        const_bones.push_back( bone );
+        parents.push_back( l.parent );
+    }
+
+    t.skel.reset( new Skeleton(const_bones, parents) );
+
+    for(int i = 0; i < NB_TEST_BONES; ++i)
+        t.bones[i]->set_hrbf_radius(t.radius[i] * 2.f, t.skel.get());
+
+    // The blending between a bone and its children is defined by the parent
+    t.skel->set_joint_blending(t.id(UPPER_ARM), elbow);
+    t.skel->set_joint_blending(t.id(FOREARM)  , wrist);
+    t.skel->set_joint_controller(t.id(UPPER_ARM), IBL::Shape::elbow());
+    t.skel->set_joint_controller(t.id(FOREARM)  , IBL::Shape::finger());
+    t.skel->update_bones_data();
+    return t;
+}
+
+#endif // TEST_SKELETON_HPP__